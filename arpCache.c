@@ -6,6 +6,8 @@ ARP cache is kept as a sorted linked list, however since many more lookups into
 
 // insert new node into the list, mac is borrowed
 void arpInsert(arpNode **head, uint32_t ip, uint8_t *mac, int is_static){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	int i;
 	arpNode *n = (arpNode*)malloc(sizeof(arpNode));	
 	n->ip = ip;
@@ -28,11 +30,11 @@ void arpInsert(arpNode **head, uint32_t ip, uint8_t *mac, int is_static){
 	}
 	
 	// add new entry
-	pthread_mutex_lock(&list_lock);
+	pthread_mutex_lock(&subsystem->list_lock);
 
 	if (*head == NULL){
 		*head = n;
-		pthread_mutex_unlock(&list_lock);
+		pthread_mutex_unlock(&subsystem->list_lock);
 		return;
 	}
 
@@ -59,16 +61,18 @@ void arpInsert(arpNode **head, uint32_t ip, uint8_t *mac, int is_static){
 		n->prev = last;
 	}
 	
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 
 }
 
 // returns list node given IP
 arpNode* arpFindIP(arpNode *head, uint32_t ip){
-	pthread_mutex_lock(&list_lock);
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	pthread_mutex_lock(&subsystem->list_lock);
 
 	if (head == NULL){
-		pthread_mutex_unlock(&list_lock);
+		pthread_mutex_unlock(&subsystem->list_lock);
 		return NULL;
 	}
 	
@@ -79,17 +83,19 @@ arpNode* arpFindIP(arpNode *head, uint32_t ip){
 		}	
 		cur = cur->next;
 	}
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 
 	return cur;
 }
 
 // delete a list entry given an IP
 void arpDeleteIP(arpNode **head, uint32_t ip){
-	pthread_mutex_lock(&list_lock);
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	pthread_mutex_lock(&subsystem->list_lock);
 
 	if (*head == NULL){
-		pthread_mutex_unlock(&list_lock);
+		pthread_mutex_unlock(&subsystem->list_lock);
 		return;
 	}
 	
@@ -110,18 +116,20 @@ void arpDeleteIP(arpNode **head, uint32_t ip){
 		}	
 		cur = cur->next;
 	}
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 
 }
 
 // delete a list entry given a MAC
 void arpDeleteMAC(arpNode **head, uint8_t *mac){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	int i;
 	
-	pthread_mutex_lock(&list_lock);
+	pthread_mutex_lock(&subsystem->list_lock);
 
 	if (*head == NULL){
-		pthread_mutex_unlock(&list_lock);
+		pthread_mutex_unlock(&subsystem->list_lock);
 		return;
 	}
 	
@@ -146,7 +154,7 @@ void arpDeleteMAC(arpNode **head, uint8_t *mac){
 		cur = cur->next;
 	}
 	
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 
 }
 
@@ -154,11 +162,11 @@ void arpDeleteMAC(arpNode **head, uint8_t *mac){
 int arpTimeout(arpNode **head){
 	struct sr_instance* sr = get_sr();
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-	pthread_mutex_lock(&list_lock);
+	pthread_mutex_lock(&subsystem->list_lock);
 	int retVal = 0;
 	
 	if (*head == NULL){
-		pthread_mutex_unlock(&list_lock);
+		pthread_mutex_unlock(&subsystem->list_lock);
 		return 0;
 	}
 	arpNode *cur = *head;
@@ -194,7 +202,7 @@ int arpTimeout(arpNode **head){
 		if(cur) cur = cur->next;
 	}
 
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 	return retVal;
 }
 
@@ -237,42 +245,46 @@ arpTreeNode* createTree(arpNode *head){
 
 // generate binary search tree (balanced) from the sorted list
 arpTreeNode* arpGenerateTree(arpNode *head){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	arpTreeNode *rv;
-	pthread_mutex_lock(&list_lock);
+	pthread_mutex_lock(&subsystem->list_lock);
 	rv = createTree(head);
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 	return rv;
 }
 
 // do lookup into the tree O(logn), destroy return value when done with it
 uint8_t* arpLookupTree(arpTreeNode *root, uint32_t ip){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	uint8_t *rv;
 	
-	pthread_rwlock_rdlock(&tree_lock);
+	pthread_rwlock_rdlock(&subsystem->tree_lock);
 	
 	if (root == NULL){
-		pthread_rwlock_unlock(&tree_lock);
+		pthread_rwlock_unlock(&subsystem->tree_lock);
 		return NULL;
 	}
 		
 	if(ip < root->ip){
 		rv = arpLookupTree(root->left, ip);
-		pthread_rwlock_unlock(&tree_lock);
+		pthread_rwlock_unlock(&subsystem->tree_lock);
 		return rv;
 	}
 	else if(ip > root->ip){
 		rv = arpLookupTree(root->right, ip);
-		pthread_rwlock_unlock(&tree_lock);
+		pthread_rwlock_unlock(&subsystem->tree_lock);
 		return rv;
 	}
 	else if (ip == root->ip){
 		uint8_t *retVal = (uint8_t*)malloc(6*sizeof(uint8_t));
 		int i;
 		for(i = 0; i < 6; i++) retVal[i] = root->mac[i];
-		pthread_rwlock_unlock(&tree_lock);
+		pthread_rwlock_unlock(&subsystem->tree_lock);
 		return retVal;
 	}
-	pthread_rwlock_unlock(&tree_lock);
+	pthread_rwlock_unlock(&subsystem->tree_lock);
 	return NULL;
 }
 
@@ -301,20 +313,22 @@ int arpCompareTrees(arpTreeNode *treeA, arpTreeNode *treeB){
 // replaces old tree with a new one in a thread safe fashion
 // replace with NULL to destroy tree
 void arpReplaceTree(arpTreeNode **root, arpTreeNode *newTree){
-	pthread_rwlock_wrlock(&tree_lock);
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	pthread_rwlock_wrlock(&subsystem->tree_lock);
 	arpTreeNode *oldTree = *root;
 	*root = newTree;
-	pthread_rwlock_unlock(&tree_lock);
+	pthread_rwlock_unlock(&subsystem->tree_lock);
 
 #ifdef _CPUMODE_
-	pthread_rwlock_rdlock(&tree_lock);
+	pthread_rwlock_rdlock(&subsystem->tree_lock);
 	if(!arpCompareTrees(oldTree, newTree) || newTree == NULL ){
 		int index = 0;
 		int i;
 		
-		pthread_rwlock_rdlock(&tree_lock);
+		pthread_rwlock_rdlock(&subsystem->tree_lock);
 			writeARPCache(newTree, &index);
-		pthread_rwlock_unlock(&tree_lock);
+		pthread_rwlock_unlock(&subsystem->tree_lock);
 
 		pthread_mutex_lock(&arpRegLock);
 		for(i = index; i < ROUTER_OP_LUT_ARP_TABLE_DEPTH; i++){
@@ -325,7 +339,7 @@ void arpReplaceTree(arpTreeNode **root, arpTreeNode *newTree){
 		}
 		pthread_mutex_unlock(&arpRegLock);
 	}
-	pthread_rwlock_unlock(&tree_lock);
+	pthread_rwlock_unlock(&subsystem->tree_lock);
 #endif // _CPUMODE_
 
 	if(oldTree) arpDestroyTree(oldTree);
@@ -381,7 +395,7 @@ unsigned arp_cache_static_purge( struct sr_instance* sr ) {
 	int cnt = 0;
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	
-	pthread_mutex_lock(&list_lock);
+	pthread_mutex_lock(&subsystem->list_lock);
 
 	if (subsystem->arpList != NULL){	
 		arpNode *cur = subsystem->arpList;
@@ -403,7 +417,7 @@ unsigned arp_cache_static_purge( struct sr_instance* sr ) {
 			cur = tmp;
 		}
 	}
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 	
 	arpReplaceTree(&subsystem->arpTree, arpGenerateTree(subsystem->arpList));
 
@@ -418,7 +432,7 @@ unsigned arp_cache_dynamic_purge( struct sr_instance* sr ) {
 	int cnt = 0;
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	
-	pthread_mutex_lock(&list_lock);
+	pthread_mutex_lock(&subsystem->list_lock);
 
 	if (subsystem->arpList != NULL){	
 		arpNode *cur = subsystem->arpList;
@@ -440,7 +454,7 @@ unsigned arp_cache_dynamic_purge( struct sr_instance* sr ) {
 			cur = tmp;
 		}
 	}
-	pthread_mutex_unlock(&list_lock);
+	pthread_mutex_unlock(&subsystem->list_lock);
 	
 	arpReplaceTree(&subsystem->arpTree, arpGenerateTree(subsystem->arpList));
 
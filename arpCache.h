@@ -41,8 +41,6 @@ arpTreeNode* arpGenerateTree(arpNode *head);
 uint8_t* arpLookupTree(arpTreeNode *root, uint32_t ip);
 void arpReplaceTree(arpTreeNode **root, arpTreeNode *newTree);
 
-pthread_mutex_t list_lock;
-pthread_rwlock_t tree_lock;
 
 /**
  * ---------------------------------------------------------------------------
@@ -28,17 +28,26 @@ struct arpQueueNode* addQueueNode(uint32_t ip, const char* interface){
 
 // add packet to queue, packet is borrowed
 void queuePacket(uint8_t* packet, unsigned len, const char* interface, uint32_t dstIP){
-	int i;
-	pthread_mutex_lock(&queue_lock);
+	queuePacketShared(packet, len, NULL, interface, dstIP);
+}
+
+// add packet made of hdr and body to queue, hdr is borrowed and copied, body is held until the packet is gone
+void queuePacketShared(uint8_t* hdr, unsigned hdr_len, struct sharedBuf* body, const char* interface, uint32_t dstIP){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	pthread_mutex_lock(&subsystem->queue_lock);
 
 	struct arpQueueNode *node = addQueueNode(dstIP, interface);
 	
 	// create new item
 	struct arpQueueItem *item = (struct arpQueueItem*)malloc(sizeof(struct arpQueueItem));
-	item->packet = (uint8_t*)malloc(len * sizeof(uint8_t));
-	for(i = 0; i < len; i++) item->packet[i] = packet[i];
-	item->len = len;
+	item->packet = (uint8_t*)malloc(hdr_len * sizeof(uint8_t));
+	memcpy(item->packet, hdr, hdr_len);
+	item->len = hdr_len;
+	item->body = body;
+	if(body) holdSharedBuf(body);
 	item->t = time(NULL);
+	pktstats_inc(&subsystem->stats, PS_ARP_QUEUED);
 	item->prev = item->next = NULL;
 	
 	// add item to node
@@ -46,7 +55,11 @@ void queuePacket(uint8_t* packet, unsigned len, const char* interface, uint32_t
 	if(node->head) node->head->prev = item;
 	node->head = item;
 	if(node->tail == NULL) node->tail = item;
-	pthread_mutex_unlock(&queue_lock);	
+
+	// the ARP reply may have come in since the caller missed the cache, and then
+	// its queueSend() is already over: send right away in that case
+	queueSendLockless(dstIP, interface);
+	pthread_mutex_unlock(&subsystem->queue_lock);	
 
 }
 
@@ -65,13 +78,19 @@ void queueSendLockless(uint32_t ip, const char* interface){
 			if( !strcmp(interface, cur->interface) && (ip == cur->dstIP) ){
 				while( cur->tail ){
 					for (i = 0; i < 6; i++) cur->tail->packet[i] = dstMAC[i];
-					sr_integ_low_level_output(sr, cur->tail->packet, cur->tail->len, cur->interface);
+					if(cur->tail->body)
+						sr_integ_low_level_outputv(sr, cur->tail->packet, cur->tail->len, cur->tail->body->data, cur->tail->body->len, cur->interface);
+					else
+						sr_integ_low_level_output(sr, cur->tail->packet, cur->tail->len, cur->interface);
+					pktstats_inc(&subsystem->stats, PS_ARP_RESOLVED);
 					struct arpQueueItem* tmp = cur->tail;
 					if(cur->tail->prev) 
 						cur->tail->prev->next = NULL;
 					else
 						cur->head = NULL;
 					cur->tail = cur->tail->prev;
+					if(tmp->body) releaseSharedBuf(tmp->body);
+					free(tmp->packet);
 					free(tmp);
 				}
 				struct arpQueueNode* curTmp = cur;
@@ -96,9 +115,11 @@ void queueSendLockless(uint32_t ip, const char* interface){
 
 // flush a particular ip queue
 void queueSend(uint32_t ip, const char* interface){
-	pthread_mutex_lock(&queue_lock);
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	pthread_mutex_lock(&subsystem->queue_lock);
 	queueSendLockless(ip, interface);
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_unlock(&subsystem->queue_lock);
 }
 
 // refresh all arp queues (timeout if neccessary)
@@ -108,7 +129,7 @@ void arpQueueRefresh(void* dummy){
 
 	while(1){
 		loop_begin:
-		pthread_mutex_lock(&queue_lock);
+		pthread_mutex_lock(&subsystem->queue_lock);
 		struct arpQueueNode* cur = subsystem->arpQueue;
 		while(cur){
 			struct arpQueueNode* tmp = cur->next;
@@ -125,13 +146,17 @@ void arpQueueRefresh(void* dummy){
 					}
 					cur->tail = cur->tail->prev;
 					// send out ICMP (host unreachable)
-					pthread_mutex_unlock(&queue_lock);
+					pthread_mutex_unlock(&subsystem->queue_lock);
 					dbgMsg("ARP queue timeout");
+					pktstats_inc(&subsystem->stats, PS_ARP_TIMEOUT);
 
 					uint32_t srcIP = ntohl(*((uint32_t*)&curTmp->packet[ETHERNET_HEADER_LENGTH + 12]));
 					char *out_if = lp_match(&(subsystem->rtable), srcIP); //output interface
-					if(out_if && !isMyIP(srcIP)) sendICMPDestinationUnreachable(out_if, curTmp->packet, curTmp->len, 1);
+					// shared payloads are our own control traffic, nobody to tell
+					if(out_if && !isMyIP(srcIP) && !curTmp->body) sendICMPDestinationUnreachable(out_if, curTmp->packet, curTmp->len, 1);
 					free(out_if);	
+					if(curTmp->body) releaseSharedBuf(curTmp->body);
+					free(curTmp->packet);
 					free(curTmp);			
 					goto loop_begin; // no way anoyone is going to convince me that there is a better way to to this (mariof)
 				}
@@ -155,7 +180,7 @@ void arpQueueRefresh(void* dummy){
 			
 			cur = tmp;
 		}
-		pthread_mutex_unlock(&queue_lock);
+		pthread_mutex_unlock(&subsystem->queue_lock);
 		sleep(ARP_QUEUE_REFRESH);
 	}	
 }
@@ -10,10 +10,13 @@
 
 #define ARP_QUEUE_TIMEOUT 4
 
+struct sharedBuf;
+
 struct arpQueueItem{
 	time_t t;
 	uint8_t* packet;
 	unsigned len;
+	struct sharedBuf* body; // rest of the packet if not NULL, held by the item
 	struct arpQueueItem *next;
 	struct arpQueueItem *prev;
 };
@@ -28,10 +31,11 @@ struct arpQueueNode{
 };
 
 void queuePacket(uint8_t* packet, unsigned len, const char* interface, uint32_t dstIP);
+void queuePacketShared(uint8_t* hdr, unsigned hdr_len, struct sharedBuf* body, const char* interface, uint32_t dstIP);
 void queueSend(uint32_t ip, const char* interface);
+void queueSendLockless(uint32_t ip, const char* interface); // caller must hold queue_lock
 
 void arpQueueRefresh(void* dummy);
 
-pthread_mutex_t queue_lock;
 
 #endif // ARP_QUEUE_H
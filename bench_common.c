@@ -0,0 +1,251 @@
+/*-----------------------------------------------------------------------------
+ * File: bench_common.c
+ *
+ * Stand-ins for sr_base.c, sr_integration.c and the lwtcp/CLI glue so the
+ * router proper can be linked into a benchmark without VNS or NetFPGA, plus
+ * the router and routing table the benchmarks run against.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "bench_common.h"
+
+#ifdef BENCH_HAVE_TSC
+#include <x86intrin.h>
+#endif
+
+struct sr_instance bench_sr;
+
+volatile unsigned long bench_sink_packets;
+volatile unsigned long bench_sink_bytes;
+
+int (*bench_output_hook)(struct sr_instance* sr, const uint8_t* frame,
+                         unsigned int len, const char* iface) = NULL;
+
+struct bench_route
+{
+    uint32_t ip;
+    uint32_t mask;
+    int iface;
+};
+
+static uint32_t* bench_prefixes;
+static int bench_num_prefixes;
+
+/*-----------------------------------------------------------------------------
+ * Stand-ins
+ *---------------------------------------------------------------------------*/
+
+struct sr_instance* get_sr()
+{
+    struct sr_instance* sr = boundRouter();
+    return sr ? sr : &bench_sr;
+}
+
+void* sr_get_subsystem(struct sr_instance* sr)
+{ return sr->interface_subsystem; }
+
+void sr_set_subsystem(struct sr_instance* sr, void* core)
+{ sr->interface_subsystem = core; }
+
+int sr_integ_low_level_output(struct sr_instance* sr, uint8_t* buf,
+                              unsigned int len, const char* iface)
+{
+    if(bench_output_hook) return bench_output_hook(sr, buf, len, iface);
+    __sync_fetch_and_add(&bench_sink_packets, 1);
+    __sync_fetch_and_add(&bench_sink_bytes, len);
+    return 0;
+}
+
+int sr_integ_low_level_outputv(struct sr_instance* sr, uint8_t* hdr, unsigned int hdr_len,
+                               const uint8_t* body, unsigned int body_len, const char* iface)
+{
+    if(bench_output_hook){
+        uint8_t frame[hdr_len + body_len];
+
+        memcpy(frame, hdr, hdr_len);
+        memcpy(frame + hdr_len, body, body_len);
+        return bench_output_hook(sr, frame, hdr_len + body_len, iface);
+    }
+    __sync_fetch_and_add(&bench_sink_packets, 1);
+    __sync_fetch_and_add(&bench_sink_bytes, hdr_len + body_len);
+    return 0;
+}
+
+void sr_transport_input(uint8_t* packet) { }
+
+// packets only come in through addThreadQueue() here, never lent out of a receive block
+void sr_rbuf_hold(struct sr_rbuf* b) { }
+
+void sr_rbuf_release(struct sr_rbuf* b) { }
+
+int writenf(int fd, const char* format, ...) { return 0; }
+
+void cli_send_prompt() { }
+
+static void* bench_thread_start(void* arg)
+{
+    void** a = (void**)arg;
+    void (*func)(void*) = (void (*)(void*))a[0];
+    void* func_arg = a[1];
+
+    free(a);
+    func(func_arg);
+    return 0;
+}
+
+void sys_thread_new(void (* thread)(void *arg), void *arg)
+{
+    pthread_t t;
+    void** a = (void**)malloc(2*sizeof(void*));
+
+    a[0] = (void*)thread;
+    a[1] = arg;
+    pthread_create(&t, NULL, bench_thread_start, a);
+    pthread_detach(t);
+}
+
+/*-----------------------------------------------------------------------------
+ * Timing
+ *---------------------------------------------------------------------------*/
+
+uint64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t bench_now_cycles()
+{
+#ifdef BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Router setup
+ *---------------------------------------------------------------------------*/
+
+void bench_init_router(unsigned int seed)
+{
+    struct sr_router* subsystem;
+    uint8_t mac[6] = { 0, 0, 0, 0, 0, 0 };
+    int i;
+
+    subsystem = (struct sr_router*)calloc(1, sizeof(struct sr_router));
+    sr_set_subsystem(&bench_sr, subsystem);
+
+    initRouterState(subsystem);
+    subsystem->ospf_enabled = 1;
+    // the SPF and LSU chatter would only fill the log rings faster than they drain
+    log_level = LOG_LVL_WARN;
+
+    subsystem->num_ifaces = 3;
+    subsystem->ifaces = (struct sr_vns_if*)calloc(3, sizeof(struct sr_vns_if));
+    for(i = 0; i < 3; i++){
+        struct sr_vns_if* intf = &subsystem->ifaces[i];
+        snprintf(intf->name, SR_NAMELEN, "eth%d", i);
+        intf->ip = BENCH_IF_IP(i);
+        intf->mask = 0xffffff00;
+        intf->addr[4] = i + 1;
+        intf->addr[5] = 1;
+        intf->enabled = intf->hard_enabled = 1;
+    }
+    initPWOSPF(&bench_sr);
+
+    // static ARP entries for the gateways, so nothing waits on ARP
+    for(i = 0; i < 3; i++){
+        mac[4] = i + 1;
+        mac[5] = 0xfe;
+        arpInsert(&subsystem->arpList, BENCH_GW_IP(i), mac, 1);
+    }
+    arpReplaceTree(&subsystem->arpTree, arpGenerateTree(subsystem->arpList));
+
+    srand(seed);
+}
+
+// same order as insert_rtable_node(): decreasing netmask, then decreasing ip
+static int bench_route_cmp(const void* a, const void* b)
+{
+    const struct bench_route* ra = (const struct bench_route*)a;
+    const struct bench_route* rb = (const struct bench_route*)b;
+
+    if(ra->mask != rb->mask) return ra->mask > rb->mask ? -1 : 1;
+    if(ra->ip != rb->ip) return ra->ip > rb->ip ? -1 : 1;
+    return 0;
+}
+
+rtableNode* bench_build_rtable(int num)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct bench_route* routes;
+    rtableNode *head = NULL, *prev = NULL, *node;
+    int i, n = 0, cnt;
+
+    if(num < 0) num = 0;
+    routes = (struct bench_route*)malloc((num + 4) * sizeof(struct bench_route));
+
+    // random /24s, drawn again until there are enough distinct ones
+    while(n < num){
+        while(n < num){
+            uint32_t prefix = (((uint32_t)rand() << 8) ^ (uint32_t)rand()) & 0xffffff00;
+            // keep clear of the router's own subnets
+            if((prefix & 0xffff0000) == 0x0a000000) prefix ^= 0x01000000;
+            routes[n].ip = prefix;
+            routes[n].mask = 0xffffff00;
+            routes[n].iface = (prefix & 0x100) ? 2 : 1;
+            n++;
+        }
+        qsort(routes, n, sizeof(struct bench_route), bench_route_cmp);
+        for(i = 1, cnt = 1; i < n; i++)
+            if(routes[i].ip != routes[cnt-1].ip) routes[cnt++] = routes[i];
+        n = cnt;
+    }
+
+    free(bench_prefixes);
+    bench_prefixes = (uint32_t*)malloc((num + 1) * sizeof(uint32_t));
+    for(i = 0; i < num; i++) bench_prefixes[i] = routes[i].ip;
+    bench_num_prefixes = num;
+
+    // connected subnets and the default route
+    for(i = 0; i < 3; i++){
+        routes[n].ip = subsystem->ifaces[i].ip & 0xffffff00;
+        routes[n].mask = 0xffffff00;
+        routes[n].iface = -1 - i;
+        n++;
+    }
+    routes[n].ip = routes[n].mask = 0;
+    routes[n].iface = 1;
+    n++;
+    qsort(routes, n, sizeof(struct bench_route), bench_route_cmp);
+
+    for(i = 0; i < n; i++){
+        int iface = routes[i].iface < 0 ? -1 - routes[i].iface : routes[i].iface;
+
+        uint32_t gw = routes[i].iface < 0 ? 0 : BENCH_GW_IP(iface);
+        char* name = subsystem->ifaces[iface].name;
+
+        node = alloc_rtable_node(routes[i].ip, routes[i].mask, &gw, &name, 1, 1);
+        node->prev = prev;
+        if(prev) prev->next = node;
+        else head = node;
+        prev = node;
+    }
+    free(routes);
+
+    return head;
+}
+
+uint32_t bench_random_dst(unsigned int* seed)
+{
+    if(bench_num_prefixes == 0) return 0x08080808;
+    return bench_prefixes[rand_r(seed) % bench_num_prefixes] | ((rand_r(seed) % 254) + 1);
+}
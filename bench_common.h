@@ -0,0 +1,48 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/*
+ * Shared pieces of the benchmark programs (bench_forward.c, bench_micro.c):
+ * stand-ins for the VNS/lwtcp/CLI side of the router, timers, and a router
+ * with three interfaces and a preloaded routing table.
+ */
+
+#include "router.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define BENCH_HAVE_TSC
+#endif
+
+// the benchmark router: eth0-eth2 on 10.0.1-3.0/24, gateways at .254
+#define BENCH_IF_IP(i) (0x0a000001 | (((i) + 1) << 8))
+#define BENCH_GW_IP(i) (0x0a0000fe | (((i) + 1) << 8))
+
+extern struct sr_instance bench_sr;
+
+// everything the router sends ends up here
+extern volatile unsigned long bench_sink_packets;
+extern volatile unsigned long bench_sink_bytes;
+
+/* when set, frames go here instead of the sink, e.g. to hand them to another
+ * router of an emulated network (bench_emulate.c)
+ */
+extern int (*bench_output_hook)(struct sr_instance* sr, const uint8_t* frame,
+                                unsigned int len, const char* iface);
+
+uint64_t bench_now_ns();
+uint64_t bench_now_cycles();
+
+// sets up the subsystem the way sr_integ_init() and sr_integ_hw_setup() do
+void bench_init_router(unsigned int seed);
+
+/* builds a routing table with the connected subnets, a default route via
+ * eth1 and num random /24 prefixes via eth1 and eth2, sorted the way
+ * insert_rtable_node() keeps it.  The prefixes are kept for
+ * bench_random_dst().
+ */
+rtableNode* bench_build_rtable(int num);
+
+// a random destination inside one of the prefixes of the last table built
+uint32_t bench_random_dst(unsigned int* seed);
+
+#endif // BENCH_COMMON_H
@@ -0,0 +1,617 @@
+/*-----------------------------------------------------------------------------
+ * File: bench_converge.c
+ *
+ * PWOSPF convergence benchmark.  Generates a synthetic topology -- a grid,
+ * a Waxman random graph, a k-ary fat-tree or an ISP-like core/aggregation/
+ * access hierarchy -- of 10 to 5000 routers, with this router hanging off
+ * the first one over eth0, and feeds every router's LSU in through
+ * processPWOSPF() the way it would arrive from that neighbor (or straight
+ * into update_lsu() with -u).
+ *
+ * SPF runs on pwospfThrottleThread() as it does in the router, so the SPF
+ * hold-down is part of the time from the last LSU to the final routing
+ * table.  Also reported: the LSUs it took, the SPF runs they caused, one
+ * SPF from scratch on the finished topology, the memory held by the LSDB
+ * and by the routing table (the dynamic part is what the shadow table of a
+ * full SPF run holds at its peak) and whether every router's stub network
+ * ended up with a route.  With -g, exits with status 2 if a topology takes
+ * longer than the given number of ms to converge, for use as a gate.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+#include "lwip/sys.h"
+
+#define BENCH_MAX_LIST       16
+#define BENCH_TIMEOUT_MS     60000
+#define BENCH_WAXMAN_ALPHA   0.1
+
+// router i is 11.0.0.0 + i + 1 with the stub network 20.0.i.0/24 behind it,
+// links are /30s from 172.16.0.0 up
+#define BENCH_RID(i)      (0x0b000001 + (i))
+#define BENCH_STUB(i)     (0x14000000 + ((i) << 8))
+#define BENCH_LINK(l)     (0xac100000 + ((l) << 2))
+#define BENCH_NBR_IP      0x0a000102 // the first router, as seen from eth0
+
+enum { TOPO_GRID, TOPO_WAXMAN, TOPO_FATTREE, TOPO_ISP, TOPO_NUM };
+static const char* topo_names[TOPO_NUM] = { "grid", "waxman", "fattree", "isp" };
+
+struct bench_node
+{
+    int* adj;
+    uint32_t* link; // subnet of the link to adj[i]
+    int deg;
+    int cap;
+};
+
+struct bench_graph
+{
+    struct bench_node* node;
+    int n;
+    int links;
+};
+
+struct bench_result
+{
+    int topo;
+    int n;
+    int links;
+    uint64_t inject_ns;
+    long long converge_ms;
+    unsigned long spf_runs;
+    unsigned long spf_coalesced;
+    uint64_t spf_ns;
+    size_t lsdb_bytes;
+    size_t rtable_bytes;
+    size_t shadow_bytes;
+    int routes;
+};
+
+/*-----------------------------------------------------------------------------
+ * Topologies
+ *---------------------------------------------------------------------------*/
+
+static void graph_init(struct bench_graph* g, int n)
+{
+    g->node = (struct bench_node*)calloc(n, sizeof(struct bench_node));
+    g->n = n;
+    g->links = 0;
+}
+
+static void graph_free(struct bench_graph* g)
+{
+    int i;
+    for(i = 0; i < g->n; i++){
+        free(g->node[i].adj);
+        free(g->node[i].link);
+    }
+    free(g->node);
+}
+
+static int graph_has_edge(struct bench_graph* g, int a, int b)
+{
+    int i;
+    if(g->node[a].deg > g->node[b].deg){ int t = a; a = b; b = t; }
+    for(i = 0; i < g->node[a].deg; i++) if(g->node[a].adj[i] == b) return 1;
+    return 0;
+}
+
+static void node_add(struct bench_node* v, int peer, uint32_t link)
+{
+    if(v->deg == v->cap){
+        v->cap = v->cap ? 2*v->cap : 4;
+        v->adj = (int*)realloc(v->adj, v->cap * sizeof(int));
+        v->link = (uint32_t*)realloc(v->link, v->cap * sizeof(uint32_t));
+    }
+    v->adj[v->deg] = peer;
+    v->link[v->deg] = link;
+    v->deg++;
+}
+
+// links a and b unless they are the same router or linked already
+static void graph_link(struct bench_graph* g, int a, int b)
+{
+    uint32_t subnet;
+
+    if(a == b || graph_has_edge(g, a, b)) return;
+    subnet = BENCH_LINK(g->links++);
+    node_add(&g->node[a], b, subnet);
+    node_add(&g->node[b], a, subnet);
+}
+
+// a square grid of about n routers, the last row possibly short
+static void gen_grid(struct bench_graph* g, int n)
+{
+    int side = (int)ceil(sqrt((double)n)), i;
+
+    graph_init(g, n);
+    for(i = 0; i < n; i++){
+        if((i + 1) % side && i + 1 < n) graph_link(g, i, i + 1);
+        if(i + side < n) graph_link(g, i, i + side);
+    }
+}
+
+/* Waxman: routers at random points in the unit square, each linked to the
+ * nearest one placed before it so the graph is connected, plus about n more
+ * links picked with probability proportional to exp(-d / (alpha L)).
+ */
+static void gen_waxman(struct bench_graph* g, int n)
+{
+    double* x = (double*)malloc(n * sizeof(double));
+    double* y = (double*)malloc(n * sizeof(double));
+    double l = sqrt(2.0), sum = 0, beta, d;
+    int i, j, best;
+
+    graph_init(g, n);
+    for(i = 0; i < n; i++){
+        x[i] = (double)rand() / RAND_MAX;
+        y[i] = (double)rand() / RAND_MAX;
+    }
+    for(i = 1; i < n; i++){
+        double best_d = 1e9;
+        for(j = 0, best = 0; j < i; j++){
+            d = hypot(x[i] - x[j], y[i] - y[j]);
+            if(d < best_d){ best_d = d; best = j; }
+        }
+        graph_link(g, i, best);
+    }
+
+    for(i = 0; i < n; i++)
+        for(j = i + 1; j < n; j++)
+            sum += exp(-hypot(x[i] - x[j], y[i] - y[j]) / (BENCH_WAXMAN_ALPHA * l));
+    beta = sum > 0 ? n / sum : 0;
+    for(i = 0; i < n; i++)
+        for(j = i + 1; j < n; j++){
+            d = hypot(x[i] - x[j], y[i] - y[j]);
+            if((double)rand() / RAND_MAX < beta * exp(-d / (BENCH_WAXMAN_ALPHA * l)))
+                graph_link(g, i, j);
+        }
+
+    free(x);
+    free(y);
+}
+
+/* k-ary fat-tree with the largest even k that fits in n routers: (k/2)^2
+ * core routers, k pods of k/2 aggregation and k/2 edge routers each.  Core
+ * router c connects to aggregation router c / (k/2) of every pod.
+ */
+static void gen_fattree(struct bench_graph* g, int n)
+{
+    int k = 2, h, p, a, e, c;
+
+    while(5 * (k + 2) * (k + 2) / 4 <= n) k += 2;
+    h = k / 2;
+    graph_init(g, 5 * k * k / 4);
+
+    // core 0 .. h*h-1, then per pod h aggregation and h edge routers
+#define CORE(c)    (c)
+#define AGGR(p, a) (h*h + (p)*k + (a))
+#define EDGE(p, e) (h*h + (p)*k + h + (e))
+    for(p = 0; p < k; p++)
+        for(a = 0; a < h; a++){
+            for(e = 0; e < h; e++) graph_link(g, AGGR(p, a), EDGE(p, e));
+            for(c = a*h; c < (a + 1)*h; c++) graph_link(g, AGGR(p, a), CORE(c));
+        }
+#undef CORE
+#undef AGGR
+#undef EDGE
+}
+
+/* ISP-like: about 2% core routers in a ring with a random chord each, 18%
+ * aggregation routers homed to two core routers and the rest access
+ * routers homed to two aggregation routers.
+ */
+static void gen_isp(struct bench_graph* g, int n)
+{
+    int core = n / 50, aggr, i;
+
+    if(core < 4) core = 4;
+    if(core > n) core = n;
+    aggr = (n - core) * 18 / 98;
+    if(aggr < 2 && n - core >= 2) aggr = 2;
+
+    graph_init(g, n);
+    for(i = 0; i < core; i++){
+        graph_link(g, i, (i + 1) % core);
+        graph_link(g, i, rand() % core);
+    }
+    for(i = core; i < core + aggr; i++){
+        graph_link(g, i, rand() % core);
+        graph_link(g, i, rand() % core);
+    }
+    for(i = core + aggr; i < n; i++){
+        graph_link(g, i, core + rand() % aggr);
+        graph_link(g, i, core + rand() % aggr);
+    }
+}
+
+static void gen_topology(struct bench_graph* g, int topo, int n)
+{
+    switch(topo){
+        case TOPO_GRID:    gen_grid(g, n); break;
+        case TOPO_WAXMAN:  gen_waxman(g, n); break;
+        case TOPO_FATTREE: gen_fattree(g, n); break;
+        default:           gen_isp(g, n); break;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * LSUs
+ *---------------------------------------------------------------------------*/
+
+struct bench_lsu
+{
+    uint8_t* data;
+    unsigned int len;
+};
+
+static uint8_t* put32(uint8_t* p, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+// the LSU router i floods, as it arrives on eth0 from the first router
+static void make_lsu(struct bench_lsu* lsu, struct bench_graph* g, int i)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct bench_node* v = &g->node[i];
+    int ads = 1 + v->deg + (i == 0), j;
+    unsigned int ospf_len = OSPF_HEADER_LENGTH + 8 + 12*ads;
+    uint8_t *p, *ip, *ospf;
+    uint16_t sum;
+
+    lsu->len = ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + ospf_len;
+    lsu->data = p = (uint8_t*)calloc(1, lsu->len);
+
+    memcpy(p, subsystem->ifaces[0].addr, 6);
+    p[10] = 1; p[11] = 2;
+    p[12] = 8; p[13] = 0;
+
+    ip = p + ETHERNET_HEADER_LENGTH;
+    ip[0] = 0x45;
+    ip[2] = (IP_HEADER_LENGTH + ospf_len) >> 8;
+    ip[3] = (IP_HEADER_LENGTH + ospf_len) & 0xff;
+    ip[8] = 64;
+    ip[9] = 89;
+    int2byteIP(BENCH_NBR_IP, &ip[12]);
+    int2byteIP(BENCH_IF_IP(0), &ip[16]);
+    sum = checksum((uint16_t*)ip, IP_HEADER_LENGTH);
+    memcpy(&ip[10], &sum, 2);
+
+    ospf = ip + IP_HEADER_LENGTH;
+    ospf[0] = 2;
+    ospf[1] = 4;
+    ospf[2] = ospf_len >> 8;
+    ospf[3] = ospf_len & 0xff;
+    put32(&ospf[4], BENCH_RID(i));
+    put32(&ospf[8], subsystem->pwospf.areaID);
+    p = &ospf[OSPF_HEADER_LENGTH];
+    p[1] = 1; // sequence
+    p[2] = LSU_DEFAULT_TTL >> 8;
+    p[3] = LSU_DEFAULT_TTL & 0xff;
+    p = put32(p + 4, ads);
+    p = put32(put32(put32(p, BENCH_STUB(i)), 0xffffff00), 0);
+    for(j = 0; j < v->deg; j++)
+        p = put32(put32(put32(p, v->link[j]), 0xfffffffc), BENCH_RID(v->adj[j]));
+    if(i == 0)
+        p = put32(put32(put32(p, BENCH_IF_IP(0) & 0xffffff00), 0xffffff00),
+                  subsystem->pwospf.routerID);
+    sum = checksum((uint16_t*)ospf, ospf_len);
+    memcpy(&ospf[12], &sum, 2);
+}
+
+// the same LSA, for update_lsu()
+static topo_router* make_lsa(struct bench_lsu* lsu)
+{
+    uint8_t* ospf = lsu->data + ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH;
+    uint8_t* ad = ospf + OSPF_HEADER_LENGTH + 8;
+    uint32_t ads = ntohl(*(uint32_t*)(ospf + OSPF_HEADER_LENGTH + 4)), i;
+    topo_router* lsa = new_lsa(ntohl(*(uint32_t*)(ospf + 4)), ads);
+
+    lsa->area_id = ntohl(*(uint32_t*)(ospf + 8));
+    lsa->last_seq = ntohs(*(uint16_t*)(ospf + OSPF_HEADER_LENGTH));
+    lsa->last_update_time = time(NULL);
+    for(i = 0; i < ads; i++, ad += 12){
+        lsa->ads[i].subnet = ntohl(*(uint32_t*)ad);
+        lsa->ads[i].mask = ntohl(*(uint32_t*)(ad + 4));
+        lsa->ads[i].router_id = ntohl(*(uint32_t*)(ad + 8));
+    }
+    lsa->num_ads = ads;
+    return lsa;
+}
+
+/*-----------------------------------------------------------------------------
+ * Benchmark
+ *---------------------------------------------------------------------------*/
+
+// back to a router that has never heard of any other, with a quiet throttle
+static void bench_reset()
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct pwospf_throttle* th = &subsystem->pwospf.throttle;
+    struct pwospf_neighbor* nbr;
+    struct pwospf_if* pif;
+
+    // let a run still in flight finish first
+    pthread_mutex_lock(&th->lock);
+    while(th->spf_pending){
+        pthread_mutex_unlock(&th->lock);
+        usleep(1000);
+        pthread_mutex_lock(&th->lock);
+    }
+    pthread_mutex_unlock(&th->lock);
+
+    flush_topo();
+    rtable_purge(&bench_sr, 0);
+
+    pthread_mutex_lock(&th->lock);
+    th->spf_hold = 0;
+    th->spf_last = -SPF_QUIET;
+    th->spf_runs = th->spf_triggers = th->spf_coalesced = 0;
+    pthread_mutex_unlock(&th->lock);
+
+    // the first router, as learned from its hellos on eth0
+    nbr = (struct pwospf_neighbor*)calloc(1, sizeof(struct pwospf_neighbor));
+    nbr->id = BENCH_RID(0);
+    nbr->ip = BENCH_NBR_IP;
+    nbr->nm = 0xffffff00;
+    nbr->lastHelloTime = time(NULL);
+    pif = findPWOSPFif(&subsystem->pwospf, BENCH_IF_IP(0));
+    pthread_mutex_lock(&pif->neighbor_lock);
+    free(pif->neighbor_list);
+    pif->neighbor_list = nbr;
+    pthread_mutex_unlock(&pif->neighbor_lock);
+}
+
+static void bench_memory(struct bench_result* r)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    topo_router* t;
+    struct nexthopTable* nt = &subsystem->nexthops;
+    rtableNode* node;
+    size_t bytes;
+    uint32_t nh;
+
+    // the LSAs, plus about a hash bucket per router
+    r->lsdb_bytes = 0;
+    pthread_mutex_lock(&subsystem->topo.lock);
+    for(t = subsystem->topo.head; t; t = t->next)
+        r->lsdb_bytes += sizeof(topo_router) + t->max_ads * sizeof(lsu_ad) + sizeof(topo_router*);
+    pthread_mutex_unlock(&subsystem->topo.lock);
+
+    // the routes, plus each next hop group once with its slot and hash bucket
+    r->rtable_bytes = r->shadow_bytes = 0;
+    pthread_mutex_lock(&subsystem->rtable_lock);
+    for(node = subsystem->rtable; node; node = node->next){
+        bytes = sizeof(rtableNode);
+        r->rtable_bytes += bytes;
+        if(!node->is_static) r->shadow_bytes += bytes;
+    }
+    pthread_mutex_lock(&nt->lock);
+    for(nh = NH_NONE + 1; nh < nt->used; nh++){
+        struct nexthopGroup* g = nh_get(nt, nh);
+        if(g == NULL) continue;
+        r->rtable_bytes += sizeof(struct nexthopGroup) + g->out_cnt * sizeof(struct nexthop)
+            + sizeof(struct nexthopGroup*) + sizeof(uint32_t);
+    }
+    pthread_mutex_unlock(&nt->lock);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+}
+
+// how many routers' stub networks have a route
+static int bench_count_routes(int n)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    char* seen = (char*)calloc(n, 1);
+    rtableNode* node;
+    int cnt = 0;
+    uint32_t i;
+
+    pthread_mutex_lock(&subsystem->rtable_lock);
+    for(node = subsystem->rtable; node; node = node->next){
+        if(node->netmask != 0xffffff00 || (node->ip & 0xff000000) != BENCH_STUB(0)) continue;
+        i = (node->ip - BENCH_STUB(0)) >> 8;
+        if(i < (uint32_t)n && !seen[i]){
+            seen[i] = 1;
+            cnt++;
+        }
+    }
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+    free(seen);
+    return cnt;
+}
+
+static int bench_run(int topo, int n, int direct, struct bench_result* r)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct pwospf_throttle* th = &subsystem->pwospf.throttle;
+    struct bench_graph g;
+    struct bench_lsu* lsu;
+    long long last_ms;
+    uint64_t t0;
+    int i, done = 0;
+
+    bench_reset();
+    gen_topology(&g, topo, n);
+    lsu = (struct bench_lsu*)malloc(g.n * sizeof(struct bench_lsu));
+    for(i = 0; i < g.n; i++) make_lsu(&lsu[i], &g, i);
+
+    memset(r, 0, sizeof(*r));
+    r->topo = topo;
+    r->n = g.n;
+    r->links = g.links;
+
+    t0 = bench_now_ns();
+    for(i = 0; i < g.n; i++){
+        if(direct){
+            if(update_lsu(make_lsa(&lsu[i]))) scheduleSPF();
+        }
+        else
+            processPWOSPF("eth0", lsu[i].data, lsu[i].len);
+    }
+    r->inject_ns = bench_now_ns() - t0;
+    last_ms = (long long)(bench_now_ns() / 1000000);
+
+    // converged once no run is pending and one has finished since the last LSU
+    while(!done && bench_now_ns() / 1000000 - last_ms < BENCH_TIMEOUT_MS){
+        usleep(200);
+        pthread_mutex_lock(&th->lock);
+        if(!th->spf_pending && th->spf_last >= last_ms){
+            done = 1;
+            r->converge_ms = th->spf_last - last_ms;
+            r->spf_runs = th->spf_runs;
+            r->spf_coalesced = th->spf_coalesced;
+        }
+        pthread_mutex_unlock(&th->lock);
+    }
+    if(!done) r->converge_ms = -1;
+
+    r->routes = bench_count_routes(g.n);
+    bench_memory(r);
+
+    // and one SPF from scratch on the finished topology
+    forget_spf();
+    t0 = bench_now_ns();
+    update_rtable();
+    r->spf_ns = bench_now_ns() - t0;
+
+    for(i = 0; i < g.n; i++) free(lsu[i].data);
+    free(lsu);
+    graph_free(&g);
+    return done ? 0 : -1;
+}
+
+static void bench_print_header(FILE* out)
+{
+    fprintf(out, "%-8s %5s %6s %10s %11s %4s %5s %10s %9s %9s %9s %11s\n",
+            "topology", "nodes", "links", "inject ms", "converge ms", "spf", "coal",
+            "spf ms", "lsdb KB", "rtable KB", "shadow KB", "routes");
+}
+
+static void bench_print(FILE* out, struct bench_result* r)
+{
+    char conv[24], routes[24];
+
+    if(r->converge_ms < 0) strcpy(conv, "timeout");
+    else snprintf(conv, sizeof(conv), "%lld", r->converge_ms);
+    snprintf(routes, sizeof(routes), "%d/%d", r->routes, r->n);
+    fprintf(out, "%-8s %5d %6d %10.2f %11s %4lu %5lu %10.2f %9.1f %9.1f %9.1f %11s\n",
+            topo_names[r->topo], r->n, r->links, r->inject_ns / 1e6, conv,
+            r->spf_runs, r->spf_coalesced, r->spf_ns / 1e6, r->lsdb_bytes / 1024.0,
+            r->rtable_bytes / 1024.0, r->shadow_bytes / 1024.0, routes);
+}
+
+// a comma separated list of numbers or topology names, returns how many
+static int parse_list(char* arg, int* list, int is_topo)
+{
+    char* tok;
+    int cnt = 0, i;
+
+    for(tok = strtok(arg, ","); tok && cnt < BENCH_MAX_LIST; tok = strtok(NULL, ",")){
+        if(!is_topo){
+            list[cnt++] = atoi(tok);
+            continue;
+        }
+        for(i = 0; i < TOPO_NUM && strcmp(tok, topo_names[i]); i++);
+        if(i == TOPO_NUM){
+            fprintf(stderr, "unknown topology %s\n", tok);
+            return -1;
+        }
+        list[cnt++] = i;
+    }
+    return cnt;
+}
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-h] [-t topologies] [-n routers] [-u] [-g ms] [-s seed]\n", argv0);
+    printf("  -t  comma separated: grid, waxman, fattree, isp (default all)\n");
+    printf("  -n  comma separated router counts, 10 to 5000 (default 100,1000)\n");
+    printf("  -u  hand the LSAs to update_lsu() rather than processPWOSPF()\n");
+    printf("  -g  exit with status 2 if a topology takes more than this many ms to converge\n");
+    printf("  -s  random seed (default 1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int topos[BENCH_MAX_LIST] = { TOPO_GRID, TOPO_WAXMAN, TOPO_FATTREE, TOPO_ISP };
+    int sizes[BENCH_MAX_LIST] = { 100, 1000 };
+    int num_topos = TOPO_NUM, num_sizes = 2;
+    int direct = 0, failed = 0, c, i, j;
+    unsigned int seed = 1;
+    double gate = 0;
+    struct bench_result r;
+    struct rusage ru;
+    FILE* out;
+
+    while((c = getopt(argc, argv, "ht:n:ug:s:")) != EOF){
+        switch(c){
+            case 'h': usage(argv[0]); return 0;
+            case 't': num_topos = parse_list(optarg, topos, 1); break;
+            case 'n': num_sizes = parse_list(optarg, sizes, 0); break;
+            case 'u': direct = 1; break;
+            case 'g': gate = atof(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(num_topos <= 0 || num_sizes <= 0){
+        usage(argv[0]);
+        return 1;
+    }
+    for(i = 0; i < num_sizes; i++){
+        if(sizes[i] < 10 || sizes[i] > 5000){
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // the router chats on stdout for every LSU and SPF run; keep that off the report
+    out = fdopen(dup(fileno(stdout)), "w");
+    if(!freopen("/dev/null", "w", stdout)){
+        perror("freopen");
+        return 1;
+    }
+
+    bench_init_router(seed);
+    ((struct sr_router*)sr_get_subsystem(&bench_sr))->rtable = bench_build_rtable(0);
+    sys_thread_new(pwospfThrottleThread, NULL);
+
+    fprintf(out, "LSUs through %s, SPF on the throttle thread\n",
+            direct ? "update_lsu()" : "processPWOSPF()");
+    bench_print_header(out);
+    for(i = 0; i < num_topos; i++){
+        for(j = 0; j < num_sizes; j++){
+            srand(seed);
+            if(bench_run(topos[i], sizes[j], direct, &r)) failed = 1;
+            if(r.routes != r.n) failed = 1;
+            bench_print(out, &r);
+            fflush(out);
+
+            if(gate > 0 && (r.converge_ms < 0 || r.converge_ms > gate)){
+                fprintf(out, "FAIL: %s with %d routers took more than %.0f ms to converge\n",
+                        topo_names[r.topo], r.n, gate);
+                fflush(out);
+                return 2;
+            }
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(out, "max rss %ld KB\n", ru.ru_maxrss);
+    if(failed) fprintf(out, "FAIL: some topology did not converge or is missing routes\n");
+    fflush(out);
+    return failed ? 1 : 0;
+}
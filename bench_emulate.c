@@ -0,0 +1,708 @@
+/*-----------------------------------------------------------------------------
+ * File: bench_emulate.c
+ *
+ * A whole network of routers in one process.  Every router is an
+ * sr_instance of its own, with its own state and threads (bound to it, see
+ * bindRouter()), and the links between them are in memory: a frame sent
+ * out of an interface goes straight onto the thread pool queue of the
+ * router at the other end.  The routers find each other with PWOSPF hellos,
+ * ARP for each other and flood their LSUs just as they would over VNS.
+ *
+ * Router i has a host on eth0 (20.0.0.0 + i*256, /24) and its links on
+ * eth1 up.  Once the network has converged, the host behind router 0 sends
+ * an ICMP echo request every -i us to the host behind the router farthest
+ * from it.  Then -f times a link on the path the probes take goes down --
+ * both ends lose carrier, as with "ip interface <name> down" -- and later
+ * comes back up.  For every event it reports the time until no router had
+ * an SPF run or an LSU left to do, the time from the event to
+ * the last probe lost, the probes lost, the SPF runs and LSUs the event
+ * cost network-wide, the neighbors taken down for missing liveness echoes
+ * and how many of the n*n host routes the routers hold.
+ * A link coming up waits for the next hello (HELLOINT) before anything
+ * happens, which is part of its time.  With -g, exits with status 2 if an
+ * event takes longer than the given number of ms to converge.  With -r the
+ * routers run in fast reroute mode, so traffic over a failed link moves to
+ * its loop-free alternate at once rather than after SPF.  With -q links fail
+ * quietly: they stop carrying frames but neither end loses carrier, so only
+ * the hellos or the liveness echoes (every -e ms, 0 for none) notice.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+
+#define EMU_MAX_ROUTERS  256
+#define EMU_MAX_PORTS    8 // links per router
+#define EMU_MAX_PROBES   (1 << 22)
+#define EMU_TIMEOUT_MS   30000
+#define EMU_QUIET_MS     300 // this long with nothing to do counts as converged
+#define EMU_PROBE_ID     0x454d
+#define EMU_PROBE_LEN    (ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 8 + 32)
+
+// the host network of router i, the router is .1 and the host .2;
+// links are /30s from 172.16.0.0 up
+#define EMU_HOST_NET(i)  (0x14000000 + ((i) << 8))
+#define EMU_LINK(l)      (0xac100000 + ((l) << 2))
+
+enum { TOPO_RING, TOPO_GRID, TOPO_MESH, TOPO_NUM };
+static const char* topo_names[TOPO_NUM] = { "ring", "grid", "mesh" };
+
+struct emu_port
+{
+    int peer; // router at the other end, -1 for the host on eth0
+    int peer_port;
+    int link;
+    uint32_t ip;
+    uint32_t mask;
+};
+
+struct emu_router
+{
+    struct sr_instance sr; // first, so the output hook gets back here from sr
+    struct sr_router* subsystem;
+    struct emu_port port[EMU_MAX_PORTS + 1];
+    int num_ports; // eth0 included
+};
+
+struct emu_link
+{
+    int a, b;
+    int a_port, b_port;
+    volatile int up;
+};
+
+struct emu_counters
+{
+    unsigned long spf_runs;
+    unsigned long lsu_sent;
+    unsigned long echo_downs;
+};
+
+static struct emu_router* emu;
+static int emu_n;
+static struct emu_link* emu_links;
+static int emu_num_links;
+
+static volatile unsigned long emu_dropped; // frames sent into a link that is down
+
+// probes, by sequence number
+static uint64_t* probe_sent;
+static volatile uint8_t* probe_recv;
+static volatile int probe_next;
+static volatile int probe_stop;
+static int probe_src, probe_dst;
+static int probe_interval_us = 1000;
+static int emu_mode; // router mode, 0x2 with -r
+static int emu_quiet; // links fail without the ends losing carrier
+static int emu_echo = ECHO_INTERVAL; // ms between liveness echoes, 0 for none
+
+/*-----------------------------------------------------------------------------
+ * Topologies
+ *---------------------------------------------------------------------------*/
+
+static int emu_linked(int a, int b)
+{
+    int p;
+    for(p = 1; p < emu[a].num_ports; p++) if(emu[a].port[p].peer == b) return 1;
+    return 0;
+}
+
+// links a and b unless they are the same router, linked already or full
+static void emu_link(int a, int b)
+{
+    struct emu_link* l;
+    struct emu_port* pa;
+    struct emu_port* pb;
+
+    if(a == b || emu_linked(a, b)) return;
+    if(emu[a].num_ports > EMU_MAX_PORTS || emu[b].num_ports > EMU_MAX_PORTS) return;
+
+    l = &emu_links[emu_num_links];
+    l->a = a;
+    l->b = b;
+    l->a_port = emu[a].num_ports++;
+    l->b_port = emu[b].num_ports++;
+    l->up = 1;
+
+    pa = &emu[a].port[l->a_port];
+    pb = &emu[b].port[l->b_port];
+    pa->peer = b;
+    pa->peer_port = l->b_port;
+    pb->peer = a;
+    pb->peer_port = l->a_port;
+    pa->link = pb->link = emu_num_links;
+    pa->ip = EMU_LINK(emu_num_links) | 1;
+    pb->ip = EMU_LINK(emu_num_links) | 2;
+    pa->mask = pb->mask = 0xfffffffc;
+    emu_num_links++;
+}
+
+/* ring: i to i+1; grid: a square of about n routers, the last row possibly
+ * short; mesh: every router to one or two random routers placed before it
+ */
+static void emu_gen_topology(int topo, int n)
+{
+    int side = (int)ceil(sqrt((double)n)), i;
+
+    emu = (struct emu_router*)calloc(n, sizeof(struct emu_router));
+    emu_links = (struct emu_link*)calloc(n * EMU_MAX_PORTS, sizeof(struct emu_link));
+    emu_n = n;
+    emu_num_links = 0;
+    for(i = 0; i < n; i++){
+        emu[i].num_ports = 1;
+        emu[i].port[0].peer = -1;
+        emu[i].port[0].link = -1;
+        emu[i].port[0].ip = EMU_HOST_NET(i) | 1;
+        emu[i].port[0].mask = 0xffffff00;
+    }
+
+    for(i = 0; i < n; i++){
+        switch(topo){
+            case TOPO_RING:
+                if(n > 2 || i == 0) emu_link(i, (i + 1) % n);
+                break;
+            case TOPO_GRID:
+                if((i + 1) % side && i + 1 < n) emu_link(i, i + 1);
+                if(i + side < n) emu_link(i, i + side);
+                break;
+            default:
+                if(i > 0) emu_link(i, rand() % i);
+                if(i > 1) emu_link(i, rand() % i);
+                break;
+        }
+    }
+}
+
+// hops from src to every router over the links that are up, other than skip,
+// -1 if unreachable
+static void emu_bfs(int src, int skip, int* dist)
+{
+    int* queue = (int*)malloc(emu_n * sizeof(int));
+    int head = 0, tail = 0, i, p;
+
+    for(i = 0; i < emu_n; i++) dist[i] = -1;
+    dist[src] = 0;
+    queue[tail++] = src;
+    while(head < tail){
+        i = queue[head++];
+        for(p = 1; p < emu[i].num_ports; p++){
+            int peer = emu[i].port[p].peer;
+            int l = emu[i].port[p].link;
+            if(l == skip || !emu_links[l].up || dist[peer] >= 0) continue;
+            dist[peer] = dist[i] + 1;
+            queue[tail++] = peer;
+        }
+    }
+    free(queue);
+}
+
+// whether the network stays in one piece without link l
+static int emu_survives(int l)
+{
+    int* dist = (int*)malloc(emu_n * sizeof(int));
+    int i, ok = 1;
+
+    emu_bfs(0, l, dist);
+    for(i = 0; i < emu_n; i++) if(dist[i] < 0) ok = 0;
+    free(dist);
+    return ok;
+}
+
+/*-----------------------------------------------------------------------------
+ * Links and hosts
+ *---------------------------------------------------------------------------*/
+
+static void emu_host_input(int i, const uint8_t* frame, unsigned int len)
+{
+    const uint8_t* ip = frame + ETHERNET_HEADER_LENGTH;
+    const uint8_t* icmp;
+    int seq;
+
+    if(len < EMU_PROBE_LEN || frame[12] != 8 || frame[13] != 0) return;
+    if(ip[9] != 1 || ntohl(*(uint32_t*)(ip + 16)) != (EMU_HOST_NET(i) | 2)) return;
+    icmp = ip + (ip[0] & 0x0f) * 4;
+    if(icmp[0] != 8 || ntohs(*(uint16_t*)(icmp + 4)) != EMU_PROBE_ID) return;
+
+    seq = ntohl(*(uint32_t*)(icmp + 8));
+    if(seq >= 0 && seq < probe_next) probe_recv[seq] = 1;
+}
+
+// bench_output_hook: out of router sr's interface iface into the link there
+static int emu_output(struct sr_instance* sr, const uint8_t* frame,
+                      unsigned int len, const char* iface)
+{
+    struct emu_router* r = (struct emu_router*)sr;
+    struct emu_port* port;
+    char name[SR_NAMELEN];
+    int p = atoi(iface + 3);
+
+    if(p < 0 || p >= r->num_ports) return -1;
+    port = &r->port[p];
+    if(port->peer < 0){
+        emu_host_input(r - emu, frame, len);
+        return 0;
+    }
+    if(!emu_links[port->link].up){
+        __sync_fetch_and_add(&emu_dropped, 1);
+        return 0;
+    }
+    snprintf(name, SR_NAMELEN, "eth%d", port->peer_port);
+    addThreadQueue(&emu[port->peer].sr, frame, len, name);
+    return 0;
+}
+
+// both ends of link l lose or get back carrier, with -q it just stops or starts carrying frames
+static void emu_set_link(int l, int up)
+{
+    struct emu_link* k = &emu_links[l];
+    char name[SR_NAMELEN];
+
+    k->up = up;
+    if(emu_quiet) return;
+    bindRouter(&emu[k->a].sr);
+    snprintf(name, SR_NAMELEN, "eth%d", k->a_port);
+    router_interface_set_enabled(&emu[k->a].sr, name, up);
+    bindRouter(&emu[k->b].sr);
+    snprintf(name, SR_NAMELEN, "eth%d", k->b_port);
+    router_interface_set_enabled(&emu[k->b].sr, name, up);
+    bindRouter(NULL);
+}
+
+// an echo request from the host behind router src to the one behind dst
+static void emu_make_probe(uint8_t* frame, int seq)
+{
+    struct emu_router* r = &emu[probe_src];
+    uint8_t* ip = frame + ETHERNET_HEADER_LENGTH;
+    uint8_t* icmp = ip + IP_HEADER_LENGTH;
+    uint16_t sum;
+
+    memset(frame, 0, EMU_PROBE_LEN);
+    memcpy(frame, r->subsystem->ifaces[0].addr, 6);
+    frame[6] = 0x02;
+    frame[11] = 0xfe;
+    frame[12] = 8;
+
+    ip[0] = 0x45;
+    *(uint16_t*)(ip + 2) = htons(EMU_PROBE_LEN - ETHERNET_HEADER_LENGTH);
+    *(uint16_t*)(ip + 4) = htons(seq & 0xffff);
+    ip[8] = 64;
+    ip[9] = 1;
+    *(uint32_t*)(ip + 12) = htonl(EMU_HOST_NET(probe_src) | 2);
+    *(uint32_t*)(ip + 16) = htonl(EMU_HOST_NET(probe_dst) | 2);
+    sum = checksum((uint16_t*)ip, IP_HEADER_LENGTH);
+    memcpy(ip + 10, &sum, 2);
+
+    icmp[0] = 8;
+    *(uint16_t*)(icmp + 4) = htons(EMU_PROBE_ID);
+    *(uint32_t*)(icmp + 8) = htonl(seq);
+    sum = checksum((uint16_t*)icmp, EMU_PROBE_LEN - ETHERNET_HEADER_LENGTH - IP_HEADER_LENGTH);
+    memcpy(icmp + 2, &sum, 2);
+}
+
+static void* emu_probe_thread(void* arg)
+{
+    uint8_t frame[EMU_PROBE_LEN];
+    int seq;
+
+    while(!probe_stop && probe_next < EMU_MAX_PROBES){
+        seq = probe_next;
+        emu_make_probe(frame, seq);
+        probe_sent[seq] = bench_now_ns();
+        probe_next = seq + 1;
+        addThreadQueue(&emu[probe_src].sr, frame, EMU_PROBE_LEN, "eth0");
+        usleep(probe_interval_us);
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Routers
+ *---------------------------------------------------------------------------*/
+
+static void emu_init_router(int i)
+{
+    struct emu_router* r = &emu[i];
+    struct sr_router* subsystem;
+    uint8_t host_mac[6] = { 0x02, 0, 0, 0, 0, 0xfe };
+    int p;
+
+    subsystem = (struct sr_router*)calloc(1, sizeof(struct sr_router));
+    r->subsystem = subsystem;
+    sr_set_subsystem(&r->sr, subsystem);
+    initRouterState(subsystem);
+    subsystem->ospf_enabled = 1;
+    subsystem->mode = emu_mode;
+
+    subsystem->num_ifaces = r->num_ports;
+    subsystem->ifaces = (struct sr_vns_if*)calloc(r->num_ports, sizeof(struct sr_vns_if));
+    for(p = 0; p < r->num_ports; p++){
+        struct sr_vns_if* intf = &subsystem->ifaces[p];
+        snprintf(intf->name, SR_NAMELEN, "eth%d", p);
+        intf->ip = r->port[p].ip;
+        intf->mask = r->port[p].mask;
+        intf->addr[0] = 0x02;
+        intf->addr[2] = i >> 8;
+        intf->addr[3] = i & 0xff;
+        intf->addr[4] = p;
+        intf->addr[5] = 1;
+        intf->enabled = intf->hard_enabled = 1;
+    }
+
+    // the host never has to answer ARP
+    bindRouter(&r->sr);
+    arpInsert(&subsystem->arpList, EMU_HOST_NET(i) | 2, host_mac, 1);
+    arpReplaceTree(&subsystem->arpTree, arpGenerateTree(subsystem->arpList));
+    bindRouter(NULL);
+}
+
+// what sr_integ_hw_setup() does, with every thread bound to this router
+static void emu_start_router(int i)
+{
+    struct sr_instance* sr = &emu[i].sr;
+    struct sr_router* subsystem = emu[i].subsystem;
+    struct pwospf_if* node;
+
+    bindRouter(sr);
+    routerThreadNew(sr, arpCacheRefresh, NULL);
+    routerThreadNew(sr, arpQueueRefresh, NULL);
+    routerThreadNew(sr, refreshPingList, NULL);
+    initPWOSPF(sr);
+    setEcho(emu_echo, ECHO_MULT);
+    routerThreadNew(sr, pwospfTimeoutHelloThread, NULL);
+    for(node = subsystem->pwospf.if_list; node; node = node->next)
+        routerThreadNew(sr, pwospfSendHelloThread, (void*)node);
+    routerThreadNew(sr, pwospfSendLSUThread, NULL);
+    routerThreadNew(sr, pwospfThrottleThread, NULL);
+    routerThreadNew(sr, pwospfEchoThread, NULL);
+    routerThreadNew(sr, topologyRefresh, NULL);
+    update_rtable();
+    initThreadPool();
+    bindRouter(NULL);
+}
+
+// whether router i has a PWOSPF neighbor on port p
+static int emu_adjacent(int i, int p)
+{
+    struct sr_router* subsystem = emu[i].subsystem;
+    struct pwospf_if* node;
+    int found = 0;
+
+    for(node = subsystem->pwospf.if_list; node; node = node->next){
+        if(node->ip != emu[i].port[p].ip) continue;
+        pthread_mutex_lock(&node->neighbor_lock);
+        found = node->neighbor_list != NULL;
+        pthread_mutex_unlock(&node->neighbor_lock);
+    }
+    return found;
+}
+
+// waits until both ends of every link that is up see each other,
+// and neither end of a link that is down sees the other any more
+static int emu_wait_adjacent(long long since)
+{
+    int l, done = 0;
+
+    while(!done){
+        if(bench_now_ns() / 1000000 - since > EMU_TIMEOUT_MS) return -1;
+        usleep(1000);
+        for(l = 0, done = 1; l < emu_num_links && done; l++){
+            struct emu_link* k = &emu_links[l];
+            if(k->up && !(emu_adjacent(k->a, k->a_port) && emu_adjacent(k->b, k->b_port)))
+                done = 0;
+            if(!k->up && (emu_adjacent(k->a, k->a_port) || emu_adjacent(k->b, k->b_port)))
+                done = 0;
+        }
+    }
+    return 0;
+}
+
+/* converged once no router has had an SPF run or an LSU pending for
+ * EMU_QUIET_MS, long enough for any LSU still on its way to arrive; returns
+ * the ms from since to the last SPF run, -1 on timeout
+ */
+static long long emu_wait_quiet(long long since)
+{
+    long long quiet = -1, last, now;
+    int i, busy;
+
+    while(1){
+        usleep(1000);
+        now = bench_now_ns() / 1000000;
+        last = since;
+        busy = 0;
+        for(i = 0; i < emu_n; i++){
+            struct pwospf_throttle* th = &emu[i].subsystem->pwospf.throttle;
+
+            pthread_mutex_lock(&th->lock);
+            if(th->spf_pending || th->lsu_pending) busy = 1;
+            if(th->spf_last > last) last = th->spf_last;
+            pthread_mutex_unlock(&th->lock);
+        }
+        if(busy) quiet = -1;
+        else if(quiet < 0) quiet = now;
+        else if(now - quiet >= EMU_QUIET_MS) return last - since;
+        if(now - since > EMU_TIMEOUT_MS) return -1;
+    }
+}
+
+static void emu_counters(struct emu_counters* c)
+{
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    for(i = 0; i < emu_n; i++){
+        struct pwospf_throttle* th = &emu[i].subsystem->pwospf.throttle;
+        pthread_mutex_lock(&th->lock);
+        c->spf_runs += th->spf_runs;
+        c->lsu_sent += th->lsu_sent;
+        pthread_mutex_unlock(&th->lock);
+        pthread_mutex_lock(&emu[i].subsystem->pwospf.echo.lock);
+        c->echo_downs += emu[i].subsystem->pwospf.echo.downs;
+        pthread_mutex_unlock(&emu[i].subsystem->pwospf.echo.lock);
+    }
+}
+
+// routes to host networks, over all routers
+static int emu_count_routes()
+{
+    rtableNode* node;
+    int i, cnt = 0;
+
+    for(i = 0; i < emu_n; i++){
+        struct sr_router* subsystem = emu[i].subsystem;
+        pthread_mutex_lock(&subsystem->rtable_lock);
+        for(node = subsystem->rtable; node; node = node->next)
+            if(node->netmask == 0xffffff00 && (node->ip >> 24) == 0x14 && node->entry_index == 0) cnt++;
+        pthread_mutex_unlock(&subsystem->rtable_lock);
+    }
+    return cnt;
+}
+
+/* the links the probes take now, from each router's routing table; returns
+ * the number of hops, -1 if they do not get there
+ */
+static int emu_probe_path(int* path)
+{
+    uint32_t dst = EMU_HOST_NET(probe_dst) | 2;
+    int cur = probe_src, hops = 0;
+
+    while(cur != probe_dst && hops < emu_n){
+        struct sr_router* subsystem = emu[cur].subsystem;
+        rtableNode* node;
+        int p = -1;
+
+        pthread_mutex_lock(&subsystem->rtable_lock);
+        for(node = subsystem->rtable; node; node = node->next){
+            if((dst & node->netmask) == node->ip && node->nh != NH_NONE){
+                p = atoi(nh_get(&subsystem->nexthops, node->nh)->hop[0].output_if + 3);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&subsystem->rtable_lock);
+        if(p < 1 || p >= emu[cur].num_ports) return -1;
+        path[hops++] = emu[cur].port[p].link;
+        cur = emu[cur].port[p].peer;
+    }
+    return cur == probe_dst ? hops : -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Events
+ *---------------------------------------------------------------------------*/
+
+static void emu_print_header(FILE* out)
+{
+    fprintf(out, "%-6s %-9s %11s %9s %6s %7s %5s %5s %5s %11s\n",
+            "event", "link", "converge ms", "outage ms", "lost", "probes",
+            "spf", "lsu", "echo", "routes");
+}
+
+/* waits for the network to settle after an event at t0 (ms) and prints what
+ * it took; returns the convergence time, -1 on timeout
+ */
+static long long emu_settle(FILE* out, const char* event, int l, long long t0,
+                            int first_probe, struct emu_counters* before)
+{
+    struct emu_counters after;
+    long long conv = -1, outage = 0;
+    char link[24], conv_s[24], lost_s[24], probes_s[24];
+    int i, lost = 0, last_probe;
+
+    if(!emu_wait_adjacent(t0)) conv = emu_wait_quiet(t0);
+
+    // let the probes in flight get there
+    last_probe = probe_next;
+    usleep(50000);
+    for(i = first_probe; i < last_probe; i++){
+        if(probe_recv[i]) continue;
+        lost++;
+        outage = (long long)(probe_sent[i] / 1000000) - t0;
+    }
+    emu_counters(&after);
+
+    if(l < 0) strcpy(link, "-");
+    else snprintf(link, sizeof(link), "%d-%d", emu_links[l].a, emu_links[l].b);
+    if(conv < 0) strcpy(conv_s, "timeout");
+    else snprintf(conv_s, sizeof(conv_s), "%lld", conv);
+    if(first_probe == last_probe){
+        strcpy(lost_s, "-");
+        strcpy(probes_s, "-");
+    }
+    else{
+        snprintf(lost_s, sizeof(lost_s), "%d", lost);
+        snprintf(probes_s, sizeof(probes_s), "%d", last_probe - first_probe);
+    }
+    fprintf(out, "%-6s %-9s %11s %9lld %6s %7s %5lu %5lu %5lu %5d/%-5d\n",
+            event, link, conv_s, outage, lost_s, probes_s,
+            after.spf_runs - before->spf_runs, after.lsu_sent - before->lsu_sent,
+            after.echo_downs - before->echo_downs, emu_count_routes(), emu_n * emu_n);
+    fflush(out);
+    return conv;
+}
+
+// a link on the probes' path the network can do without, -1 if there is none
+static int emu_pick_link()
+{
+    int* path = (int*)malloc(emu_n * sizeof(int));
+    int hops = emu_probe_path(path), start, i, l = -1;
+
+    if(hops > 0){
+        start = rand() % hops;
+        for(i = 0; i < hops && l < 0; i++)
+            if(emu_survives(path[(start + i) % hops])) l = path[(start + i) % hops];
+    }
+    free(path);
+    return l;
+}
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-h] [-t topology] [-n routers] [-f failures] [-i us] [-r] [-q] [-e ms] [-g ms] [-s seed]\n", argv0);
+    printf("  -t  ring, grid or mesh (default grid)\n");
+    printf("  -n  routers, 2 to %d (default 16)\n", EMU_MAX_ROUTERS);
+    printf("  -f  links on the probes' path to take down and back up (default 2)\n");
+    printf("  -i  us between two probes (default 1000)\n");
+    printf("  -r  fast reroute mode\n");
+    printf("  -q  links fail quietly, without the ends losing carrier\n");
+    printf("  -e  ms between liveness echoes, 0 for none (default %d)\n", ECHO_INTERVAL);
+    printf("  -g  exit with status 2 if an event takes more than this many ms to converge\n");
+    printf("  -s  random seed (default 1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int topo = TOPO_GRID, n = 16, failures = 2, failed = 0, c, i, l;
+    int* dist;
+    unsigned int seed = 1;
+    double gate = 0;
+    long long t0, conv;
+    struct emu_counters before;
+    pthread_t prober;
+    FILE* out;
+
+    while((c = getopt(argc, argv, "ht:n:f:i:rqe:g:s:")) != EOF){
+        switch(c){
+            case 'h': usage(argv[0]); return 0;
+            case 't':
+                for(topo = 0; topo < TOPO_NUM && strcmp(optarg, topo_names[topo]); topo++);
+                break;
+            case 'n': n = atoi(optarg); break;
+            case 'f': failures = atoi(optarg); break;
+            case 'i': probe_interval_us = atoi(optarg); break;
+            case 'r': emu_mode = 0x2; break;
+            case 'q': emu_quiet = 1; break;
+            case 'e': emu_echo = atoi(optarg); break;
+            case 'g': gate = atof(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(topo == TOPO_NUM || n < 2 || n > EMU_MAX_ROUTERS || failures < 0 || probe_interval_us <= 0 || emu_echo < 0){
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the routers chat on stdout for every packet; keep that off the report
+    out = fdopen(dup(fileno(stdout)), "w");
+    if(!freopen("/dev/null", "w", stdout)){
+        perror("freopen");
+        return 1;
+    }
+    log_level = LOG_LVL_WARN;
+
+    srand(seed);
+    emu_gen_topology(topo, n);
+    bench_output_hook = emu_output;
+
+    // probes go from router 0 to the one farthest from it
+    dist = (int*)malloc(n * sizeof(int));
+    emu_bfs(0, -1, dist);
+    probe_src = probe_dst = 0;
+    for(i = 0; i < n; i++) if(dist[i] > dist[probe_dst]) probe_dst = i;
+    free(dist);
+    probe_sent = (uint64_t*)malloc(EMU_MAX_PROBES * sizeof(uint64_t));
+    probe_recv = (volatile uint8_t*)calloc(EMU_MAX_PROBES, 1);
+
+    fprintf(out, "%s of %d routers, %d links, probes from %d to %d every %d us%s%s, ",
+            topo_names[topo], n, emu_num_links, probe_src, probe_dst, probe_interval_us,
+            emu_mode ? ", fast reroute" : "", emu_quiet ? ", quiet failures" : "");
+    if(emu_echo) fprintf(out, "echoes every %d ms\n", emu_echo);
+    else fprintf(out, "no echoes\n");
+    emu_print_header(out);
+
+    for(i = 0; i < n; i++) emu_init_router(i);
+    emu_counters(&before);
+    t0 = bench_now_ns() / 1000000;
+    for(i = 0; i < n; i++) emu_start_router(i);
+    conv = emu_settle(out, "start", -1, t0, 0, &before);
+    if(conv < 0 || emu_count_routes() != n * n) failed = 1;
+
+    pthread_create(&prober, NULL, emu_probe_thread, NULL);
+    for(i = 0; i < failures && !failed; i++){
+        int first;
+
+        l = emu_pick_link();
+        if(l < 0){
+            fprintf(out, "no link on the path the network can do without\n");
+            break;
+        }
+        emu_counters(&before);
+        first = probe_next;
+        t0 = bench_now_ns() / 1000000;
+        emu_set_link(l, 0);
+        conv = emu_settle(out, "down", l, t0, first, &before);
+        if(conv < 0) failed = 1;
+        if(gate > 0 && (conv < 0 || conv > gate)){
+            fprintf(out, "FAIL: link %d-%d down took more than %.0f ms to converge\n",
+                    emu_links[l].a, emu_links[l].b, gate);
+            return 2;
+        }
+
+        emu_counters(&before);
+        first = probe_next;
+        t0 = bench_now_ns() / 1000000;
+        emu_set_link(l, 1);
+        conv = emu_settle(out, "up", l, t0, first, &before);
+        if(conv < 0) failed = 1;
+        if(gate > 0 && (conv < 0 || conv > gate)){
+            fprintf(out, "FAIL: link %d-%d up took more than %.0f ms to converge\n",
+                    emu_links[l].a, emu_links[l].b, gate);
+            return 2;
+        }
+    }
+    probe_stop = 1;
+    pthread_join(prober, NULL);
+
+    fprintf(out, "%lu frames dropped on links that were down\n", emu_dropped);
+    if(failed) fprintf(out, "FAIL: the network did not converge or is missing routes\n");
+    fflush(out);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,355 @@
+/*-----------------------------------------------------------------------------
+ * File: bench_forward.c
+ *
+ * Forwarding benchmark.  Links the router proper (router.c, routingTable.c,
+ * arpCache.c, ...) without VNS, lwtcp or the CLI and pushes a packet trace
+ * through processPacket() -- or through the thread pool, like
+ * sr_integ_input() does -- as fast as it can.  Every packet the router sends
+ * ends up in a counting sink instead of a socket.
+ *
+ * The router gets three interfaces (eth0-eth2 on 10.0.1-3.0/24), a default
+ * route plus -p random /24 prefixes spread over eth1 and eth2, and static
+ * ARP entries for their gateways, so nothing ever waits on ARP.  Packets
+ * come from a pcap file written by sr_dumper.c (-f) or are synthesized to
+ * random destinations inside the prefixes.
+ *
+ * With -m every route gets both gateways as equal cost next hops, and the
+ * packets each of them got is reported to show how evenly flows spread.
+ *
+ * Afterwards the main stages of the forwarding path are timed on their
+ * own over the same destinations.  With -g, exits with status 2 if the
+ * forwarding cost exceeds the given ns/packet, for use as a gate.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+#include "sr_dumper.h"
+
+#define BENCH_DEFAULT_PACKETS  1000000
+#define BENCH_DEFAULT_PREFIXES 1000
+#define BENCH_DEFAULT_FRAMES   1024
+#define BENCH_FRAME_LEN        64
+#define BENCH_MAX_LEN          1514
+
+struct bench_frame
+{
+    uint8_t data[BENCH_MAX_LEN];
+    unsigned int len;
+    uint32_t dst; /* host byte order */
+};
+
+static struct bench_frame* frames;
+static unsigned int num_frames;
+
+// fills in a 64 byte UDP packet from 10.0.1.100:sport to dst:9
+static void bench_make_frame(struct bench_frame* f, uint32_t dst, uint16_t sport)
+{
+    uint8_t* ip = f->data + ETHERNET_HEADER_LENGTH;
+    uint16_t sum;
+
+    memset(f->data, 0, BENCH_FRAME_LEN);
+    f->data[4] = 1; f->data[5] = 1;             // eth0 MAC
+    f->data[10] = 1; f->data[11] = 100;
+    f->data[12] = 8; f->data[13] = 0;
+
+    ip[0] = 0x45;
+    ip[3] = BENCH_FRAME_LEN - ETHERNET_HEADER_LENGTH;
+    ip[8] = 64;
+    ip[9] = 17;
+    ip[12] = 10; ip[13] = 0; ip[14] = 1; ip[15] = 100;
+    int2byteIP(dst, &ip[16]);
+    ip[20] = sport >> 8; ip[21] = sport & 0xff;
+    ip[23] = 9;
+    sum = checksum((uint16_t*)ip, IP_HEADER_LENGTH);
+    memcpy(&ip[10], &sum, 2);
+
+    f->len = BENCH_FRAME_LEN;
+    f->dst = dst;
+}
+
+static void bench_synthesize(unsigned int count)
+{
+    unsigned int i, seed = rand();
+
+    frames = (struct bench_frame*)malloc(count * sizeof(struct bench_frame));
+    for(i = 0; i < count; i++)
+        bench_make_frame(&frames[i], bench_random_dst(&seed), 1024 + i % 64512);
+    num_frames = count;
+}
+
+// loads all IPv4 frames from a pcap trace
+static int bench_load_pcap(const char* fname)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    unsigned int cap = 0;
+    uint8_t buf[65536];
+    FILE* fp = fopen(fname, "rb");
+
+    if(!fp){
+        perror(fname);
+        return -1;
+    }
+    if(fread(&fh, sizeof(fh), 1, fp) != 1 || fh.magic != TCPDUMP_MAGIC){
+        fprintf(stderr, "%s is not a pcap file\n", fname);
+        fclose(fp);
+        return -1;
+    }
+
+    frames = NULL;
+    num_frames = 0;
+    while(fread(&ph, sizeof(ph), 1, fp) == 1){
+        if(ph.caplen > sizeof(buf) || fread(buf, ph.caplen, 1, fp) != 1)
+            break;
+        if(ph.caplen > BENCH_MAX_LEN || ph.caplen < ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH ||
+           buf[12] != 8 || buf[13] != 0)
+            continue;
+
+        if(num_frames == cap){
+            cap = cap ? 2*cap : 1024;
+            frames = (struct bench_frame*)realloc(frames, cap * sizeof(struct bench_frame));
+        }
+        memcpy(frames[num_frames].data, buf, ph.caplen);
+        frames[num_frames].len = ph.caplen;
+        frames[num_frames].dst = ntohl(*(uint32_t*)&buf[ETHERNET_HEADER_LENGTH + 16]);
+        num_frames++;
+    }
+    fclose(fp);
+
+    if(num_frames == 0){
+        fprintf(stderr, "no IPv4 frames in %s\n", fname);
+        return -1;
+    }
+    return 0;
+}
+
+// gives every route through a gateway both gateways, for -m
+static void bench_multipath(rtableNode* node)
+{
+    uint32_t gw[2] = { BENCH_GW_IP(1), BENCH_GW_IP(2) };
+    char names[2][SR_NAMELEN] = { "eth1", "eth2" };
+    char* ifs[2] = { names[0], names[1] };
+
+    for(; node; node = node->next){
+        uint32_t nh = node->nh;
+        if(nh == NH_NONE || nh_group(nh)->hop[0].gateway == 0) continue;
+        node->nh = nh_intern(gw, ifs, 2);
+        nh_release(nh);
+    }
+}
+
+// packets each interface got over the next hop groups with several next hops
+static void bench_print_hops(FILE* out)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct nexthopTable* nt = &subsystem->nexthops;
+    unsigned long cnt[3] = { 0, 0, 0 }, total = 0;
+    uint32_t nh;
+    int i;
+
+    for(nh = NH_NONE + 1; nh < nt->used; nh++){
+        struct nexthopGroup* g = nh_get(nt, nh);
+        if(g == NULL || g->out_cnt < 2) continue;
+        for(i = 0; i < g->out_cnt; i++){
+            cnt[g->hop[i].output_if[3] - '0'] += g->hop[i].hits;
+            total += g->hop[i].hits;
+        }
+    }
+    fprintf(out, "  next hops:");
+    for(i = 1; i < 3; i++)
+        fprintf(out, " eth%d %lu (%.2f%%)", i, cnt[i], total ? 100.0 * cnt[i] / total : 0);
+    fprintf(out, "\n");
+}
+
+/*-----------------------------------------------------------------------------
+ * Benchmarks
+ *---------------------------------------------------------------------------*/
+
+struct bench_result
+{
+    const char* name;
+    unsigned long ops;
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+static void bench_print(FILE* out, struct bench_result* r)
+{
+    double ns_op = r->ops ? (double)r->ns / r->ops : 0;
+
+    fprintf(out, "%-22s %10lu ops %9.3f Mops/s %9.1f ns/op", r->name, r->ops,
+            r->ns ? r->ops * 1e3 / r->ns : 0, ns_op);
+#ifdef BENCH_HAVE_TSC
+    fprintf(out, " %9.1f cycles/op", r->ops ? (double)r->cycles / r->ops : 0);
+#endif
+    fprintf(out, "\n");
+}
+
+// runs packets straight through processPacket() on this thread
+static void bench_direct(unsigned long count, struct bench_result* r)
+{
+    uint8_t work[BENCH_MAX_LEN];
+    uint64_t t0, c0;
+    unsigned long i;
+
+    t0 = bench_now_ns();
+    c0 = bench_now_cycles();
+    for(i = 0; i < count; i++){
+        struct bench_frame* f = &frames[i % num_frames];
+        memcpy(work, f->data, f->len);
+        processPacket(&bench_sr, work, f->len, "eth0");
+    }
+    r->cycles = bench_now_cycles() - c0;
+    r->ns = bench_now_ns() - t0;
+    r->ops = count;
+}
+
+// hands packets to the thread pool the way sr_integ_input() does and waits
+// for the workers to drain it
+static void bench_pool(unsigned long count, struct bench_result* r)
+{
+    unsigned long i, start = bench_sink_packets;
+    uint64_t t0, c0;
+
+    t0 = bench_now_ns();
+    c0 = bench_now_cycles();
+    for(i = 0; i < count; i++){
+        struct bench_frame* f = &frames[i % num_frames];
+        addThreadQueue(&bench_sr, f->data, f->len, "eth0");
+    }
+    while(bench_sink_packets - start < count) usleep(10);
+    r->cycles = bench_now_cycles() - c0;
+    r->ns = bench_now_ns() - t0;
+    r->ops = count;
+}
+
+// times the main stages of the forwarding path on their own
+static void bench_stages(FILE* out, unsigned long count)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct bench_result r;
+    volatile uint32_t sink = 0;
+    unsigned long i;
+    uint64_t t0, c0;
+    uint8_t* p;
+    char* s;
+
+#define BENCH_STAGE(label, body) \
+    do { \
+        t0 = bench_now_ns(); c0 = bench_now_cycles(); \
+        for(i = 0; i < count; i++){ struct bench_frame* f = &frames[i % num_frames]; body; } \
+        r.cycles = bench_now_cycles() - c0; r.ns = bench_now_ns() - t0; \
+        r.name = label; r.ops = count; bench_print(out, &r); \
+    } while(0)
+
+    BENCH_STAGE("  ip checksum", sink += checksum((uint16_t*)(f->data + ETHERNET_HEADER_LENGTH),
+                                                IP_HEADER_LENGTH));
+    BENCH_STAGE("  gw_match", sink += gw_match(&subsystem->rtable, f->dst));
+    BENCH_STAGE("  lp_match", s = lp_match(&subsystem->rtable, f->dst); free(s));
+    BENCH_STAGE("  arpLookupTree", p = arpLookupTree(subsystem->arpTree, BENCH_GW_IP(1 + (f->dst & 1)));
+                                 free(p));
+    BENCH_STAGE("  output", sr_integ_low_level_output(&bench_sr, f->data, f->len, "eth1"));
+
+#undef BENCH_STAGE
+}
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-h] [-f pcap] [-n packets] [-p prefixes] [-u frames] [-m] [-q] [-g ns] [-s seed]\n",
+            argv0);
+    printf("  -f  replay IPv4 frames from this pcap file\n");
+    printf("  -n  packets to forward (default %d)\n", BENCH_DEFAULT_PACKETS);
+    printf("  -p  random /24 prefixes in the routing table (default %d)\n",
+            BENCH_DEFAULT_PREFIXES);
+    printf("  -u  distinct synthetic frames (default %d)\n", BENCH_DEFAULT_FRAMES);
+    printf("  -m  two equal cost next hops per route\n");
+    printf("  -q  also go through the thread pool, like sr_integ_input()\n");
+    printf("  -g  exit with status 2 if forwarding takes more than this many ns/packet\n");
+    printf("  -s  random seed (default 1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long count = BENCH_DEFAULT_PACKETS;
+    int prefixes = BENCH_DEFAULT_PREFIXES;
+    unsigned int unique = BENCH_DEFAULT_FRAMES, seed = 1;
+    double gate = 0;
+    char* pcap = NULL;
+    int use_pool = 0, multipath = 0, c;
+    struct bench_result r;
+    FILE* out;
+
+    while((c = getopt(argc, argv, "hf:n:p:u:mqg:s:")) != EOF){
+        switch(c){
+            case 'h': usage(argv[0]); return 0;
+            case 'f': pcap = optarg; break;
+            case 'n': count = strtoul(optarg, NULL, 10); break;
+            case 'p': prefixes = atoi(optarg); break;
+            case 'u': unique = atoi(optarg); break;
+            case 'm': multipath = 1; break;
+            case 'q': use_pool = 1; break;
+            case 'g': gate = atof(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(count == 0 || unique == 0){
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the router chats on stdout for every packet; keep that off the report
+    out = fdopen(dup(fileno(stdout)), "w");
+    if(!freopen("/dev/null", "w", stdout)){
+        perror("freopen");
+        return 1;
+    }
+
+    bench_init_router(seed);
+    ((struct sr_router*)sr_get_subsystem(&bench_sr))->rtable = bench_build_rtable(prefixes);
+    if(multipath) bench_multipath(((struct sr_router*)sr_get_subsystem(&bench_sr))->rtable);
+    if(pcap){
+        if(bench_load_pcap(pcap)) return 1;
+    }
+    else
+        bench_synthesize(unique);
+
+    fprintf(out, "%u frames, %d prefixes, %lu packets%s\n", num_frames, prefixes,
+            count, pcap ? " (pcap)" : "");
+
+    // warm up caches and the allocator
+    bench_direct(count < 10000 ? count : 10000, &r);
+
+    bench_sink_packets = bench_sink_bytes = 0;
+    bench_direct(count, &r);
+    r.name = "processPacket";
+    bench_print(out, &r);
+    fprintf(out, "  sink: %lu packets, %lu bytes\n", bench_sink_packets, bench_sink_bytes);
+    if(multipath) bench_print_hops(out);
+
+    if(gate > 0 && (double)r.ns / r.ops > gate){
+        fprintf(out, "FAIL: %.1f ns/packet is over the %.1f ns/packet gate\n",
+                (double)r.ns / r.ops, gate);
+        fflush(out);
+        return 2;
+    }
+
+    bench_stages(out, count);
+
+    if(use_pool){
+        initThreadPool();
+        bench_pool(count, &r);
+        r.name = "thread pool";
+        bench_print(out, &r);
+    }
+
+    fflush(out);
+    return 0;
+}
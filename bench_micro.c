@@ -0,0 +1,836 @@
+/*-----------------------------------------------------------------------------
+ * File: bench_micro.c
+ *
+ * Microbenchmarks for the router's data structures: route lookup, ARP
+ * lookup and insertion, routing table loading (from the rtable file and from
+ * a snapshot), batched route changes, SPF (from scratch and after a link flap), LSU processing,
+ * route aggregation, the IP checksum, the thread pool queue, the flight recorder and the packet counters.  Each one runs at several sizes and
+ * with one or more threads hammering it at once, for a fixed time.
+ *
+ * Results are printed as a table, CSV or JSON.  -o saves them as CSV and -b
+ * compares a run against such a file; anything more than -r percent slower
+ * per operation than the baseline is flagged and makes the program exit
+ * with status 2.  "make bench" and "make bench-baseline" wrap this.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <limits.h>
+
+#include "bench_common.h"
+
+#define BENCH_MAX_SIZES   5
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_RESULTS 256
+#define BENCH_BATCH_NS    1000000  // grow batches until they take this long
+
+void arpDestroyTree(arpTreeNode *root); /* -- arpCache.c -- */
+
+struct bench_thread
+{
+    pthread_t thread;
+    unsigned int seed;
+    int size;
+    uint64_t ops;
+    uint64_t busy_ns;
+    uint64_t excluded_ns; // setup time an op does not want counted
+    void* priv;
+    struct bench_case* c;
+};
+
+struct bench_case
+{
+    const char* name;
+    const char* unit; // what one op is
+    int sizes[BENCH_MAX_SIZES];
+    void (*setup)(int size);
+    void (*teardown)(int size);
+    void (*op)(struct bench_thread* t, unsigned long n);
+    void (*thread_done)(struct bench_thread* t);
+};
+
+struct bench_result
+{
+    char name[32];
+    int size;
+    int threads;
+    uint64_t ops;
+    double ns_op;
+    double mops;
+    double base_ns_op; // 0 if there is no baseline
+};
+
+static uint64_t duration_ns = 200000000ULL;
+static int max_size = 1000000;
+static unsigned int seed = 1;
+
+static volatile int bench_go;
+
+/*-----------------------------------------------------------------------------
+ * Route lookup
+ *---------------------------------------------------------------------------*/
+
+static rtableNode* lookup_table;
+
+static void rtable_setup(int size) { lookup_table = bench_build_rtable(size); }
+
+static void rtable_teardown(int size) { kill_rtable(&lookup_table); }
+
+static void lp_match_op(struct bench_thread* t, unsigned long n)
+{
+    while(n--) free(lp_match(&lookup_table, bench_random_dst(&t->seed)));
+}
+
+static void gw_match_op(struct bench_thread* t, unsigned long n)
+{
+    volatile uint32_t gw;
+    while(n--) gw = gw_match(&lookup_table, bench_random_dst(&t->seed));
+    (void)gw;
+}
+
+/*-----------------------------------------------------------------------------
+ * ARP cache
+ *---------------------------------------------------------------------------*/
+
+static arpTreeNode* arp_tree;
+static uint32_t* arp_ips;
+static int arp_num_ips;
+
+// a sorted list of distinct addresses, built directly since arpInsert() is
+// linear in the length of the list
+static void arp_setup(int size)
+{
+    arpNode *head = NULL, *prev = NULL, *node;
+    int i;
+
+    arp_ips = (uint32_t*)malloc(size * sizeof(uint32_t));
+    for(i = 0; i < size; i++){
+        arp_ips[i] = 0x0b000000 + i * 7;
+        node = (arpNode*)calloc(1, sizeof(arpNode));
+        node->ip = arp_ips[i];
+        node->mac[5] = i;
+        node->is_static = 1;
+        node->prev = prev;
+        if(prev) prev->next = node;
+        else head = node;
+        prev = node;
+    }
+    arp_num_ips = size;
+
+    arp_tree = arpGenerateTree(head);
+    while(head){
+        node = head->next;
+        free(head);
+        head = node;
+    }
+}
+
+static void arp_teardown(int size)
+{
+    arpDestroyTree(arp_tree);
+    arp_tree = NULL;
+    free(arp_ips);
+}
+
+static void arp_lookup_op(struct bench_thread* t, unsigned long n)
+{
+    while(n--) free(arpLookupTree(arp_tree, arp_ips[rand_r(&t->seed) % arp_num_ips]));
+}
+
+static void arp_free_list(arpNode** head)
+{
+    arpNode* next;
+    while(*head){
+        next = (*head)->next;
+        free(*head);
+        *head = next;
+    }
+}
+
+// fills a private list up to size entries, then starts over
+static void arp_insert_op(struct bench_thread* t, unsigned long n)
+{
+    arpNode** head = (arpNode**)&t->priv;
+    uint8_t mac[6] = { 0, 0, 0, 0, 0, 1 };
+    uint64_t t0;
+
+    while(n--){
+        if(t->ops % t->size == 0 && *head){
+            t0 = bench_now_ns();
+            arp_free_list(head);
+            t->excluded_ns += bench_now_ns() - t0;
+        }
+        arpInsert(head, (uint32_t)rand_r(&t->seed), mac, 0);
+        t->ops++;
+    }
+}
+
+static void arp_insert_done(struct bench_thread* t) { arp_free_list((arpNode**)&t->priv); }
+
+/*-----------------------------------------------------------------------------
+ * Routing table loading
+ *---------------------------------------------------------------------------*/
+
+static void rtable_insert_op(struct bench_thread* t, unsigned long n)
+{
+    rtableNode** head = (rtableNode**)&t->priv;
+    uint32_t gw = BENCH_GW_IP(1);
+    char name[SR_NAMELEN] = "eth1";
+    char* if_name = name;
+    uint64_t t0;
+
+    while(n--){
+        if(t->ops % t->size == 0 && *head){
+            t0 = bench_now_ns();
+            kill_rtable(head);
+            t->excluded_ns += bench_now_ns() - t0;
+        }
+        insert_rtable_node(head, (uint32_t)rand_r(&t->seed) & 0xffffff00, 0xffffff00,
+                &gw, &if_name, 1, 1);
+        t->ops++;
+    }
+}
+
+static void rtable_insert_done(struct bench_thread* t) { kill_rtable((rtableNode**)&t->priv); }
+
+static char rtable_file[32];
+
+// an rtable file of random /24s, every eighth one with a second next hop
+static void rtable_file_setup(int size)
+{
+    unsigned int s = seed;
+    FILE* f;
+    int i, fd;
+
+    strcpy(rtable_file, "/tmp/bench_rtable.XXXXXX");
+    fd = mkstemp(rtable_file);
+    f = fdopen(fd, "w");
+    for(i = 0; i < size; i++){
+        uint32_t ip = (uint32_t)rand_r(&s) & 0xffffff00;
+        fprintf(f, "%u.%u.%u.0  10.0.1.254  255.255.255.0  eth1\n", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff);
+        if(i % 8 == 0)
+            fprintf(f, "%u.%u.%u.0  10.0.2.254  255.255.255.0  eth2...m\n", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff);
+    }
+    fclose(f);
+}
+
+static void rtable_file_teardown(int size) { unlink(rtable_file); }
+
+// what fill_rtable() does, without putting the table in place
+static void rtable_load_op(struct bench_thread* t, unsigned long n)
+{
+    struct rtableLoad l;
+    rtableNode* table;
+    int entries, bad_line;
+
+    while(n--){
+        memset(&l, 0, sizeof(l));
+        read_rtable_file(rtable_file, &l, 0, &bad_line);
+        table = build_rtable(&l, 1, &entries);
+        free_rtable_load(&l);
+        kill_rtable(&table);
+    }
+}
+
+#define TXN_ROUTES 1000
+
+// TXN_ROUTES static routes committed at once into a table of size routes, the
+// same ones each time so the table stays the size it is
+static void rtable_txn_op(struct bench_thread* t, unsigned long n)
+{
+    struct rtableTxn txn;
+    unsigned int s;
+    int i;
+
+    while(n--){
+        s = seed;
+        rtable_txn_begin(&txn, 1);
+        for(i = 0; i < TXN_ROUTES; i++)
+            rtable_txn_add(&txn, (uint32_t)rand_r(&s) & 0xffffff00, 0xffffff00, BENCH_GW_IP(1), "eth1",
+                    i % 8 ? RTABLE_INSERT : RTABLE_MERGE);
+        rtable_txn_commit(&lookup_table, &txn);
+    }
+}
+
+// a snapshot of the router with a table of size routes, for the warm restart
+static void snapshot_setup(int size)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    rtableNode* old = subsystem->rtable;
+
+    strcpy(rtable_file, "/tmp/bench_snap.XXXXXX");
+    close(mkstemp(rtable_file));
+    subsystem->rtable = bench_build_rtable(size);
+    kill_rtable(&old);
+    snapshot_save(rtable_file);
+}
+
+static void snapshot_teardown(int size)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    kill_rtable(&subsystem->rtable);
+    unlink(rtable_file);
+}
+
+static void snapshot_load_op(struct bench_thread* t, unsigned long n)
+{
+    while(n--) snapshot_load(rtable_file);
+}
+
+/*-----------------------------------------------------------------------------
+ * SPF
+ *---------------------------------------------------------------------------*/
+
+static int topo_has_ad(topo_router* r, uint32_t rid)
+{
+    uint32_t i;
+    for(i = 0; i < r->num_ads; i++) if(r->ads[i].router_id == rid) return 1;
+    return 0;
+}
+
+// the ring link spf_flap_op() takes down and brings back up
+static uint32_t flap_rid[2];
+static uint32_t flap_subnet;
+static int flap_down;
+static pthread_mutex_t flap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Builds a topology of size routers around this one: a ring of size - 1
+ * routers with a random chord at every router and a stub network behind
+ * each, with this router attached to the first three over eth0-eth2.
+ */
+static void spf_setup(int size)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    int n = size - 1, i, j, link = 0;
+    topo_router** rtr;
+    struct pwospf_if* pif;
+    uint32_t subnet;
+
+    if(n < 3) n = 3;
+    rtr = (topo_router**)malloc(n * sizeof(topo_router*));
+    for(i = 0; i < n; i++){
+        rtr[i] = new_lsa(0x0b000001 + i, 4);
+        rtr[i]->last_update_time = (time_t)INT_MAX;
+        lsa_add_ad(&rtr[i], 0x14000000 + (i << 8), 0xffffff00, 0);
+    }
+    for(i = 0; i < n; i++){
+        for(j = 0; j < 2; j++){
+            int k = j ? rand() % n : (i + 1) % n;
+            if(k == i || topo_has_ad(rtr[i], rtr[k]->router_id)) continue;
+            subnet = 0xac100000 + (link++ << 2);
+            lsa_add_ad(&rtr[i], subnet, 0xfffffffc, rtr[k]->router_id);
+            lsa_add_ad(&rtr[k], subnet, 0xfffffffc, rtr[i]->router_id);
+            if(i == n/2 && j == 0){
+                flap_rid[0] = rtr[i]->router_id;
+                flap_rid[1] = rtr[k]->router_id;
+                flap_subnet = subnet;
+            }
+        }
+    }
+    flap_down = 0;
+
+    // this router's neighbors, as learned from hellos
+    for(pif = subsystem->pwospf.if_list; pif; pif = pif->next){
+        struct pwospf_neighbor* nbr = (struct pwospf_neighbor*)calloc(1, sizeof(struct pwospf_neighbor));
+        i = ((pif->ip >> 8) & 0xff) - 1;
+        nbr->id = rtr[i]->router_id;
+        nbr->ip = (pif->ip & pif->netmask) | 2;
+        nbr->nm = pif->netmask;
+        nbr->lastHelloTime = time(NULL);
+        pif->neighbor_list = nbr;
+        lsa_add_ad(&rtr[i], pif->ip & pif->netmask, pif->netmask, subsystem->pwospf.routerID);
+    }
+
+    for(i = 0; i < n; i++) update_lsu(rtr[i]);
+    free(rtr);
+}
+
+static void spf_teardown(int size)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct pwospf_if* pif;
+
+    flush_topo();
+    forget_spf();
+    for(pif = subsystem->pwospf.if_list; pif; pif = pif->next){
+        free(pif->neighbor_list);
+        pif->neighbor_list = NULL;
+    }
+    pthread_mutex_lock(&subsystem->rtable_lock);
+    kill_rtable(&subsystem->rtable);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+}
+
+// SPF from scratch every time, as update_rtable() used to do
+static void spf_op(struct bench_thread* t, unsigned long n)
+{
+    while(n--){
+        forget_spf();
+        update_rtable();
+    }
+}
+
+// a new LSU from router rid with the link on subnet taken out or put back
+static void spf_flap_lsu(uint32_t rid, uint32_t peer, uint32_t subnet, int down)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    topo_router *r, *copy;
+    uint32_t i;
+
+    pthread_mutex_lock(&subsystem->topo.lock);
+    r = find_router(rid);
+    copy = new_lsa(rid, r->num_ads + 1);
+    copy->last_update_time = (time_t)INT_MAX;
+    for(i = 0; i < r->num_ads; i++)
+        if(r->ads[i].subnet != subnet) lsa_add_ad(&copy, r->ads[i].subnet, r->ads[i].mask, r->ads[i].router_id);
+    pthread_mutex_unlock(&subsystem->topo.lock);
+    if(!down) lsa_add_ad(&copy, subnet, 0xfffffffc, peer);
+    update_lsu(copy);
+}
+
+// incremental SPF after one link of the ring went down or came back
+static void spf_flap_op(struct bench_thread* t, unsigned long n)
+{
+    while(n--){
+        pthread_mutex_lock(&flap_lock);
+        flap_down = !flap_down;
+        spf_flap_lsu(flap_rid[0], flap_rid[1], flap_subnet, flap_down);
+        spf_flap_lsu(flap_rid[1], flap_rid[0], flap_subnet, flap_down);
+        update_rtable();
+        pthread_mutex_unlock(&flap_lock);
+    }
+}
+
+// an unchanged LSU from a random router, as the LSU handler receives it:
+// sequence check, a fresh LSA with the ads in reverse, then update_lsu()
+static void lsu_op(struct bench_thread* t, unsigned long n)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    topo_router *r, *lsa;
+    uint32_t rid, i;
+
+    while(n--){
+        rid = 0x0b000001 + rand_r(&t->seed) % (t->size > 4 ? t->size - 1 : 3);
+        get_last_seq(rid);
+
+        pthread_mutex_lock(&subsystem->topo.lock);
+        r = find_router(rid);
+        lsa = new_lsa(rid, r->num_ads);
+        lsa->last_update_time = (time_t)INT_MAX;
+        for(i = r->num_ads; i > 0; i--)
+            lsa->ads[lsa->num_ads++] = r->ads[i - 1];
+        pthread_mutex_unlock(&subsystem->topo.lock);
+
+        update_lsu(lsa);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Route aggregation
+ *---------------------------------------------------------------------------*/
+
+static rtableNode* agg_table;
+
+// consecutive /24s, eight at a time behind the same gateway
+static void agg_setup(int size)
+{
+    uint32_t gw;
+    char name[SR_NAMELEN];
+    char* if_name = name;
+    int i;
+
+    for(i = 0; i < size; i++){
+        gw = BENCH_GW_IP(1 + ((i >> 3) & 1));
+        strcpy(name, (i >> 3) & 1 ? "eth2" : "eth1");
+        force_insert_rtable_node(&agg_table, 0x14000000 + (i << 8), 0xffffff00, &gw, &if_name, 1, 0);
+    }
+}
+
+static void agg_teardown(int size) { kill_rtable(&agg_table); }
+
+static void agg_op(struct bench_thread* t, unsigned long n)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    rtableNode* table;
+    uint64_t t0;
+
+    while(n--){
+        t0 = bench_now_ns();
+        pthread_mutex_lock(&subsystem->rtable_lock);
+        table = copy_rtable(agg_table);
+        pthread_mutex_unlock(&subsystem->rtable_lock);
+        t->excluded_ns += bench_now_ns() - t0;
+
+        aggregateRoutes(&table);
+
+        t0 = bench_now_ns();
+        kill_rtable(&table);
+        t->excluded_ns += bench_now_ns() - t0;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Checksum, thread pool and flight recorder
+ *---------------------------------------------------------------------------*/
+
+static void checksum_op(struct bench_thread* t, unsigned long n)
+{
+    uint16_t buf[1500/2];
+    volatile uint16_t sum;
+    int i;
+
+    for(i = 0; i < t->size/2; i++) buf[i] = rand_r(&t->seed);
+    while(n--){
+        sum = checksum(buf, t->size);
+        buf[0]++;
+    }
+    (void)sum;
+}
+
+// all threads record on the same interface
+static void flightrec_op(struct bench_thread* t, unsigned long n)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    struct flightrec_verdict v = { FR_FORWARD, 1, 0x0a000000, 0xffffff00, 0x0a000001 };
+    struct flightrec_entry* e;
+    uint8_t packet[1500];
+    unsigned pos;
+
+    memset(packet, 0, sizeof(packet));
+    while(n--){
+        e = flightrec_begin(&subsystem->flightrec, 0, packet, t->size, &pos);
+        flightrec_end(e, pos, &v);
+    }
+}
+
+// what processPacket() and the output count for a forwarded packet
+static void pktstats_op(struct bench_thread* t, unsigned long n)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+
+    while(n--){
+        pktstats_rx(&subsystem->stats, t->size, FR_FORWARD);
+        pktstats_tx(&subsystem->stats, t->size);
+    }
+}
+
+static void pool_setup(int size)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+
+    // the queue only, without the workers that would process the packets
+    subsystem->poolHead = subsystem->poolTail = NULL;
+}
+
+// every thread takes one job for each it adds, so the queue never runs dry
+static void pool_op(struct bench_thread* t, unsigned long n)
+{
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(&bench_sr);
+    uint8_t packet[1500];
+    struct threadWorker* w;
+
+    memset(packet, 0, t->size);
+    while(n--){
+        addThreadQueue(&bench_sr, packet, t->size, "eth0");
+        w = takeThreadQueue(&subsystem->poolHead, &subsystem->poolTail);
+        if(w){
+            free(w->packet);
+            free(w);
+        }
+    }
+}
+
+static struct bench_case cases[] = {
+    { "lp_match", "lookup", { 10, 1000, 100000, 1000000 },
+      rtable_setup, rtable_teardown, lp_match_op, NULL },
+    { "gw_match", "lookup", { 10, 1000, 100000, 1000000 },
+      rtable_setup, rtable_teardown, gw_match_op, NULL },
+    { "arpLookupTree", "lookup", { 10, 1000, 100000 },
+      arp_setup, arp_teardown, arp_lookup_op, NULL },
+    { "arpInsert", "insert", { 10, 1000, 10000 },
+      NULL, NULL, arp_insert_op, arp_insert_done },
+    { "insert_rtable_node", "insert", { 10, 1000, 10000 },
+      NULL, NULL, rtable_insert_op, rtable_insert_done },
+    { "fill_rtable", "table", { 1000, 100000, 1000000 },
+      rtable_file_setup, rtable_file_teardown, rtable_load_op, NULL },
+    { "snapshot_load", "table", { 1000, 100000, 1000000 },
+      snapshot_setup, snapshot_teardown, snapshot_load_op, NULL },
+    { "rtable_txn_commit", "batch", { 1000, 100000, 1000000 },
+      rtable_setup, rtable_teardown, rtable_txn_op, NULL },
+    { "update_rtable", "SPF run", { 10, 100, 1000 },
+      spf_setup, spf_teardown, spf_op, NULL },
+    { "update_rtable_flap", "SPF run", { 10, 100, 1000 },
+      spf_setup, spf_teardown, spf_flap_op, NULL },
+    { "update_lsu", "LSU", { 10, 1000, 100000 },
+      spf_setup, spf_teardown, lsu_op, NULL },
+    { "aggregateRoutes", "call", { 100, 1000, 10000 },
+      agg_setup, agg_teardown, agg_op, NULL },
+    { "checksum", "call", { 20, 64, 1500 },
+      NULL, NULL, checksum_op, NULL },
+    { "threadPool", "add+take", { 64, 1500 },
+      pool_setup, NULL, pool_op, NULL },
+    { "flightrec", "packet", { 64, 1500 },
+      NULL, NULL, flightrec_op, NULL },
+    { "pktstats", "packet", { 64 },
+      NULL, NULL, pktstats_op, NULL },
+};
+
+#define NUM_CASES (sizeof(cases)/sizeof(cases[0]))
+
+/*-----------------------------------------------------------------------------
+ * Runner
+ *---------------------------------------------------------------------------*/
+
+/* Runs the op in growing batches until the time is up.  Ops that count
+ * themselves (the inserts, which reset their table every size ops) bump
+ * t->ops; for the rest a batch of n counts as n ops.
+ */
+static void* bench_thread_main(void* arg)
+{
+    struct bench_thread* t = (struct bench_thread*)arg;
+    unsigned long batch = 1;
+    uint64_t start, t0, dt, before;
+
+    while(!bench_go);
+
+    start = bench_now_ns();
+    do {
+        before = t->ops;
+        t0 = bench_now_ns();
+        t->c->op(t, batch);
+        dt = bench_now_ns() - t0;
+        if(t->ops == before) t->ops += batch;
+        if(dt < BENCH_BATCH_NS) batch *= 2;
+    } while(bench_now_ns() - start < duration_ns);
+    t->busy_ns = bench_now_ns() - start - t->excluded_ns;
+
+    if(t->c->thread_done) t->c->thread_done(t);
+    return 0;
+}
+
+static void bench_run(struct bench_case* c, int size, int threads, struct bench_result* r)
+{
+    struct bench_thread t[BENCH_MAX_THREADS];
+    uint64_t ops = 0, busy = 0;
+    int i;
+
+    bench_go = 0;
+    memset(t, 0, sizeof(t));
+    for(i = 0; i < threads; i++){
+        t[i].seed = seed + i;
+        t[i].size = size;
+        t[i].c = c;
+        pthread_create(&t[i].thread, NULL, bench_thread_main, &t[i]);
+    }
+    bench_go = 1;
+    for(i = 0; i < threads; i++){
+        pthread_join(t[i].thread, NULL);
+        ops += t[i].ops;
+        busy += t[i].busy_ns;
+    }
+
+    snprintf(r->name, sizeof(r->name), "%s", c->name);
+    r->size = size;
+    r->threads = threads;
+    r->ops = ops;
+    r->ns_op = ops ? (double)busy / ops : 0;
+    r->mops = busy ? ops * 1e3 * threads / busy : 0;
+    r->base_ns_op = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Baseline and output
+ *---------------------------------------------------------------------------*/
+
+static int load_baseline(const char* fname, struct bench_result* base, int max)
+{
+    char line[256];
+    int n = 0;
+    FILE* fp = fopen(fname, "r");
+
+    if(!fp){
+        perror(fname);
+        return -1;
+    }
+    while(n < max && fgets(line, sizeof(line), fp)){
+        struct bench_result* b = &base[n];
+        char* comma = strchr(line, ',');
+        if(!comma || comma - line >= (int)sizeof(b->name)) continue;
+        memcpy(b->name, line, comma - line);
+        b->name[comma - line] = '\0';
+        if(sscanf(comma + 1, "%d,%d,%lu,%lf,%lf", &b->size, &b->threads,
+                  (unsigned long*)&b->ops, &b->ns_op, &b->mops) == 5)
+            n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+static double find_baseline(struct bench_result* base, int nbase, struct bench_result* r)
+{
+    int i;
+    for(i = 0; i < nbase; i++)
+        if(!strcmp(base[i].name, r->name) && base[i].size == r->size &&
+           base[i].threads == r->threads)
+            return base[i].ns_op;
+    return 0;
+}
+
+static void print_result(FILE* out, const char* format, struct bench_result* r, int first,
+                         double threshold, const char* unit)
+{
+    double delta = r->base_ns_op ? (r->ns_op - r->base_ns_op) * 100 / r->base_ns_op : 0;
+
+    if(!strcmp(format, "csv")){
+        if(first) fprintf(out, "name,size,threads,ops,ns_per_op,mops,base_ns_per_op,delta_pct\n");
+        fprintf(out, "%s,%d,%d,%lu,%.2f,%.4f,%.2f,%.1f\n", r->name, r->size, r->threads,
+                (unsigned long)r->ops, r->ns_op, r->mops, r->base_ns_op, delta);
+    }
+    else if(!strcmp(format, "json")){
+        fprintf(out, "%s  {\"name\": \"%s\", \"size\": %d, \"threads\": %d, \"ops\": %lu, "
+                "\"ns_per_op\": %.2f, \"mops\": %.4f", first ? "[\n" : ",\n", r->name, r->size,
+                r->threads, (unsigned long)r->ops, r->ns_op, r->mops);
+        if(r->base_ns_op)
+            fprintf(out, ", \"base_ns_per_op\": %.2f, \"delta_pct\": %.1f", r->base_ns_op, delta);
+        fprintf(out, "}");
+    }
+    else{
+        if(first)
+            fprintf(out, "%-20s %8s %3s %14s %10s %-9s\n", "benchmark", "size", "thr",
+                    "ns/op", "Mops/s", "op");
+        fprintf(out, "%-20s %8d %3d %14.1f %10.4g %-9s", r->name, r->size, r->threads,
+                r->ns_op, r->mops, unit);
+        if(r->base_ns_op)
+            fprintf(out, " %+7.1f%%%s", delta, delta > threshold ? "  REGRESSION" : "");
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-h] [-f table|csv|json] [-t threads,..] [-d ms] [-m max size]\n"
+           "          [-c case] [-o baseline] [-b baseline] [-r percent] [-s seed]\n", argv0);
+    printf("  -f  output format (default table)\n");
+    printf("  -t  thread counts to run each benchmark with (default 1 and all cpus)\n");
+    printf("  -d  time per benchmark in ms (default %lu)\n",
+            (unsigned long)(duration_ns / 1000000));
+    printf("  -m  skip sizes above this (default %d)\n", max_size);
+    printf("  -c  only run benchmarks whose name contains this\n");
+    printf("  -o  save the results to this baseline file (CSV)\n");
+    printf("  -b  compare against this baseline file\n");
+    printf("  -r  flag results this many percent slower than the baseline (default 10)\n");
+    printf("  -s  random seed (default 1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* format = "table";
+    char *save = NULL, *baseline = NULL, *filter = NULL;
+    int thread_counts[8], num_thread_counts = 0;
+    static struct bench_result results[BENCH_MAX_RESULTS], base[BENCH_MAX_RESULTS];
+    int nresults = 0, nbase = 0, regressions = 0;
+    double threshold = 10;
+    unsigned int i, j, k;
+    FILE* out;
+    int c;
+
+    while((c = getopt(argc, argv, "hf:t:d:m:c:o:b:r:s:")) != EOF){
+        switch(c){
+            case 'h': usage(argv[0]); return 0;
+            case 'f': format = optarg; break;
+            case 't': {
+                char* tok;
+                for(tok = strtok(optarg, ","); tok && num_thread_counts < 8; tok = strtok(NULL, ","))
+                    thread_counts[num_thread_counts++] = atoi(tok);
+                break;
+            }
+            case 'd': duration_ns = strtoull(optarg, NULL, 10) * 1000000ULL; break;
+            case 'm': max_size = atoi(optarg); break;
+            case 'c': filter = optarg; break;
+            case 'o': save = optarg; break;
+            case 'b': baseline = optarg; break;
+            case 'r': threshold = atof(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(strcmp(format, "table") && strcmp(format, "csv") && strcmp(format, "json")){
+        usage(argv[0]);
+        return 1;
+    }
+    if(num_thread_counts == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_counts[num_thread_counts++] = 1;
+        if(cpus > 1) thread_counts[num_thread_counts++] = cpus;
+    }
+    for(i = 0; i < (unsigned)num_thread_counts; i++){
+        if(thread_counts[i] < 1 || thread_counts[i] > BENCH_MAX_THREADS){
+            fprintf(stderr, "thread counts must be between 1 and %d\n", BENCH_MAX_THREADS);
+            return 1;
+        }
+    }
+    if(baseline && (nbase = load_baseline(baseline, base, BENCH_MAX_RESULTS)) < 0)
+        return 1;
+
+    // the router chats on stdout; keep that off the report
+    out = fdopen(dup(fileno(stdout)), "w");
+    if(!freopen("/dev/null", "w", stdout)){
+        perror("freopen");
+        return 1;
+    }
+
+    bench_init_router(seed);
+
+    for(i = 0; i < NUM_CASES; i++){
+        struct bench_case* bc = &cases[i];
+        if(filter && !strstr(bc->name, filter)) continue;
+
+        for(j = 0; j < BENCH_MAX_SIZES && bc->sizes[j]; j++){
+            int size = bc->sizes[j];
+            if(size > max_size) continue;
+
+            srand(seed);
+            if(bc->setup) bc->setup(size);
+            for(k = 0; k < (unsigned)num_thread_counts && nresults < BENCH_MAX_RESULTS; k++){
+                struct bench_result* r = &results[nresults];
+                bench_run(bc, size, thread_counts[k], r);
+                r->base_ns_op = find_baseline(base, nbase, r);
+                if(r->base_ns_op && (r->ns_op - r->base_ns_op) * 100 / r->base_ns_op > threshold)
+                    regressions++;
+                print_result(out, format, r, nresults == 0, threshold, bc->unit);
+                nresults++;
+            }
+            if(bc->teardown) bc->teardown(size);
+        }
+    }
+    if(!strcmp(format, "json")) fprintf(out, nresults ? "\n]\n" : "[]\n");
+
+    if(save){
+        FILE* fp = fopen(save, "w");
+        if(!fp){
+            perror(save);
+            return 1;
+        }
+        fprintf(fp, "name,size,threads,ops,ns_per_op,mops\n");
+        for(i = 0; i < (unsigned)nresults; i++)
+            fprintf(fp, "%s,%d,%d,%lu,%.2f,%.4f\n", results[i].name, results[i].size,
+                    results[i].threads, (unsigned long)results[i].ops, results[i].ns_op,
+                    results[i].mops);
+        fclose(fp);
+    }
+
+    if(regressions){
+        fprintf(out, "%d result(s) more than %.0f%% slower than %s\n", regressions,
+                threshold, baseline);
+        fflush(out);
+        return 2;
+    }
+    fflush(out);
+    return 0;
+}
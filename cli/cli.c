@@ -14,6 +14,7 @@
 #include "../router.h"		/* interface enable/disable cli functions */
 #include "../routingTable.h" /* routing table functions */
 #include "../arpCache.h"	/* arp cache functions */
+#include "../sr_dumper.h"    /* capture stats */
 #include <time.h>
 
 /* temporary */
@@ -260,7 +261,7 @@ void cli_show_ip_arp() {
     char buf[128];
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-    pthread_mutex_lock(&list_lock);
+    pthread_mutex_lock(&subsystem->list_lock);
     struct arpCacheNode *node = subsystem->arpList;
     uint8_t ip_str[4];
 
@@ -274,7 +275,7 @@ void cli_show_ip_arp() {
 		node = node->next;
 	    cli_send_str( buf );
 	}
-    pthread_mutex_unlock(&list_lock);
+    pthread_mutex_unlock(&subsystem->list_lock);
 	cli_send_end();
 }
 
@@ -304,33 +305,49 @@ void cli_show_ip_intf() {
 }
 
 void cli_show_ip_route() {
-    char buf[128];
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-    rtableNode *node = subsystem->rtable;
+    rtableNode *node;
     uint8_t ip[4], gw[4], nm[4];
+    char *text = NULL;
+    size_t size = 0;
+    FILE *f;
     int i;
     
-    cli_send_str("\nRouting table:\n");
-    while(node != NULL) {
+    // the groups and routes may be freed once rtable_lock is let go, so the
+    // rows are written out under it and only sent to the client after
+    if( (f = open_memstream(&text, &size)) == NULL ) {
+        cli_send_str("Error: out of memory\n");
+        cli_send_end();
+        return;
+    }
+    // Pkts are counted per next hop group, routes with the same next hops add up
+    fprintf(f, "\nRouting table:\n");
+    pthread_mutex_lock(&subsystem->rtable_lock);
+    for(node = subsystem->rtable; node != NULL; node = node->next) {
+		struct nexthopGroup *g = nh_group(node->nh);
+		if(g->out_cnt == 0) continue;
 		int2byteIP(node->ip, ip);
-		int2byteIP(node->gateway[0], gw);
+		int2byteIP(g->hop[0].gateway, gw);
 		int2byteIP(node->netmask, nm);
-		sprintf(buf, "IP:%d.%d.%d.%d  Netmask:%d.%d.%d.%d  Gateway:%d.%d.%d.%d  IF:%s Static:%d\n", 
+		fprintf(f, "IP:%d.%d.%d.%d  Netmask:%d.%d.%d.%d  Gateway:%d.%d.%d.%d  IF:%s Static:%d NH:%u Pkts:%lu%s\n", 
 			    ip[0], ip[1], ip[2], ip[3],
 			    nm[0], nm[1], nm[2], nm[3],
 			    gw[0], gw[1], gw[2], gw[3],
-			    node->output_if[0], node->is_static);
-	    cli_send_str( buf );
-	    for( i = 1; i < node->out_cnt; i++){
-			int2byteIP(node->gateway[i], gw);
-			sprintf(buf, "-- Multipath: \t\t\t\t Gateway:%u.%u.%u.%u  IF:%s\n", 
+			    g->hop[0].output_if, node->is_static, node->nh, g->hop[0].hits, (g->down & 1) ? " Down" : "");
+	    for( i = 1; i < g->out_cnt; i++){
+			int2byteIP(g->hop[i].gateway, gw);
+			fprintf(f, "-- Multipath: \t\t\t\t Gateway:%u.%u.%u.%u  IF:%s Pkts:%lu%s\n", 
 				    gw[0], gw[1], gw[2], gw[3],
-				    node->output_if[i]);
-		    cli_send_str( buf );	    
+				    g->hop[i].output_if, g->hop[i].hits,
+				    (i < 32 && (g->down & (1u << i))) ? " Down" : "");
 	    }
-		node = node->next;
     }
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+    fclose(f);
+
+    cli_send_str(text);
+    free(text);
 	cli_send_end();
 }
 
@@ -351,6 +368,9 @@ void cli_show_ospf() {
 
     cli_send_str( "\nTopology:\n" );
     cli_show_ospf_topo();
+
+    cli_send_str( "\nThrottling:\n" );
+    cli_show_ospf_stats();
 }
 
 void cli_show_ospf_neighbors() {
@@ -392,35 +412,243 @@ void cli_show_ospf_neighbors() {
 }
 
 void cli_show_ospf_topo() {
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(SR);
     char buf[128];
 	topo_router *rnode;
 		
     uint8_t ip[4];
 
-	pthread_mutex_lock(&topo_lock);
-	rnode = topo_head;
+	pthread_mutex_lock(&subsystem->topo.lock);
+	rnode = subsystem->topo.head;
 	
 	while(rnode){
 		sprintf(buf, "RouterID:%x, last seq_num:%u, links:\n", rnode->router_id, rnode->last_seq);
 		cli_send_str(buf);
 		
-		lsu_ad *lnode = rnode->ads;
-		while(lnode){
+		uint32_t i;
+		for(i = 0; i < rnode->num_ads; i++){
+			lsu_ad *lnode = &rnode->ads[i];
 			int2byteIP(lnode->subnet, ip);
 			sprintf(buf, "\tRouterID:%x, subnet:%u.%u.%u.%u\n", lnode->router_id, ip[0], ip[1], ip[2], ip[3]);
 			cli_send_str(buf);
-			lnode = lnode->next;
 		}
 	
 		rnode = rnode->next;
 	}
 	cli_send_end();
 
-	pthread_mutex_unlock(&topo_lock);
+	pthread_mutex_unlock(&subsystem->topo.lock);
 
 //    cli_send_str( "not yet implemented: show PWOSPF topology of SR (e.g., for each router, show its ID, last pwospf seq #, and a list of all its links (e.g., router ID + subnet))\n" );
 }
 
+void cli_show_ospf_stats() {
+    char buf[128];
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_throttle* th = &subsystem->pwospf.throttle;
+
+	pthread_mutex_lock(&th->lock);
+	sprintf(buf, "SPF: %lu triggered, %lu coalesced, %lu runs, hold %d ms%s\n",
+			th->spf_triggers, th->spf_coalesced, th->spf_runs, th->spf_hold,
+			th->spf_pending ? " (run pending)" : "");
+	cli_send_str(buf);
+	sprintf(buf, "LSU: %lu triggered, %lu coalesced, %lu sent (%lu rebuilt)%s\n",
+			th->lsu_triggers, th->lsu_coalesced, th->lsu_sent, th->lsu_rebuilt,
+			th->lsu_pending ? " (update pending)" : "");
+	cli_send_str(buf);
+	pthread_mutex_unlock(&th->lock);
+	cli_send_end();
+}
+
+// one line about a flight recorder entry, buf has CAPTURE_LINE bytes
+#define CAPTURE_LINE 256
+static void capture_line( char* buf, const struct flightrec_entry* e, const char* out_if ) {
+    char src[STRLEN_IP], dst[STRLEN_IP], when[16], what[96], route[64];
+    time_t sec = e->sec;
+    const uint8_t* p = e->hdr;
+
+    strftime( when, sizeof(when), "%H:%M:%S", localtime(&sec) );
+
+    if( e->caplen >= ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH && p[12] == 8 && p[13] == 0 ) {
+        ip_to_string( src, *(uint32_t*)&p[26] );
+        ip_to_string( dst, *(uint32_t*)&p[30] );
+        snprintf( what, sizeof(what), "%s > %s proto %u ttl %u len %u",
+                  src, dst, p[23], p[22], e->len );
+    }
+    else if( e->caplen >= ETHERNET_HEADER_LENGTH + 28 && p[12] == 8 && p[13] == 6 ) {
+        ip_to_string( src, *(uint32_t*)&p[28] );
+        ip_to_string( dst, *(uint32_t*)&p[38] );
+        if( p[21] == 1 )
+            snprintf( what, sizeof(what), "arp who-has %s tell %s", dst, src );
+        else
+            snprintf( what, sizeof(what), "arp %s is-at %s", src, quick_mac_to_string( (uint8_t*)&p[22] ) );
+    }
+    else if( e->caplen >= ETHERNET_HEADER_LENGTH )
+        snprintf( what, sizeof(what), "type 0x%02x%02x len %u", p[12], p[13], e->len );
+    else
+        snprintf( what, sizeof(what), "len %u", e->len );
+
+    // the next hop is only set once a route was found
+    route[0] = 0;
+    if( e->nexthop != 0 ) {
+        ip_to_string( src, htonl(e->route) );
+        ip_to_string( dst, htonl(e->nexthop) );
+        snprintf( route, sizeof(route), " %s/%d via %s", src, __builtin_popcount(e->mask), dst );
+    }
+
+    snprintf( buf, CAPTURE_LINE, "  %s.%03u %s: %s%s%s%s\n", when, e->nsec / 1000000, what,
+              flightrec_verdict_name(e->verdict), route, out_if ? " " : "", out_if ? out_if : "" );
+}
+
+// the latest max entries of interface i
+static void capture_show_intf( struct sr_router* subsystem, int i, int max ) {
+    struct flightrec_entry* e;
+    char buf[CAPTURE_LINE];
+    char name[SR_NAMELEN], out[SR_NAMELEN];
+    int n, j;
+
+    if( (e = (struct flightrec_entry*)malloc(max * sizeof(struct flightrec_entry))) == NULL )
+        return;
+    n = flightrec_read( &subsystem->flightrec, i, e, max );
+
+    pthread_rwlock_rdlock( &subsystem->if_lock );
+    strncpy( name, subsystem->ifaces[i].name, SR_NAMELEN );
+    name[SR_NAMELEN-1] = 0;
+    pthread_rwlock_unlock( &subsystem->if_lock );
+    snprintf( buf, sizeof(buf), "%s: last %d packets\n", name, n );
+    cli_send_str( buf );
+
+    for( j = 0; j < n; j++ ) {
+        out[0] = 0;
+        pthread_rwlock_rdlock( &subsystem->if_lock );
+        if( e[j].out_if >= 0 && e[j].out_if < subsystem->num_ifaces )
+            strncpy( out, subsystem->ifaces[(int)e[j].out_if].name, SR_NAMELEN );
+        out[SR_NAMELEN-1] = 0;
+        pthread_rwlock_unlock( &subsystem->if_lock );
+        capture_line( buf, &e[j], out[0] ? out : NULL );
+        cli_send_str( buf );
+    }
+    free( e );
+}
+
+void cli_show_capture() {
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    int i;
+
+    for( i = 0; i < subsystem->num_ifaces && i < FLIGHTREC_IFACES; i++ )
+        capture_show_intf( subsystem, i, FLIGHTREC_SHOW );
+    cli_send_end();
+}
+
+void cli_show_capture_intf( gross_intf_t* data ) {
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    int i;
+
+    pthread_rwlock_rdlock( &subsystem->if_lock );
+    for( i = 0; i < subsystem->num_ifaces; i++ )
+        if( !strcmp(subsystem->ifaces[i].name, data->intf_name) )
+            break;
+    pthread_rwlock_unlock( &subsystem->if_lock );
+
+    if( i >= subsystem->num_ifaces )
+        cli_send_strs( 3, "Error: no interface named ", data->intf_name, "\n" );
+    else if( i >= FLIGHTREC_IFACES )
+        cli_send_strs( 3, "Error: ", data->intf_name, " is not recorded\n" );
+    else
+        capture_show_intf( subsystem, i, FLIGHTREC_DEPTH );
+    cli_send_end();
+}
+
+// one counter: its total and rate over secs
+static void stats_line( const char* label, uint64_t cur, uint64_t prev, double secs ) {
+    char buf[128];
+
+    snprintf( buf, sizeof(buf), "  %-26.26s %14llu %14.1f/s\n", label,
+              (unsigned long long)cur, secs > 0 ? (cur - prev) / secs : 0.0 );
+    cli_send_str( buf );
+}
+
+void cli_show_stats() {
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(SR);
+    struct pktstats_sample cur, prev;
+    double secs;
+    char buf[128], label[32];
+    int v;
+
+    pktstats_sample( &subsystem->stats, &cur, &prev );
+    secs = pktstats_seconds( &prev, &cur );
+    snprintf( buf, sizeof(buf), "Packet counters of %d threads, rates over the last %.1f s:\n",
+              cur.threads, secs );
+    cli_send_str( buf );
+
+    stats_line( "received", cur.c[PS_RX], prev.c[PS_RX], secs );
+    stats_line( "received bytes", cur.c[PS_RX_BYTES], prev.c[PS_RX_BYTES], secs );
+    stats_line( "sent", cur.c[PS_TX], prev.c[PS_TX], secs );
+    stats_line( "sent bytes", cur.c[PS_TX_BYTES], prev.c[PS_TX_BYTES], secs );
+    stats_line( "forwarded", pktstats_forwarded(&cur), pktstats_forwarded(&prev), secs );
+    stats_line( "  of them queued for ARP", cur.c[PS_VERDICT + FR_ARP_WAIT], prev.c[PS_VERDICT + FR_ARP_WAIT], secs );
+    stats_line( "local", cur.c[PS_VERDICT + FR_LOCAL], prev.c[PS_VERDICT + FR_LOCAL], secs );
+    stats_line( "arp", cur.c[PS_VERDICT + FR_ARP], prev.c[PS_VERDICT + FR_ARP], secs );
+    stats_line( "ignored", cur.c[PS_VERDICT + FR_IGNORED], prev.c[PS_VERDICT + FR_IGNORED], secs );
+    stats_line( "dropped", pktstats_dropped(&cur), pktstats_dropped(&prev), secs );
+    for( v = 0; v < FR_VERDICTS; v++ )
+        if( FR_IS_DROP(v) ) {
+            // "drop: ttl" -> "  ttl"
+            snprintf( label, sizeof(label), "  %s", flightrec_verdict_name(v) + 6 );
+            stats_line( label, cur.c[PS_VERDICT + v], prev.c[PS_VERDICT + v], secs );
+        }
+    stats_line( "  arp timeout", cur.c[PS_ARP_TIMEOUT], prev.c[PS_ARP_TIMEOUT], secs );
+    stats_line( "ICMP sent", cur.c[PS_ICMP_SENT], prev.c[PS_ICMP_SENT], secs );
+    stats_line( "ARP requests sent", cur.c[PS_ARP_REQUESTS], prev.c[PS_ARP_REQUESTS], secs );
+    stats_line( "ARP queue: queued", cur.c[PS_ARP_QUEUED], prev.c[PS_ARP_QUEUED], secs );
+    stats_line( "  resolved", cur.c[PS_ARP_RESOLVED], prev.c[PS_ARP_RESOLVED], secs );
+    stats_line( "  timed out", cur.c[PS_ARP_TIMEOUT], prev.c[PS_ARP_TIMEOUT], secs );
+    cli_send_end();
+}
+
+// one "name": value per counter, then forwarded and dropped: the totals, or the rates over secs
+static void stats_json_counters( const struct pktstats_sample* cur, const struct pktstats_sample* prev, double secs, int rates ) {
+    char buf[96];
+    int i;
+
+    for( i = 0; i < PS_COUNTERS; i++ ) {
+        if( pktstats_name(i) == NULL ) continue;
+        if( rates )
+            snprintf( buf, sizeof(buf), "\"%s\": %.3f, ", pktstats_name(i), secs > 0 ? (cur->c[i] - prev->c[i]) / secs : 0.0 );
+        else
+            snprintf( buf, sizeof(buf), "\"%s\": %llu, ", pktstats_name(i), (unsigned long long)cur->c[i] );
+        cli_send_str( buf );
+    }
+    if( rates )
+        snprintf( buf, sizeof(buf), "\"forwarded\": %.3f, \"dropped\": %.3f",
+                  secs > 0 ? (pktstats_forwarded(cur) - pktstats_forwarded(prev)) / secs : 0.0,
+                  secs > 0 ? (pktstats_dropped(cur) - pktstats_dropped(prev)) / secs : 0.0 );
+    else
+        snprintf( buf, sizeof(buf), "\"forwarded\": %llu, \"dropped\": %llu",
+                  (unsigned long long)pktstats_forwarded(cur), (unsigned long long)pktstats_dropped(cur) );
+    cli_send_str( buf );
+}
+
+void cli_show_stats_json() {
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(SR);
+    struct pktstats_sample cur, prev;
+    double secs;
+    char buf[96];
+
+    pktstats_sample( &subsystem->stats, &cur, &prev );
+    secs = pktstats_seconds( &prev, &cur );
+    snprintf( buf, sizeof(buf), "{\"threads\": %d, \"interval\": %.3f, \"counters\": {", cur.threads, secs );
+    cli_send_str( buf );
+    stats_json_counters( &cur, &prev, secs, 0 );
+    cli_send_str( "}, \"rates\": {" );
+    stats_json_counters( &cur, &prev, secs, 1 );
+    cli_send_str( "}}\n" );
+    cli_send_end();
+}
+
 #ifndef _VNS_MODE_
 void cli_send_no_vns_str() {
 #ifdef _CPUMODE_
@@ -439,6 +667,7 @@ void cli_show_vns() {
     cli_show_vns_user();
     cli_send_str( "  Virtual Host: " );
     cli_show_vns_vhost();
+    cli_show_vns_sendq();
 }
 
 void cli_show_vns_lhost() {
@@ -459,6 +688,29 @@ void cli_show_vns_user() {
 void cli_show_vns_vhost() {
     cli_send_strln( SR->vhost );
 }
+
+void cli_show_vns_sendq() {
+    char buf[128];
+    unsigned long sent, dropped, writes;
+
+    sr_vns_send_stats( SR, &sent, &dropped, &writes );
+    snprintf( buf, 128, "  Send queue: %lu sent, %lu dropped, %lu writes\n",
+              sent, dropped, writes );
+    cli_send_str( buf );
+    cli_show_vns_capture();
+}
+
+void cli_show_vns_capture() {
+    char buf[160];
+    struct sr_capture_stats st;
+
+    if( !SR->capture )
+        return;
+    sr_capture_get_stats( SR->capture, &st );
+    snprintf( buf, 160, "  Capture: %lu captured, %lu filtered out, %lu dropped, %lu writes, %lu files\n",
+              st.captured, st.filtered, st.dropped, st.writes, st.files );
+    cli_send_str( buf );
+}
 #endif
 
 void cli_manip_ip_arp_add( gross_arp_t* data ) {
@@ -638,6 +890,47 @@ void cli_manip_ip_route_del( gross_route_t* data ) {
 	update_rtable();
 }
 
+void cli_manip_ip_route_batch( gross_file_t* data ) {
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(SR);
+    struct rtableTxn t;
+    char buf[128];
+    long long start = pwospfTime();
+    int i, cnt, changes, bad_line;
+
+    rtable_txn_begin( &t, 1 );
+    cnt = read_rtable_file( data->name, &t.ops, 0, &bad_line );
+    if( cnt == RTABLE_FILE_OPEN ) {
+        cli_send_strs( 3, "Error: cannot read ", data->name, ".\n" );
+        rtable_txn_abort( &t );
+        cli_send_end();
+        return;
+    }
+    if( cnt < 0 ) {
+        snprintf( buf, sizeof(buf), ":%d: %s, no route has been added.\n", bad_line,
+                  cnt == RTABLE_FILE_NAME ? "interface name too long" : "not a route" );
+        cli_send_strs( 3, "Error: ", data->name, buf );
+        rtable_txn_abort( &t );
+        cli_send_end();
+        return;
+    }
+    // all of them or none
+    for( i = 0; i < t.ops.names; i++ ) {
+        if( !router_lookup_interface_via_name( SR, t.ops.name[i] ) ) {
+            cli_send_strs( 3, "Error: no interface with the name ",
+                           t.ops.name[i], " exists, no route has been added.\n" );
+            rtable_txn_abort( &t );
+            cli_send_end();
+            return;
+        }
+    }
+    changes = rtable_txn_commit( &(subsystem->rtable), &t );
+    snprintf( buf, sizeof(buf), "%d routes from %s have been added, %d changes in %lld ms.\n",
+              cnt, data->name, changes, pwospfTime() - start );
+    cli_send_str( buf );
+	cli_send_end();
+	update_rtable();
+}
+
 void cli_manip_ip_route_purge_all() {
     rtable_purge_all( SR );
     cli_send_str( "All routes have been removed from the routing table.\n" );
@@ -725,11 +1018,11 @@ static void cli_send_ping( int client_fd, uint32_t ip ) {
 	strcpy(node->interface, out_if);
 	node->isTraceroute = 0;
 	
-	pthread_mutex_lock(&ping_lock);
-		node->next = pingListHead;	
-		pingListHead = node;
+	pthread_mutex_lock(&subsystem->ping_lock);
+		node->next = subsystem->pingListHead;	
+		subsystem->pingListHead = node;
 		sendICMPEchoRequest(out_if, ip, identifier, seqNum, &node->time, 64);
-	pthread_mutex_unlock(&ping_lock);
+	pthread_mutex_unlock(&subsystem->ping_lock);
 
 	uint8_t ipStr[4];
 	int2byteIP(ip, ipStr);
@@ -766,6 +1059,9 @@ void cli_shutdown() {
     cli_send_str( "Shutting down the router ...\n" );
     router_shutdown = 1;
 
+    /* so the next start forwards right away */
+    snapshot_save( SNAPSHOT_FILE );
+
     /* we could do a cleaner shutdown, but this is probably fine */
     exit(0);
 }
@@ -803,11 +1099,11 @@ void cli_traceroute( gross_ip_t* data ) {
 	sprintf(buf, "Traceroute to %u.%u.%u.%u\n", ipStr[0], ipStr[1], ipStr[2], ipStr[3]);
 	writenf(fd, buf);
 
-	pthread_mutex_lock(&ping_lock);
-		node->next = pingListHead;	
-		pingListHead = node;
+	pthread_mutex_lock(&subsystem->ping_lock);
+		node->next = subsystem->pingListHead;	
+		subsystem->pingListHead = node;
 		sendICMPEchoRequest(out_if, ip, identifier, seqNum, &node->time, 4);
-	pthread_mutex_unlock(&ping_lock);
+	pthread_mutex_unlock(&subsystem->ping_lock);
 
 	free(out_if);
     
@@ -1324,6 +1620,120 @@ void cli_adv_get_agg(){
 	cli_send_end();
 }
 
+void cli_adv_show_bfd(){
+	char buf[128];
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_echo* ec = &subsystem->pwospf.echo;
+	long long now = pwospfTime();
+	uint8_t ip[4];
+
+	pthread_mutex_lock(&ec->lock);
+	if(ec->interval > 0)
+		sprintf(buf, "Liveness echo is ON: every %d ms, neighbor down after %d missed (%d ms)\n",
+				ec->interval, ec->mult, ec->interval * ec->mult);
+	else
+		sprintf(buf, "Liveness echo is OFF\n");
+	cli_send_str(buf);
+	sprintf(buf, "%lu echoes sent, %lu back, %lu neighbors taken down\n", ec->sent, ec->received, ec->downs);
+	cli_send_str(buf);
+	pthread_mutex_unlock(&ec->lock);
+
+	pthread_rwlock_rdlock(&subsystem->if_lock);
+	struct pwospf_if *pw_if;
+	for(pw_if = subsystem->pwospf.if_list; pw_if; pw_if = pw_if->next){
+		char* if_name = getIfName(pw_if->ip);
+		if(if_name == NULL) continue;
+		pthread_mutex_lock(&pw_if->neighbor_lock);
+		struct pwospf_neighbor *node;
+		for(node = pw_if->neighbor_list; node; node = node->next){
+			if(node->id == 0) continue;
+			int2byteIP(node->ip, ip);
+			if(node->echoUp)
+				sprintf(buf, "%s: %u.%u.%u.%u up, last echo %lld ms ago\n", if_name,
+						ip[0], ip[1], ip[2], ip[3], now - node->echoLast);
+			else
+				sprintf(buf, "%s: %u.%u.%u.%u waiting for the first echo\n", if_name,
+						ip[0], ip[1], ip[2], ip[3]);
+			cli_send_str(buf);
+		}
+		pthread_mutex_unlock(&pw_if->neighbor_lock);
+	}
+	pthread_rwlock_unlock(&subsystem->if_lock);
+	cli_send_end();
+}
+
+void cli_adv_set_bfd( gross_option_t* data ){
+	if(data->on) setEcho(ECHO_INTERVAL, ECHO_MULT);
+	else setEcho(0, ECHO_MULT);
+	cli_adv_show_bfd();
+}
+
+void cli_adv_set_bfd_timers( gross_echo_t* data ){
+	if(data->interval <= 0 || data->mult <= 0){
+		cli_send_str("Interval and multiplier must be positive\n");
+		cli_send_end();
+		return;
+	}
+	setEcho(data->interval, data->mult);
+	cli_adv_show_bfd();
+}
+
+void cli_adv_snapshot(){
+	char buf[128];
+	long long start = pwospfTime();
+	long len = snapshot_save(SNAPSHOT_FILE);
+
+	if(len < 0)
+		snprintf(buf, sizeof(buf), "Could not write %s\n", SNAPSHOT_FILE);
+	else
+		snprintf(buf, sizeof(buf), "Saved %s, %ld bytes, in %lld ms\n", SNAPSHOT_FILE, len, pwospfTime() - start);
+	cli_send_str(buf);
+	cli_send_end();
+}
+
+void cli_adv_capture( gross_file_t* data ){
+	char buf[160];
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	long n = flightrec_dump(&subsystem->flightrec, data->name);
+
+	if(n < 0)
+		snprintf(buf, sizeof(buf), "Could not write %s\n", data->name);
+	else
+		snprintf(buf, sizeof(buf), "Wrote %ld packets to %s\n", n, data->name);
+	cli_send_str(buf);
+	cli_send_end();
+}
+
+void cli_adv_show_log(){
+	char buf[160];
+	unsigned long written, dropped, suppressed;
+
+	log_stats(&written, &dropped, &suppressed);
+	snprintf(buf, sizeof(buf), "Log level is %s (up to %s compiled in)\n",
+			log_level_name(log_level), log_level_name(LOG_MAX_LEVEL));
+	cli_send_str(buf);
+	snprintf(buf, sizeof(buf), "%lu messages written, %lu dropped (ring full), %lu suppressed (rate limit)\n",
+			written, dropped, suppressed);
+	cli_send_str(buf);
+	cli_send_end();
+}
+
+void cli_adv_set_log( gross_level_t* data ){
+	int level = log_level_from_name(data->name);
+
+	if(level < 0){
+		cli_send_strs(3, "Error: ", data->name, " is not a log level (error, warn, info or debug)\n");
+		cli_send_end();
+		return;
+	}
+	if(level > LOG_MAX_LEVEL)
+		cli_send_strs(3, "Warning: ", log_level_name(level), " messages are not compiled in, see LOG_LEVEL in the Makefile\n");
+	log_level = level;
+	cli_adv_show_log();
+}
+
 void cli_send_end(){
 	if(is_bot)
 		cli_send_str("TheEnd!\n");
@@ -56,6 +56,19 @@ typedef struct {
     int on;
 } gross_option_t;
 
+typedef struct {
+    int interval;
+    int mult;
+} gross_echo_t;
+
+typedef struct {
+    const char* name;
+} gross_file_t;
+
+typedef struct {
+    const char* name;
+} gross_level_t;
+
 /** flag indicating if the CLI user is a human or a bot */
 int is_bot;
 
@@ -121,6 +134,11 @@ void cli_show_opt_verbose();
 void cli_show_ospf();
 void cli_show_ospf_neighbors();
 void cli_show_ospf_topo();
+void cli_show_ospf_stats();
+void cli_show_capture();
+void cli_show_capture_intf( gross_intf_t* data );
+void cli_show_stats();
+void cli_show_stats_json();
 
 #ifndef _VNS_MODE_
     void cli_send_no_vns_str();
@@ -129,12 +147,16 @@ void cli_show_ospf_topo();
 #   define cli_show_vns_topo   cli_send_no_vns_str
 #   define cli_show_vns_user   cli_send_no_vns_str
 #   define cli_show_vns_vhost  cli_send_no_vns_str
+#   define cli_show_vns_sendq  cli_send_no_vns_str
+#   define cli_show_vns_capture cli_send_no_vns_str
 #else
     void cli_show_vns();
     void cli_show_vns_lhost();
     void cli_show_vns_topo();
     void cli_show_vns_user();
     void cli_show_vns_vhost();
+    void cli_show_vns_sendq();
+    void cli_show_vns_capture();
 #endif
 
 void cli_manip_ip_arp_add( gross_arp_t* data );
@@ -152,6 +174,7 @@ void cli_manip_ip_ospf_up();
 
 void cli_manip_ip_route_add( gross_route_t* data );
 void cli_manip_ip_route_del( gross_route_t* data );
+void cli_manip_ip_route_batch( gross_file_t* data );
 void cli_manip_ip_route_purge_all();
 void cli_manip_ip_route_purge_dyn();
 void cli_manip_ip_route_purge_sta();
@@ -166,6 +189,13 @@ void cli_manip_ip_route_addm( gross_route_t* data );
 void cli_manip_ip_route_addf( gross_route_t* data );
 void cli_adv_set_bot( gross_option_t* data );
 void cli_adv_set_agg( gross_option_t* data );
+void cli_adv_show_bfd();
+void cli_adv_set_bfd( gross_option_t* data );
+void cli_adv_set_bfd_timers( gross_echo_t* data );
+void cli_adv_snapshot();
+void cli_adv_show_log();
+void cli_adv_capture( gross_file_t* data );
+void cli_adv_set_log( gross_level_t* data );
 void cli_adv_get_agg();
 void cli_send_end();
 
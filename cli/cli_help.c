@@ -40,13 +40,15 @@ HELP_ACTION );
 
         case HELP_SHOW:
             return cli_send_multi_help( fd, "\
-show [hw | ip | opt | ospf | vns]: display information about the router's current state\n",
-5,
+show [hw | ip | opt | ospf | vns | capture | stats]: display information about the router's current state\n",
+7,
 HELP_SHOW_HW,
 HELP_SHOW_IP,
 HELP_SHOW_OPT,
 HELP_SHOW_OSPF,
-HELP_SHOW_VNS );
+HELP_SHOW_VNS,
+HELP_SHOW_CAPTURE,
+HELP_SHOW_STATS );
 
           case HELP_SHOW_HW:
               return cli_send_multi_help( fd, "\
@@ -107,10 +109,11 @@ show opt verbose: displays whether this session has verbose mode enabled\n" );
 
           case HELP_SHOW_OSPF:
               return cli_send_multi_help( fd, "\
-show ospf [neigh | topo]: display information about OSPF state\n",
-2,
+show ospf [neigh | topo | stats]: display information about OSPF state\n",
+3,
 HELP_SHOW_OSPF_NEIGHBORS,
-HELP_SHOW_OSPF_TOPOLOGY );
+HELP_SHOW_OSPF_TOPOLOGY,
+HELP_SHOW_OSPF_STATS );
 
             case HELP_SHOW_OSPF_NEIGHBORS:
                 return 0==writenstr( fd, "\
@@ -120,6 +123,10 @@ show ospf neigh: displays information about each interface's neighbors\n" );
                 return 0==writenstr( fd, "\
 show ospf topo: displays the current dynamically computed network topology\n" );
 
+            case HELP_SHOW_OSPF_STATS:
+                return 0==writenstr( fd, "\
+show ospf stats: displays how many SPF runs and LSUs were triggered, coalesced and done\n" );
+
           case HELP_SHOW_VNS:
               return cli_send_multi_help( fd, "\
 show vns [lhost, topo[logy], user, vhost]: display information about \n\
@@ -146,6 +153,16 @@ show vns user: displays the VNS user name\n" );
                 return 0==writenstr( fd, "\
 show vns vhost: displays the VNS virtual host address\n" );
 
+          case HELP_SHOW_CAPTURE:
+              return 0==writenstr( fd, "\
+show capture [interface]: displays the last packets received on each interface (or all\n\
+  those kept of one) and what the router did with them\n" );
+
+          case HELP_SHOW_STATS:
+              return 0==writenstr( fd, "\
+show stats [json]: displays the software packet counters (received, sent, forwarded, dropped\n\
+  and why, ICMP and ARP queue) and their rates since they were last shown, as text or JSON\n" );
+
 
         case HELP_MANIP:
             /* fall-through to HELP_MANIP_IP */
@@ -229,10 +246,11 @@ ip ospf <enable|up>: enable the dynamic OSPF routing protocol\n" );
 
            case HELP_MANIP_IP_ROUTE:
                return cli_send_multi_help( fd, "\
-ip route {add | del | purge} [<options>]: modify the routing table\n",
-3,
+ip route {add | del | batch | purge} [<options>]: modify the routing table\n",
+4,
 HELP_MANIP_IP_ROUTE_ADD,
 HELP_MANIP_IP_ROUTE_DEL,
+HELP_MANIP_IP_ROUTE_BATCH,
 HELP_MANIP_IP_ROUTE_PURGE_ALL );
 
              case HELP_MANIP_IP_ROUTE_ADD:
@@ -245,6 +263,12 @@ ip route add <dest IP> <gateway IP> <mask IP> <interface name>: add a static rou
                  return 0==writenstr( fd, "\
 ip route del <dest IP> <mask IP>: remove a static route to <dest IP> with subnet mask <mask IP>\n" );
 
+             case HELP_MANIP_IP_ROUTE_BATCH:
+                 return 0==writenstr( fd, "\
+ip route batch <file>: add the static routes listed in <file>, one per line in\n\
+  the format of the rtable file, all at once (put the name in quotes if it\n\
+  has dots or slashes in it)\n" );
+
              case HELP_MANIP_IP_ROUTE_PURGE_ALL:
                  return cli_send_multi_help( fd, "\
 ip route purge: remove all routes in the routing table\n",
@@ -312,19 +336,23 @@ strace <dest IP>: traceourte to <dest IP>\n" );
 
 	    case HELP_ADV:
             return cli_send_multi_help( fd, "\
-adv [mode | stats | route | agg | bot]: advanced features\n",
-5,
+adv [mode | stats | route | agg | bot | bfd | snapshot | log | capture]: advanced features\n",
+9,
 HELP_ADV_MODE,
 HELP_ADV_STATS,
 HELP_ADV_ROUTE,
 HELP_ADV_AGG,
-HELP_ADV_BOT);
+HELP_ADV_BOT,
+HELP_ADV_BFD,
+HELP_ADV_SNAPSHOT,
+HELP_ADV_LOG,
+HELP_ADV_CAPTURE);
           case HELP_ADV_MODE:
               return 0==writenstr( fd, "\
 adv mode <multi | fast> <on | off>: switches advanced features on or off\n" );
           case HELP_ADV_STATS:
               return 0==writenstr( fd, "\
-adv stats: prints statistics\n" );
+adv stats: prints the NetFPGA interface statistics (see show stats for the software ones)\n" );
 	      case HELP_ADV_ROUTE:
               return 0==writenstr( fd, "\
 adv route <addm | addf> add a static multipath or fast reroute route.\n" );
@@ -345,6 +373,22 @@ adv agg <show | on | off>: switches hw route aggregation on or off\n" );
           case HELP_ADV_BOT:
               return 0==writenstr( fd, "\
 adv bot <on | off>: switches bot interface (printing TheEnd! at the end) on or off\n" );
+          case HELP_ADV_BFD:
+              return 0==writenstr( fd, "\
+adv bfd [on | off | <interval ms> <multiplier>]: shows or sets the liveness echoes sent to\n\
+  each OSPF neighbor; a neighbor is down once <multiplier> echoes in a row did not come back\n" );
+          case HELP_ADV_SNAPSHOT:
+              return 0==writenstr( fd, "\
+adv snapshot: saves the routing table, ARP cache and OSPF topology for the next start\n\
+  (done on shutdown as well)\n" );
+          case HELP_ADV_LOG:
+              return 0==writenstr( fd, "\
+adv log [error | warn | info | debug]: shows or sets the level of the messages the router\n\
+  prints; errors repeated more than 10 times a second are counted, not printed\n" );
+          case HELP_ADV_CAPTURE:
+              return 0==writenstr( fd, "\
+adv capture <file>: writes the packets in the flight recorder of every interface to <file>\n\
+  as pcap (quote names with a dot, e.g. \"last.pcap\")\n" );
 
 
         case HELP_OPT:
@@ -26,11 +26,14 @@ typedef enum cli_help_t {
       HELP_SHOW_OSPF,
        HELP_SHOW_OSPF_NEIGHBORS,
        HELP_SHOW_OSPF_TOPOLOGY,
+       HELP_SHOW_OSPF_STATS,
       HELP_SHOW_VNS,
         HELP_SHOW_VNS_LHOST,
         HELP_SHOW_VNS_TOPOLOGY,
         HELP_SHOW_VNS_USER,
         HELP_SHOW_VNS_VHOST,
+      HELP_SHOW_CAPTURE,
+      HELP_SHOW_STATS,
 
     HELP_MANIP,
       HELP_MANIP_IP,
@@ -50,6 +53,7 @@ typedef enum cli_help_t {
        HELP_MANIP_IP_ROUTE,
          HELP_MANIP_IP_ROUTE_ADD,
          HELP_MANIP_IP_ROUTE_DEL,
+         HELP_MANIP_IP_ROUTE_BATCH,
          HELP_MANIP_IP_ROUTE_PURGE_ALL,
          HELP_MANIP_IP_ROUTE_PURGE_DYN,
          HELP_MANIP_IP_ROUTE_PURGE_STA,
@@ -70,6 +74,10 @@ typedef enum cli_help_t {
         HELP_ADV_ROUTE_ADDF,
 	  HELP_ADV_AGG,
 	  HELP_ADV_BOT,
+	  HELP_ADV_BFD,
+	  HELP_ADV_SNAPSHOT,
+	  HELP_ADV_LOG,
+	  HELP_ADV_CAPTURE,
 	  
     HELP_OPT,
       HELP_OPT_VERBOSE
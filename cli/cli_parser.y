@@ -52,6 +52,9 @@ gross_route_t grt;
 gross_ip_t gip;
 gross_ip_int_t giip;
 gross_option_t gopt;
+gross_echo_t gecho;
+gross_file_t gfile;
+gross_level_t glevel;
 #define SETC_FUNC0(func)      gobj.func_do0=func; gobj.func_do1=NULL; gobj.data=NULL
 #define SETC_FUNC1(func)      gobj.func_do0=NULL; gobj.func_do1=(void (*)(void*))func; gobj.data=NULL
 #define SETC_ARP_IP(func,xip)  SETC_FUNC1(func); gobj.data=&garp; garp.ip=xip
@@ -63,6 +66,9 @@ gross_option_t gopt;
 #define SETC_IP(func,xip) SETC_FUNC1(func); gobj.data=&gip; gip.ip=xip
 #define SETC_IP_INT(func,xip,xn) SETC_FUNC1(func); gobj.data=&giip; giip.ip=xip; giip.count=xn
 #define SETC_OPT(func) SETC_FUNC1(func); gobj.data=&gopt
+#define SETC_ECHO(func,xi,xm) SETC_FUNC1(func); gobj.data=&gecho; gecho.interval=xi; gecho.mult=xm
+#define SETC_FILE(func,xname) SETC_FUNC1(func); gobj.data=&gfile; gfile.name=xname
+#define SETC_LEVEL(func,xname) SETC_FUNC1(func); gobj.data=&glevel; glevel.name=xname
 
 /** Clears out any previous command */
 static void clear_command();
@@ -89,10 +95,10 @@ static void run_command();
 %token  T_SHOW T_QUESTION T_NEWLINE T_ALL
 %token  T_VNS T_USER T_VHOST T_LHOST T_TOPOLOGY
 %token  T_IP T_ROUTE T_INTF T_ARP T_OSPF T_HW T_NEIGHBORS
-%token  T_ADD T_DEL T_UP T_DOWN T_PURGE T_STATIC T_DYNAMIC T_ABOUT
+%token  T_ADD T_DEL T_UP T_DOWN T_PURGE T_BATCH T_STATIC T_DYNAMIC T_ABOUT
 %token  T_PING T_TRACE T_HELP T_EXIT T_SHUTDOWN T_FLOOD
 %token  T_SET T_UNSET T_OPTION T_VERBOSE T_DATE
-%token  T_MODE T_MULTIPATH T_ADV T_STATS T_FAST T_ADDM T_ADDF T_BOT T_AGG
+%token  T_MODE T_MULTIPATH T_ADV T_STATS T_FAST T_ADDM T_ADDF T_BOT T_AGG T_BFD T_SNAPSHOT T_LOG T_CAPTURE T_JSON
 
 /* Terminals which evaluate to some attribute value */
 %token   <intVal>       TAV_INT
@@ -122,6 +128,8 @@ ShowType : /* empty: show all */                  { SETC_FUNC0(cli_show_all); }
          | T_IP  ShowTypeIP
          | T_OSPF ShowTypeOSPF
          | T_VNS ShowTypeVNS
+         | T_CAPTURE ShowTypeCapture
+         | T_STATS ShowTypeStats
          | T_OPTION ShowTypeOption
          | HelpOrQ                                { HELP(HELP_SHOW); }
          ;
@@ -153,6 +161,8 @@ ShowTypeOSPF : /* empty: show all */                { SETC_FUNC0(cli_show_ospf);
              | T_NEIGHBORS TMIorQ                   { HELP(HELP_SHOW_OSPF_NEIGHBORS); }
              | T_TOPOLOGY                           { SETC_FUNC0(cli_show_ospf_topo); }
              | T_TOPOLOGY TMIorQ                    { HELP(HELP_SHOW_OSPF_TOPOLOGY); }
+             | T_STATS                              { SETC_FUNC0(cli_show_ospf_stats); }
+             | T_STATS TMIorQ                       { HELP(HELP_SHOW_OSPF_STATS); }
              | WrongOrQ                             { HELP(HELP_SHOW_OSPF); }
              ;
 
@@ -176,6 +186,18 @@ ShowTypeVNS : /* empty: show all */               { SETC_FUNC0(cli_show_vns); }
             | WrongOrQ                            { HELP(HELP_SHOW_VNS); }
             ;
 
+ShowTypeCapture : /* empty: show all */           { SETC_FUNC0(cli_show_capture); }
+                | TAV_STR                         { SETC_INTF(cli_show_capture_intf,$1); }
+                | TAV_STR TMIorQ                  { HELP(HELP_SHOW_CAPTURE); }
+                | WrongOrQ                        { HELP(HELP_SHOW_CAPTURE); }
+                ;
+
+ShowTypeStats : /* empty: show all */             { SETC_FUNC0(cli_show_stats); }
+              | T_JSON                            { SETC_FUNC0(cli_show_stats_json); }
+              | T_JSON TMIorQ                     { HELP(HELP_SHOW_STATS); }
+              | WrongOrQ                          { HELP(HELP_SHOW_STATS); }
+              ;
+
 ManipCommand : T_IP ManipTypeIP
              ;
 
@@ -231,6 +253,7 @@ ManipTypeIPOSPF : WrongOrQ                        { HELP(HELP_MANIP_IP_OSPF);
 ManipTypeIPRoute : WrongOrQ                       { HELP(HELP_MANIP_IP_ROUTE); }
                  | T_ADD RouteAddOrQ
                  | T_DEL RouteDelOrQ
+                 | T_BATCH RouteBatchOrQ
                  | T_PURGE                        { SETC_FUNC0(cli_manip_ip_route_purge_all); }
                  | T_PURGE T_DYNAMIC              { SETC_FUNC0(cli_manip_ip_route_purge_dyn); }
                  | T_PURGE T_STATIC               { SETC_FUNC0(cli_manip_ip_route_purge_sta); }
@@ -253,6 +276,12 @@ RouteDelOrQ : HelpOrQ                             { HELP(HELP_MANIP_IP_ROUTE_DEL
             | TAV_IP TAV_IP TMIorQ                { HELP(HELP_MANIP_IP_ROUTE_DEL); }
             ;
 
+RouteBatchOrQ : HelpOrQ                           { HELP(HELP_MANIP_IP_ROUTE_BATCH); }
+              | {ERR("expected file name")} error { HELP(HELP_MANIP_IP_ROUTE_BATCH); }
+              | TAV_STR                           { SETC_FILE(cli_manip_ip_route_batch,$1); }
+              | TAV_STR TMIorQ                    { HELP(HELP_MANIP_IP_ROUTE_BATCH); }
+              ;
+
 ActionCommand : T_PING ActionPing
               | T_TRACE ActionTrace
               | ActionDate
@@ -307,11 +336,14 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_SHOW T_OSPF                { HELP(HELP_SHOW_OSPF); }
            | HelpOrQ T_SHOW T_OSPF T_NEIGHBORS    { HELP(HELP_SHOW_OSPF_NEIGHBORS); }
            | HelpOrQ T_SHOW T_OSPF T_TOPOLOGY     { HELP(HELP_SHOW_OSPF_TOPOLOGY); }
+           | HelpOrQ T_SHOW T_OSPF T_STATS        { HELP(HELP_SHOW_OSPF_STATS); }
            | HelpOrQ T_SHOW T_VNS                 { HELP(HELP_SHOW_VNS); }
            | HelpOrQ T_SHOW T_VNS T_LHOST         { HELP(HELP_SHOW_VNS_LHOST); }
            | HelpOrQ T_SHOW T_VNS T_TOPOLOGY      { HELP(HELP_SHOW_VNS_TOPOLOGY); }
            | HelpOrQ T_SHOW T_VNS T_USER          { HELP(HELP_SHOW_VNS_USER); }
            | HelpOrQ T_SHOW T_VNS T_VHOST         { HELP(HELP_SHOW_VNS_VHOST); }
+           | HelpOrQ T_SHOW T_CAPTURE             { HELP(HELP_SHOW_CAPTURE); }
+           | HelpOrQ T_SHOW T_STATS               { HELP(HELP_SHOW_STATS); }
            | HelpOrQ T_IP                         { HELP(HELP_MANIP_IP); }
            | HelpOrQ T_IP T_ARP                   { HELP(HELP_MANIP_IP_ARP); }
            | HelpOrQ T_IP T_ARP T_ADD             { HELP(HELP_MANIP_IP_ARP_ADD); }
@@ -325,6 +357,7 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_IP T_ROUTE                 { HELP(HELP_MANIP_IP_ROUTE); }
            | HelpOrQ T_IP T_ROUTE T_ADD           { HELP(HELP_MANIP_IP_ROUTE_ADD); }
            | HelpOrQ T_IP T_ROUTE T_DEL           { HELP(HELP_MANIP_IP_ROUTE_DEL); }
+           | HelpOrQ T_IP T_ROUTE T_BATCH         { HELP(HELP_MANIP_IP_ROUTE_BATCH); }
            | HelpOrQ T_IP T_ROUTE T_PURGE         { HELP(HELP_MANIP_IP_ROUTE_PURGE_ALL); }
            | HelpOrQ T_IP T_ROUTE T_DYNAMIC       { HELP(HELP_MANIP_IP_ROUTE_PURGE_DYN); }
            | HelpOrQ T_IP T_ROUTE T_STATIC        { HELP(HELP_MANIP_IP_ROUTE_PURGE_STA); }
@@ -345,6 +378,10 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_ADV T_ROUTE T_ADDF         { HELP(HELP_ADV_ROUTE_ADDF); }
            | HelpOrQ T_ADV T_AGG                  { HELP(HELP_ADV_AGG); }
            | HelpOrQ T_ADV T_BOT                  { HELP(HELP_ADV_BOT); }
+           | HelpOrQ T_ADV T_BFD                  { HELP(HELP_ADV_BFD); }
+           | HelpOrQ T_ADV T_SNAPSHOT             { HELP(HELP_ADV_SNAPSHOT); }
+           | HelpOrQ T_ADV T_LOG                  { HELP(HELP_ADV_LOG); }
+           | HelpOrQ T_ADV T_CAPTURE              { HELP(HELP_ADV_CAPTURE); }
            | HelpOrQ {ERR_IGNORE} error           { HELP(HELP_ACTION_HELP); }
            ;
 
@@ -381,6 +418,17 @@ AdvSubCommand : /* empty: show help */            { HELP(HELP_ADV); }
          	  | T_AGG T_SHOW     		   		  { SETC_FUNC0(cli_adv_get_agg); }
               | T_BOT OptionAction				  { SETC_OPT(cli_adv_set_bot); }
               | T_AGG OptionAction				  { SETC_OPT(cli_adv_set_agg); }
+              | T_BFD                             { SETC_FUNC0(cli_adv_show_bfd); }
+              | T_BFD OptionAction                { SETC_OPT(cli_adv_set_bfd); }
+              | T_BFD TAV_INT TAV_INT             { SETC_ECHO(cli_adv_set_bfd_timers,$2,$3); }
+              | T_BFD TMIorQ                      { HELP(HELP_ADV_BFD); }
+              | T_SNAPSHOT                        { SETC_FUNC0(cli_adv_snapshot); }
+              | T_SNAPSHOT TMIorQ                 { HELP(HELP_ADV_SNAPSHOT); }
+              | T_LOG                             { SETC_FUNC0(cli_adv_show_log); }
+              | T_LOG TAV_STR                     { SETC_LEVEL(cli_adv_set_log,$2); }
+              | T_LOG TMIorQ                      { HELP(HELP_ADV_LOG); }
+              | T_CAPTURE TAV_STR                 { SETC_FILE(cli_adv_capture,$2); }
+              | T_CAPTURE TMIorQ                  { HELP(HELP_ADV_CAPTURE); }
               ;
               
 AdvSubMode : /* empty: show mode */               { SETC_FUNC0(cli_adv_show_mode); }
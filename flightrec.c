@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flightrec.h"
+#include "sr_dumper.h"
+
+static const char *verdict_names[FR_VERDICTS] = {
+	"pending", "forward", "arp wait", "local", "arp", "ignored",
+	"drop: interface down", "drop: runt", "drop: checksum", "drop: ttl",
+	"drop: no route", "drop: output down", "drop: unknown type"
+};
+
+static struct flightrec_ring *new_ring(struct flightrec *fr, int iface)
+{
+	struct flightrec_ring *r = (struct flightrec_ring*)calloc(1, sizeof(struct flightrec_ring));
+
+	if(r == NULL) return NULL;
+	// two threads may get here for the same interface, the first one wins
+	if(!__sync_bool_compare_and_swap(&fr->ring[iface], NULL, r)) {
+		free(r);
+		r = fr->ring[iface];
+	}
+	return r;
+}
+
+// memcpy() for the few bytes of a header: 16 byte moves the compiler inlines,
+// the last one overlapping, rather than a call that is slow to start up
+static inline void copy_hdr(uint8_t *dst, const uint8_t *src, unsigned n)
+{
+	unsigned i;
+
+	if(n < 16) {
+		for(i = 0; i < n; i++) dst[i] = src[i];
+		return;
+	}
+	for(i = 0; i + 16 <= n; i += 16) memcpy(dst + i, src + i, 16);
+	if(i < n) memcpy(dst + n - 16, src + n - 16, 16);
+}
+
+struct flightrec_entry *flightrec_begin(struct flightrec *fr, int iface, const uint8_t *packet, unsigned len, unsigned *pos)
+{
+	struct flightrec_ring *r;
+	struct flightrec_entry *e;
+	struct timespec ts;
+	unsigned p;
+
+	if(iface < 0 || iface >= FLIGHTREC_IFACES) return NULL;
+	if((r = fr->ring[iface]) == NULL && (r = new_ring(fr, iface)) == NULL) return NULL;
+
+	p = __sync_fetch_and_add(&r->head, 1);
+	e = &r->e[p & (FLIGHTREC_DEPTH - 1)];
+	// not complete, and ours: flightrec_end() checks it is still
+	e->seq = ~p;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(FLIGHTREC_CLOCK, &ts);
+	e->sec = ts.tv_sec;
+	e->nsec = ts.tv_nsec;
+	e->iface = iface;
+	e->len = len;
+	e->caplen = len < FLIGHTREC_SNAP ? len : FLIGHTREC_SNAP;
+	copy_hdr(e->hdr, packet, e->caplen);
+
+	*pos = p;
+	return e;
+}
+
+void flightrec_end(struct flightrec_entry *e, unsigned pos, const struct flightrec_verdict *v)
+{
+	if(e->seq != ~pos) return;
+	e->verdict = v->verdict;
+	e->out_if = v->out_if;
+	e->route = v->route;
+	e->mask = v->mask;
+	e->nexthop = v->nexthop;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	e->seq = pos + 1;
+}
+
+int flightrec_read(struct flightrec *fr, int iface, struct flightrec_entry *out, int max)
+{
+	struct flightrec_ring *r;
+	struct flightrec_entry *e;
+	unsigned head, p;
+	int n = 0;
+
+	if(iface < 0 || iface >= FLIGHTREC_IFACES || (r = fr->ring[iface]) == NULL || max <= 0) return 0;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	if(max > FLIGHTREC_DEPTH) max = FLIGHTREC_DEPTH;
+	p = head - (head < (unsigned)max ? head : (unsigned)max);
+	for(; p != head; p++) {
+		e = &r->e[p & (FLIGHTREC_DEPTH - 1)];
+		if(e->seq != p + 1) continue;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		memcpy(&out[n], (const void*)e, sizeof(struct flightrec_entry));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		// overwritten while we copied it
+		if(e->seq != p + 1) continue;
+		n++;
+	}
+	return n;
+}
+
+static int cmp_time(const void *a, const void *b)
+{
+	const struct flightrec_entry *x = (const struct flightrec_entry*)a;
+	const struct flightrec_entry *y = (const struct flightrec_entry*)b;
+
+	if(x->sec != y->sec) return x->sec < y->sec ? -1 : 1;
+	if(x->nsec != y->nsec) return x->nsec < y->nsec ? -1 : 1;
+	// the clock is coarse, keep each interface's entries in order
+	if(x->iface != y->iface) return x->iface < y->iface ? -1 : 1;
+	if(x->seq == y->seq) return 0;
+	return (int32_t)(x->seq - y->seq) < 0 ? -1 : 1;
+}
+
+long flightrec_dump(struct flightrec *fr, const char *fname)
+{
+	struct flightrec_entry *all;
+	struct pcap_file_header fh;
+	struct pcap_sf_pkthdr ph;
+	FILE *f;
+	long n = 0, i;
+	int iface;
+
+	all = (struct flightrec_entry*)malloc(sizeof(struct flightrec_entry) * FLIGHTREC_IFACES * FLIGHTREC_DEPTH);
+	if(all == NULL) return -1;
+	for(iface = 0; iface < FLIGHTREC_IFACES; iface++)
+		n += flightrec_read(fr, iface, all + n, FLIGHTREC_DEPTH);
+	qsort(all, n, sizeof(struct flightrec_entry), cmp_time);
+
+	if((f = fopen(fname, "w")) == NULL) {
+		free(all);
+		return -1;
+	}
+	memset(&fh, 0, sizeof(fh));
+	fh.magic = TCPDUMP_MAGIC;
+	fh.version_major = PCAP_VERSION_MAJOR;
+	fh.version_minor = PCAP_VERSION_MINOR;
+	fh.snaplen = FLIGHTREC_SNAP;
+	fh.linktype = LINKTYPE_ETHERNET;
+	fwrite(&fh, sizeof(fh), 1, f);
+	for(i = 0; i < n; i++) {
+		ph.ts.tv_sec = all[i].sec;
+		ph.ts.tv_usec = all[i].nsec / 1000;
+		ph.caplen = all[i].caplen;
+		ph.len = all[i].len;
+		fwrite(&ph, sizeof(ph), 1, f);
+		fwrite(all[i].hdr, all[i].caplen, 1, f);
+	}
+	free(all);
+	if(fclose(f) != 0) return -1;
+	return n;
+}
+
+const char *flightrec_verdict_name(int verdict)
+{
+	if(verdict < 0 || verdict >= FR_VERDICTS) return "?";
+	return verdict_names[verdict];
+}
@@ -0,0 +1,101 @@
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+/*
+ * Flight recorder: the headers of the last FLIGHTREC_DEPTH packets received
+ * on each interface, with what the router did with them.  Always on, so
+ * there is some history when something goes wrong without -l logging;
+ * "show capture" prints it and "adv capture <file>" writes it out as pcap.
+ *
+ * A packet thread claims the next entry of its interface's ring with one
+ * atomic add and marks it complete once the packet is handled.  A reader
+ * copies entries and checks the mark again afterwards, so it never blocks
+ * the packet threads and they never wait for it.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#define FLIGHTREC_DEPTH 512 // entries per interface, a power of two
+#define FLIGHTREC_SNAP 96 // bytes kept of each packet
+#define FLIGHTREC_IFACES 8 // interfaces recorded, in the order of sr_router.ifaces
+#define FLIGHTREC_SHOW 16 // entries per interface "show capture" prints
+
+// only ticks every few ms, but costs a few ns rather than a few tens
+#ifdef CLOCK_REALTIME_COARSE
+#define FLIGHTREC_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define FLIGHTREC_CLOCK CLOCK_REALTIME
+#endif
+
+// what the router did with a packet
+enum {
+	FR_PENDING, // still being handled
+	FR_FORWARD, // sent to the next hop
+	FR_ARP_WAIT, // forwarded, queued until the next hop answers ARP
+	FR_LOCAL, // for the router itself
+	FR_ARP, // ARP request or reply
+	FR_IGNORED, // broadcast the router has no use for
+	FR_DROP_IF_DOWN, // came in on a disabled interface
+	FR_DROP_RUNT, // too short for its headers
+	FR_DROP_CHECKSUM,
+	FR_DROP_TTL,
+	FR_DROP_NO_ROUTE,
+	FR_DROP_OUT_DOWN, // output interface disabled or gone
+	FR_DROP_UNKNOWN, // neither IPv4 nor ARP
+	FR_VERDICTS
+};
+
+#define FR_IS_DROP(v) ((v) >= FR_DROP_IF_DOWN)
+
+// a packet's verdict, filled in while it is handled
+struct flightrec_verdict {
+	int verdict;
+	int out_if; // index of the output interface, -1 if none
+	uint32_t route, mask; // routing table entry used, hbo
+	uint32_t nexthop; // hbo
+};
+
+struct flightrec_entry {
+	volatile uint32_t seq; // position in the ring + 1 once complete, ~position while written
+	uint32_t len; // of the packet
+	uint32_t sec, nsec;
+	uint32_t route, mask, nexthop;
+	uint8_t verdict;
+	int8_t out_if;
+	uint8_t caplen; // bytes of hdr used
+	uint8_t iface; // ring it is in
+	uint8_t hdr[FLIGHTREC_SNAP];
+};
+
+struct flightrec_ring {
+	volatile unsigned head; // position of the next entry
+	struct flightrec_entry e[FLIGHTREC_DEPTH];
+};
+
+struct flightrec {
+	struct flightrec_ring *ring[FLIGHTREC_IFACES]; // allocated on the interface's first packet
+};
+
+/* Claims the next entry of interface iface's ring and copies the headers of
+ * packet into it.
+ * returns the entry to hand to flightrec_end() with *pos, NULL if iface is
+ * not recorded
+ */
+struct flightrec_entry *flightrec_begin(struct flightrec *fr, int iface, const uint8_t *packet, unsigned len, unsigned *pos);
+// stores v in e and marks it complete, unless the ring came round to e meanwhile
+void flightrec_end(struct flightrec_entry *e, unsigned pos, const struct flightrec_verdict *v);
+
+/* Copies the complete entries of interface iface, at most max of the latest,
+ * oldest first.
+ * returns the number copied
+ */
+int flightrec_read(struct flightrec *fr, int iface, struct flightrec_entry *out, int max);
+/* Writes the entries of all interfaces, in time order, to fname as pcap.
+ * returns the number of packets written, -1 if fname cannot be written
+ */
+long flightrec_dump(struct flightrec *fr, const char *fname);
+
+const char *flightrec_verdict_name(int verdict);
+
+#endif // FLIGHTREC_H
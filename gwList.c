@@ -3,9 +3,11 @@
 // Inserts gateway into the list if it is not in it already and returns its index in the list
 // In case of an error returns -1
 int gwList_insert(struct gwListNode **head, uint32_t gw){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	int i = 0;
 	
-	pthread_mutex_lock(&gw_lock);
+	pthread_mutex_lock(&subsystem->gw_lock);
 	struct gwListNode *node = *head;
 	struct gwListNode *prev = NULL;
 	while(node){
@@ -28,7 +30,7 @@ int gwList_insert(struct gwListNode **head, uint32_t gw){
 			i = -1;
 		}
 	}
-	pthread_mutex_unlock(&gw_lock);
+	pthread_mutex_unlock(&subsystem->gw_lock);
 
 	// if i bigger than 255 something is wrong
 	if(i > 0xff) i = -1;
@@ -38,7 +40,9 @@ int gwList_insert(struct gwListNode **head, uint32_t gw){
 
 // Empties given gwList
 void gwList_flush(struct gwListNode **head){
-	pthread_mutex_lock(&gw_lock);
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	pthread_mutex_lock(&subsystem->gw_lock);
 	struct gwListNode *node = *head;
 	struct gwListNode *tmp;
 	while(node){
@@ -47,6 +51,6 @@ void gwList_flush(struct gwListNode **head){
 		free(tmp);
 	}
 	*head = NULL;
-	pthread_mutex_unlock(&gw_lock);
+	pthread_mutex_unlock(&subsystem->gw_lock);
 }
 
@@ -13,7 +13,6 @@ struct gwListNode{
 	struct gwListNode *next;
 };
 
-pthread_mutex_t gw_lock;
 
 int gwList_insert(struct gwListNode **head, uint32_t gw);
 void gwList_flush(struct gwListNode **head);
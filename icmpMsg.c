@@ -3,6 +3,11 @@
 #include "cli.h"
 #include <sys/time.h>
 
+// the counters of the router this thread works for
+static struct pktstats *router_stats() {
+	return &((struct sr_router*)sr_get_subsystem(get_sr()))->stats;
+}
+
 void processICMP(const char* interface, const uint8_t* packet, unsigned len){
 	if(packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH] == 8){ // Echo Reqeust
 		sendICMPEchoReply(interface, packet, len);
@@ -22,6 +27,8 @@ inline double deltaTimeMili(struct timeval *t1, struct timeval *t2){
 
 // match incoming ping reply with set request
 void processEchoReply(const uint8_t* packet, unsigned len){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	uint16_t identifier, seqNum;
 	struct timeval tv;
 	gettimeofday(&tv, 0);
@@ -29,8 +36,8 @@ void processEchoReply(const uint8_t* packet, unsigned len){
 	identifier = ntohs(*((uint16_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 4])));
 	seqNum = ntohs(*((uint16_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 6])));
 	
-	pthread_mutex_lock(&ping_lock);
-		struct pingRequestNode *node = pingListHead;
+	pthread_mutex_lock(&subsystem->ping_lock);
+		struct pingRequestNode *node = subsystem->pingListHead;
 		struct pingRequestNode *prev = NULL;
 		while(node){
 			if(node->identifier == identifier){
@@ -54,7 +61,7 @@ void processEchoReply(const uint8_t* packet, unsigned len){
 					prev->next = node->next;
 				}
 				else{
-					pingListHead = node->next;
+					subsystem->pingListHead = node->next;
 				}
 				free(node);
 				break;
@@ -62,11 +69,13 @@ void processEchoReply(const uint8_t* packet, unsigned len){
 			prev = node;
 			node = node->next;
 		}
-	pthread_mutex_unlock(&ping_lock);
+	pthread_mutex_unlock(&subsystem->ping_lock);
 }
 
 // match TTL expired with a possible traceroute in progress
 void processTTLexpired(const uint8_t* packet, unsigned len){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	uint16_t identifier, seqNum;
 	uint8_t sentTTL;
 	struct timeval tv;
@@ -77,8 +86,8 @@ void processTTLexpired(const uint8_t* packet, unsigned len){
 	seqNum = ntohs(*((uint16_t*)(&packet[orig_ip_header_offset + IP_HEADER_LENGTH + 6])));
 	sentTTL = packet[orig_ip_header_offset + 8];
 	
-	pthread_mutex_lock(&ping_lock);
-		struct pingRequestNode *node = pingListHead;
+	pthread_mutex_lock(&subsystem->ping_lock);
+		struct pingRequestNode *node = subsystem->pingListHead;
 		struct pingRequestNode *prev = NULL;
 		while(node){
 			if(node->identifier == identifier && node->isTraceroute == 1){
@@ -96,16 +105,18 @@ void processTTLexpired(const uint8_t* packet, unsigned len){
 			prev = node;
 			node = node->next;
 		}
-	pthread_mutex_unlock(&ping_lock);
+	pthread_mutex_unlock(&subsystem->ping_lock);
 }
 
 // maintain the ping list
 void refreshPingList(void *dummy){	
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	while(1){
-		pthread_mutex_lock(&ping_lock);
+		pthread_mutex_lock(&subsystem->ping_lock);
 			struct timeval tv;
 			gettimeofday(&tv, 0);
-			struct pingRequestNode *node = pingListHead;
+			struct pingRequestNode *node = subsystem->pingListHead;
 			struct pingRequestNode *prev = NULL;
 			while(node){
 				if(deltaTimeMili(&tv, &node->time) > (PING_LIST_TIMEOUT * 1000)){
@@ -123,7 +134,7 @@ void refreshPingList(void *dummy){
 						prev->next = node->next;
 					}
 					else{
-						pingListHead = node->next;
+						subsystem->pingListHead = node->next;
 					}
 					free(node);
 					break;
@@ -131,7 +142,7 @@ void refreshPingList(void *dummy){
 				prev = node;
 				node = node->next;
 			}
-		pthread_mutex_unlock(&ping_lock);	
+		pthread_mutex_unlock(&subsystem->ping_lock);	
 		sleep(PING_LIST_REFRESH);
 	}
 }
@@ -162,7 +173,7 @@ void sendICMPEchoReply(const char* interface, const uint8_t* requestPacket, unsi
 		return;
 	}
 	
-	dstIP = requestPacket[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
+	dstIP = (uint32_t)requestPacket[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
 			requestPacket[ETHERNET_HEADER_LENGTH + 13] * 256 * 256 +
 			requestPacket[ETHERNET_HEADER_LENGTH + 14] * 256 +
 			requestPacket[ETHERNET_HEADER_LENGTH + 15] * 1;    				
@@ -207,6 +218,7 @@ void sendICMPEchoReply(const char* interface, const uint8_t* requestPacket, unsi
 	
 	// send the packet out
 	sendIPpacket(get_sr(), interface, getNextHopIP(dstIP), p, len);
+	pktstats_inc(router_stats(), PS_ICMP_SENT);
 	
 //	for(i = 0; i < len; i++) printf("%d: %d\n", i, p[i]);
 		
@@ -261,6 +273,7 @@ void sendICMPEchoRequest(const char* interface, uint32_t dstIP, uint16_t identif
 	dbgMsg("ICMP: Sending Echo Request");
 	gettimeofday(time, 0);
 	sendIPpacket(get_sr(), interface, getNextHopIP(dstIP), p, len);
+	pktstats_inc(router_stats(), PS_ICMP_SENT);
 	
 //	for(i = 0; i < len; i++) printf("%d: %d\n", i, p[i]);
 		
@@ -298,7 +311,7 @@ void sendICMPDestinationUnreachable(const char* interface, const uint8_t* origin
 		return;
 	}
 	
-	dstIP = originalPacket[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
+	dstIP = (uint32_t)originalPacket[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
 			originalPacket[ETHERNET_HEADER_LENGTH + 13] * 256 * 256 +
 			originalPacket[ETHERNET_HEADER_LENGTH + 14] * 256 +
 			originalPacket[ETHERNET_HEADER_LENGTH + 15] * 1;    				
@@ -345,6 +358,7 @@ void sendICMPDestinationUnreachable(const char* interface, const uint8_t* origin
 	// send the packet out
 	dbgMsg("ICMP: Sending destination unreachable");
 	sendIPpacket(get_sr(), interface, getNextHopIP(dstIP), p, myLen);
+	pktstats_inc(router_stats(), PS_ICMP_SENT);
 	free(p);
 }
 
@@ -360,7 +374,7 @@ void sendICMPTimeExceeded(const char* interface, const uint8_t* originalPacket,
 		return;
 	}
 	
-	dstIP = originalPacket[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
+	dstIP = (uint32_t)originalPacket[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
 			originalPacket[ETHERNET_HEADER_LENGTH + 13] * 256 * 256 +
 			originalPacket[ETHERNET_HEADER_LENGTH + 14] * 256 +
 			originalPacket[ETHERNET_HEADER_LENGTH + 15] * 1;    				
@@ -405,5 +419,6 @@ void sendICMPTimeExceeded(const char* interface, const uint8_t* originalPacket,
 	// send the packet out
 	dbgMsg("ICMP: Sending TTL Exceeded");
 	sendIPpacket(get_sr(), interface, getNextHopIP(dstIP), p, myLen);
+	pktstats_inc(router_stats(), PS_ICMP_SENT);
 	free(p);
 }
@@ -26,5 +26,3 @@ struct pingRequestNode{
 	struct pingRequestNode *next;
 };
 
-struct pingRequestNode *pingListHead;
-pthread_mutex_t ping_lock;
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log.h"
+
+volatile int log_level = LOG_LVL_INFO;
+
+static const char *level_names[] = { "error", "warn", "info", "debug" };
+static const char *level_prefix[] = { "error: ", "warn: ", "", "dbg: " };
+
+struct log_rec {
+	int level;
+	char text[LOG_MSG_LEN];
+};
+
+// one producer (its thread) and one consumer (log_flush()), no locks between them
+struct log_ring {
+	struct log_rec rec[LOG_RING];
+	unsigned head; // next to fill, only moved by the owner
+	unsigned tail; // next to write out, only moved by log_flush()
+	unsigned long dropped; // only changed by the owner
+	unsigned long reported; // dropped as of the last report
+	int dead; // owner is gone, free once empty
+	struct log_ring *next;
+};
+
+static __thread struct log_ring *my_ring = NULL;
+static struct log_ring *rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER; // for the list and the consumer side
+static pthread_key_t ring_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+static unsigned long written, dropped, suppressed;
+
+static void ring_exit(void *arg)
+{
+	struct log_ring *r = (struct log_ring*)arg;
+	my_ring = NULL;
+	__atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void* log_thread(void *arg)
+{
+	for(;;) {
+		usleep(LOG_FLUSH_MS*1000);
+		log_flush();
+	}
+	return NULL;
+}
+
+static void log_init()
+{
+	pthread_t t;
+
+	pthread_key_create(&ring_key, ring_exit);
+	atexit(log_flush);
+	pthread_create(&t, NULL, log_thread, NULL);
+	pthread_detach(t);
+}
+
+static struct log_ring *get_ring()
+{
+	struct log_ring *r = my_ring;
+
+	if(r != NULL) return r;
+	pthread_once(&log_once, log_init);
+	r = (struct log_ring*)calloc(1, sizeof(struct log_ring));
+	if(r == NULL) return NULL;
+	pthread_setspecific(ring_key, r);
+	pthread_mutex_lock(&rings_lock);
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&rings_lock);
+	my_ring = r;
+	return r;
+}
+
+// fills the next record of the thread's ring, returns NULL if it is full
+static struct log_rec *ring_next(struct log_ring *r)
+{
+	if(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING) {
+		r->dropped++;
+		return NULL;
+	}
+	return &r->rec[r->head % LOG_RING];
+}
+
+static void ring_push(struct log_ring *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+static void log_vwrite(int level, const char *suffix, const char *fmt, va_list ap)
+{
+	struct log_ring *r = get_ring();
+	struct log_rec *rec;
+	int len;
+
+	if(r == NULL || (rec = ring_next(r)) == NULL) return;
+	rec->level = level;
+	len = vsnprintf(rec->text, LOG_MSG_LEN, fmt, ap);
+	if(suffix != NULL && len >= 0 && len < LOG_MSG_LEN)
+		snprintf(rec->text + len, LOG_MSG_LEN - len, "%s", suffix);
+	ring_push(r);
+}
+
+void log_write(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	log_vwrite(level, NULL, fmt, ap);
+	va_end(ap);
+}
+
+void log_write_limited(struct log_limit *ll, int level, const char *fmt, ...)
+{
+	time_t now = time(NULL);
+	char suffix[48];
+	unsigned left_out = 0;
+	va_list ap;
+
+	// racy between threads, but it only has to be about right
+	if(ll->sec != now) {
+		ll->sec = now;
+		ll->cnt = 0;
+		left_out = __sync_lock_test_and_set(&ll->suppressed, 0);
+	}
+	if(__sync_fetch_and_add(&ll->cnt, 1) >= LOG_BURST) {
+		__sync_fetch_and_add(&ll->suppressed, 1);
+		__sync_fetch_and_add(&suppressed, 1);
+		return;
+	}
+	if(left_out > 0)
+		snprintf(suffix, sizeof(suffix), " (%u more suppressed)", left_out);
+	va_start(ap, fmt);
+	log_vwrite(level, left_out > 0 ? suffix : NULL, fmt, ap);
+	va_end(ap);
+}
+
+void log_flush()
+{
+	struct log_ring **pr, *r;
+	int out = 0, err = 0;
+
+	pthread_mutex_lock(&rings_lock);
+	pr = &rings;
+	while((r = *pr) != NULL) {
+		int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+		unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned tail = r->tail;
+		unsigned long d = r->dropped;
+
+		for(; tail != head; tail++) {
+			struct log_rec *rec = &r->rec[tail % LOG_RING];
+			FILE *f = rec->level <= LOG_LVL_WARN ? stderr : stdout;
+			fputs(level_prefix[rec->level], f);
+			fputs(rec->text, f);
+			fputc('\n', f);
+			if(f == stderr) err = 1;
+			else out = 1;
+			written++;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		if(d != r->reported) {
+			fprintf(stderr, "warn: %lu log messages dropped\n", d - r->reported);
+			dropped += d - r->reported;
+			r->reported = d;
+			err = 1;
+		}
+
+		if(dead) {
+			*pr = r->next;
+			free(r);
+		}
+		else pr = &r->next;
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	if(out) fflush(stdout);
+	if(err) fflush(stderr);
+}
+
+const char *log_level_name(int level)
+{
+	if(level < LOG_LVL_ERR || level > LOG_LVL_DBG) return "?";
+	return level_names[level];
+}
+
+int log_level_from_name(const char *name)
+{
+	int i;
+
+	for(i = LOG_LVL_ERR; i <= LOG_LVL_DBG; i++)
+		if(!strcasecmp(name, level_names[i])) return i;
+	if(!strcasecmp(name, "dbg")) return LOG_LVL_DBG;
+	return -1;
+}
+
+void log_stats(unsigned long *w, unsigned long *d, unsigned long *s)
+{
+	pthread_mutex_lock(&rings_lock);
+	*w = written;
+	*d = dropped;
+	pthread_mutex_unlock(&rings_lock);
+	*s = suppressed;
+}
@@ -0,0 +1,67 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+ * Leveled logging.  A message above LOG_MAX_LEVEL is not compiled in at
+ * all, one above log_level (set with "adv log") costs a compare.  The others
+ * are formatted into a ring of the calling thread and written out by a
+ * background thread, so a packet thread never waits on the terminal.  Each
+ * thread's messages come out in order, those of different threads may not.
+ * A thread whose ring is full drops its messages, and counts them.
+ */
+
+#include <time.h>
+
+#define LOG_LVL_ERR  0
+#define LOG_LVL_WARN 1
+#define LOG_LVL_INFO 2
+#define LOG_LVL_DBG  3
+
+// make LOG_LEVEL=LOG_LVL_INFO compiles the debug messages out
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LVL_DBG
+#endif
+
+#define LOG_MSG_LEN 120 // longer messages are cut
+#define LOG_RING 256 // messages of a thread waiting to be written
+#define LOG_FLUSH_MS 20 // how often the rings are written out
+#define LOG_BURST 10 // messages per second from one rate limited call
+
+extern volatile int log_level;
+
+// state of a rate limited call
+struct log_limit {
+	time_t sec;
+	int cnt; // messages in second sec
+	unsigned suppressed; // since the last one let through
+};
+
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+/* log_write(), but at most LOG_BURST messages a second through ll; the next
+ * one let through says how many were left out
+ */
+void log_write_limited(struct log_limit *ll, int level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+// writes out all the messages waiting, also done at exit
+void log_flush();
+
+const char *log_level_name(int level);
+// -1 if name is not a level
+int log_level_from_name(const char *name);
+void log_stats(unsigned long *written, unsigned long *dropped, unsigned long *suppressed);
+
+#define log_enabled(level) ((level) <= LOG_MAX_LEVEL && (level) <= log_level)
+
+#define logMsg(level, ...) do { \
+	if(log_enabled(level)) log_write(level, __VA_ARGS__); \
+} while(0)
+
+#define logLimited(level, ...) do { \
+	static struct log_limit _log_limit; \
+	if(log_enabled(level)) log_write_limited(&_log_limit, level, __VA_ARGS__); \
+} while(0)
+
+// errors often come from bad packets, a flood of them is rate limited
+#define errorMsg(msg) logLimited(LOG_LVL_ERR, "%s", msg)
+#define dbgMsg(msg) logMsg(LOG_LVL_DBG, "%s", msg)
+
+#endif // LOG_H
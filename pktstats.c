@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pktstats.h"
+
+__thread struct pktstats_block *pktstats_mine = NULL;
+
+static __thread struct pktstats_block *mine = NULL; // all of this thread's, one per router
+static pthread_key_t block_key;
+static pthread_once_t block_once = PTHREAD_ONCE_INIT;
+
+static const char *names[PS_COUNTERS] = {
+	"rx", "rx_bytes", "tx", "tx_bytes", "icmp_sent",
+	"arp_requests", "arp_queued", "arp_resolved", "arp_timeout",
+	NULL, "forward", "arp_wait", "local", "arp", "ignored",
+	"drop_if_down", "drop_runt", "drop_checksum", "drop_ttl",
+	"drop_no_route", "drop_out_down", "drop_unknown"
+};
+
+// a thread that is gone leaves its counts, the next new thread counts on
+static void block_exit(void *arg)
+{
+	struct pktstats_block *b;
+
+	pktstats_mine = mine = NULL;
+	for(b = (struct pktstats_block*)arg; b != NULL; b = b->next_mine)
+		__atomic_store_n(&b->used, 0, __ATOMIC_RELEASE);
+}
+
+static void block_init()
+{
+	pthread_key_create(&block_key, block_exit);
+}
+
+// the block this thread counts into for ps, taken the first time it counts for ps
+struct pktstats_block *pktstats_block_of(struct pktstats *ps)
+{
+	struct pktstats_block *b;
+	void *p;
+
+	for(b = mine; b != NULL; b = b->next_mine)
+		if(b->owner == ps) return pktstats_mine = b;
+
+	pthread_once(&block_once, block_init);
+	for(b = __atomic_load_n(&ps->blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next)
+		if(!__atomic_load_n(&b->used, __ATOMIC_RELAXED) && __sync_bool_compare_and_swap(&b->used, 0, 1)) break;
+
+	if(b == NULL) {
+		if(posix_memalign(&p, PKTSTATS_LINE, sizeof(struct pktstats_block)) != 0) return NULL;
+		b = (struct pktstats_block*)p;
+		memset(b, 0, sizeof(struct pktstats_block));
+		b->owner = ps;
+		b->used = 1;
+		do b->next = ps->blocks;
+		while(!__sync_bool_compare_and_swap(&ps->blocks, b->next, b));
+	}
+	b->next_mine = mine;
+	mine = b;
+	pthread_setspecific(block_key, mine);
+	return pktstats_mine = b;
+}
+
+void pktstats_init(struct pktstats *ps)
+{
+	ps->blocks = NULL;
+	pthread_mutex_init(&ps->last_lock, NULL);
+	memset(&ps->last, 0, sizeof(ps->last));
+	clock_gettime(CLOCK_MONOTONIC, &ps->last.t);
+}
+
+void pktstats_read(struct pktstats *ps, struct pktstats_sample *s)
+{
+	struct pktstats_block *b;
+	int i;
+
+	memset(s, 0, sizeof(struct pktstats_sample));
+	clock_gettime(CLOCK_MONOTONIC, &s->t);
+	for(b = __atomic_load_n(&ps->blocks, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+		for(i = 0; i < PS_COUNTERS; i++)
+			s->c[i] += __atomic_load_n(&b->c[i], __ATOMIC_RELAXED);
+		if(__atomic_load_n(&b->used, __ATOMIC_RELAXED)) s->threads++;
+	}
+}
+
+void pktstats_sample(struct pktstats *ps, struct pktstats_sample *cur, struct pktstats_sample *prev)
+{
+	pthread_mutex_lock(&ps->last_lock);
+	pktstats_read(ps, cur);
+	*prev = ps->last;
+	ps->last = *cur;
+	pthread_mutex_unlock(&ps->last_lock);
+}
+
+uint64_t pktstats_dropped(const struct pktstats_sample *s)
+{
+	uint64_t n = s->c[PS_ARP_TIMEOUT];
+	int v;
+
+	for(v = 0; v < FR_VERDICTS; v++)
+		if(FR_IS_DROP(v)) n += s->c[PS_VERDICT + v];
+	return n;
+}
+
+uint64_t pktstats_forwarded(const struct pktstats_sample *s)
+{
+	return s->c[PS_VERDICT + FR_FORWARD] + s->c[PS_VERDICT + FR_ARP_WAIT];
+}
+
+double pktstats_seconds(const struct pktstats_sample *from, const struct pktstats_sample *to)
+{
+	return (to->t.tv_sec - from->t.tv_sec) + (to->t.tv_nsec - from->t.tv_nsec) / 1e9;
+}
+
+const char *pktstats_name(int counter)
+{
+	if(counter < 0 || counter >= PS_COUNTERS) return NULL;
+	return names[counter];
+}
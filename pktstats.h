@@ -0,0 +1,106 @@
+#ifndef PKTSTATS_H
+#define PKTSTATS_H
+
+/*
+ * Software packet counters of a router, kept whatever the mode (the NetFPGA
+ * registers of "adv stats" only see the hardware path).  Each thread counts
+ * into a block of its own for each router it works for, a whole number of
+ * cache lines, with plain stores: no atomic instructions and no line shared
+ * with another thread.  A reader adds up the blocks of a router; the counts
+ * of a thread still at work may be a packet behind.  "show stats [json]"
+ * prints them with the rates since the last time they were shown.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "flightrec.h"
+
+#define PKTSTATS_LINE 64 // cache line size
+
+enum {
+	PS_RX, // frames received
+	PS_RX_BYTES,
+	PS_TX, // frames sent, by the router or on its behalf
+	PS_TX_BYTES,
+	PS_ICMP_SENT, // ICMP messages the router generated
+	PS_ARP_REQUESTS, // ARP requests sent
+	PS_ARP_QUEUED, // packets queued waiting for ARP
+	PS_ARP_RESOLVED, // of those, sent once the reply came in
+	PS_ARP_TIMEOUT, // of those, dropped because none did
+	PS_VERDICT, // then one counter per flightrec verdict of the packets received
+	PS_COUNTERS = PS_VERDICT + FR_VERDICTS
+};
+
+struct pktstats;
+
+struct pktstats_block {
+	uint64_t c[PS_COUNTERS];
+	struct pktstats *owner; // the counters of the router it counts for
+	int used; // by a live thread
+	struct pktstats_block *next; // of the owner's blocks
+	struct pktstats_block *next_mine; // of the blocks of the thread using it
+} __attribute__((aligned(PKTSTATS_LINE)));
+
+// the counters added up over all threads
+struct pktstats_sample {
+	struct timespec t; // CLOCK_MONOTONIC
+	int threads; // blocks counted into
+	uint64_t c[PS_COUNTERS];
+};
+
+// the counters of a router, in its struct sr_router
+struct pktstats {
+	struct pktstats_block *blocks; // never freed, so read without a lock
+	pthread_mutex_t last_lock;
+	struct pktstats_sample last; // read by the last pktstats_sample()
+};
+
+// the block this thread counted into last
+extern __thread struct pktstats_block *pktstats_mine;
+
+struct pktstats_block *pktstats_block_of(struct pktstats *ps);
+
+static inline void pktstats_add(struct pktstats *ps, int counter, uint64_t n)
+{
+	struct pktstats_block *b = pktstats_mine;
+
+	if((b == NULL || b->owner != ps) && (b = pktstats_block_of(ps)) == NULL) return;
+	// only this thread writes it, the store just must not be torn for a reader
+	__atomic_store_n(&b->c[counter], b->c[counter] + n, __ATOMIC_RELAXED);
+}
+
+#define pktstats_inc(ps, counter) pktstats_add(ps, counter, 1)
+
+// counts a packet received and what became of it
+static inline void pktstats_rx(struct pktstats *ps, unsigned len, int verdict)
+{
+	pktstats_inc(ps, PS_RX);
+	pktstats_add(ps, PS_RX_BYTES, len);
+	pktstats_inc(ps, PS_VERDICT + verdict);
+}
+
+static inline void pktstats_tx(struct pktstats *ps, unsigned len)
+{
+	pktstats_inc(ps, PS_TX);
+	pktstats_add(ps, PS_TX_BYTES, len);
+}
+
+// sets up the counters of a new router and notes when counting started, for the first rates
+void pktstats_init(struct pktstats *ps);
+void pktstats_read(struct pktstats *ps, struct pktstats_sample *s);
+/* Reads the counters into cur and the sample the previous call read into
+ * prev (zero counters at pktstats_init() the first time), for rates.
+ */
+void pktstats_sample(struct pktstats *ps, struct pktstats_sample *cur, struct pktstats_sample *prev);
+
+// packets received that were dropped, and those dropped in the ARP queue
+uint64_t pktstats_dropped(const struct pktstats_sample *s);
+// packets received that were sent on or queued for ARP (some of which time out)
+uint64_t pktstats_forwarded(const struct pktstats_sample *s);
+double pktstats_seconds(const struct pktstats_sample *from, const struct pktstats_sample *to);
+
+// short name of a counter, for JSON keys; NULL for one never counted
+const char *pktstats_name(int counter);
+
+#endif // PKTSTATS_H
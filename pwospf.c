@@ -1,8 +1,5 @@
 #include "router.h"
 
-// this is to make sendLSU() reentrant (well, not really, but at least thread safe)
-pthread_mutex_t lsu_reentrant;
-
 // Thread that sends Hello packets, one thread per interface
 void pwospfSendHelloThread(void* arg){
 	struct sr_instance* sr = get_sr();
@@ -16,6 +13,20 @@ void pwospfSendHelloThread(void* arg){
 	}
 }
 
+// cnt neighbors with the IPs in dead were removed: routes through them move to their
+// backups now, our LSU and the routing table follow
+static void neighborsDown(uint32_t* dead, int cnt){
+	int i;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+
+	for(i = 0; i < cnt; i++)
+		rtable_nexthop_down(&subsystem->rtable, dead[i], NULL, 1);
+	invalidateLSU();
+	scheduleLSU();
+	scheduleSPF();
+}
+
 // checks for hello timeouts
 void pwospfTimeoutHelloThread(void *dummy){
 	int i;
@@ -25,6 +36,8 @@ void pwospfTimeoutHelloThread(void *dummy){
 	while(1){
 		int updateLSU = 0;
 		struct pwospf_if* iface = NULL;
+		uint32_t *dead = NULL; // IPs of the neighbors that timed out
+		int dead_cnt = 0;
 		
 		pthread_rwlock_rdlock(&subsystem->if_lock);
 		for(i = 0; i < subsystem->num_ifaces; i++){
@@ -35,6 +48,8 @@ void pwospfTimeoutHelloThread(void *dummy){
 				struct pwospf_neighbor* prev_nbor = NULL;
 				while(nbor){
 					if( time(NULL) > nbor->lastHelloTime && (time(NULL) - nbor->lastHelloTime) > (NEIGHBOR_TIMEOUT * iface->helloint) ){
+						dead = (uint32_t*)realloc(dead, sizeof(uint32_t)*(dead_cnt+1));
+						dead[dead_cnt++] = nbor->ip;
 						if(prev_nbor){
 							prev_nbor->next = nbor->next;
 							free(nbor);
@@ -45,7 +60,7 @@ void pwospfTimeoutHelloThread(void *dummy){
 						else{
 							iface->neighbor_list = nbor->next;
 							free(nbor);
-							nbor = nbor->next;
+							nbor = iface->neighbor_list;
 							dbgMsg("PWOSPF: Hello packet timeout");
 							updateLSU = 1;						
 						}
@@ -59,14 +74,14 @@ void pwospfTimeoutHelloThread(void *dummy){
 		}	
 		pthread_rwlock_unlock(&subsystem->if_lock);
 		
-		if(updateLSU){ 
-			sendLSU();
-		}		
+		if(updateLSU) neighborsDown(dead, dead_cnt);
+		free(dead);
 		sleep(PWOSPF_HELLO_REFRESH);
 	}
 }
 
 // removes all disabled interfaces from the neighbor list
+// called whenever an interface changes, so our LSU is rebuilt as well
 void updateNeighbors(){
 	int i;
 	struct sr_instance* sr = get_sr();
@@ -90,7 +105,7 @@ void updateNeighbors(){
 					else{
 						iface->neighbor_list = nbor->next;
 						free(nbor);
-						nbor = nbor->next;
+						nbor = iface->neighbor_list;
 					}
 				}
 				else{
@@ -101,6 +116,278 @@ void updateNeighbors(){
 		pthread_mutex_unlock(&iface->neighbor_lock);
 	}	
 	pthread_rwlock_unlock(&subsystem->if_lock);
+
+	invalidateLSU();
+}
+
+// monotonic time in ms, for the throttle and the liveness echoes
+long long pwospfTime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// asks for update_rtable(), which runs on the throttle thread once the hold time is over
+// all requests made in the meantime are served by that one run
+void scheduleSPF(){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_throttle* th = &subsystem->pwospf.throttle;
+	long long now = pwospfTime();
+
+	pthread_mutex_lock(&th->lock);
+	th->spf_triggers++;
+	if(th->spf_pending){
+		th->spf_coalesced++;
+	}
+	else{
+		th->spf_pending = 1;
+		th->spf_event = now;
+		if(now - th->spf_last >= SPF_QUIET) th->spf_hold = 0;
+		pthread_cond_signal(&th->cond);
+	}
+	pthread_mutex_unlock(&th->lock);
+}
+
+// asks for an LSU to be sent, right away unless we sent one less than LSU_MIN_INTERVAL ago
+void scheduleLSU(){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_throttle* th = &subsystem->pwospf.throttle;
+	long long now = pwospfTime();
+
+	pthread_mutex_lock(&th->lock);
+	th->lsu_triggers++;
+	if(th->lsu_pending){
+		th->lsu_coalesced++;
+		pthread_mutex_unlock(&th->lock);
+		return;
+	}
+	if(now - th->lsu_last >= LSU_MIN_INTERVAL){
+		th->lsu_last = now;
+		pthread_mutex_unlock(&th->lock);
+		sendLSU();
+		return;
+	}
+	th->lsu_pending = 1;
+	pthread_cond_signal(&th->cond);
+	pthread_mutex_unlock(&th->lock);
+}
+
+// Thread that runs the SPF and sends the LSUs scheduled above when they are due
+void pwospfThrottleThread(void* dummy){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_throttle* th = &subsystem->pwospf.throttle;
+
+	pthread_mutex_lock(&th->lock);
+	while(1){
+		long long now = pwospfTime();
+		long long spf_due = th->spf_event + SPF_INITIAL_DELAY;
+		long long lsu_due = th->lsu_last + LSU_MIN_INTERVAL;
+		long long due = -1;
+
+		if(th->spf_last + th->spf_hold > spf_due) spf_due = th->spf_last + th->spf_hold;
+		if(th->spf_pending) due = spf_due;
+		if(th->lsu_pending && (due < 0 || lsu_due < due)) due = lsu_due;
+
+		if(due < 0){
+			pthread_cond_wait(&th->cond, &th->lock);
+			continue;
+		}
+		if(now < due){
+			struct timespec ts;
+			ts.tv_sec = due / 1000;
+			ts.tv_nsec = (due % 1000) * 1000000;
+			pthread_cond_timedwait(&th->cond, &th->lock, &ts);
+			continue;
+		}
+
+		if(th->spf_pending && spf_due <= now){
+			th->spf_pending = 0;
+			pthread_mutex_unlock(&th->lock);
+			update_rtable();
+			pthread_mutex_lock(&th->lock);
+			th->spf_runs++;
+			th->spf_last = pwospfTime();
+			if(th->spf_hold == 0) th->spf_hold = SPF_HOLD;
+			else if(2*th->spf_hold < SPF_MAX_WAIT) th->spf_hold *= 2;
+			else th->spf_hold = SPF_MAX_WAIT;
+		}
+		if(th->lsu_pending && lsu_due <= now){
+			th->lsu_pending = 0;
+			th->lsu_last = now;
+			pthread_mutex_unlock(&th->lock);
+			sendLSU();
+			pthread_mutex_lock(&th->lock);
+		}
+	}
+}
+
+// sets how often the liveness echoes go out (ms, 0 turns them off) and after how many
+// missed ones a neighbor is down; the sessions start over
+void setEcho(int interval, int mult){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_echo* ec = &subsystem->pwospf.echo;
+
+	pthread_mutex_lock(&ec->lock);
+	ec->interval = interval > 0 ? interval : 0;
+	ec->mult = mult > 0 ? mult : 1;
+	ec->changed = 1;
+	pthread_cond_signal(&ec->cond);
+	pthread_mutex_unlock(&ec->lock);
+}
+
+// sends an echo to nbor out of the interface with ip ifIP and MAC ifMAC, returns 1 if it went out
+// caller should hold the neighbor lock
+static int sendEcho(const char* ifName, uint32_t ifIP, const uint8_t* ifMAC, struct pwospf_neighbor* nbor){
+	int i = 0;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	uint8_t p[ECHO_LEN];
+	uint8_t* ip = &p[ETHERNET_HEADER_LENGTH];
+	uint8_t* udp = &ip[IP_HEADER_LENGTH];
+	uint8_t *dstMAC = arpLookupTree(subsystem->arpTree, nbor->ip);
+
+	if(dstMAC == NULL){
+		sendARPrequest(sr, ifName, nbor->ip);
+		return 0;
+	}
+
+	// Ethernet header
+	memcpy(p, dstMAC, 6);
+	memcpy(&p[6], ifMAC, 6);
+	p[12] = 8; p[13] = 0;
+	free(dstMAC);
+
+	// IP header, from and to us
+	ip[i++] = 69; // version and length
+	ip[i++] = 0; // TOS
+	*((uint16_t*)&ip[i]) = htons(ECHO_LEN - ETHERNET_HEADER_LENGTH); i+=2; // total length
+	ip[i++] = (uint8_t)(rand() % 256); ip[i++] = (uint8_t)(rand() % 256); // identification
+	ip[i++] = 0; ip[i++] = 0; // fragmentation
+	ip[i++] = 255; // TTL
+	ip[i++] = 17; // protocol (UDP)
+	ip[i++] = 0; ip[i++] = 0; // checksum (calculated later)
+	int2byteIP(ifIP, &ip[12]);
+	int2byteIP(ifIP, &ip[16]);
+	uint16_t ipChksum = checksum((uint16_t*)ip, IP_HEADER_LENGTH);
+	ip[10] = (htons(ipChksum) >> 8) & 0xff;
+	ip[11] = (htons(ipChksum) & 0xff);
+
+	// UDP header, no checksum, and which neighbor it is for
+	*((uint16_t*)&udp[0]) = htons(ECHO_PORT);
+	*((uint16_t*)&udp[2]) = htons(ECHO_PORT);
+	*((uint16_t*)&udp[4]) = htons(16);
+	udp[6] = 0; udp[7] = 0;
+	*((uint32_t*)&udp[8]) = htonl(nbor->ip);
+	*((uint32_t*)&udp[12]) = htonl(subsystem->pwospf.routerID);
+
+	sr_integ_low_level_output(sr, p, ECHO_LEN, ifName);
+	return 1;
+}
+
+// Thread that sends the liveness echoes and takes down the neighbors whose echoes stopped coming back
+void pwospfEchoThread(void* dummy){
+	int i;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_echo* ec = &subsystem->pwospf.echo;
+	long long next = 0;
+
+	pthread_mutex_lock(&ec->lock);
+	while(1){
+		long long now = pwospfTime();
+		long long due = ec->interval > 0 && subsystem->ospf_enabled ? next : now + 1000;
+		int reset = ec->changed, detect = ec->interval * ec->mult;
+		unsigned long sent = 0;
+
+		if(reset) due = next = now;
+		if(now < due){
+			struct timespec ts;
+			ts.tv_sec = due / 1000;
+			ts.tv_nsec = (due % 1000) * 1000000;
+			pthread_cond_timedwait(&ec->cond, &ec->lock, &ts);
+			continue;
+		}
+		ec->changed = 0;
+		if(ec->interval <= 0 || !subsystem->ospf_enabled) continue;
+		next = now + ec->interval;
+		pthread_mutex_unlock(&ec->lock);
+
+		uint32_t *dead = NULL; // IPs of the neighbors that went quiet
+		int dead_cnt = 0;
+
+		pthread_rwlock_rdlock(&subsystem->if_lock);
+		for(i = 0; i < subsystem->num_ifaces; i++){
+			struct sr_vns_if* intf = &subsystem->ifaces[i];
+			struct pwospf_if* iface = findPWOSPFif(&subsystem->pwospf, intf->ip);
+			if(iface == NULL || !intf->enabled) continue;
+			pthread_mutex_lock(&iface->neighbor_lock);
+				struct pwospf_neighbor** link = &iface->neighbor_list;
+				while(*link){
+					struct pwospf_neighbor* nbor = *link;
+					if(reset) nbor->echoUp = 0;
+					if(nbor->echoUp && now - nbor->echoLast > detect){
+						dead = (uint32_t*)realloc(dead, sizeof(uint32_t)*(dead_cnt+1));
+						dead[dead_cnt++] = nbor->ip;
+						*link = nbor->next;
+						free(nbor);
+						dbgMsg("PWOSPF: liveness echo timeout");
+						continue;
+					}
+					// end hosts and gateways do not take part
+					if(nbor->id != 0) sent += sendEcho(intf->name, intf->ip, intf->addr, nbor);
+					link = &nbor->next;
+				}
+			pthread_mutex_unlock(&iface->neighbor_lock);
+		}
+		pthread_rwlock_unlock(&subsystem->if_lock);
+
+		if(dead_cnt) neighborsDown(dead, dead_cnt);
+		free(dead);
+
+		pthread_mutex_lock(&ec->lock);
+		ec->sent += sent;
+		ec->downs += dead_cnt;
+	}
+}
+
+// an echo we sent came back from the neighbor it was for: its session is up
+void processEcho(const char* interface, uint8_t* packet, unsigned len){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	const uint8_t* ip = &packet[ETHERNET_HEADER_LENGTH];
+	const uint8_t* udp = &ip[(ip[0] & 0x0F)*4];
+	struct pwospf_if* iface;
+	int found = 0;
+
+	if(len < (udp - packet) + 16 || memcmp(&ip[12], &ip[16], 4)){
+		dbgMsg("Not our liveness echo, dropping the packet");
+		return;
+	}
+	if(ntohl(*(uint32_t*)&udp[12]) != subsystem->pwospf.routerID) return;
+
+	pthread_rwlock_rdlock(&subsystem->if_lock);
+	iface = findPWOSPFif(&subsystem->pwospf, ntohl(*(uint32_t*)&ip[12]));
+	if(iface){
+		pthread_mutex_lock(&iface->neighbor_lock);
+		struct pwospf_neighbor* nbor = findOSPFNeighbor(iface, ntohl(*(uint32_t*)&udp[8]));
+		if(nbor){
+			nbor->echoUp = 1;
+			nbor->echoLast = pwospfTime();
+			found = 1;
+		}
+		pthread_mutex_unlock(&iface->neighbor_lock);
+	}
+	pthread_rwlock_unlock(&subsystem->if_lock);
+
+	if(found){
+		pthread_mutex_lock(&subsystem->pwospf.echo.lock);
+		subsystem->pwospf.echo.received++;
+		pthread_mutex_unlock(&subsystem->pwospf.echo.lock);
+	}
 }
 
 // Thread that sends LSU packets
@@ -153,19 +440,19 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 
 	// CHECKSUM
 	uint32_t ospfLen = len - (ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH);
-	uint8_t* ospfPacket = (uint8_t*)malloc(ospfLen*sizeof(uint8_t));
-	memcpy(ospfPacket, &packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH], ospfLen);
-    for(i = 16; i < 24; i++) ospfPacket[i] = 0; // set Authentication fields to 0 to check checksum
+	const uint8_t* ospfPacket = &packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH];
     
-   	// check checksum
+   	// check checksum, in place
 	uint16_t word16, sum16;
 	uint32_t sum = 0;
 	    
 	// make 16 bit words out of every two adjacent 8 bit words in the packet
-	// and add them up
+	// and add them up, the Authentication fields (bytes 16-23) count as 0
 	for (i = 0; i < ospfLen; i+=2) {
+	    if (i == 16) i = 24;
+	    if (i >= ospfLen) break;
 	    word16 = ospfPacket[i] & 0xFF;
-	    word16 = (word16 << 8) + (ospfPacket[i+1] & 0xFF);
+	    word16 = (word16 << 8) + (i + 1 < ospfLen ? ospfPacket[i+1] & 0xFF : 0);
 	    sum += (uint32_t)word16;	
 	}
 
@@ -173,8 +460,6 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 	while (sum >> 16)
 	    sum = (sum & 0xFFFF) + (sum >> 16);
 	sum16 = ~((uint16_t)(sum & 0xFFFF));
-
-	free(ospfPacket);
 	
 	if(sum16 != 0) {
 	    /* checksum error
@@ -198,7 +483,7 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 	}
 	
 
-	uint32_t srcIP = packet[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
+	uint32_t srcIP = (uint32_t)packet[ETHERNET_HEADER_LENGTH + 12] * 256 * 256 * 256 +
 					 packet[ETHERNET_HEADER_LENGTH + 13] * 256 * 256 +
 					 packet[ETHERNET_HEADER_LENGTH + 14] * 256 +
 					 packet[ETHERNET_HEADER_LENGTH + 15] * 1;    				
@@ -227,7 +512,7 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 		    return;
 		}
 		
-		int updateTable = 0;		
+		int updateTable = 0, newNeighbor = 0;
 		pthread_mutex_lock(&iface->neighbor_lock);
 			struct pwospf_neighbor* nbor = findOSPFNeighbor(iface, srcIP);
 			if(nbor){
@@ -247,17 +532,25 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 				nbor->ip = srcIP;
 				nbor->nm = iface->netmask;
 				nbor->lastHelloTime = time(NULL);
+				nbor->echoUp = 0;
+				nbor->echoLast = 0;
 				nbor->next = iface->neighbor_list;
 				iface->neighbor_list = nbor;
 				updateTable = 1;
+				newNeighbor = 1;
 			}
 		pthread_mutex_unlock(&iface->neighbor_lock);
 		pthread_rwlock_unlock(&subsystem->if_lock);	
+
+		// it may have timed out before, see pwospfTimeoutHelloThread()
+		if(newNeighbor)
+			rtable_nexthop_down(&subsystem->rtable, srcIP, NULL, 0);
 		
 		// if neighbors have been updated
 		if(updateTable){
-			update_rtable();
-			sendLSU();
+			invalidateLSU();
+			scheduleSPF();
+			scheduleLSU();
 		}
 	}
 	else if(packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 1] == 4){ // LSU packet
@@ -277,73 +570,29 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 			return;
 		}
 		
-		if(len < ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 8 + 12*advNum){
-			printf("LSU len: %u, advNum: %u\n", len, advNum);
-			errorMsg("LSU packet too short. Dropping the packet");
+		if(len < ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 8 + 12*(uint64_t)advNum){
+			logLimited(LOG_LVL_ERR, "LSU packet too short (%u bytes for %u ads). Dropping the packet", len, advNum);
 			return;
 		}
 
 
 		// create topology data structures					
-		topo_router *head = (topo_router*)malloc(sizeof(topo_router));
-		head->router_id = routerID;
+		topo_router *head = new_lsa(routerID, advNum);
 		head->area_id = areaID;
 		head->last_seq = seqNum;
 		head->last_update_time = time(NULL);
-		head->num_ads = advNum;
-		head->next = NULL;
-		head->prev = NULL;
-		head->ads = NULL;
 		
 		for(i = 0; i < advNum; i++){
-			lsu_ad *node = (lsu_ad*)malloc(sizeof(lsu_ad));
+			lsu_ad *node = &head->ads[i];
 			node->subnet = ntohl(*(uint32_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 8 + i*12 + 0]));
 			node->mask = ntohl(*(uint32_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 8 + i*12 + 4]));
 			node->router_id = ntohl(*(uint32_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 8 + i*12 + 8]));
-			node->next = NULL;
-			node->prev = NULL;
-			
-			if(head->ads == NULL){
-				head->ads = node;
-				continue;
-			}
-			
-			// insert node into sorted list
-			lsu_ad *tmp = head->ads;
-			while(tmp){
-				if(node->router_id < tmp->router_id) break;
-				tmp = tmp->next;
-			}
-			if(tmp==NULL){ // find last list element and insert after it
-				tmp = head->ads;
-				while(tmp){
-					if(tmp->next){
-						tmp = tmp->next;
-					}
-					else{
-						break;
-					}
-				}
-				tmp->next = node;
-				node->prev = tmp;
-			}
-			else if(tmp->prev == NULL){ // insert before first element
-				node->next = tmp;
-				tmp->prev = node;
-				head->ads = node;
-			}
-			else{
-				node->next = tmp;
-				node->prev = tmp->prev;
-				tmp->prev->next = node;
-				tmp->prev = node;
-			}
 		}
-		
+		head->num_ads = advNum;
 		
 		// update_lsu returns 1 if routing table recalculation is neccessary		
 		if( update_lsu(head) ){
-			update_rtable();
+			scheduleSPF();
 		}
 		// forward the packet on all interfaces (except the incoming one)		
 		forwardLSUpacket(interface, packet, len);
@@ -351,84 +600,103 @@ void processPWOSPF(const char* interface, uint8_t* packet, unsigned len){
 	}
 }
 
-// forwards LSU packets to all interfaces except the incoming one, also decrements and checks TTL
-void forwardLSUpacket(const char* incoming_if, uint8_t* packet, unsigned len){
+// sends the OSPF packet in body to every neighboring router, except over skip_if
+// every copy only gets its own Ethernet and IP headers, made from ip_hdr with the neighbor
+// as destination and, if own_src, the outgoing interface as source; body is never copied
+static void floodLSU(const uint8_t* ip_hdr, int own_src, struct sharedBuf* body, const char* skip_if){
 	int i;
 	struct sr_instance* sr = get_sr();
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	struct pwospf_if* iface;
+	uint8_t hdr[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH];
+	uint8_t* ip = &hdr[ETHERNET_HEADER_LENGTH];
 
-	// update LSU TTL
-	uint16_t lsu_ttl = ntohs(*(uint16_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 2]));		
-	lsu_ttl--;
-	*(uint16_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 2]) = htons(lsu_ttl);
-	
-	if(lsu_ttl <= 0){
-		dbgMsg("LSU TTL expired!");
-		return;
-	}		
-
-	// save OSPF auth fileds
-	uint8_t tmp_auth[8];
-	memcpy(tmp_auth, &packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 16], 8);
-	memset(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 16], 0, 8);
-
-	// OSPF checksum (make sure Authentication fileds are set to 0 here)
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 12] = 0; // checksum
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 13] = 0; // checksum
-	uint16_t ospfChksum = 
-		checksum(	(uint16_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH]), 
-					len - (ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH) );
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 12] = (htons(ospfChksum) >> 8) & 0xff; // OSPF checksum 
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 13] = (htons(ospfChksum) & 0xff); // OSPF checksum
-	
-	// restore OSPF auth fields
-	memcpy(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 16], tmp_auth, 8);
+	memcpy(ip, ip_hdr, IP_HEADER_LENGTH);
 
-
-	// find the incoming interface by name and skip it
 	pthread_rwlock_rdlock(&subsystem->if_lock);
 	for(i = 0; i < subsystem->num_ifaces; i++){
-		if (!strcmp(incoming_if, subsystem->ifaces[i].name) || !(subsystem->ifaces[i].enabled) ){
+		if ( (skip_if && !strcmp(skip_if, subsystem->ifaces[i].name)) || !(subsystem->ifaces[i].enabled) ){
 			continue;
 		}
-			
+
+		// src ip
+		if(own_src) int2byteIP(subsystem->ifaces[i].ip, &ip[12]); // source IP
+
 		iface = findPWOSPFif(&subsystem->pwospf, subsystem->ifaces[i].ip);
+		if(iface == NULL) continue;
 		pthread_mutex_lock(&iface->neighbor_lock);
-		struct pwospf_neighbor* nbor = iface->neighbor_list;
-		while(nbor){		
+		struct pwospf_neighbor* nbor;
+		for(nbor = iface->neighbor_list; nbor; nbor = nbor->next){
 			// do not send to gw
 			if(nbor->id == 0) continue;
 
 			// dest IP
-			int2byteIP(nbor->ip, &packet[ETHERNET_HEADER_LENGTH + 16]); // destination IP
+			int2byteIP(nbor->ip, &ip[16]); // destination IP
 
 			// IP checksum
-			packet[ETHERNET_HEADER_LENGTH + 10] = 0; packet[ETHERNET_HEADER_LENGTH + 11] = 0; // checksum (calculated later)
-			uint16_t ipChksum = checksum((uint16_t*)(&packet[ETHERNET_HEADER_LENGTH]), IP_HEADER_LENGTH);
-			packet[ETHERNET_HEADER_LENGTH + 10] = (htons(ipChksum) >> 8) & 0xff; // IP checksum 
-			packet[ETHERNET_HEADER_LENGTH + 11] = (htons(ipChksum) & 0xff); // IP checksum
-		
+			ip[10] = 0; ip[11] = 0; // checksum (calculated later)
+			uint16_t ipChksum = checksum((uint16_t*)ip, IP_HEADER_LENGTH);
+			ip[10] = (htons(ipChksum) >> 8) & 0xff; // IP checksum 
+			ip[11] = (htons(ipChksum) & 0xff); // IP checksum
+
 			// send packet
-			sendIPpacket(sr, subsystem->ifaces[i].name, nbor->ip, packet, len);
-			
-			nbor = nbor->next;
-		}	
+			sendIPpacketShared(sr, nbor->ip, hdr, sizeof(hdr), body);
+		}
 		pthread_mutex_unlock(&iface->neighbor_lock);
 	}
 	pthread_rwlock_unlock(&subsystem->if_lock);
 }
 
-// generate and send a LSU packet from all enabled interfaces 
-void sendLSU(){
-	pthread_mutex_lock(&lsu_reentrant);
-	static uint16_t sequence = 0; // stupid static counter makes this function non-reentrant
+// patches the 16 bit checksum at sum for a 16 bit word that changed from old_val to new_val,
+// rather than recomputing it over the whole packet (RFC 1624)
+static void patchChecksum(uint8_t* sum, uint16_t old_val, uint16_t new_val){
+	uint32_t s = (~((sum[0] << 8) | sum[1]) & 0xffff) + (~old_val & 0xffff) + new_val;
+	while (s >> 16)
+	    s = (s & 0xFFFF) + (s >> 16);
+	sum[0] = (~s >> 8) & 0xff;
+	sum[1] = ~s & 0xff;
+}
+
+// forwards LSU packets to all interfaces except the incoming one, also decrements and checks TTL
+void forwardLSUpacket(const char* incoming_if, uint8_t* packet, unsigned len){
+	uint8_t* ospf = &packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH];
+
+	// update LSU TTL
+	uint16_t lsu_ttl = ntohs(*(uint16_t*)(&ospf[OSPF_HEADER_LENGTH + 2]));
+	if(lsu_ttl <= 1){
+		dbgMsg("LSU TTL expired!");
+		return;
+	}		
+	*(uint16_t*)(&ospf[OSPF_HEADER_LENGTH + 2]) = htons(lsu_ttl - 1);
+
+	// OSPF checksum, patched for the new TTL rather than recomputed
+	patchChecksum(&ospf[12], lsu_ttl, lsu_ttl - 1);
+
+	// one copy of the OSPF part for all the neighbors
+	struct sharedBuf* body = newSharedBuf(len - (ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH));
+	memcpy(body->data, ospf, body->len);
+	floodLSU(&packet[ETHERNET_HEADER_LENGTH], 0, body, incoming_if);
+	releaseSharedBuf(body);
+}
+
+// our LSU has to be rebuilt: neighbors, interfaces or static default routes changed
+// cheap enough to call with any lock held
+void invalidateLSU(){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	__sync_fetch_and_add(&subsystem->pwospf.lsu_gen, 1);
+}
+
+// builds the OSPF part of our LSU with the given sequence number, checksum included
+// caller should hold lsu_reentrant
+static struct sharedBuf* buildLSU(uint16_t sequence){
 	int i;
 	struct sr_instance* sr = get_sr();
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-	int len = ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + OSPF_HEADER_LENGTH + 8;
+	int len = OSPF_HEADER_LENGTH + 8;
 	uint32_t advCnt = 0;
 	uint8_t *packet;
+	struct sharedBuf* body;
 
 	struct pwospf_if* iface;
 	
@@ -445,44 +713,32 @@ void sendLSU(){
 				nbor = nbor->next;
 			}
 			pthread_mutex_unlock(&iface->neighbor_lock);		
-			pthread_mutex_lock(&rtable_lock);
+			pthread_mutex_lock(&subsystem->rtable_lock);
  		   	rtableNode *rtable = subsystem->rtable;
     		while(rtable){
-	    		if(rtable->ip == 0 && rtable->netmask == 0 && rtable->is_static && !strcmp(rtable->output_if[0], getIfName(iface->ip))){
+	    		if(rtable->ip == 0 && rtable->netmask == 0 && rtable->is_static && rtable->nh != NH_NONE && !strcmp(nh_group(rtable->nh)->hop[0].output_if, getIfName(iface->ip))){
 					advCnt++;
 					break;
 				}
 	    		rtable = rtable->next;
 	    	}
-	    	pthread_mutex_unlock(&rtable_lock);
+	    	pthread_mutex_unlock(&subsystem->rtable_lock);
 
 		}			
 		iface = iface->next;
 	}	
 	pthread_rwlock_unlock(&subsystem->if_lock);
 
-	// calculate packet length
+	// calculate packet length, the OSPF part goes to all neighbors as it is
 	len += advCnt * 12;
-	packet = (uint8_t*)malloc(len*sizeof(uint8_t));
-
+	body = newSharedBuf(len);
+	packet = body->data;
 
-	// IP header
-	i = ETHERNET_HEADER_LENGTH;
-	packet[i++] = 69; // version and length 
-	packet[i++] = 0; // TOS
-	*((uint16_t*)&packet[i]) = htons(len - ETHERNET_HEADER_LENGTH); i+=2; // total length
-	packet[i++] = (uint8_t)(rand() % 256); packet[i++] = (uint8_t)(rand() % 256); // identification
-	packet[i++] = 0; packet[i++] = 0; // fragmentation
-	packet[i++] = 64; // TTL
-	packet[i++] = 89; // protocol (OSPF)
-	packet[i++] = 0; packet[i++] = 0; // checksum (calculated later)
-	i += 4; // place for src IP
-	i += 4; // place for des IP
-	
 	// OSPF header
+	i = 0;
 	packet[i++] = 2; // version
 	packet[i++] = 4; // type (LSU)
-	*((uint16_t*)&packet[i]) = htons(len - ETHERNET_HEADER_LENGTH - IP_HEADER_LENGTH); i+=2; // ospf length (header + data)
+	*((uint16_t*)&packet[i]) = htons(len); i+=2; // ospf length (header + data)
 	*((uint32_t*)&packet[i]) = htonl(subsystem->pwospf.routerID); i+=4; // router ID
 	*((uint32_t*)&packet[i]) = htonl(subsystem->pwospf.areaID); i+=4; // area ID
 	packet[i++] = 0; packet[i++] = 0; // checksum (calculated later)
@@ -516,10 +772,10 @@ void sendLSU(){
 			pthread_mutex_unlock(&iface->neighbor_lock);		
 
 			// advertise default route if present	
-			pthread_mutex_lock(&rtable_lock);
+			pthread_mutex_lock(&subsystem->rtable_lock);
  		   	rtableNode *rtable = subsystem->rtable;
     		while(rtable){
-	    		if(rtable->ip == 0 && rtable->netmask == 0 && rtable->is_static && !strcmp(rtable->output_if[0], getIfName(iface->ip))){
+	    		if(rtable->ip == 0 && rtable->netmask == 0 && rtable->is_static && rtable->nh != NH_NONE && !strcmp(nh_group(rtable->nh)->hop[0].output_if, getIfName(iface->ip))){
 					*((uint32_t*)&packet[i]) = htonl(0); i+=4; // subnet
 					*((uint32_t*)&packet[i]) = htonl(0); i+=4; // mask
 					*((uint32_t*)&packet[i]) = htonl(0); i+=4; // router ID							
@@ -527,7 +783,7 @@ void sendLSU(){
 				}
 	    		rtable = rtable->next;
 	    	}
-	    	pthread_mutex_unlock(&rtable_lock);			
+	    	pthread_mutex_unlock(&subsystem->rtable_lock);			
 							
 		}
 			
@@ -536,53 +792,72 @@ void sendLSU(){
 	pthread_rwlock_unlock(&subsystem->if_lock);
 	
 	// OSPF checksum (make sure Authentication fileds are set to 0 here)
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 12] = 0; // checksum
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 13] = 0; // checksum
-	uint16_t ospfChksum = 
-		checksum(	(uint16_t*)(&packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH]), 
-					len - (ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH) );
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 12] = (htons(ospfChksum) >> 8) & 0xff; // OSPF checksum 
-	packet[ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH + 13] = (htons(ospfChksum) & 0xff); // OSPF checksum
-	
-	// send the packet out	
-	pthread_rwlock_rdlock(&subsystem->if_lock);
-	for(i = 0; i < subsystem->num_ifaces; i++){
-		if ( !(subsystem->ifaces[i].enabled) ){
-			continue;
-		}
-		
-		// src ip
-		int2byteIP(subsystem->ifaces[i].ip, &packet[ETHERNET_HEADER_LENGTH + 12]); // source IP
-		
-		iface = findPWOSPFif(&subsystem->pwospf, subsystem->ifaces[i].ip);
-		pthread_mutex_lock(&iface->neighbor_lock);
-		struct pwospf_neighbor* nbor = iface->neighbor_list;
-		while(nbor){
-			// do not send to gw
-			if(nbor->id == 0) continue;
-					
-			// dest IP
-			int2byteIP(nbor->ip, &packet[ETHERNET_HEADER_LENGTH + 16]); // destination IP
+	uint16_t ospfChksum = checksum((uint16_t*)packet, len);
+	packet[12] = (htons(ospfChksum) >> 8) & 0xff; // OSPF checksum 
+	packet[13] = (htons(ospfChksum) & 0xff); // OSPF checksum
 
-			// IP checksum
-			packet[ETHERNET_HEADER_LENGTH + 10] = 0; packet[ETHERNET_HEADER_LENGTH + 11] = 0; // checksum (calculated later)
-			uint16_t ipChksum = checksum((uint16_t*)(&packet[ETHERNET_HEADER_LENGTH]), IP_HEADER_LENGTH);
-			packet[ETHERNET_HEADER_LENGTH + 10] = (htons(ipChksum) >> 8) & 0xff; // IP checksum 
-			packet[ETHERNET_HEADER_LENGTH + 11] = (htons(ipChksum) & 0xff); // IP checksum
-		
-			// send packet
-			sendIPpacket(sr, subsystem->ifaces[i].name, nbor->ip, packet, len);
+	return body;
+}
 
-			nbor = nbor->next;
-		}
-		pthread_mutex_unlock(&iface->neighbor_lock);
+// send our LSU packet from all enabled interfaces
+// the LSU is only built again after invalidateLSU(), a refresh just gets the next sequence number
+void sendLSU(){
+	int i, rebuilt = 0;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct pwospf_router* pw = &subsystem->pwospf;
+	uint8_t ip_hdr[IP_HEADER_LENGTH];
+	struct sharedBuf* body;
+
+	pthread_mutex_lock(&pw->lsu_reentrant);
+	unsigned gen = pw->lsu_gen;
 
+	// anything invalidating the LSU while it is built makes the next send build it again
+	__sync_synchronize();
+	if(pw->lsu == NULL || pw->lsu_built != gen){
+		if(pw->lsu) releaseSharedBuf(pw->lsu);
+		pw->lsu = buildLSU(pw->lsu_seq);
+		pw->lsu_built = gen;
+		rebuilt = 1;
 	}
-	pthread_rwlock_unlock(&subsystem->if_lock);
+	else{
+		// copies of the last LSU may still wait for ARP, leave them alone
+		if(pw->lsu->refcnt > 1){
+			body = newSharedBuf(pw->lsu->len);
+			memcpy(body->data, pw->lsu->data, body->len);
+			releaseSharedBuf(pw->lsu);
+			pw->lsu = body;
+		}
+		uint8_t* seq = &pw->lsu->data[OSPF_HEADER_LENGTH];
+		uint16_t old_seq = ntohs(*(uint16_t*)seq);
+		*(uint16_t*)seq = htons(pw->lsu_seq);
+		patchChecksum(&pw->lsu->data[12], old_seq, pw->lsu_seq);
+	}
+	body = pw->lsu;
 
-	sequence++;
-	free(packet);
-	pthread_mutex_unlock(&lsu_reentrant);
+	// IP header (addresses and checksum are filled in for each neighbor)
+	i = 0;
+	ip_hdr[i++] = 69; // version and length 
+	ip_hdr[i++] = 0; // TOS
+	*((uint16_t*)&ip_hdr[i]) = htons(IP_HEADER_LENGTH + body->len); i+=2; // total length
+	ip_hdr[i++] = (uint8_t)(rand() % 256); ip_hdr[i++] = (uint8_t)(rand() % 256); // identification
+	ip_hdr[i++] = 0; ip_hdr[i++] = 0; // fragmentation
+	ip_hdr[i++] = 64; // TTL
+	ip_hdr[i++] = 89; // protocol (OSPF)
+	ip_hdr[i++] = 0; ip_hdr[i++] = 0; // checksum (calculated later)
+	memset(&ip_hdr[i], 0, 8); // place for src and dst IP
+	
+	// send the packet out	
+	floodLSU(ip_hdr, 1, body, NULL);
+
+	pw->lsu_seq++;
+	pthread_mutex_unlock(&pw->lsu_reentrant);
+
+	pthread_mutex_lock(&pw->throttle.lock);
+	pw->throttle.lsu_last = pwospfTime();
+	pw->throttle.lsu_sent++;
+	if(rebuilt) pw->throttle.lsu_rebuilt++;
+	pthread_mutex_unlock(&pw->throttle.lock);
 }
 
 // sending a Hello packet out the interface with ifIP
@@ -687,6 +962,9 @@ void initPWOSPF(struct sr_instance* sr){
 	subsystem->pwospf.areaID = AREA_ID; // this should be the same for all routers
 	subsystem->pwospf.lsuint = LSUINT;
 	subsystem->pwospf.if_list = NULL;
+	subsystem->pwospf.lsu = NULL;
+	subsystem->pwospf.lsu_gen = subsystem->pwospf.lsu_built = 0;
+	subsystem->pwospf.lsu_seq = 0;
 
 	pthread_rwlock_rdlock(&subsystem->if_lock);	
 	for(i = 0; i < subsystem->num_ifaces; i++){
@@ -702,7 +980,24 @@ void initPWOSPF(struct sr_instance* sr){
 	}
 	pthread_rwlock_unlock(&subsystem->if_lock);
 	
-	pthread_mutex_init(&lsu_reentrant, NULL);
+	pthread_mutex_init(&subsystem->pwospf.lsu_reentrant, NULL);
+
+	// SPF and LSU throttle, timed on the monotonic clock
+	pthread_condattr_t cond_attr;
+	memset(&subsystem->pwospf.throttle, 0, sizeof(struct pwospf_throttle));
+	subsystem->pwospf.throttle.spf_last = subsystem->pwospf.throttle.lsu_last = -SPF_QUIET;
+	pthread_mutex_init(&subsystem->pwospf.throttle.lock, NULL);
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&subsystem->pwospf.throttle.cond, &cond_attr);
+
+	// liveness echoes, on the same clock
+	memset(&subsystem->pwospf.echo, 0, sizeof(struct pwospf_echo));
+	subsystem->pwospf.echo.interval = ECHO_INTERVAL;
+	subsystem->pwospf.echo.mult = ECHO_MULT;
+	pthread_mutex_init(&subsystem->pwospf.echo.lock, NULL);
+	pthread_cond_init(&subsystem->pwospf.echo.cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
 		
 }
 
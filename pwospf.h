@@ -12,11 +12,71 @@
 
 #define AREA_ID 0
 
+// SPF throttling, in ms: the first run after a quiet period waits SPF_INITIAL_DELAY
+// for more events, then each run waits at least the hold time after the last one,
+// starting at SPF_HOLD and doubling up to SPF_MAX_WAIT; SPF_QUIET without events resets it
+#define SPF_INITIAL_DELAY 50
+#define SPF_HOLD 200
+#define SPF_MAX_WAIT 5000
+#define SPF_QUIET (2*SPF_MAX_WAIT)
+
+#define LSU_MIN_INTERVAL 1000 // at least this many ms between two LSUs we send
+
+// BFD-style liveness in echo mode (RFC 5880/5881 in spirit): every ECHO_INTERVAL ms each
+// neighbor gets a UDP packet to ECHO_PORT that is addressed to ourselves, so it just forwards
+// it back; once echoes come back, ECHO_MULT intervals without one take the neighbor down
+#define ECHO_PORT 3785
+#define ECHO_INTERVAL 50
+#define ECHO_MULT 3
+#define ECHO_LEN (14 + 20 + 8 + 8) // ethernet, ip, udp, neighbor ip and our router ID
+
+struct pwospf_echo{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int interval; // ms, 0 - off
+	int mult;
+	int changed; // sessions start over with the new settings
+
+	unsigned long sent;
+	unsigned long received;
+	unsigned long downs; // neighbors taken down for missing echoes
+};
+
+struct pwospf_throttle{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int spf_pending;
+	long long spf_event; // first event the pending run waits for
+	long long spf_last; // last run
+	int spf_hold; // 0 when quiet
+	int lsu_pending;
+	long long lsu_last; // last LSU sent
+
+	unsigned long spf_triggers;
+	unsigned long spf_coalesced; // triggers that found a run already pending
+	unsigned long spf_runs;
+	unsigned long lsu_triggers;
+	unsigned long lsu_coalesced;
+	unsigned long lsu_sent;
+	unsigned long lsu_rebuilt; // sent LSUs that had to be built from scratch
+};
+
 struct pwospf_router{
 	uint32_t routerID;
 	uint32_t areaID;
 	uint16_t lsuint;
 	struct pwospf_if* if_list; 
+	struct pwospf_throttle throttle;
+	struct pwospf_echo echo;
+
+	pthread_mutex_t lsu_reentrant; // makes sendLSU() reentrant (well, not really, but at least thread safe)
+	// our own LSU (OSPF part, checksummed), kept between sends under lsu_reentrant;
+	// invalidateLSU() bumps lsu_gen and the next sendLSU() rebuilds it, otherwise
+	// only the sequence number and the checksum are patched
+	struct sharedBuf* lsu;
+	unsigned lsu_gen;
+	unsigned lsu_built; // lsu_gen the cached LSU was built at
+	uint16_t lsu_seq; // sequence number of the next LSU
 };
 
 struct pwospf_neighbor{
@@ -24,6 +84,8 @@ struct pwospf_neighbor{
 	uint32_t ip;
 	uint32_t nm;
 	time_t lastHelloTime;
+	int echoUp; // its echoes came back, so missing ones count
+	long long echoLast; // ms, last echo back from it
 	struct pwospf_neighbor* next;
 };
 
@@ -42,6 +104,14 @@ void pwospfSendHelloThread(void* arg);
 void pwospfSendLSUThread(void* dummy);
 void sendHello(uint32_t ifIP);
 void sendLSU();
+void invalidateLSU();
+void scheduleSPF();
+void scheduleLSU();
+void pwospfThrottleThread(void* dummy);
+long long pwospfTime();
+void setEcho(int interval, int mult);
+void pwospfEchoThread(void* dummy);
+void processEcho(const char* interface, uint8_t* packet, unsigned len);
 void processPWOSPF(const char* interface, uint8_t* packet, unsigned len);
 struct pwospf_if* findPWOSPFif(struct pwospf_router* router, uint32_t ip);
 struct pwospf_neighbor* findOSPFNeighbor(struct pwospf_if* interface, uint32_t ip);
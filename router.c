@@ -3,48 +3,119 @@
 #include <time.h>
 #include <string.h>
 #include "router.h"
+#include "lwtcp/lwip/sys.h"
 
 #ifdef _CPUMODE_
 struct nf2device netFPGA;
 #endif // _CPUMODE_
 
-inline void errorMsg(char* msg){
-	fputs("error: ", stderr); fputs(msg, stderr); fputs("\n", stderr);
+void inorderPrintTree(arpTreeNode *node);
+
+// the instance this thread works for, NULL means the global one
+static __thread struct sr_instance* thread_sr = NULL;
+
+struct routerThreadArg{
+	struct sr_instance* sr;
+	void (*func)(void*);
+	void* arg;
+};
+
+void initRouterState(struct sr_router* subsystem){
+	pthread_mutex_init(&subsystem->rtable_lock, NULL);
+	init_nexthops(&subsystem->nexthops);
+	pthread_mutex_init(&subsystem->list_lock, NULL);
+	pthread_rwlock_init(&subsystem->tree_lock, NULL);
+	pthread_mutex_init(&subsystem->queue_lock, NULL);
+	pthread_mutex_init(&subsystem->gw_lock, NULL);
+	pthread_mutex_init(&subsystem->ping_lock, NULL);
+	pthread_mutex_init(&subsystem->pool_lock, NULL);
+	pthread_cond_init(&subsystem->pool_cond, NULL);
+	pthread_rwlock_init(&subsystem->if_lock, NULL);
+	pthread_mutex_init(&subsystem->mode_lock, NULL);
+
+	subsystem->arpQueue = NULL;
+	subsystem->arpList = NULL;
+	subsystem->arpTree = NULL;
+	subsystem->rtable = NULL;
+	subsystem->gwList = NULL;
+	subsystem->pingListHead = NULL;
+	subsystem->poolHead = subsystem->poolTail = NULL;
+	subsystem->poolFree = NULL;
+	subsystem->pool_cnt = 0;
+
+	init_topo(&subsystem->topo);
+	memset(&subsystem->flightrec, 0, sizeof(subsystem->flightrec));
+	pktstats_init(&subsystem->stats);
 }
 
-inline void dbgMsg(char* msg){
-	fputs("dbg: ", stdout); fputs(msg, stdout); fputs("\n", stdout);
+void bindRouter(struct sr_instance* sr){
+	thread_sr = sr;
 }
 
-void inorderPrintTree(arpTreeNode *node);
+struct sr_instance* boundRouter(){
+	return thread_sr;
+}
 
-// this function processes all input packets
-void processPacket(struct sr_instance* sr,
+static void routerThreadStart(void* arg){
+	struct routerThreadArg a = *(struct routerThreadArg*)arg;
+
+	free(arg);
+	bindRouter(a.sr);
+	a.func(a.arg);
+}
+
+void routerThreadNew(struct sr_instance* sr, void (*func)(void*), void* arg){
+	struct routerThreadArg* a = (struct routerThreadArg*)malloc(sizeof(struct routerThreadArg));
+
+	a->sr = sr;
+	a->func = func;
+	a->arg = arg;
+	sys_thread_new(routerThreadStart, a);
+}
+
+static uint32_t flowMix(uint32_t h, uint32_t v){
+	v *= 0xcc9e2d51;
+	h ^= (v << 15) | (v >> 17);
+	h = (h << 13) | (h >> 19);
+	return h * 5 + 0xe6546b64;
+}
+
+// hash of the flow an IP packet belongs to, to spread flows over equal cost next hops:
+// addresses, protocol and, for TCP and UDP, the ports, but not for fragments so they stay together;
+// seeded, so that routers in a row do not all split the flows the same way
+static uint32_t flowHash(const uint8_t* ipPacket, unsigned len, uint32_t seed){
+	unsigned hl = (ipPacket[0] & 0x0F)*4;
+	uint32_t h = seed;
+
+	h = flowMix(h, *(const uint32_t*)&ipPacket[12]);
+	h = flowMix(h, *(const uint32_t*)&ipPacket[16]);
+	h = flowMix(h, ipPacket[9]);
+	if((ipPacket[9] == 6 || ipPacket[9] == 17) && !(ipPacket[6] & 0x3F) && !ipPacket[7] && len >= hl + 4)
+		h = flowMix(h, *(const uint32_t*)&ipPacket[hl]);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static int sendIPpacketTo(struct sr_instance* sr, uint32_t ip, uint8_t* packet, unsigned len, struct sharedBuf* body, const char* via, int* out_idx);
+
+// handles a packet that came in on an enabled interface, saying what became of it in v
+static void handlePacket(struct sr_instance* sr,
         uint8_t * packet/* borrowed */,
         unsigned int len,
-        const char* interface/* borrowed */)
+        const char* interface/* borrowed */,
+        struct flightrec_verdict* v)
 {
     int i;
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-    int iface_disabled = 0;
-    
-	pthread_rwlock_rdlock(&subsystem->if_lock);	
-    for(i = 0; i < subsystem->num_ifaces; i++) {
-		if(!strcmp(subsystem->ifaces[i].name, interface)) {
-		    if(!(subsystem->ifaces[i].enabled)) {
-			iface_disabled = 1;
-		    }
-		    break;
-		}
-    }
-    pthread_rwlock_unlock(&subsystem->if_lock);
 
-    if(iface_disabled) {
-		return;
-    }
-        
     if (len < ETHERNET_HEADER_LENGTH){
     	errorMsg("Ethernet Packet too short");
+    	v->verdict = FR_DROP_RUNT;
     	return;
     }
     
@@ -53,6 +124,7 @@ void processPacket(struct sr_instance* sr,
         dbgMsg("IPv4 packet received");
 		if (len < ETHERNET_HEADER_LENGTH + IP_HEADER_LENGTH){
 		    errorMsg("IP Packet too short");
+		    v->verdict = FR_DROP_RUNT;
 		    return;
 		}
     	uint8_t* ipPacket = &packet[ETHERNET_HEADER_LENGTH];
@@ -81,6 +153,7 @@ void processPacket(struct sr_instance* sr,
 	     * drop packet
 	     */
 	    errorMsg("Checksum error! Dropping the packet.");
+	    v->verdict = FR_DROP_CHECKSUM;
 	    return;
 	}
 	
@@ -93,11 +166,12 @@ void processPacket(struct sr_instance* sr,
 	     */
 	    errorMsg("TTL went to 0. Dropping packet");
 	    sendICMPTimeExceeded(interface, packet, len);
+	    v->verdict = FR_DROP_TTL;
 	    return;
 	}
 	
     uint32_t nextHopIP, dstIP;
-	char *out_if = NULL;
+	char out_if[SR_NAMELEN];
     		
 	/*uint32_t testIP;
 	testIP =	172 * 256 * 256 * 256 +
@@ -106,7 +180,7 @@ void processPacket(struct sr_instance* sr,
 	    11 * 1; 
 	testIP = ntohl(testIP);*/
 
-	dstIP = ipPacket[16] * 256 * 256 * 256 +
+	dstIP = (uint32_t)ipPacket[16] * 256 * 256 * 256 +
 	    ipPacket[17] * 256 * 256 +
 	    ipPacket[18] * 256 +
 	    ipPacket[19] * 1; 
@@ -127,6 +201,7 @@ void processPacket(struct sr_instance* sr,
 
 	if(myIP == dstIP){
 	    dbgMsg("Received packet destined for the router");
+	    v->verdict = FR_LOCAL;
 	    if(ipPacket[9] == 1){ // ICMP
 			processICMP(interface, packet, len);
 	    }
@@ -136,6 +211,10 @@ void processPacket(struct sr_instance* sr,
 	    else if(ipPacket[9] == 89){ // OSPF
 			processPWOSPF(interface, packet, len);
 	    } 
+	    else if(ipPacket[9] == 17 && len >= ETHERNET_HEADER_LENGTH + header_len + 8 &&
+	    		ntohs(*(uint16_t*)&ipPacket[header_len + 2]) == ECHO_PORT){ // liveness echo, back from a neighbor
+			processEcho(interface, packet, len);
+	    }
 	    else{ // protocol not supported
 			dbgMsg("Transport Protocol not supported");
 			sendICMPDestinationUnreachable(interface, packet, len, 2);
@@ -143,9 +222,12 @@ void processPacket(struct sr_instance* sr,
 	}
 	else if (is_broadcast){ // broadcast IP
 		// nothing to do really, ignoring all packets
+		v->verdict = FR_IGNORED;
 	}
 	else if (dstIP == ALLSPFRouters){
+		v->verdict = FR_IGNORED;
 	    if(ipPacket[9] == 89){ // OSPF
+			v->verdict = FR_LOCAL;
 			processPWOSPF(interface, packet, len);
 	    } 		
 	} 
@@ -153,19 +235,16 @@ void processPacket(struct sr_instance* sr,
 	else{
 		ttl = ipPacket[8];
 
-		nextHopIP = gw_match(&(subsystem->rtable), dstIP); //nextHopIP in hbo
-		if(!nextHopIP) {
-		    errorMsg("Destination network unreachable. Dropping packet");
-		    sendICMPDestinationUnreachable(interface, packet, len, 0);
-		    return;
-		}
-
-		out_if = lp_match(&(subsystem->rtable), dstIP); //output interface
-		if(!out_if) {
+		// next hop (in hbo) and output interface, picked by flow if there are several,
+		// from a backup if the primary is down
+		uint32_t flow = flowHash(ipPacket, len - ETHERNET_HEADER_LENGTH, subsystem->pwospf.routerID);
+		if(!rtable_lookup(&(subsystem->rtable), dstIP, flow, &nextHopIP, out_if, &v->route, &v->mask)) {
 		    errorMsg("Destination network unreachable. Dropping packet");
 		    sendICMPDestinationUnreachable(interface, packet, len, 0);
+		    v->verdict = FR_DROP_NO_ROUTE;
 		    return;
 		}
+		v->nexthop = nextHopIP;
 
 		// check TTL
 		if(ttl <= 1) {
@@ -174,6 +253,7 @@ void processPacket(struct sr_instance* sr,
 		     */
 		    errorMsg("TTL went to 0. Dropping packet");
 		    sendICMPTimeExceeded(interface, packet, len);
+		    v->verdict = FR_DROP_TTL;
 		    return;
 		}
 
@@ -192,18 +272,18 @@ void processPacket(struct sr_instance* sr,
 	    dbgMsg("Forwarding received packet");
 //	    printf("from: %u.%u.%u.%u\n", ipPacket[12], ipPacket[13], ipPacket[14], ipPacket[15]);
 //	    printf("to: %u.%u.%u.%u\n", ipPacket[16], ipPacket[17], ipPacket[18], ipPacket[19]);
-	    sendIPpacket(sr, out_if, nextHopIP, (uint8_t*)packet, len);
+	    v->verdict = sendIPpacketTo(sr, nextHopIP, (uint8_t*)packet, len, NULL, out_if, &v->out_if);
 	}		
 
-	free(out_if);
-
     }
     else if (packet[12] == 8 && packet[13] == 6){ // ARP
 	    if (len < ETHERNET_HEADER_LENGTH + ARP_HEADER_LENGTH){
 	    	errorMsg("ARP Packet too short");
+	    	v->verdict = FR_DROP_RUNT;
 	    	return;
 	    }
     	const uint8_t* arpPacket = &packet[ETHERNET_HEADER_LENGTH];
+    	v->verdict = FR_ARP;
  
  		//for(i = 0; i < len; i++) printf("%d: %d\n", i, packet[i]);
     	    	
@@ -215,7 +295,7 @@ void processPacket(struct sr_instance* sr,
     		const uint8_t* arpPacketData = &arpPacket[ARP_HEADER_LENGTH];
     		uint32_t dstIP;
     		
-    		dstIP = arpPacketData[macLen + ipLen + macLen + 0] * 256 * 256 * 256 +
+    		dstIP = (uint32_t)arpPacketData[macLen + ipLen + macLen + 0] * 256 * 256 * 256 +
     				arpPacketData[macLen + ipLen + macLen + 1] * 256 * 256 +
     				arpPacketData[macLen + ipLen + macLen + 2] * 256 +
     				arpPacketData[macLen + ipLen + macLen + 3] * 1; 
@@ -241,7 +321,7 @@ void processPacket(struct sr_instance* sr,
     		
     		for(i = 0; i < macLen; i++) srcMAC[i] = arpPacketData[i];
     		
-    		srcIP = arpPacketData[macLen + 0] * 256 * 256 * 256 +
+    		srcIP = (uint32_t)arpPacketData[macLen + 0] * 256 * 256 * 256 +
     				arpPacketData[macLen + 1] * 256 * 256 +
     				arpPacketData[macLen + 2] * 256 +
     				arpPacketData[macLen + 3] * 1;  				
@@ -257,6 +337,41 @@ void processPacket(struct sr_instance* sr,
      	       
 }
 
+// this function processes all input packets, records each in the flight recorder and counts it
+void processPacket(struct sr_instance* sr,
+        uint8_t * packet/* borrowed */,
+        unsigned int len,
+        const char* interface/* borrowed */)
+{
+    int i;
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    int iface_disabled = 0;
+    struct flightrec_verdict v = { FR_DROP_UNKNOWN, -1, 0, 0, 0 };
+    struct flightrec_entry* fr;
+    unsigned fr_pos;
+    
+	pthread_rwlock_rdlock(&subsystem->if_lock);	
+    for(i = 0; i < subsystem->num_ifaces; i++) {
+		if(!strcmp(subsystem->ifaces[i].name, interface)) {
+		    if(!(subsystem->ifaces[i].enabled)) {
+			iface_disabled = 1;
+		    }
+		    break;
+		}
+    }
+    if(i >= subsystem->num_ifaces) i = -1;
+    pthread_rwlock_unlock(&subsystem->if_lock);
+
+    fr = flightrec_begin(&subsystem->flightrec, i, packet, len, &fr_pos);
+    if(iface_disabled)
+		v.verdict = FR_DROP_IF_DOWN;
+    else
+		handlePacket(sr, packet, len, interface, &v);
+    if(fr)
+		flightrec_end(fr, fr_pos, &v);
+    pktstats_rx(&subsystem->stats, len, v.verdict);
+}
+
 // get interface's MAC address if given correct name and IP address
 uint8_t* getMAC(struct sr_instance* sr, uint32_t ip, const char* name){
 
@@ -469,10 +584,12 @@ uint8_t* generateARPrequest(struct sr_instance* sr, const char* interface, uint3
 
 // sends ARP request for ip (host byte order)
 void sendARPrequest(struct sr_instance* sr, const char* interface, uint32_t ip){
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	//int i;
 	uint8_t *arprq = generateARPrequest(sr, interface, ip);
 	//for(i = 0; i < 60; i++) printf("::%d: %d\n", i, arprq[i]);				
 	sr_integ_low_level_output(sr, arprq, 60, interface);
+	pktstats_inc(&subsystem->stats, PS_ARP_REQUESTS);
 	free(arprq);			
 }
 
@@ -489,9 +606,11 @@ void arpCacheRefresh(void *dummy){
 
 // runs every ~2 seconds in a separate thread to see if any topology node entries have timed out
 void topologyRefresh(void *dummy){
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(get_sr());
     while(1) {
-	if(purge_topo()) {
-	    update_rtable();
+	// grace_until is cleared by the SPF that ends the grace time
+	if(purge_topo() || (subsystem->topo.grace_until && time(NULL) >= subsystem->topo.grace_until)) {
+	    scheduleSPF();
 	}
 	sleep(TOPO_REFRESH);
     }
@@ -513,24 +632,51 @@ uint32_t getNextHopIP(uint32_t ip){
 	return retVal;
 }
 
+struct sharedBuf* newSharedBuf(unsigned len){
+	struct sharedBuf* buf = (struct sharedBuf*)malloc(sizeof(struct sharedBuf) + len);
+	buf->refcnt = 1;
+	buf->len = len;
+	return buf;
+}
+
+void holdSharedBuf(struct sharedBuf* buf){
+	__sync_fetch_and_add(&buf->refcnt, 1);
+}
+
+void releaseSharedBuf(struct sharedBuf* buf){
+	if(__sync_sub_and_fetch(&buf->refcnt, 1) == 0) free(buf);
+}
+
 // Sends out packet to next hop ip address "ip" out the "interface". Packet has to have a placeholder for Ethernet header. Packet is just borrowed (not destroyed here)
 // interface parameter is ignored, output if is calculated from the IP
-void sendIPpacket(struct sr_instance* sr, const char* interface, uint32_t ip, uint8_t* packet, unsigned len){
+int sendIPpacket(struct sr_instance* sr, const char* interface, uint32_t ip, uint8_t* packet, unsigned len){
+	return sendIPpacketShared(sr, ip, packet, len, NULL);
+}
+
+// sendIPpacketShared(), also giving the index of the output interface (if out_idx is not NULL);
+// via is the output interface if the caller looked it up along with ip, NULL to look it up here
+static int sendIPpacketTo(struct sr_instance* sr, uint32_t ip, uint8_t* packet, unsigned len, struct sharedBuf* body, const char* via, int* out_idx){
 	int i,j;
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	char out_if[SR_NAMELEN];
 
 	if(isMyIP(ip)){
 		dbgMsg("Cannot send to myself!");
-		return;
+		return FR_DROP_NO_ROUTE;
 	}
 
-	char * out_if = lp_match(&(subsystem->rtable), ip); // make sure output interface is correct
+	if(via == NULL){
+		char * match = lp_match(&(subsystem->rtable), ip); // make sure output interface is correct
 
-	if (out_if == NULL){
-		dbgMsg("Network unreachable, packet not sent!");
-		free(out_if);
-		return;
+		if (match == NULL){
+			dbgMsg("Network unreachable, packet not sent!");
+			return FR_DROP_NO_ROUTE;
+		}
+		strncpy(out_if, match, SR_NAMELEN);
+		free(match);
 	}
+	else strncpy(out_if, via, SR_NAMELEN);
+	out_if[SR_NAMELEN-1] = 0;
 
 	// find the interface by name
 	pthread_rwlock_rdlock(&subsystem->if_lock);
@@ -542,16 +688,15 @@ void sendIPpacket(struct sr_instance* sr, const char* interface, uint32_t ip, ui
 	
 	if (i >= subsystem->num_ifaces){
 		errorMsg("Given interfaces does not exist");
-		free(out_if);
-		return;
+		return FR_DROP_OUT_DOWN;
 	}
+	if(out_idx) *out_idx = i;
 
 	pthread_rwlock_rdlock(&subsystem->if_lock);
 	if (subsystem->ifaces[i].enabled == 0){
 		//errorMsg("Given interface is disabled");
 		pthread_rwlock_unlock(&subsystem->if_lock);
-		free(out_if);
-		return;		
+		return FR_DROP_OUT_DOWN;		
 	}			
 	uint8_t *myMAC = subsystem->ifaces[i].addr;
 	pthread_rwlock_unlock(&subsystem->if_lock);
@@ -569,16 +714,25 @@ void sendIPpacket(struct sr_instance* sr, const char* interface, uint32_t ip, ui
 	if(dstMAC){
 		dbgMsg("Sending packet");
 		for (i = 0; i < 6; i++) packet[i] = dstMAC[i];
-		sr_integ_low_level_output(sr, packet, len, out_if);	
+		if(body)
+			sr_integ_low_level_outputv(sr, packet, len, body->data, body->len, out_if);
+		else
+			sr_integ_low_level_output(sr, packet, len, out_if);	
 		free(dstMAC);	
+		return FR_FORWARD;
 	}
 	else{ // send out ARP and queue the packet
 		dbgMsg("Queueing packet");
 		sendARPrequest(sr, out_if, ip);
-		queuePacket(packet, len, out_if, ip);
+		queuePacketShared(packet, len, body, out_if, ip);
+		return FR_ARP_WAIT;
 	}	
-	
-	free(out_if);
+}
+
+// sendIPpacket() with the packet split in two: hdr (borrowed) gets the Ethernet header, body (if not NULL) follows it
+// and is held by the ARP queue rather than copied if the packet has to wait
+int sendIPpacketShared(struct sr_instance* sr, uint32_t ip, uint8_t* packet, unsigned len, struct sharedBuf* body){
+	return sendIPpacketTo(sr, ip, packet, len, body, NULL, NULL);
 }
 
 //////////////////////////////
@@ -667,7 +821,7 @@ void inorderPrintTree(arpTreeNode *node) {
 void printARPCache() {
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-    pthread_mutex_lock(&list_lock);
+    pthread_mutex_lock(&subsystem->list_lock);
     struct arpCacheNode *node = subsystem->arpList;
     uint8_t ip_str[4];
     while(node != NULL) {
@@ -678,77 +832,130 @@ void printARPCache() {
 			node->is_static);
 		node = node->next;
 	    }
-    pthread_mutex_unlock(&list_lock);
+    pthread_mutex_unlock(&subsystem->list_lock);
 }
 
-void fill_rtable(rtableNode **head)
+// the next word of f into buf, returns its length (size if it did not fit) or -1 at the end
+static int read_word(FILE *f, char *buf, int size, int *line)
 {
-    int ip[4], gw[4], nm[4];
-    char output_if[SR_NAMELEN+4];
-    uint32_t ip_32 = 0, gw_32 = 0, nm_32 = 0;
-    int i;
-    FILE *rtable_file = fopen("rtable", "r");
+	int c, len = 0;
+
+	while((c = getc_unlocked(f)) != EOF && (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+		if(c == '\n') (*line)++;
+	if(c == EOF) return -1;
+	do {
+		if(len < size - 1) buf[len] = c;
+		len++;
+	} while((c = getc_unlocked(f)) != EOF && c != ' ' && c != '\t' && c != '\r' && c != '\n');
+	if(c == '\n') ungetc(c, f);
+	if(len >= size) {
+		buf[size - 1] = 0;
+		return size;
+	}
+	buf[len] = 0;
+	return len;
+}
 
-	if (rtable_file == NULL) return;
+// a dotted quad, returns 0 if s is not one
+static int parse_ip(const char *s, uint32_t *ip)
+{
+	int i, v;
+
+	*ip = 0;
+	for(i = 0; i < 4; i++) {
+		if(*s < '0' || *s > '9') return 0;
+		for(v = 0; *s >= '0' && *s <= '9' && v <= 255; s++) v = v*10 + *s - '0';
+		if(v > 255 || *s != (i < 3 ? '.' : 0)) return 0;
+		*ip = (*ip << 8) | v;
+		s++;
+	}
+	return 1;
+}
 
-	// initialize
-	*head = NULL;
-	
-    while (!feof(rtable_file)) {
-    	int mode = 0;
-		if (fscanf(rtable_file, "%d.%d.%d.%d  %d.%d.%d.%d  %d.%d.%d.%d  %s", 
-			    &ip[0], &ip[1], &ip[2], &ip[3],
-			    &gw[0], &gw[1], &gw[2], &gw[3],
-			    &nm[0], &nm[1], &nm[2], &nm[3],
-			    output_if) != 13)
-		    break;
-		for(i = 0; i < 4; i++) {
-		    ip_32 = ip_32 << 8;
-		    ip_32 += (uint32_t)ip[i];
-		    gw_32 = gw_32 << 8;
-		    gw_32 += (uint32_t)gw[i];
-		    nm_32 = nm_32 << 8;
-		    nm_32 += (uint32_t)nm[i];
+int read_rtable_file(const char *fname, struct rtableLoad *l, int progress, int *bad_line)
+{
+	char word[4][SR_NAMELEN+8];
+	uint32_t ip, gw, nm;
+	int i, len, line = 1, cnt = 0;
+	long long start = pwospfTime();
+	FILE *f = fopen(fname, "r");
+
+	*bad_line = 0;
+	if(f == NULL) return RTABLE_FILE_OPEN;
+
+	flockfile(f);
+	for(;;) {
+		int mode = RTABLE_INSERT, start_line;
+		if(read_word(f, word[0], sizeof(word[0]), &line) < 0) break;
+		start_line = line;
+		for(i = 1; i < 4; i++)
+			if((len = read_word(f, word[i], sizeof(word[i]), &line)) < 0) break;
+		if(i < 4 || !parse_ip(word[0], &ip) || !parse_ip(word[1], &gw) || !parse_ip(word[2], &nm)) {
+			*bad_line = start_line;
+			cnt = RTABLE_FILE_SYNTAX;
+			break;
 		}
-		int if_len = strlen(output_if);
-		if(if_len > 4){
-			if( strcmp(&output_if[if_len-4], "...m") == 0 ){
-				output_if[if_len-4] = 0;
-				mode = 1;
-			}
-			else if( strcmp(&output_if[if_len-4], "...f") == 0 ){
-				output_if[if_len-4] = 0;
-				mode = 2;
-			}
+		if(len > 4 && strcmp(&word[3][len-4], "...m") == 0) {
+			word[3][len-4] = 0;
+			mode = RTABLE_MERGE;
 		}
-		printf("Added to the routing table : %d.%d.%d.%d  %d.%d.%d.%d  %d.%d.%d.%d  %s\n", 
-			    ip[0], ip[1], ip[2], ip[3],
-			    gw[0], gw[1], gw[2], gw[3],
-			    nm[0], nm[1], nm[2], nm[3],
-			    output_if);
-		printf("%x  %x  %x  %s\n", ip_32, gw_32, nm_32, output_if);
-	    char *tmp_if = (char*)malloc(sizeof(char)*SR_NAMELEN);
-	    strcpy(tmp_if, output_if);
-	    if(mode == 1)	
-			merge_rtable_node(head, ip_32, nm_32, &gw_32, &tmp_if, 1, 1);
-	    else if(mode == 2)	
-			force_insert_rtable_node(head, ip_32, nm_32, &gw_32, &tmp_if, 1, 1);
-	    else
-			insert_rtable_node(head, ip_32, nm_32, &gw_32, &tmp_if, 1, 1);
-		free(tmp_if);
-		ip_32 = gw_32 = nm_32 = 0;
-    }
+		else if(len > 4 && strcmp(&word[3][len-4], "...f") == 0) {
+			word[3][len-4] = 0;
+			mode = RTABLE_FORCE;
+		}
+		if(!rtable_load_add(l, ip, nm, gw, word[3], mode)) {
+			*bad_line = start_line;
+			cnt = RTABLE_FILE_NAME;
+			break;
+		}
+		if(++cnt % 250000 == 0 && progress) {
+			printf("Reading %s: %d routes, %lld ms\n", fname, cnt, pwospfTime() - start);
+			fflush(stdout);
+		}
+	}
+	funlockfile(f);
+	fclose(f);
+	return cnt;
+}
 
-    fclose(rtable_file);
+void fill_rtable(rtableNode **head)
+{
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(get_sr());
+	struct rtableLoad l;
+	rtableNode *table, *old;
+	long long start = pwospfTime(), parsed;
+	int cnt, entries, bad_line;
+
+	memset(&l, 0, sizeof(l));
+	if((cnt = read_rtable_file("rtable", &l, 1, &bad_line)) < 0) {
+		// all of the file or none of it, as a batch from the CLI
+		if(cnt != RTABLE_FILE_OPEN)
+			printf("rtable:%d: %s, no route has been loaded\n", bad_line,
+				cnt == RTABLE_FILE_NAME ? "interface name too long" : "not a route");
+		free_rtable_load(&l);
+		return;
+	}
+	parsed = pwospfTime();
 
+	// all of it sorted at once, instead of an insert (a walk of the list) per route
+	table = build_rtable(&l, 1, &entries);
+	free_rtable_load(&l);
+
+	pthread_mutex_lock(&subsystem->rtable_lock);
+	old = *head;
+	*head = table;
 #ifdef _CPUMODE_
-	pthread_mutex_lock(&rtable_lock);
-		writeRoutingTable();
-	pthread_mutex_unlock(&rtable_lock);
+	writeRoutingTable();
 #endif // _CPUMODE_
+	pthread_mutex_unlock(&subsystem->rtable_lock);
+	kill_rtable(&old);
+
+	printf("Loaded %d routes from rtable into %d entries in %lld ms (%lld ms reading)\n",
+		cnt, entries, pwospfTime() - start, parsed - start);
 }
 
 
+#ifdef _CPUMODE_
 // Thread monitors link status and enables/disables interface
 void linkStatusThread(void *dummy){
 	uint32_t mac_hi, mac_lo, stat;
@@ -854,6 +1061,7 @@ void linkStatusThread(void *dummy){
 	
 	free(link_status);
 }
+#endif // _CPUMODE_
 
 /**
  * ---------------------------------------------------------------------------
@@ -880,10 +1088,13 @@ int router_interface_set_enabled( struct sr_instance* sr, const char* name, int
 			}
 		    else {
 				subsystem->ifaces[i].enabled = enabled && subsystem->ifaces[i].hard_enabled;
+				enabled = subsystem->ifaces[i].enabled;
 				pthread_rwlock_unlock(&subsystem->if_lock);
+				// traffic moves to the backups right away, SPF catches up later
+				rtable_nexthop_down(&subsystem->rtable, 0, name, !enabled);
 				updateNeighbors();
-				sendLSU();
-				update_rtable();
+				scheduleLSU();
+				scheduleSPF();
 				return 0;
 		    }
 		}
@@ -912,7 +1123,9 @@ int router_interface_set_enabled_only( struct sr_instance* sr, const char* name,
 			}
 		    else {
 				subsystem->ifaces[i].enabled = enabled && subsystem->ifaces[i].hard_enabled;
+				enabled = subsystem->ifaces[i].enabled;
 				pthread_rwlock_unlock(&subsystem->if_lock);
+				rtable_nexthop_down(&subsystem->rtable, 0, name, !enabled);
 				return 0;
 		    }
 		}
@@ -940,10 +1153,12 @@ int router_interface_set_hard_enabled( struct sr_instance* sr, const char* name,
 		    else {
 				subsystem->ifaces[i].hard_enabled = enabled;
 				subsystem->ifaces[i].enabled = subsystem->ifaces[i].enabled && enabled;
+				enabled = subsystem->ifaces[i].enabled;
 				pthread_rwlock_unlock(&subsystem->if_lock);
+				rtable_nexthop_down(&subsystem->rtable, 0, name, !enabled);
 				updateNeighbors();
-				sendLSU();
-				update_rtable();
+				scheduleLSU();
+				scheduleSPF();
 				return 0;
 		    }
 		}
@@ -1099,14 +1314,19 @@ uint32_t findMinNetmask_(uint32_t s1, uint32_t s2){
 
 int compareRoutes_(rtableNode* r1, rtableNode* r2){
 	int i, j;
+	struct nexthopGroup *g1, *g2;
 	
-	if(r1->out_cnt != r2->out_cnt) return 0;
 	if(r1->entry_index != r2->entry_index) return 0;
-	for(i = 0; i < r1->out_cnt; i++){
+	if(r1->nh == r2->nh) return 1;
+	// same next hops in another order are a different group
+	g1 = nh_group(r1->nh);
+	g2 = nh_group(r2->nh);
+	if(g1->out_cnt != g2->out_cnt) return 0;
+	for(i = 0; i < g1->out_cnt; i++){
 		int tmp_found = 0;
-		for(j = 0; j < r2->out_cnt; j++){
-			if(r1->gateway[i] == r2->gateway[j]){
-				if(!strcmp(r1->output_if[i], r2->output_if[j])){
+		for(j = 0; j < g2->out_cnt; j++){
+			if(g1->hop[i].gateway == g2->hop[j].gateway){
+				if(!strcmp(g1->hop[i].output_if, g2->hop[j].output_if)){
 					tmp_found = 1;
 					break;
 				}
@@ -1156,7 +1376,7 @@ void aggregateRoutes(rtableNode** rtable){
 					
 						if(second->next) second->next->prev = second->prev;
 						second->prev->next = second->next;
-						free(second);
+						free_rtable_node(second);
 					}
 				}
 				second = second_next;
@@ -1190,7 +1410,7 @@ void aggregateRoutes(rtableNode** rtable){
 						else{
 							*rtable = second->next;
 						}
-						free(second);
+						free_rtable_node(second);
 					}
 				}
 				second = second_prev;
@@ -1259,7 +1479,37 @@ void writeARPCache(arpTreeNode *node, int *index){
     if(node->right) writeARPCache(node->right, index);
 }
 
-// writes routing table to hardware
+// what the hw route and gateway tables hold, so only the rows that change
+// are written again; protected by rtable_lock, like writeRoutingTable()
+static uint32_t hw_route[ROUTER_OP_LUT_ROUTE_TABLE_DEPTH][4];
+static uint32_t hw_gw[ROUTER_OP_LUT_GATEWAY_TABLE_DEPTH];
+static int hw_written;
+
+// caller must hold routeRegLock
+static void writeRouteRow(int index, uint32_t ip, uint32_t mask, uint32_t gws, uint32_t ifs){
+	uint32_t *row = hw_route[index];
+	if(hw_written && row[0] == ip && row[1] == mask && row[2] == gws && row[3] == ifs) return;
+	writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_IP_REG, ip );
+	writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_MASK_REG, mask );
+	writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_NEXT_HOP_IP_REG, gws );
+	writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, ifs );
+	writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_WR_ADDR_REG, index );
+	row[0] = ip;
+	row[1] = mask;
+	row[2] = gws;
+	row[3] = ifs;
+}
+
+// caller must hold gwRegLock
+static void writeGatewayRow(int index, uint32_t gw){
+	if(hw_written && hw_gw[index] == gw) return;
+	writeReg( &netFPGA, ROUTER_OP_LUT_GATEWAY_TABLE_ENTRY_IP_REG, gw );
+	writeReg( &netFPGA, ROUTER_OP_LUT_GATEWAY_TABLE_WR_ADDR_REG, index );
+	hw_gw[index] = gw;
+}
+
+// writes routing table to hardware, only the rows that differ from what
+// was written last time
 // caller must hold rtable_lock
 void writeRoutingTable(){
 	int i;
@@ -1339,51 +1589,47 @@ void writeRoutingTable(){
 		rtable = subsystem->rtable;
 
 	while(rtable){
+		struct nexthopGroup *g = nh_group(rtable->nh);
 		uint32_t ifs = 0;
 		uint32_t gws = 0;
 		int pos = -1;
 		if(index < ROUTER_OP_LUT_ROUTE_TABLE_DEPTH){
-			writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_IP_REG, rtable->ip );
-			writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_MASK_REG, rtable->netmask );
-			
-			for(i = 0; i < rtable->out_cnt; i++){
+			for(i = 0; i < g->out_cnt; i++){
 				char *name;
 				name = getIfNameFromMAC(&mac[3][0]);
-				if(name && ( strcmp(name, rtable->output_if[i]) == 0 )){
-					pos = gwList_insert(&subsystem->gwList, rtable->gateway[i]);	
+				if(name && ( strcmp(name, g->hop[i].output_if) == 0 )){
+					pos = gwList_insert(&subsystem->gwList, g->hop[i].gateway);	
 					if(pos != -1){
 						ifs |= 0x40;
 						gws = (gws & ~0xFF000000) | ( ((uint32_t)(pos & 0xFF)) << 24 );					
 					}
 				}
 				name = getIfNameFromMAC(&mac[2][0]);
-				if(name && ( strcmp(name, rtable->output_if[i]) == 0 )){
-					pos = gwList_insert(&subsystem->gwList, rtable->gateway[i]);	
+				if(name && ( strcmp(name, g->hop[i].output_if) == 0 )){
+					pos = gwList_insert(&subsystem->gwList, g->hop[i].gateway);	
 					if(pos != -1){
 						ifs |= 0x10;
 						gws = (gws & ~0x00FF0000) | ( ((uint32_t)(pos & 0xFF)) << 16 );					
 					}
 				}
 				name = getIfNameFromMAC(&mac[1][0]);
-				if(name && ( strcmp(name, rtable->output_if[i]) == 0 )){
-					pos = gwList_insert(&subsystem->gwList, rtable->gateway[i]);	
+				if(name && ( strcmp(name, g->hop[i].output_if) == 0 )){
+					pos = gwList_insert(&subsystem->gwList, g->hop[i].gateway);	
 					if(pos != -1){
 						ifs |= 0x04;
 						gws = (gws & ~0x0000FF00) | ( ((uint32_t)(pos & 0xFF)) << 8 );					
 					}
 				}
 				name = getIfNameFromMAC(&mac[0][0]);
-				if(name && ( strcmp(name, rtable->output_if[i]) == 0 )){
-					pos = gwList_insert(&subsystem->gwList, rtable->gateway[i]);	
+				if(name && ( strcmp(name, g->hop[i].output_if) == 0 )){
+					pos = gwList_insert(&subsystem->gwList, g->hop[i].gateway);	
 					if(pos != -1){
 						ifs |= 0x01;
 						gws = (gws & ~0x000000FF) | ( ((uint32_t)(pos & 0xFF)) << 0 );					
 					}
 				}
 			}			
-			writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_NEXT_HOP_IP_REG, gws );
-			writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, ifs );
-			writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_WR_ADDR_REG, index++ );		
+			writeRouteRow(index++, rtable->ip, rtable->netmask, gws, ifs);
 		}
 		else{
 			break;
@@ -1392,22 +1638,17 @@ void writeRoutingTable(){
 	}
 	// fill the rest of the table with 0s
 	for(i = index; i < ROUTER_OP_LUT_ROUTE_TABLE_DEPTH; i++){
-		writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_IP_REG, 0 );
-		writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_MASK_REG, 0 );
-		writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_NEXT_HOP_IP_REG, 0 );
-		writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, 0 );
-		writeReg( &netFPGA, ROUTER_OP_LUT_ROUTE_TABLE_WR_ADDR_REG, i );		
+		writeRouteRow(i, 0, 0, 0, 0);
 	}	
 	pthread_mutex_unlock(&routeRegLock);
 
-	pthread_mutex_lock(&gw_lock);
+	pthread_mutex_lock(&subsystem->gw_lock);
 	pthread_mutex_lock(&gwRegLock);
 	index = 0;
 	struct gwListNode *gwNode = subsystem->gwList;
 	while(gwNode){
 		if(index < ROUTER_OP_LUT_GATEWAY_TABLE_DEPTH){
-			writeReg( &netFPGA, ROUTER_OP_LUT_GATEWAY_TABLE_ENTRY_IP_REG, gwNode->gw );
-			writeReg( &netFPGA, ROUTER_OP_LUT_GATEWAY_TABLE_WR_ADDR_REG, index++ );				
+			writeGatewayRow(index++, gwNode->gw);
 		}
 		else{
 			break;
@@ -1416,11 +1657,11 @@ void writeRoutingTable(){
 	}
 	// fill the rest of the table with 255.255.255.255 (because 0 is actually a valid gw)
 	for(i = index; i < ROUTER_OP_LUT_GATEWAY_TABLE_DEPTH; i++){
-			writeReg( &netFPGA, ROUTER_OP_LUT_GATEWAY_TABLE_ENTRY_IP_REG, 0xFFFFFFFF );
-			writeReg( &netFPGA, ROUTER_OP_LUT_GATEWAY_TABLE_WR_ADDR_REG, i );				
+			writeGatewayRow(i, 0xFFFFFFFF);
 	}	
 	pthread_mutex_unlock(&gwRegLock);
-	pthread_mutex_unlock(&gw_lock);
+	hw_written = 1;
+	pthread_mutex_unlock(&subsystem->gw_lock);
 	
 	pthread_rwlock_unlock(&subsystem->if_lock);
 	
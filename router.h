@@ -6,6 +6,7 @@
 #include "sr_base_internal.h"
 #include "sr_integration.h"
 #include <pthread.h>
+#include "log.h"
 #include "arpCache.h"
 #include "arpQueue.h"
 #include "icmpMsg.h"
@@ -14,6 +15,9 @@
 #include "pwospf.h"
 #include "topology.h"
 #include "gwList.h"
+#include "snapshot.h"
+#include "flightrec.h"
+#include "pktstats.h"
 
 #ifdef _CPUMODE_
 
@@ -59,21 +63,63 @@ struct sr_router{
 	pthread_rwlock_t if_lock;
 	struct threadWorker* poolHead;
 	struct threadWorker* poolTail;
+	struct threadWorker* poolFree; // nodes done with, for reuse
 	struct pwospf_router pwospf;
+
+	// everything else a router keeps is here as well, so that several of them
+	// can run in one process, see bindRouter()
+	pthread_mutex_t rtable_lock;
+	struct nexthopTable nexthops; // next hop groups of all the routing tables
+	pthread_mutex_t list_lock; // arpList
+	pthread_rwlock_t tree_lock; // arpTree
+	pthread_mutex_t queue_lock; // arpQueue
+	pthread_mutex_t gw_lock; // gwList
+	pthread_mutex_t ping_lock;
+	struct pingRequestNode *pingListHead;
+	pthread_mutex_t pool_lock;
+	pthread_cond_t pool_cond;
+	int pool_cnt; // jobs waiting in the thread pool
+	struct topo_db topo;
+	struct flightrec flightrec; // of the packets received
+	struct pktstats stats; // software packet counters
 };
 
+// initializes the locks and empties the lists of a new router
+void initRouterState(struct sr_router* subsystem);
+
+/* The router's functions find the instance they work for through get_sr().
+ * A thread bound to an instance gets that one, any other the global one.
+ */
+void bindRouter(struct sr_instance* sr);
+struct sr_instance* boundRouter();
+// sys_thread_new() for a thread bound to sr
+void routerThreadNew(struct sr_instance* sr, void (*func)(void*), void* arg);
+
 void processPacket(struct sr_instance* sr,
         uint8_t * packet/* borrowed */,
         unsigned int len,
         const char* interface/* borrowed */);
         
-inline void errorMsg(char* msg);
-inline void dbgMsg(char* msg);
-
 uint8_t* getMAC(struct sr_instance* sr, uint32_t ip, const char* name);
 uint8_t* generateARPreply(const uint8_t *packet, size_t len, uint8_t *mac);
 void sendARPrequest(struct sr_instance* sr, const char* interface, uint32_t ip);
-void sendIPpacket(struct sr_instance* sr, const char* interface, uint32_t ip, uint8_t* packet, unsigned len);
+/* returns what became of the packet: FR_FORWARD, FR_ARP_WAIT (queued), FR_DROP_NO_ROUTE
+ * or FR_DROP_OUT_DOWN, see flightrec.h
+ */
+int sendIPpacket(struct sr_instance* sr, const char* interface, uint32_t ip, uint8_t* packet, unsigned len);
+
+// a packet payload shared by several packets, e.g. one LSU flooded to all neighbors
+// freed when the last holder releases it
+struct sharedBuf{
+	int refcnt;
+	unsigned len;
+	uint8_t data[];
+};
+struct sharedBuf* newSharedBuf(unsigned len); // held once by the caller
+void holdSharedBuf(struct sharedBuf* buf);
+void releaseSharedBuf(struct sharedBuf* buf);
+// sendIPpacket() for the Ethernet and IP headers in hdr followed by body, which is not copied
+int sendIPpacketShared(struct sr_instance* sr, uint32_t ip, uint8_t* hdr, unsigned hdr_len, struct sharedBuf* body);
 int isMyIP(uint32_t ip);
 int isEnabled(uint32_t ip);
 char* getIfName(uint32_t ip);
@@ -84,7 +130,6 @@ int setMultipath(int multipath);
 int setFastReroute(int fast);
 int getMode();
 void aggregateRoutes(rtableNode** rtable);
-void linkStatusThread(void *dummy);
 
 void int2byteIP(uint32_t ip, uint8_t *byteIP);
 uint32_t getInterfaceIP(const char* interface);
@@ -96,6 +141,18 @@ void topologyRefresh(void *dummy);
 
 void testList(struct sr_instance* sr);
 
+/* Reads the routes of a routing table file ("ip gw mask if" per line, the
+ * interface with "...m" or "...f" appended to merge or force it in) into l,
+ * printing how far it got every 250000 routes if progress is set.
+ * returns the number of routes read, RTABLE_FILE_OPEN if the file cannot be
+ * opened, RTABLE_FILE_SYNTAX if line *bad_line is not a route or
+ * RTABLE_FILE_NAME if its interface name is too long (l then holds only the
+ * routes before it).
+ */
+#define RTABLE_FILE_OPEN -1
+#define RTABLE_FILE_SYNTAX -2
+#define RTABLE_FILE_NAME -3
+int read_rtable_file(const char *fname, struct rtableLoad *l, int progress, int *bad_line);
 void fill_rtable(rtableNode **head);
 
 void sr_transport_input(uint8_t* packet /* borrowed */);
@@ -103,6 +160,7 @@ void sr_transport_input(uint8_t* packet /* borrowed */);
 #ifdef _CPUMODE_
 
 void writeIPfilter();
+void linkStatusThread(void *dummy);
 
 #endif // _CPUMODE_
 
@@ -1,80 +1,239 @@
 #include "router.h"
 #include "routingTable.h"
 
-void insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
+/*
+ * ------------------------------- next hop groups ------------------
+ */
+
+static struct nexthopTable* nexthops()
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	return &subsystem->nexthops;
+}
+
+static uint32_t nh_hash(const uint32_t* gateway, char** output_if, int out_cnt)
 {
+	uint32_t h = 2166136261u; // FNV-1a
+	const char* c;
 	int i;
-	
-	if(out_cnt < 1) return;
-	
+
+	for(i = 0; i < out_cnt; i++){
+		h = (h ^ gateway[i]) * 16777619u;
+		for(c = output_if[i]; *c; c++) h = (h ^ (uint8_t)*c) * 16777619u;
+		h = (h ^ 0xff) * 16777619u; // end of the name
+	}
+	return h;
+}
+
+static int nh_equal(const struct nexthopGroup* g, const uint32_t* gateway, char** output_if, int out_cnt)
+{
+	int i;
+	if(g->out_cnt != out_cnt) return 0;
+	for(i = 0; i < out_cnt; i++){
+		if(g->hop[i].gateway != gateway[i] || strcmp(g->hop[i].output_if, output_if[i])) return 0;
+	}
+	return 1;
+}
+
+// puts g at index nh, caller must hold the lock
+static void nh_set(struct nexthopTable* nt, uint32_t nh, struct nexthopGroup* g)
+{
+	struct nexthopGroup*** chunk = &nt->chunk[nh >> NH_CHUNK_BITS];
+	if(*chunk == NULL) *chunk = (struct nexthopGroup**)calloc(1 << NH_CHUNK_BITS, sizeof(struct nexthopGroup*));
+	(*chunk)[nh & ((1 << NH_CHUNK_BITS) - 1)] = g;
+}
+
+// twice the hash buckets, caller must hold the lock
+static void nh_grow(struct nexthopTable* nt)
+{
+	uint32_t i, nh, next, buckets = 2*nt->buckets;
+	uint32_t* bucket = (uint32_t*)malloc(sizeof(uint32_t)*buckets);
+
+	for(i = 0; i < buckets; i++) bucket[i] = NH_NONE;
+	for(i = 0; i < nt->buckets; i++){
+		for(nh = nt->bucket[i]; nh != NH_NONE; nh = next){
+			struct nexthopGroup* g = nh_get(nt, nh);
+			next = g->chain;
+			g->chain = bucket[g->hash & (buckets - 1)];
+			bucket[g->hash & (buckets - 1)] = nh;
+		}
+	}
+	free(nt->bucket);
+	nt->bucket = bucket;
+	nt->buckets = buckets;
+}
+
+void init_nexthops(struct nexthopTable* nt)
+{
+	uint32_t i;
+	struct nexthopGroup* none = (struct nexthopGroup*)calloc(1, sizeof(struct nexthopGroup));
+
+	pthread_mutex_init(&nt->lock, NULL);
+	memset(nt->chunk, 0, sizeof(nt->chunk));
+	nt->free_idx = NULL;
+	nt->free_cnt = nt->free_size = 0;
+	nt->buckets = 64;
+	nt->bucket = (uint32_t*)malloc(sizeof(uint32_t)*nt->buckets);
+	for(i = 0; i < nt->buckets; i++) nt->bucket[i] = NH_NONE;
+	nt->count = 0;
+
+	// the empty group is never interned nor released
+	none->refcnt = 1;
+	none->chain = NH_NONE;
+	nh_set(nt, NH_NONE, none);
+	nt->used = NH_NONE + 1;
+}
+
+uint32_t nh_intern(const uint32_t* gateway, char** output_if, int out_cnt)
+{
+	struct nexthopTable* nt = nexthops();
+	struct nexthopGroup* g;
+	uint32_t h, nh;
+	int i;
+
+	if(out_cnt < 1) return NH_NONE;
+	h = nh_hash(gateway, output_if, out_cnt);
+
+	pthread_mutex_lock(&nt->lock);
+	for(nh = nt->bucket[h & (nt->buckets - 1)]; nh != NH_NONE; nh = g->chain){
+		g = nh_get(nt, nh);
+		if(g->hash == h && nh_equal(g, gateway, output_if, out_cnt)){
+			__sync_fetch_and_add(&g->refcnt, 1);
+			pthread_mutex_unlock(&nt->lock);
+			return nh;
+		}
+	}
+
+	if(nt->free_cnt == 0 && nt->used >= (NH_MAX_CHUNKS << NH_CHUNK_BITS)){
+		pthread_mutex_unlock(&nt->lock);
+		errorMsg("Too many next hop groups, route has no next hops");
+		return NH_NONE;
+	}
+
+	g = (struct nexthopGroup*)malloc(sizeof(struct nexthopGroup) + sizeof(struct nexthop)*out_cnt);
+	g->refcnt = 1;
+	g->down = 0;
+	g->hash = h;
+	g->out_cnt = out_cnt;
+	for(i = 0; i < out_cnt; i++){
+		g->hop[i].gateway = gateway[i];
+		strncpy(g->hop[i].output_if, output_if[i], SR_NAMELEN - 1);
+		g->hop[i].output_if[SR_NAMELEN - 1] = 0;
+		g->hop[i].hits = 0;
+	}
+	nh = nt->free_cnt ? nt->free_idx[--nt->free_cnt] : nt->used++;
+	nh_set(nt, nh, g);
+	g->chain = nt->bucket[h & (nt->buckets - 1)];
+	nt->bucket[h & (nt->buckets - 1)] = nh;
+	if(++nt->count > nt->buckets) nh_grow(nt);
+	pthread_mutex_unlock(&nt->lock);
+
+	return nh;
+}
+
+// only for a group the caller holds already, so it cannot go away meanwhile
+void nh_hold(uint32_t nh)
+{
+	if(nh == NH_NONE) return;
+	__sync_fetch_and_add(&nh_get(nexthops(), nh)->refcnt, 1);
+}
+
+void nh_release(uint32_t nh)
+{
+	struct nexthopTable* nt = nexthops();
+	struct nexthopGroup* g;
+	uint32_t* link;
+
+	if(nh == NH_NONE) return;
+
+	pthread_mutex_lock(&nt->lock);
+	g = nh_get(nt, nh);
+	if(__sync_sub_and_fetch(&g->refcnt, 1) == 0){
+		for(link = &nt->bucket[g->hash & (nt->buckets - 1)]; *link != nh; link = &nh_get(nt, *link)->chain);
+		*link = g->chain;
+		nh_set(nt, nh, NULL);
+		free(g);
+		if(nt->free_cnt == nt->free_size){
+			nt->free_size = nt->free_size ? 2*nt->free_size : 64;
+			nt->free_idx = (uint32_t*)realloc(nt->free_idx, sizeof(uint32_t)*nt->free_size);
+		}
+		nt->free_idx[nt->free_cnt++] = nh;
+		nt->count--;
+	}
+	pthread_mutex_unlock(&nt->lock);
+}
+
+struct nexthopGroup* nh_group(uint32_t nh)
+{
+	return nh_get(nexthops(), nh);
+}
+
+/*
+ * ------------------------------- routes ------------------
+ */
+
+rtableNode* alloc_rtable_node(uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
+{
+	int i;
+	rtableNode *node;
+
     //check output_if size
     for(i = 0; i < out_cnt; i++){
 	    if(strlen(output_if[i]) >= SR_NAMELEN) {
-			return;
+			return NULL;
 	    }
 	}
 
-    //create new node
-    rtableNode *node = (rtableNode*) malloc(sizeof(rtableNode));
+    node = (rtableNode*) malloc(sizeof(rtableNode));
     node->ip = ip;
     node->netmask = netmask;
-    node->out_cnt = out_cnt;
-    node->gateway = (uint32_t*)malloc(sizeof(uint32_t)*out_cnt);
-    node->output_if = (char**)malloc(sizeof(char*)*out_cnt);
+    node->nh = nh_intern(gateway, output_if, out_cnt);
     node->entry_index = 0;
-    for(i = 0; i < out_cnt; i++) node->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);
-    for(i = 0; i < out_cnt; i++) node->gateway[i] = gateway[i];
-    for(i = 0; i < out_cnt; i++) strcpy(node->output_if[i], output_if[i]);
     node->is_static = is_static;
     node->next = node->prev = NULL;
+    return node;
+}
 
-    //acquire lock
-    pthread_mutex_lock(&rtable_lock);
+void free_rtable_node(rtableNode *node)
+{
+	nh_release(node->nh);
+	free(node);
+}
 
+// puts node in the table, or gives its next hops to the last entry of its
+// subnet if that one is of the same kind or node is static
+static void insert_node_lockless(rtableNode **head, rtableNode *node)
+{
     //Check if the list is empty
     if(*head == NULL) {
 		(*head) = node;
-		pthread_mutex_unlock(&rtable_lock);
 		return;
     }
 
     //scan the list until you hit the right netmask
     rtableNode *cnode = *head;
-    if(netmask > cnode->netmask || (netmask == cnode->netmask && (ip&netmask) > (cnode->ip&cnode->netmask))) {
+    if(node->netmask > cnode->netmask || (node->netmask == cnode->netmask && (node->ip&node->netmask) > (cnode->ip&cnode->netmask))) {
 		*head = node;
 		node->next = cnode;
 		cnode->prev = node;
     }
     else {
 		while(cnode->next != NULL) {
-		    if(netmask > cnode->next->netmask || (netmask == cnode->next->netmask && (ip&netmask) > (cnode->next->ip & cnode->next->netmask))) {
+		    if(node->netmask > cnode->next->netmask || (node->netmask == cnode->next->netmask && (node->ip&node->netmask) > (cnode->next->ip & cnode->next->netmask))) {
 				break;
 		    }
 		    cnode = cnode->next;
 		}
 
 		//check for equality to prevent adding duplicate nodes
-		if((cnode->ip&cnode->netmask) == (ip&netmask) && ((cnode->is_static == is_static) || is_static )) {
-			if(cnode->out_cnt != out_cnt){
-				for(i = 0; i < cnode->out_cnt; i++) free(cnode->output_if[i]);
-				free(cnode->output_if);
-				free(cnode->gateway);
-			    cnode->out_cnt = out_cnt;
-			    cnode->is_static = is_static;
-			    cnode->gateway = (uint32_t*)malloc(sizeof(uint32_t)*cnode->out_cnt);
-			    cnode->output_if = (char**)malloc(sizeof(char*)*cnode->out_cnt);
-			    for(i = 0; i < cnode->out_cnt; i++) cnode->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);							
-			}
-			cnode->is_static = is_static;
-			for(i = 0; i < out_cnt; i++){
-				cnode->gateway[i] = gateway[i];
-				strcpy(cnode->output_if[i], output_if[i]);
-			}
-			for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-			free(node->output_if);
-			free(node->gateway);
-		    free(node);
-		    pthread_mutex_unlock(&rtable_lock);
+		if((cnode->ip&cnode->netmask) == (node->ip&node->netmask) && ((cnode->is_static == node->is_static) || node->is_static )) {
+			// takes the new next hops, the old ones go with node
+			uint32_t nh = cnode->nh;
+			cnode->nh = node->nh;
+			cnode->is_static = node->is_static;
+			node->nh = nh;
+			free_rtable_node(node);
 		    return;
 		}
 
@@ -86,68 +245,53 @@ void insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32
 		node->prev = cnode;
 		cnode->next = node;
     }
-
-    //release lock
-    pthread_mutex_unlock(&rtable_lock);
-    return;
 }
 
-void force_insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
+void insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
 {
-	int i;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	
 	if(out_cnt < 1) return;
-	
-    //check output_if size
-    for(i = 0; i < out_cnt; i++){
-	    if(strlen(output_if[i]) >= SR_NAMELEN) {
-			return;
-	    }
-	}
 
     //create new node
-    rtableNode *node = (rtableNode*) malloc(sizeof(rtableNode));
-    node->ip = ip;
-    node->netmask = netmask;
-    node->out_cnt = out_cnt;
-    node->gateway = (uint32_t*)malloc(sizeof(uint32_t)*out_cnt);
-    node->output_if = (char**)malloc(sizeof(char*)*out_cnt);
-    node->entry_index = 0;
-    for(i = 0; i < out_cnt; i++) node->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);
-    for(i = 0; i < out_cnt; i++) node->gateway[i] = gateway[i];
-    for(i = 0; i < out_cnt; i++) strcpy(node->output_if[i], output_if[i]);
-    node->is_static = is_static;
-    node->next = node->prev = NULL;
+    rtableNode *node = alloc_rtable_node(ip, netmask, gateway, output_if, out_cnt, is_static);
+    if(node == NULL) return;
 
-    //acquire lock
-    pthread_mutex_lock(&rtable_lock);
+    pthread_mutex_lock(&subsystem->rtable_lock);
+	insert_node_lockless(head, node);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+}
 
+// puts node in the table after the entries of its subnet, as their next fast
+// reroute entry
+static void force_insert_node_lockless(rtableNode **head, rtableNode *node)
+{
     //Check if the list is empty
     if(*head == NULL) {
 		(*head) = node;
-		pthread_mutex_unlock(&rtable_lock);
 		return;
     }
 
     //scan the list until you hit the right netmask
     rtableNode *cnode = *head;
-    if(netmask > cnode->netmask || (netmask == cnode->netmask && (ip&netmask) > (cnode->ip&cnode->netmask))) {
+    if(node->netmask > cnode->netmask || (node->netmask == cnode->netmask && (node->ip&node->netmask) > (cnode->ip&cnode->netmask))) {
 		*head = node;
 		node->next = cnode;
 		cnode->prev = node;
     }
     else {
 		while(cnode->next != NULL) {
-		    if(netmask > cnode->next->netmask || (netmask == cnode->next->netmask && (ip&netmask) > (cnode->next->ip & cnode->next->netmask))) {
+		    if(node->netmask > cnode->next->netmask || (node->netmask == cnode->next->netmask && (node->ip&node->netmask) > (cnode->next->ip & cnode->next->netmask))) {
 				break;
 		    }
 		    cnode = cnode->next;
 		}
 
 		//check for equality to prevent adding duplicate nodes
-		if((cnode->ip & cnode->netmask) == (ip & netmask)) {
+		if((cnode->ip & cnode->netmask) == (node->ip & node->netmask)) {
 			int tmp_flag = 1;
-			while((cnode->ip & cnode->netmask) == (ip & netmask)){
+			while((cnode->ip & cnode->netmask) == (node->ip & node->netmask)){
 				if(cnode->next){	
 					cnode = cnode->next;
 				}
@@ -168,81 +312,70 @@ void force_insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask,
 		node->prev = cnode;
 		cnode->next = node;
     }
-
-    //release lock
-    pthread_mutex_unlock(&rtable_lock);
-    return;
 }
 
-void merge_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
+void force_insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
 {
-	int i;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	
 	if(out_cnt < 1) return;
-	
-    //check output_if size
-    for(i = 0; i < out_cnt; i++){
-	    if(strlen(output_if[i]) >= SR_NAMELEN) {
-			return;
-	    }
-	}
 
     //create new node
-    rtableNode *node = (rtableNode*) malloc(sizeof(rtableNode));
-    node->ip = ip;
-    node->netmask = netmask;
-    node->out_cnt = out_cnt;
-    node->gateway = (uint32_t*)malloc(sizeof(uint32_t)*out_cnt);
-    node->output_if = (char**)malloc(sizeof(char*)*out_cnt);
-    node->entry_index = 0;
-    for(i = 0; i < out_cnt; i++) node->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);
-    for(i = 0; i < out_cnt; i++) node->gateway[i] = gateway[i];
-    for(i = 0; i < out_cnt; i++) strcpy(node->output_if[i], output_if[i]);
-    node->is_static = is_static;
-    node->next = node->prev = NULL;
+    rtableNode *node = alloc_rtable_node(ip, netmask, gateway, output_if, out_cnt, is_static);
+    if(node == NULL) return;
 
-    //acquire lock
-    pthread_mutex_lock(&rtable_lock);
+    pthread_mutex_lock(&subsystem->rtable_lock);
+	force_insert_node_lockless(head, node);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+}
 
+// adds the next hops of node to the last entry of its subnet, or puts node
+// in the table if there is none
+static void merge_node_lockless(rtableNode **head, rtableNode *node)
+{
     //Check if the list is empty
     if(*head == NULL) {
 		(*head) = node;
-		pthread_mutex_unlock(&rtable_lock);
 		return;
     }
 
     //scan the list until you hit the right netmask
     rtableNode *cnode = *head;
-    if(netmask > cnode->netmask || (netmask == cnode->netmask && (ip&netmask) > (cnode->ip&cnode->netmask))) {
+    if(node->netmask > cnode->netmask || (node->netmask == cnode->netmask && (node->ip&node->netmask) > (cnode->ip&cnode->netmask))) {
 		*head = node;
 		node->next = cnode;
 		cnode->prev = node;
     }
     else {
 		while(cnode->next != NULL) {
-		    if(netmask > cnode->next->netmask || (netmask == cnode->next->netmask && (ip&netmask) > (cnode->next->ip & cnode->next->netmask))) {
+		    if(node->netmask > cnode->next->netmask || (node->netmask == cnode->next->netmask && (node->ip&node->netmask) > (cnode->next->ip & cnode->next->netmask))) {
 				break;
 		    }
 		    cnode = cnode->next;
 		}
 
 		//check for equality
-		if((cnode->ip&cnode->netmask) == (ip&netmask)) {
-			int old_cnt = cnode->out_cnt;
-		    cnode->out_cnt += out_cnt;
-		    cnode->is_static &= is_static; 
-		    cnode->gateway = (uint32_t*)realloc(cnode->gateway, sizeof(uint32_t)*cnode->out_cnt);
-		    cnode->output_if = (char**)realloc(cnode->output_if, sizeof(char*)*cnode->out_cnt);
-		    for(i = old_cnt; i < cnode->out_cnt; i++) cnode->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);							
-			for(i = 0; i < out_cnt; i++){
-				cnode->gateway[old_cnt + i] = gateway[i];
-				strcpy(cnode->output_if[old_cnt + i], output_if[i]);
+		if((cnode->ip&cnode->netmask) == (node->ip&node->netmask)) {
+			// the group of the old next hops followed by the new ones
+			uint32_t old_nh = cnode->nh;
+			struct nexthopGroup *g = nh_group(old_nh);
+			struct nexthopGroup *ng = nh_group(node->nh);
+			int i, cnt = g->out_cnt + ng->out_cnt;
+			uint32_t gw[cnt];
+			char *ifs[cnt];
+			for(i = 0; i < g->out_cnt; i++){
+				gw[i] = g->hop[i].gateway;
+				ifs[i] = g->hop[i].output_if;
 			}
-			for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-			free(node->output_if);
-			free(node->gateway);
-		    free(node);
-		    pthread_mutex_unlock(&rtable_lock);
+			for(i = 0; i < ng->out_cnt; i++){
+				gw[g->out_cnt + i] = ng->hop[i].gateway;
+				ifs[g->out_cnt + i] = ng->hop[i].output_if;
+			}
+			cnode->nh = nh_intern(gw, ifs, cnt);
+		    cnode->is_static &= node->is_static; 
+			nh_release(old_nh);
+			free_rtable_node(node);
 		    return;
 		}
 
@@ -254,32 +387,138 @@ void merge_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_
 		node->prev = cnode;
 		cnode->next = node;
     }
+}
 
-    //release lock
-    pthread_mutex_unlock(&rtable_lock);
-    return;
+void merge_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static)
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	
+	if(out_cnt < 1) return;
+
+    //create new node
+    rtableNode *node = alloc_rtable_node(ip, netmask, gateway, output_if, out_cnt, is_static);
+    if(node == NULL) return;
+
+    pthread_mutex_lock(&subsystem->rtable_lock);
+	merge_node_lockless(head, node);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
 }
 
-rtableNode* copy_rtable(rtableNode *src){
+int rtable_load_add(struct rtableLoad *l, uint32_t ip, uint32_t netmask, uint32_t gateway, const char *output_if, int mode)
+{
+	struct rtableRoute *r;
 	int i;
+
+	if(strlen(output_if) >= SR_NAMELEN) return 0;
+
+	// few interfaces, the last one used is the likely one
+	for(i = l->names - 1; i >= 0; i--)
+		if(!strcmp(l->name[i], output_if)) break;
+	if(i < 0) {
+		l->name = (char (*)[SR_NAMELEN])realloc(l->name, (l->names + 1) * SR_NAMELEN);
+		i = l->names++;
+		strcpy(l->name[i], output_if);
+	}
+
+	if(l->cnt == l->size) {
+		l->size = l->size ? 2*l->size : 1024;
+		l->route = (struct rtableRoute*)realloc(l->route, l->size * sizeof(struct rtableRoute));
+	}
+	r = &l->route[l->cnt];
+	r->ip = ip;
+	r->netmask = netmask;
+	r->gateway = gateway;
+	r->seq = l->cnt++;
+	r->iface = i;
+	r->mode = mode;
+	return 1;
+}
+
+void free_rtable_load(struct rtableLoad *l)
+{
+	free(l->route);
+	free(l->name);
+	memset(l, 0, sizeof(struct rtableLoad));
+}
+
+// table order: decreasing netmask, then decreasing subnet, then as added
+static int cmp_load(const void *a, const void *b)
+{
+	const struct rtableRoute *ra = (const struct rtableRoute*)a;
+	const struct rtableRoute *rb = (const struct rtableRoute*)b;
+
+	if(ra->netmask != rb->netmask) return (ra->netmask > rb->netmask) ? -1 : 1;
+	if((ra->ip & ra->netmask) != (rb->ip & rb->netmask)) return ((ra->ip & ra->netmask) > (rb->ip & rb->netmask)) ? -1 : 1;
+	return (ra->seq < rb->seq) ? -1 : 1;
+}
+
+// appends the entry with the next hops of routes first..last
+static rtableNode *build_entry(struct rtableLoad *l, rtableNode *tail, uint32_t ip, int first, int last, int entry_index, int is_static)
+{
+	int i, cnt = last - first + 1;
+	uint32_t gw[cnt];
+	char *ifs[cnt];
+	rtableNode *node;
+
+	for(i = 0; i < cnt; i++) {
+		gw[i] = l->route[first + i].gateway;
+		ifs[i] = l->name[l->route[first + i].iface];
+	}
+	node = alloc_rtable_node(ip, l->route[first].netmask, gw, ifs, cnt, is_static);
+	node->entry_index = entry_index;
+	node->prev = tail;
+	if(tail != NULL) tail->next = node;
+	return node;
+}
+
+rtableNode* build_rtable(struct rtableLoad *l, int is_static, int *entries)
+{
+	rtableNode *head = NULL, *tail = NULL;
+	uint32_t ip = 0;
+	int i, first = 0, entry_index = 0;
+
+	*entries = 0;
+	if(l->cnt == 0) return NULL;
+	qsort(l->route, l->cnt, sizeof(struct rtableRoute), cmp_load);
+
+	// the next hops of an entry are always a run of the sorted routes: a
+	// route that replaces them starts the run again, one that merges with
+	// them extends it and one that is forced in starts the next entry
+	for(i = 0; i <= l->cnt; i++) {
+		struct rtableRoute *r = &l->route[i];
+		int same = i > 0 && i < l->cnt && r->netmask == r[-1].netmask &&
+			(r->ip & r->netmask) == (r[-1].ip & r[-1].netmask);
+
+		if(same && r->mode == RTABLE_MERGE) continue;
+		if(same && r->mode == RTABLE_INSERT) {
+			first = i;
+			continue;
+		}
+		if(i > 0) {
+			tail = build_entry(l, tail, ip, first, i - 1, entry_index, is_static);
+			if(head == NULL) head = tail;
+			(*entries)++;
+		}
+		if(i == l->cnt) break;
+		entry_index = same ? entry_index + 1 : 0;
+		ip = r->ip;
+		first = i;
+	}
+	return head;
+}
+
+rtableNode* copy_rtable(rtableNode *src){
 	rtableNode *dst_head = NULL;
 	rtableNode *dst;
 	rtableNode *dst_prev = NULL;
 	while(src){
 		dst = (rtableNode*)malloc(sizeof(rtableNode));
-		dst->out_cnt = src->out_cnt;
-		dst->gateway = (uint32_t*)malloc(sizeof(uint32_t)*dst->out_cnt);
-		dst->output_if = (char**)malloc(sizeof(char*)*dst->out_cnt);
-		for(i = 0; i < dst->out_cnt; i++) dst->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);
-		
 		dst->ip = src->ip;
 		dst->netmask = src->netmask;
-		for(i = 0; i < dst->out_cnt; i++){
-			dst->gateway[i] = src->gateway[i];
-			strcpy(dst->output_if[i], src->output_if[i]);
-		}
+		dst->nh = src->nh; // same group
+		nh_hold(dst->nh);
 		dst->is_static = src->is_static;
-		dst->t = src->t;
 		dst->entry_index = src->entry_index;
 		
 		dst->prev = dst_prev;
@@ -298,25 +537,18 @@ rtableNode* copy_rtable(rtableNode *src){
 }
 
 void kill_rtable(rtableNode** head){
-	int i;
 	while(*head){
 		rtableNode *next_node = (*head)->next;
-		for(i = 0; i < (*head)->out_cnt; i++) free((*head)->output_if[i]);
-		free((*head)->output_if);
-		free((*head)->gateway);
-		free(*head);
+		free_rtable_node(*head);
 		
 		*head = next_node;
 	}
 }
 
 
-int del_ip(rtableNode **head, uint32_t ip, uint32_t netmask, int is_static)
+// removes the first entry of the subnet of that kind, returns 1 if there was one
+static int del_ip_lockless(rtableNode **head, uint32_t ip, uint32_t netmask, int is_static)
 {
-	int i;
-    //acquire lock
-    pthread_mutex_lock(&rtable_lock);
-
     // search node
     rtableNode *node = *head;
     while(node != NULL) {
@@ -325,28 +557,38 @@ int del_ip(rtableNode **head, uint32_t ip, uint32_t netmask, int is_static)
 		    if(node->prev != NULL) {
 				(node->prev)->next = node->next;
 		    }
+		    else {
+				*head = node->next;
+		    }
 		    if(node->next != NULL) {
 				(node->next)->prev = node->prev;
 		    }
-			for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-			free(node->output_if);
-			free(node->gateway);
-		    free(node);
-		    pthread_mutex_unlock(&rtable_lock);
+			free_rtable_node(node);
 		    return 1;
 		}
 		node = node->next;
     }
-    //release lock
-    pthread_mutex_unlock(&rtable_lock);
     return 0;
 }
 
+int del_ip(rtableNode **head, uint32_t ip, uint32_t netmask, int is_static)
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	int ret;
+
+    pthread_mutex_lock(&subsystem->rtable_lock);
+	ret = del_ip_lockless(head, ip, netmask, is_static);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+    return ret;
+}
+
 void del_route_type(rtableNode **head, int is_static)
 {
-	int i;
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
     //acquire lock
-    pthread_mutex_lock(&rtable_lock);
+    pthread_mutex_lock(&subsystem->rtable_lock);
 
     // search node
     rtableNode *node = *head;
@@ -363,17 +605,170 @@ void del_route_type(rtableNode **head, int is_static)
 	    if(node->next != NULL) {
 		(node->next)->prev = node->prev;
 	    }
-		for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-		free(node->output_if);
-		free(node->gateway);
-	    free(node);
+		free_rtable_node(node);
 	    node = nxt_node;
 	    continue;
 	}
 	node = node->next;
     }
     //release lock
-    pthread_mutex_unlock(&rtable_lock);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+}
+
+void rtable_txn_begin(struct rtableTxn *t, int is_static)
+{
+	memset(t, 0, sizeof(struct rtableTxn));
+	t->is_static = is_static;
+}
+
+int rtable_txn_add(struct rtableTxn *t, uint32_t ip, uint32_t netmask, uint32_t gateway, const char *output_if, int mode)
+{
+	return rtable_load_add(&t->ops, ip, netmask, gateway, output_if, mode);
+}
+
+void rtable_txn_del(struct rtableTxn *t, uint32_t ip, uint32_t netmask)
+{
+	rtable_load_add(&t->ops, ip, netmask, 0, "", RTABLE_DELETE);
+}
+
+void rtable_txn_abort(struct rtableTxn *t)
+{
+	free_rtable_load(&t->ops);
+}
+
+// node is an entry of the subnet of r
+static int same_subnet(const rtableNode *node, const struct rtableRoute *r)
+{
+	return node->netmask == r->netmask && (node->ip & node->netmask) == (r->ip & r->netmask);
+}
+
+int rtable_txn_commit(rtableNode **head, struct rtableTxn *t)
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct rtableLoad *l = &t->ops;
+	rtableNode *prev = NULL, *cur, *run, *tail, *node;
+	int i, first, changes = 0, defaults = 0;
+
+	t->missing = 0;
+	if(l->cnt == 0) {
+		free_rtable_load(l);
+		return 0;
+	}
+	// the operations of a subnet end up together, in the order they were made
+	qsort(l->route, l->cnt, sizeof(struct rtableRoute), cmp_load);
+
+	pthread_mutex_lock(&subsystem->rtable_lock);
+
+	// the table is sorted the same way, so one walk finds all the subnets
+	cur = *head;
+	for(first = 0; first < l->cnt; first = i) {
+		struct rtableRoute *r = &l->route[first];
+
+		while(cur != NULL && (cur->netmask > r->netmask ||
+				(cur->netmask == r->netmask && (cur->ip & cur->netmask) > (r->ip & r->netmask)))) {
+			prev = cur;
+			cur = cur->next;
+		}
+
+		// take the subnet's entries out, they are all that the operations touch
+		run = NULL;
+		if(cur != NULL && same_subnet(cur, r)) {
+			run = cur;
+			while(cur != NULL && same_subnet(cur, r)) cur = cur->next;
+			run->prev = NULL;
+			if(cur != NULL) cur->prev->next = NULL;
+		}
+
+		for(i = first; i < l->cnt && (i == first || (l->route[i].netmask == r->netmask &&
+				(l->route[i].ip & r->netmask) == (r->ip & r->netmask))); i++) {
+			struct rtableRoute *op = &l->route[i];
+			char *if_name = l->name[op->iface];
+
+			if(op->mode == RTABLE_DELETE) {
+				if(del_ip_lockless(&run, op->ip, op->netmask, t->is_static)) changes++;
+				else t->missing++;
+				continue;
+			}
+			node = alloc_rtable_node(op->ip, op->netmask, &op->gateway, &if_name, 1, t->is_static);
+			if(op->mode == RTABLE_MERGE) merge_node_lockless(&run, node);
+			else if(op->mode == RTABLE_FORCE) force_insert_node_lockless(&run, node);
+			else insert_node_lockless(&run, node);
+			changes++;
+		}
+		if(r->netmask == 0) defaults = 1;
+
+		// and back in the same place
+		for(tail = run; tail != NULL && tail->next != NULL; tail = tail->next);
+		if(run != NULL) {
+			run->prev = prev;
+			if(prev != NULL) prev->next = run;
+			else *head = run;
+			tail->next = cur;
+			if(cur != NULL) cur->prev = tail;
+			prev = tail;
+		}
+		else {
+			if(prev != NULL) prev->next = cur;
+			else *head = cur;
+			if(cur != NULL) cur->prev = prev;
+		}
+	}
+
+	#ifdef _CPUMODE_
+	// one hw update for all of them
+	if(changes > 0)
+		writeRoutingTable();
+	#endif // _CPUMODE_
+
+	pthread_mutex_unlock(&subsystem->rtable_lock);
+
+	free_rtable_load(l);
+	if(t->is_static && defaults && changes > 0) invalidateLSU(); // we advertise static default routes
+	return changes;
+}
+
+// next hop i of group g is marked down, only the first 32 can be
+static int nexthop_down(const struct nexthopGroup *g, int i)
+{
+	return i < 32 && (g->down & (1u << i));
+}
+
+/* the longest prefix match for ip with a next hop that is not down, NULL if none
+ * *group and *hop are set to that next hop: the flow hash picks one of all the
+ * next hops (hash-threshold), and the flows of one that is down are spread over
+ * those that are not, so no other flow moves; caller must hold rtable_lock
+ */
+static rtableNode *usable_match(struct nexthopTable *nt, rtableNode *head, uint32_t ip, uint32_t flow,
+	struct nexthopGroup **group, int *hop)
+{
+	int i, up;
+	uint64_t x;
+	rtableNode *node = head;
+	while(node != NULL) {
+		if((node->ip & node->netmask) == (ip & node->netmask) && node->nh != NH_NONE) {
+			struct nexthopGroup *g = nh_get(nt, node->nh);
+			*group = g;
+			x = (uint64_t)flow * g->out_cnt;
+			*hop = x >> 32;
+			if(!nexthop_down(g, *hop))
+				return node;
+			for(i = 0, up = 0; i < g->out_cnt; i++)
+				if(!nexthop_down(g, i)) up++;
+			if(up > 0) {
+				// the rest of the hash picks among the others
+				up = ((uint64_t)(uint32_t)x * up) >> 32;
+				for(i = 0; i < g->out_cnt; i++) {
+					if(!nexthop_down(g, i) && up-- == 0) {
+						*hop = i;
+						return node;
+					}
+				}
+			}
+		}
+		node = node->next;
+	}
+	return NULL;
 }
 
 /* Return value: 
@@ -389,39 +784,20 @@ char *lp_match(rtableNode **head, uint32_t ip)
     char *output_if = NULL;
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    struct nexthopGroup *g;
+    int hop;
 
     //acquire lock
-    pthread_mutex_lock(&rtable_lock);
+    pthread_mutex_lock(&subsystem->rtable_lock);
 
     //do LP matching
-    rtableNode *node = *head;
-    while(node != NULL) {
-	if((node->ip & node->netmask) == (ip & node->netmask)) {
+    if(usable_match(&subsystem->nexthops, *head, ip, 0, &g, &hop) != NULL) {
 	    //malloc 32 bytes for storing interface
 	    output_if = (char*)malloc((sizeof(char)) * SR_NAMELEN);
-	    int i;
-	    int iface_disabled = 0;
-	    pthread_rwlock_rdlock(&subsystem->if_lock);
-	    for(i = 0; i < subsystem->num_ifaces; i++) {
-			if(!strcmp(subsystem->ifaces[i].name, output_if)) {
-			    if(!(subsystem->ifaces[i].enabled)) {
-					iface_disabled = 1;
-			    }
-			    break;
-			}
-	    }
-	    pthread_rwlock_unlock(&subsystem->if_lock);
-
-	    if(iface_disabled)
-		continue;
-
-	    strcpy(output_if, node->output_if[0]);
-	    break;
-	}
-	node = node->next;
+	    strcpy(output_if, g->hop[hop].output_if);
     }
     //release lock
-    pthread_mutex_unlock(&rtable_lock);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
 
     //return pointer to the interface buffer
     return output_if;
@@ -429,22 +805,21 @@ char *lp_match(rtableNode **head, uint32_t ip)
 
 uint32_t gw_match(rtableNode **head, uint32_t ip)
 {
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
     uint32_t gw = 0;
+    struct nexthopGroup *g;
+    int hop;
 
     //acquire lock
-    pthread_mutex_lock(&rtable_lock);
+    pthread_mutex_lock(&subsystem->rtable_lock);
 
     //do LP matching
-    rtableNode *node = *head;
-    while(node != NULL) {
-	if((node->ip & node->netmask) == (ip & node->netmask)) {
-	    gw = node->gateway[0];
-	    break;
-	}
-	node = node->next;
+    if(usable_match(&subsystem->nexthops, *head, ip, 0, &g, &hop) != NULL) {
+	    gw = g->hop[hop].gateway;
     }
     //release lock
-    pthread_mutex_unlock(&rtable_lock);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
 
 	if(gw == 0) gw = ip;
 
@@ -452,9 +827,64 @@ uint32_t gw_match(rtableNode **head, uint32_t ip)
     return gw;
 }
 
+int rtable_lookup(rtableNode **head, uint32_t ip, uint32_t flow, uint32_t *gw, char *output_if,
+		uint32_t *route, uint32_t *mask)
+{
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    struct nexthopGroup *g;
+    rtableNode *node;
+    int hop;
+
+    pthread_mutex_lock(&subsystem->rtable_lock);
+    node = usable_match(&subsystem->nexthops, *head, ip, flow, &g, &hop);
+    if(node != NULL) {
+	    *gw = g->hop[hop].gateway ? g->hop[hop].gateway : ip;
+	    strcpy(output_if, g->hop[hop].output_if);
+	    g->hop[hop].hits++;
+	    if(route != NULL) *route = node->ip;
+	    if(mask != NULL) *mask = node->netmask;
+    }
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+
+    return node != NULL;
+}
+
+int rtable_nexthop_down(rtableNode **head, uint32_t gw, const char *if_name, int down)
+{
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    struct nexthopTable *nt = &subsystem->nexthops;
+    uint32_t nh;
+    int i, changes = 0;
+
+    if(gw == 0 && if_name == NULL) return 0;
+
+    // the groups of the routing table and of the shadow tables all change,
+    // which is right for both
+    pthread_mutex_lock(&subsystem->rtable_lock);
+    pthread_mutex_lock(&nt->lock);
+    for(nh = NH_NONE + 1; nh < nt->used; nh++) {
+	    struct nexthopGroup *g = nh_get(nt, nh);
+	    if(g == NULL) continue;
+	    for(i = 0; i < g->out_cnt && i < 32; i++) {
+		    if((gw && g->hop[i].gateway != gw) || (if_name && strcmp(g->hop[i].output_if, if_name)))
+			    continue;
+		    if(nexthop_down(g, i) != (down != 0)) {
+			    g->down ^= 1u << i;
+			    changes++;
+		    }
+	    }
+    }
+    pthread_mutex_unlock(&nt->lock);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+
+    return changes;
+}
+
 void rebuild_rtable_lockless(rtableNode **head, rtableNode *shadow_table)
 {
-	int i, mode = 0;
+	int mode = 0;
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
     
@@ -478,10 +908,7 @@ void rebuild_rtable_lockless(rtableNode **head, rtableNode *shadow_table)
 		    if(node->next != NULL) {
 				(node->next)->prev = node->prev;
 		    }
-			for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-			free(node->output_if);
-			free(node->gateway);	    
-		    free(node);
+		    free_rtable_node(node);
 		    node = nxt_node;
 		    continue;
 		}
@@ -520,23 +947,11 @@ void rebuild_rtable_lockless(rtableNode **head, rtableNode *shadow_table)
 
 		    //check for equality
 		    if( ((mode & 0x2) == 0 ) && ((cnode->ip & cnode->netmask) == (node->ip & node->netmask)) && (cnode->is_static == node->is_static)) {
-				if(cnode->out_cnt != node->out_cnt){
-					for(i = 0; i < cnode->out_cnt; i++) free(cnode->output_if[i]);
-					free(cnode->output_if);
-					free(cnode->gateway);
-				    cnode->out_cnt = node->out_cnt;
-				    cnode->gateway = (uint32_t*)malloc(sizeof(uint32_t)*cnode->out_cnt);
-				    node->output_if = (char**)malloc(sizeof(char*)*cnode->out_cnt);
-				    for(i = 0; i < cnode->out_cnt; i++) cnode->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);							
-				}
-				for(i = 0; i < node->out_cnt; i++){
-					cnode->gateway[i] = node->gateway[i];
-					strcpy(cnode->output_if[i], node->output_if[i]);
-				}
-				for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-				free(node->output_if);
-				free(node->gateway);
-				free(node);
+				// take the new next hop group, the old one goes with node
+				uint32_t nh = cnode->nh;
+				cnode->nh = node->nh;
+				node->nh = nh;
+				free_rtable_node(node);
 				node = nxt_node;
 				continue;
 		    }		    
@@ -554,10 +969,7 @@ void rebuild_rtable_lockless(rtableNode **head, rtableNode *shadow_table)
 				}
 				if(tmp_flag) cnode = cnode->prev;
 				if(cnode->entry_index >= node->entry_index){
-					for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-					free(node->output_if);
-					free(node->gateway);
-				    free(node);
+				    free_rtable_node(node);
 					node = nxt_node;
 					continue;
 				}
@@ -577,8 +989,10 @@ void rebuild_rtable_lockless(rtableNode **head, rtableNode *shadow_table)
 
 void rebuild_rtable(rtableNode **head, rtableNode *shadow_table)
 {
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
     // acquire lock
-    pthread_mutex_lock(&rtable_lock);
+    pthread_mutex_lock(&subsystem->rtable_lock);
 
 	rebuild_rtable_lockless(head, shadow_table);
 
@@ -588,7 +1002,133 @@ void rebuild_rtable(rtableNode **head, rtableNode *shadow_table)
 	#endif // _CPUMODE_
 
     // release lock
-    pthread_mutex_unlock(&rtable_lock);
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+}
+
+
+// orders routes the way the table is kept: decreasing netmask, then decreasing ip
+static int cmp_route(const rtableNode *a, const rtableNode *b)
+{
+	if(a->netmask != b->netmask) return (a->netmask > b->netmask) ? -1 : 1;
+	if((a->ip & a->netmask) != (b->ip & b->netmask)) return ((a->ip & a->netmask) > (b->ip & b->netmask)) ? -1 : 1;
+	return 0;
+}
+
+// next hop groups are interned, equal next hops have the same index
+static int same_route(const rtableNode *a, const rtableNode *b)
+{
+	return a->ip == b->ip && a->nh == b->nh;
+}
+
+static rtableNode *next_dynamic(rtableNode *node)
+{
+	while(node != NULL && node->is_static) node = node->next;
+	return node;
+}
+
+int patch_rtable_lockless(rtableNode **head, rtableNode *shadow_table, int all)
+{
+	int changes = 0;
+	rtableNode *pos = NULL; // last dynamic entry in place so far
+	rtableNode *old = next_dynamic(*head);
+	rtableNode *node = shadow_table;
+	rtableNode *marked = NULL; // subnet whose entries are being replaced
+
+	// both lists are sorted the same way (fast reroute entries of a subnet
+	// follow each other by entry_index), walk them side by side
+	while(old != NULL || node != NULL) {
+		int c;
+		if(node == NULL) c = -1;
+		else if(old == NULL) c = 1;
+		else {
+			c = cmp_route(old, node);
+			if(c == 0) c = old->entry_index - node->entry_index;
+		}
+
+		if(c > 0 && node->nh == NH_NONE) {
+			// marks a subnet, its old entries go unless they are in the shadow table
+			rtableNode *nxt_node = node->next;
+			if(marked != NULL) free_rtable_node(marked);
+			marked = node;
+			node = nxt_node;
+			continue;
+		}
+
+		if(c < 0 && !all && (marked == NULL || cmp_route(old, marked) != 0)) {
+			// not in the shadow table, leave it alone
+			pos = old;
+			old = next_dynamic(old->next);
+		}
+		else if(c < 0) {
+			// route is gone
+			rtableNode *nxt_old = next_dynamic(old->next);
+			if(old->prev != NULL) old->prev->next = old->next;
+			else *head = old->next;
+			if(old->next != NULL) old->next->prev = old->prev;
+			free_rtable_node(old);
+			old = nxt_old;
+			changes++;
+		}
+		else if(c > 0) {
+			// new route, goes after the static entries that sort before or with it
+			rtableNode *nxt_node = node->next;
+			rtableNode *prev = pos;
+			rtableNode *cnode = (pos != NULL) ? pos->next : *head;
+			while(cnode != NULL && cnode->is_static && cmp_route(cnode, node) <= 0) {
+				prev = cnode;
+				cnode = cnode->next;
+			}
+			node->prev = prev;
+			node->next = cnode;
+			if(cnode != NULL) cnode->prev = node;
+			if(prev != NULL) prev->next = node;
+			else *head = node;
+			pos = node;
+			node = nxt_node;
+			changes++;
+		}
+		else {
+			// same route, keep the entry and take the new next hops if they changed
+			rtableNode *nxt_node = node->next;
+			if(!same_route(old, node)) {
+				uint32_t nh = old->nh;
+				old->ip = node->ip;
+				old->nh = node->nh;
+				node->nh = nh;
+				changes++;
+			}
+			free_rtable_node(node);
+			pos = old;
+			old = next_dynamic(old->next);
+			node = nxt_node;
+		}
+	}
+	if(marked != NULL) free_rtable_node(marked);
+
+	return changes;
+}
+
+int patch_rtable(rtableNode **head, rtableNode *shadow_table, int all)
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	int changes;
+
+    // acquire lock
+    pthread_mutex_lock(&subsystem->rtable_lock);
+
+	changes = patch_rtable_lockless(head, shadow_table, all);
+
+	#ifdef _CPUMODE_
+	// update hw table, only if something changed
+	if(changes > 0)
+		writeRoutingTable();
+	#endif // _CPUMODE_
+
+    // release lock
+    pthread_mutex_unlock(&subsystem->rtable_lock);
+
+	return changes;
 }
 
 
@@ -610,6 +1150,7 @@ void rtable_route_add( struct sr_instance* sr,
     strcpy(tmp_if, interface->name);
     insert_rtable_node(&(subsystem->rtable), dest, mask, &gw, &tmp_if, 1, is_static_route);
 	free(tmp_if);
+    if(is_static_route && mask == 0) invalidateLSU(); // we advertise static default routes
 }
 
 /** Adds a multipath route (i.e. merges new route with old ones) */
@@ -624,6 +1165,7 @@ void rtable_route_addm( struct sr_instance* sr,
     strcpy(tmp_if, interface->name);
     merge_rtable_node(&(subsystem->rtable), dest, mask, &gw, &tmp_if, 1, is_static_route);
 	free(tmp_if);
+    if(is_static_route && mask == 0) invalidateLSU();
 }
 
 /** Adds a multipath route (i.e. merges new route with old ones) */
@@ -638,6 +1180,7 @@ void rtable_route_addf( struct sr_instance* sr,
     strcpy(tmp_if, interface->name);
     force_insert_rtable_node(&(subsystem->rtable), dest, mask, &gw, &tmp_if, 1, is_static_route);
 	free(tmp_if);
+    if(is_static_route && mask == 0) invalidateLSU();
 }
 
 /** Removes the specified route from the routing table, if present. */
@@ -646,7 +1189,9 @@ int rtable_route_remove( struct sr_instance* sr,
                          int is_static ) 
 {
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-    return del_ip(&(subsystem->rtable), dest, mask, is_static);
+    int ret = del_ip(&(subsystem->rtable), dest, mask, is_static);
+    if(is_static && mask == 0) invalidateLSU();
+    return ret;
 }
 
 /** Remove all routes from the router. */
@@ -655,6 +1200,8 @@ void rtable_purge_all( struct sr_instance* sr )
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
     del_route_type(&(subsystem->rtable), 0);
     del_route_type(&(subsystem->rtable), 1);
+    forget_spf();
+    invalidateLSU();
 }
 
 /** Remove all routes of a specific type from the router. */
@@ -662,5 +1209,7 @@ void rtable_purge( struct sr_instance* sr, int is_static )
 {
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
     del_route_type(&(subsystem->rtable), is_static);
+    if(!is_static) forget_spf();
+    else invalidateLSU();
 }
 
@@ -15,29 +15,165 @@
  * - IP address
  */
 
+// one next hop of a group
+struct nexthop {
+	uint32_t gateway; // 0 for a directly connected subnet
+	char output_if[SR_NAMELEN];
+	unsigned long hits; // packets rtable_lookup() sent this way
+};
+
+/* The next hops of a route.  All the routes with the same next hops, in the
+ * same order, share one group: groups are interned in the router's
+ * nexthopTable, refcounted by the routes (of any table) that use them, and a
+ * route only keeps the group's index.  A next hop going down or up changes
+ * the group in place (rtable_nexthop_down()), so every route using it sees
+ * the change at once.  Only down, hits and refcnt ever change.
+ */
+struct nexthopGroup {
+	int refcnt;
+	uint32_t down; // bit i: next hop i is known to be down, only the first 32 can be
+	uint32_t hash;
+	uint32_t chain; // next group in the same hash bucket, NH_NONE for none
+	int out_cnt;
+	struct nexthop hop[];
+};
+
+#define NH_NONE 0 // the group without next hops, marks a subnet (see patch_rtable())
+#define NH_CHUNK_BITS 10
+#define NH_MAX_CHUNKS 1024 // up to a million groups
+
+/* The groups of a router by index.  Groups sit in chunks that never move, so
+ * a group a route holds can be read without the lock; interning and
+ * releasing take it.
+ */
+struct nexthopTable {
+	pthread_mutex_t lock;
+	struct nexthopGroup** chunk[NH_MAX_CHUNKS];
+	uint32_t used; // indices handed out so far
+	uint32_t* free_idx; // released indices, to be used again
+	uint32_t free_cnt;
+	uint32_t free_size;
+	uint32_t* bucket; // hash buckets, heads of the chains
+	uint32_t buckets; // power of 2
+	uint32_t count; // groups alive
+};
+
+void init_nexthops(struct nexthopTable* nt);
+/* Returns the index of the group with these next hops, made if there is
+ * none, with a reference held for the caller
+ */
+uint32_t nh_intern(const uint32_t* gateway, char** output_if, int out_cnt);
+void nh_hold(uint32_t nh);
+void nh_release(uint32_t nh);
+
+// the group at index nh, the caller must hold a reference (or a route that does)
+static inline struct nexthopGroup* nh_get(struct nexthopTable* nt, uint32_t nh)
+{
+	return nt->chunk[nh >> NH_CHUNK_BITS][nh & ((1 << NH_CHUNK_BITS) - 1)];
+}
+struct nexthopGroup* nh_group(uint32_t nh);
+
 struct routingTableNode {
 	uint32_t ip;
 	uint32_t netmask;
-	uint32_t* gateway;
-	char** output_if;
-	int out_cnt;
-	int is_static;
-	time_t t;
-	int entry_index; // for fast reroute
+	uint32_t nh; // next hop group, see nh_group()
+	int16_t entry_index; // for fast reroute
+	uint8_t is_static;
 	struct routingTableNode *prev;
 	struct routingTableNode *next;
 };
 
 typedef struct routingTableNode rtableNode;
-pthread_mutex_t rtable_lock;
 
+/* a new entry, not in any table yet, holding a reference to the group of
+ * the next hops given; NULL if an interface name is too long
+ */
+rtableNode* alloc_rtable_node(uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static);
+void free_rtable_node(rtableNode *node);
 void insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static);
 void merge_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static);
 void force_insert_rtable_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static);
 int del_ip(rtableNode **head, uint32_t ip, uint32_t netmask, int is_static);
+
+// how a route of a routing table file joins the others of its subnet
+#define RTABLE_INSERT 0 // replaces their next hops, like insert_rtable_node()
+#define RTABLE_MERGE  1 // "...m" adds a next hop, like merge_rtable_node()
+#define RTABLE_FORCE  2 // "...f" is another entry, like force_insert_rtable_node()
+#define RTABLE_DELETE 3 // only in transactions, removes an entry, like del_ip()
+
+struct rtableRoute
+{
+	uint32_t ip, netmask, gateway;
+	uint32_t seq; // order the routes were added in
+	uint16_t iface; // index into the names of the rtableLoad
+	uint8_t mode;
+};
+
+// routes gathered to be built into a table at once
+struct rtableLoad
+{
+	struct rtableRoute *route;
+	int cnt, size;
+	char (*name)[SR_NAMELEN];
+	int names;
+};
+
+/* adds a route to l, returns 0 if the interface name is too long */
+int rtable_load_add(struct rtableLoad *l, uint32_t ip, uint32_t netmask, uint32_t gateway, const char *output_if, int mode);
+void free_rtable_load(struct rtableLoad *l);
+/* A new table with the routes of l, the same as inserting them one by one in
+ * the order they were added, but sorting them once instead of walking the
+ * list for each, O(n log n) rather than O(n^2).  Reorders l->route.
+ * *entries is set to the number of entries of the table.
+ */
+rtableNode* build_rtable(struct rtableLoad *l, int is_static, int *entries);
+
+// route changes made to the table at once
+struct rtableTxn
+{
+	struct rtableLoad ops;
+	int is_static; // of all the routes added and removed
+	int missing; // removals that found no route, set by rtable_txn_commit()
+};
+
+void rtable_txn_begin(struct rtableTxn *t, int is_static);
+/* the same as insert_rtable_node(), merge_rtable_node() or
+ * force_insert_rtable_node() with a single next hop, depending on mode, but
+ * only once the transaction is committed.
+ * returns 0 if the interface name is too long
+ */
+int rtable_txn_add(struct rtableTxn *t, uint32_t ip, uint32_t netmask, uint32_t gateway, const char *output_if, int mode);
+/* the same as del_ip(), once the transaction is committed */
+void rtable_txn_del(struct rtableTxn *t, uint32_t ip, uint32_t netmask);
+/* Makes the changes of t in the order they were made, all under one hold of
+ * rtable_lock, so lookups see either none or all of them, and updates the hw
+ * table once.  Sorts the changes and walks the table once, O(n + k log k)
+ * for k changes, and only the entries of the subnets they are about are
+ * touched.  Ends the transaction.
+ * returns the number of changes made
+ */
+int rtable_txn_commit(rtableNode **head, struct rtableTxn *t);
+void rtable_txn_abort(struct rtableTxn *t);
 void del_route_type(rtableNode **head, int is_static);
 char *lp_match(rtableNode **head, uint32_t ip);
 uint32_t gw_match(rtableNode **head, uint32_t ip);
+/* Longest prefix match over the next hops that are not marked down, so a
+ * subnet's backup entry (fast reroute) or a shorter prefix takes over as soon
+ * as its primary fails.  Of several next hops (multipath) the flow hash picks
+ * one, the same for all packets of a flow.  Fills in gw (ip itself if
+ * directly connected) and output_if (SR_NAMELEN bytes) with a consistent pair
+ * and counts the packet on that next hop.  The entry matched goes to route
+ * and mask, unless they are NULL.
+ * returns 1 if a usable route was found, 0 otherwise
+ */
+int rtable_lookup(rtableNode **head, uint32_t ip, uint32_t flow, uint32_t *gw, char *output_if,
+		uint32_t *route, uint32_t *mask);
+/* Marks the next hops to gateway gw (any if 0) over interface if_name (any if
+ * NULL) down, or up again, without waiting for SPF to take them out.  Only the
+ * groups change, not the routes, so the cost does not grow with the table.
+ * returns the number of next hops (of all groups) that changed
+ */
+int rtable_nexthop_down(rtableNode **head, uint32_t gw, const char *if_name, int down);
 rtableNode* copy_rtable(rtableNode *src);
 void kill_rtable(rtableNode** head);
 /* Replace all the dynamic routing table entries
@@ -46,6 +182,18 @@ void kill_rtable(rtableNode** head);
 void rebuild_rtable(rtableNode **head, rtableNode *shadow_table);
 void rebuild_rtable_lockless(rtableNode **head, rtableNode *shadow_table);
 
+/* Brings the dynamic entries up to date with the shadow table, but leaves
+ * alone the entries that did not change and only updates the hw table if
+ * something did.  If all is set, the shadow table holds all the dynamic
+ * routes, like for rebuild_rtable.  Otherwise only the subnets in it are
+ * touched, and a subnet's old entries are only removed if the shadow table
+ * marks it with an entry without next hops (NH_NONE, entry_index -1)
+ * ahead of its new ones.  Consumes the shadow table.
+ * returns the number of entries added, changed or removed
+ */
+int patch_rtable(rtableNode **head, rtableNode *shadow_table, int all);
+int patch_rtable_lockless(rtableNode **head, rtableNode *shadow_table, int all);
+
 /**
  * ---------------------------------------------------------------------------
  * -------------------- CLI Functions ----------------------------------------
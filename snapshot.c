@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "router.h"
+
+#define SNAP_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+// records of one kind, grown as they come
+struct snap_array {
+	char *data;
+	size_t len, size;
+};
+
+static void *snap_add(struct snap_array *a, size_t len)
+{
+	void *rec;
+	if(a->len + len > a->size) {
+		a->size = a->size ? 2*a->size : 4096;
+		if(a->size < a->len + len) a->size = a->len + len;
+		a->data = (char*)realloc(a->data, a->size);
+	}
+	rec = a->data + a->len;
+	memset(rec, 0, len);
+	a->len += len;
+	return rec;
+}
+
+// FNV-1a over 32 bit words, len is a multiple of 4
+static uint32_t snap_sum(uint32_t h, const void *data, size_t len)
+{
+	const uint32_t *w = (const uint32_t*)data;
+	size_t i;
+	for(i = 0; i < len/4; i++) h = (h ^ w[i]) * 16777619u;
+	return h;
+}
+
+// of the rtable file fill_rtable() reads, -1 if there is none
+static int64_t rtable_mtime()
+{
+	struct stat st;
+	if(stat("rtable", &st) < 0) return -1;
+	return (int64_t)st.st_mtime;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = (const char*)data;
+	while(len > 0) {
+		ssize_t n = write(fd, p, len);
+		if(n < 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+long snapshot_save(const char *fname)
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct nexthopTable *nt = &subsystem->nexthops;
+	struct topo_db *db = &subsystem->topo;
+	struct snap_array sec[6]; // groups, hops, routes, arp, lsas, ads, in file order
+	struct snap_header h;
+	char tmp[256];
+	uint32_t *group_of, used, i;
+	int fd, ret = -1;
+
+	memset(sec, 0, sizeof(sec));
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.header_len = sizeof(h);
+	h.saved = (int64_t)time(NULL);
+	h.rtable_mtime = rtable_mtime();
+	h.router_id = subsystem->pwospf.routerID;
+
+	// the routes, with each of their groups once
+	pthread_mutex_lock(&subsystem->rtable_lock);
+	pthread_mutex_lock(&nt->lock);
+	used = nt->used;
+	pthread_mutex_unlock(&nt->lock);
+	group_of = (uint32_t*)malloc(sizeof(uint32_t)*used);
+	memset(group_of, 0xff, sizeof(uint32_t)*used);
+	rtableNode *node;
+	for(node = subsystem->rtable; node != NULL; node = node->next) {
+		struct snap_route *r = (struct snap_route*)snap_add(&sec[2], sizeof(struct snap_route));
+		r->ip = node->ip;
+		r->netmask = node->netmask;
+		r->entry_index = node->entry_index;
+		r->is_static = node->is_static;
+		r->group = SNAP_NO_GROUP;
+		h.num_routes++;
+		if(node->nh == NH_NONE) continue;
+		if(group_of[node->nh] == SNAP_NO_GROUP) {
+			struct nexthopGroup *g = nh_get(nt, node->nh);
+			struct snap_group *sg = (struct snap_group*)snap_add(&sec[0], sizeof(struct snap_group));
+			int j;
+			sg->first_hop = h.num_hops;
+			sg->out_cnt = g->out_cnt;
+			for(j = 0; j < g->out_cnt; j++) {
+				struct snap_hop *sh = (struct snap_hop*)snap_add(&sec[1], sizeof(struct snap_hop));
+				sh->gateway = g->hop[j].gateway;
+				strcpy(sh->output_if, g->hop[j].output_if);
+			}
+			h.num_hops += g->out_cnt;
+			group_of[node->nh] = h.num_groups++;
+		}
+		r->group = group_of[node->nh];
+	}
+	pthread_mutex_unlock(&subsystem->rtable_lock);
+	free(group_of);
+
+	pthread_mutex_lock(&subsystem->list_lock);
+	arpNode *arp;
+	for(arp = subsystem->arpList; arp != NULL; arp = arp->next) {
+		struct snap_arp *a = (struct snap_arp*)snap_add(&sec[3], sizeof(struct snap_arp));
+		a->ip = arp->ip;
+		memcpy(a->mac, arp->mac, 6);
+		a->is_static = arp->is_static;
+		h.num_arp++;
+	}
+	pthread_mutex_unlock(&subsystem->list_lock);
+
+	// the LSAs of the others, ours is made again from the neighbors
+	pthread_mutex_lock(&db->lock);
+	topo_router *rtr;
+	for(rtr = db->head; rtr != NULL; rtr = rtr->next) {
+		struct snap_lsa *l;
+		if(rtr->router_id == h.router_id) continue;
+		l = (struct snap_lsa*)snap_add(&sec[4], sizeof(struct snap_lsa));
+		l->last_update_time = (int64_t)rtr->last_update_time;
+		l->router_id = rtr->router_id;
+		l->area_id = rtr->area_id;
+		l->last_seq = rtr->last_seq;
+		l->first_ad = h.num_ads;
+		l->num_ads = rtr->num_ads;
+		for(i = 0; i < rtr->num_ads; i++) {
+			struct snap_ad *ad = (struct snap_ad*)snap_add(&sec[5], sizeof(struct snap_ad));
+			ad->subnet = rtr->ads[i].subnet;
+			ad->mask = rtr->ads[i].mask;
+			ad->router_id = rtr->ads[i].router_id;
+		}
+		h.num_ads += rtr->num_ads;
+		h.num_lsas++;
+	}
+	pthread_mutex_unlock(&db->lock);
+
+	pthread_mutex_lock(&subsystem->pwospf.lsu_reentrant);
+	h.lsu_seq = subsystem->pwospf.lsu_seq;
+	pthread_mutex_unlock(&subsystem->pwospf.lsu_reentrant);
+	struct pwospf_if *pif;
+	for(pif = subsystem->pwospf.if_list; pif != NULL; pif = pif->next) {
+		struct pwospf_neighbor *nbr;
+		pthread_mutex_lock(&pif->neighbor_lock);
+		for(nbr = pif->neighbor_list; nbr != NULL; nbr = nbr->next) h.num_nbrs++;
+		pthread_mutex_unlock(&pif->neighbor_lock);
+	}
+
+	h.len = sizeof(h);
+	h.checksum = 2166136261u;
+	for(i = 0; i < 6; i++) {
+		size_t pad = SNAP_ALIGN(sec[i].len) - sec[i].len;
+		if(pad) snap_add(&sec[i], pad);
+		h.checksum = snap_sum(h.checksum, sec[i].data, sec[i].len);
+		h.len += sec[i].len;
+	}
+
+	// write it next to the old one and swap, so there always is a whole one
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd >= 0) {
+		ret = write_all(fd, &h, sizeof(h));
+		for(i = 0; i < 6 && ret == 0; i++) ret = write_all(fd, sec[i].data, sec[i].len);
+		if(ret == 0) ret = fsync(fd);
+		if(close(fd) < 0) ret = -1;
+		if(ret == 0) ret = rename(tmp, fname);
+		if(ret < 0) unlink(tmp);
+	}
+	for(i = 0; i < 6; i++) free(sec[i].data);
+
+	if(ret < 0) {
+		errorMsg("Could not write the snapshot");
+		return -1;
+	}
+	return (long)h.len;
+}
+
+// the record arrays of a snapshot, NULL if it is not a valid one of this router
+static const char *snap_check(const char *map, size_t len, uint32_t router_id, const char **sec)
+{
+	const struct snap_header *h = (const struct snap_header*)map;
+	const size_t rec[6] = { sizeof(struct snap_group), sizeof(struct snap_hop), sizeof(struct snap_route),
+		sizeof(struct snap_arp), sizeof(struct snap_lsa), sizeof(struct snap_ad) };
+	const struct snap_group *groups;
+	const struct snap_hop *hops;
+	const struct snap_route *routes;
+	const struct snap_lsa *lsas;
+	uint32_t cnt[6], i;
+	size_t off = sizeof(struct snap_header);
+
+	if(len < sizeof(struct snap_header) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)))
+		return "not a snapshot";
+	if(h->version != SNAPSHOT_VERSION || h->header_len != sizeof(struct snap_header))
+		return "snapshot of another version";
+	if(h->len != len) return "snapshot is truncated";
+	if(h->router_id != router_id) return "snapshot of another router";
+
+	cnt[0] = h->num_groups; cnt[1] = h->num_hops; cnt[2] = h->num_routes;
+	cnt[3] = h->num_arp; cnt[4] = h->num_lsas; cnt[5] = h->num_ads;
+	for(i = 0; i < 6; i++) {
+		size_t sz = SNAP_ALIGN((size_t)cnt[i] * rec[i]);
+		if(cnt[i] > len / rec[i] || off + sz > len) return "snapshot is truncated";
+		sec[i] = map + off;
+		off += sz;
+	}
+	if(off != len) return "snapshot is truncated";
+	if(snap_sum(2166136261u, map + sizeof(struct snap_header), len - sizeof(struct snap_header)) != h->checksum)
+		return "snapshot is corrupt";
+
+	// all the references within it
+	groups = (const struct snap_group*)sec[0];
+	hops = (const struct snap_hop*)sec[1];
+	routes = (const struct snap_route*)sec[2];
+	lsas = (const struct snap_lsa*)sec[4];
+	for(i = 0; i < h->num_groups; i++)
+		if(groups[i].out_cnt == 0 || groups[i].first_hop > h->num_hops || groups[i].out_cnt > h->num_hops - groups[i].first_hop)
+			return "snapshot is corrupt";
+	for(i = 0; i < h->num_hops; i++)
+		if(memchr(hops[i].output_if, 0, SR_NAMELEN) == NULL) return "snapshot is corrupt";
+	for(i = 0; i < h->num_routes; i++)
+		if(routes[i].group != SNAP_NO_GROUP && routes[i].group >= h->num_groups) return "snapshot is corrupt";
+	for(i = 0; i < h->num_lsas; i++)
+		if(lsas[i].first_ad > h->num_ads || lsas[i].num_ads > h->num_ads - lsas[i].first_ad)
+			return "snapshot is corrupt";
+	return NULL;
+}
+
+// the routes of the snapshot as a table, in the order they were saved in (the table's)
+static rtableNode *snap_rtable(const struct snap_header *h, const char **sec, int dynamic, uint32_t *cnt)
+{
+	const struct snap_group *groups = (const struct snap_group*)sec[0];
+	const struct snap_hop *hops = (const struct snap_hop*)sec[1];
+	const struct snap_route *routes = (const struct snap_route*)sec[2];
+	uint32_t *nh = (uint32_t*)malloc(sizeof(uint32_t)*(h->num_groups + 1));
+	rtableNode *head = NULL, *prev = NULL, *node;
+	uint32_t i, j;
+
+	for(i = 0; i < h->num_groups; i++) {
+		uint32_t gw[groups[i].out_cnt];
+		char *ifs[groups[i].out_cnt];
+		for(j = 0; j < groups[i].out_cnt; j++) {
+			gw[j] = hops[groups[i].first_hop + j].gateway;
+			ifs[j] = (char*)hops[groups[i].first_hop + j].output_if;
+		}
+		nh[i] = nh_intern(gw, ifs, groups[i].out_cnt);
+	}
+
+	*cnt = 0;
+	for(i = 0; i < h->num_routes; i++) {
+		if(!routes[i].is_static && !dynamic) continue;
+		node = (rtableNode*)malloc(sizeof(rtableNode));
+		node->ip = routes[i].ip;
+		node->netmask = routes[i].netmask;
+		node->nh = (routes[i].group == SNAP_NO_GROUP) ? NH_NONE : nh[routes[i].group];
+		nh_hold(node->nh);
+		node->entry_index = routes[i].entry_index;
+		node->is_static = routes[i].is_static;
+		node->prev = prev;
+		node->next = NULL;
+		if(prev != NULL) prev->next = node;
+		else head = node;
+		prev = node;
+		(*cnt)++;
+	}
+
+	// the routes hold the groups now
+	for(i = 0; i < h->num_groups; i++) nh_release(nh[i]);
+	free(nh);
+	return head;
+}
+
+int snapshot_load(const char *fname)
+{
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct topo_db *db = &subsystem->topo;
+	const struct snap_header *h;
+	const char *sec[6], *err;
+	char msg[256];
+	struct stat st;
+	char *map;
+	long long start = pwospfTime();
+	int fd, dynamic, fib = 0;
+	uint32_t i, j, routes = 0, lsas = 0, arps = 0;
+	time_t now = time(NULL);
+
+	fd = open(fname, O_RDONLY);
+	if(fd < 0) return -1;
+	if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct snap_header)) {
+		close(fd);
+		return -1;
+	}
+	map = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) return -1;
+
+	h = (const struct snap_header*)map;
+	if((err = snap_check(map, st.st_size, subsystem->pwospf.routerID, sec)) != NULL) {
+		snprintf(msg, sizeof(msg), "%s: %s, not used", fname, err);
+		errorMsg(msg);
+		munmap(map, st.st_size);
+		return -1;
+	}
+	dynamic = (now >= h->saved && now - h->saved <= SNAPSHOT_MAX_AGE);
+
+	// the routing table, unless the static routes changed meanwhile
+	if(h->rtable_mtime == rtable_mtime()) {
+		rtableNode *table = snap_rtable(h, sec, dynamic, &routes), *old;
+		pthread_mutex_lock(&subsystem->rtable_lock);
+		old = subsystem->rtable;
+		subsystem->rtable = table;
+#ifdef _CPUMODE_
+		writeRoutingTable();
+#endif // _CPUMODE_
+		pthread_mutex_unlock(&subsystem->rtable_lock);
+		kill_rtable(&old);
+		fib = 1;
+	}
+
+	const struct snap_arp *arp = (const struct snap_arp*)sec[3];
+	for(i = 0; i < h->num_arp; i++) {
+		if(!arp[i].is_static && !dynamic) continue;
+		arpInsert(&subsystem->arpList, arp[i].ip, (uint8_t*)arp[i].mac, arp[i].is_static);
+		arps++;
+	}
+	if(arps > 0) arpReplaceTree(&subsystem->arpTree, arpGenerateTree(subsystem->arpList));
+
+	if(dynamic) {
+		const struct snap_lsa *lsa = (const struct snap_lsa*)sec[4];
+		const struct snap_ad *ad = (const struct snap_ad*)sec[5];
+		for(i = 0; i < h->num_lsas; i++) {
+			topo_router *t = new_lsa(lsa[i].router_id, lsa[i].num_ads);
+			t->area_id = lsa[i].area_id;
+			t->last_seq = lsa[i].last_seq;
+			t->last_update_time = (time_t)lsa[i].last_update_time;
+			for(j = 0; j < lsa[i].num_ads; j++)
+				lsa_add_ad(&t, ad[lsa[i].first_ad + j].subnet, ad[lsa[i].first_ad + j].mask, ad[lsa[i].first_ad + j].router_id);
+			update_lsu(t);
+			lsas++;
+		}
+
+		// keep the routes until the neighbors are back, not just until the first SPF
+		if(fib && h->num_nbrs > 0) {
+			pthread_mutex_lock(&db->lock);
+			db->grace_until = now + SNAPSHOT_GRACE;
+			db->grace_nbrs = h->num_nbrs;
+			pthread_mutex_unlock(&db->lock);
+		}
+	}
+
+	pthread_mutex_lock(&subsystem->pwospf.lsu_reentrant);
+	subsystem->pwospf.lsu_seq = h->lsu_seq;
+	pthread_mutex_unlock(&subsystem->pwospf.lsu_reentrant);
+
+	printf("Restored %u routes, %u ARP entries and %u LSAs from %s, saved %lld s ago, in %lld ms%s\n",
+		routes, arps, lsas, fname, (long long)(now - h->saved), pwospfTime() - start,
+		fib ? "" : " (rtable changed, routes not restored)");
+	munmap(map, st.st_size);
+	return fib;
+}
@@ -0,0 +1,97 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * Binary snapshot of the router's state: the routing table and its next hop
+ * groups, the ARP cache and the link state database.  Written on shutdown
+ * (and with "adv snapshot") and mmap()ed at startup, so a restarted router
+ * forwards right away instead of waiting for PWOSPF to reconverge.
+ *
+ * The file is a header followed by arrays of fixed size records, each
+ * starting at a multiple of 8 bytes, in the order of the counts in the
+ * header.  Numbers are in host byte order, the file is only read back on
+ * the machine that wrote it.
+ */
+
+#include <stdint.h>
+
+#define SNAPSHOT_FILE "fib.snap"
+#define SNAPSHOT_MAGIC "SRSNAP\r\n"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAX_AGE LSU_TIMEOUT // s, older snapshots only give the static routes and ARP entries
+#define SNAPSHOT_GRACE (NEIGHBOR_TIMEOUT*HELLOINT) // s the restored routes are kept while the neighbors come back
+
+struct snap_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_len; // sizeof(struct snap_header)
+	uint32_t len; // of the whole file
+	uint32_t checksum; // of everything after the header
+	int64_t saved; // time(NULL)
+	int64_t rtable_mtime; // of the rtable file the static routes came from, -1 if there was none
+	uint32_t router_id;
+	uint16_t lsu_seq; // of our next LSU, so the neighbors take it
+	uint16_t num_nbrs; // adjacencies we had
+	uint32_t num_groups, num_hops, num_routes, num_arp, num_lsas, num_ads;
+};
+
+struct snap_group {
+	uint32_t first_hop;
+	uint32_t out_cnt;
+};
+
+struct snap_hop {
+	uint32_t gateway;
+	char output_if[SR_NAMELEN];
+};
+
+#define SNAP_NO_GROUP 0xffffffff // a route without next hops
+
+struct snap_route {
+	uint32_t ip;
+	uint32_t netmask;
+	uint32_t group;
+	int16_t entry_index;
+	uint8_t is_static;
+	uint8_t pad;
+};
+
+struct snap_arp {
+	uint32_t ip;
+	uint8_t mac[6];
+	uint8_t is_static;
+	uint8_t pad;
+};
+
+struct snap_lsa {
+	int64_t last_update_time;
+	uint32_t router_id;
+	uint32_t area_id;
+	uint32_t first_ad;
+	uint32_t num_ads;
+	uint16_t last_seq;
+	uint16_t pad[3];
+};
+
+struct snap_ad {
+	uint32_t subnet;
+	uint32_t mask;
+	uint32_t router_id;
+};
+
+/* Writes the snapshot to fname, through a temporary file that replaces it
+ * only once it is complete.
+ * returns the size of the file, -1 on failure
+ */
+long snapshot_save(const char *fname);
+/* Restores the state saved in fname, if it is a valid snapshot of this
+ * router.  The routing table only if the rtable file did not change since;
+ * the dynamic routes, ARP entries and LSAs only if the snapshot is at most
+ * SNAPSHOT_MAX_AGE old.  The restored dynamic routes stay until the
+ * adjacencies are back, or for SNAPSHOT_GRACE, see update_rtable().
+ * returns 1 if the routing table was restored, 0 if only the rest was
+ * and -1 if the file is not there or not usable
+ */
+int snapshot_load(const char *fname);
+
+#endif // SNAPSHOT_H
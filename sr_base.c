@@ -51,6 +51,7 @@
 #include "lwip/transport_subsys.h"
 
 #include "sr_vns.h"
+#include "sr_dumper.h"
 #include "sr_base_internal.h"
 
 #ifdef _CPUMODE_
@@ -91,6 +92,7 @@ int sr_init_low_level_subystem(int argc, char **argv)
 
     char  *client = 0;
     char  *logfile = 0;
+    struct sr_capture_opts capture = { 0, 0, 0, 0 };
 
     /* -- singleton instance of router, passed to sr_get_global_instance
           to become globally accessible                                  -- */
@@ -110,7 +112,7 @@ int sr_init_low_level_subystem(int argc, char **argv)
 	// pass the sr so that it's globally accesssible
 	sr_get_global_instance(sr);
 
-    while ((c = getopt(argc, argv, "hs:v:p:c:t:r:l:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:c:t:r:l:S:C:G:F:")) != EOF)
     {
         switch (c)
         {
@@ -139,6 +141,18 @@ int sr_init_low_level_subystem(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'S':
+                capture.snaplen = atoi((char *) optarg);
+                break;
+            case 'C':
+                capture.rotate_bytes = strtoul(optarg, 0, 10) * 1000000;
+                break;
+            case 'G':
+                capture.rotate_secs = atoi((char *) optarg);
+                break;
+            case 'F':
+                capture.filter = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
@@ -183,7 +197,7 @@ int sr_init_low_level_subystem(int argc, char **argv)
     }
 
     /* -- log all packets sent/received to logfile (if non-null) -- */
-    sr_vns_init_log(sr, logfile);
+    sr_vns_init_log(sr, logfile, &capture);
 
     sr_lwip_transport_startup();
 
@@ -342,8 +356,13 @@ void sr_init_instance(struct sr_instance* sr)
     sr->user[0]  = 0;
     sr->vhost[0] = 0;
     sr->topo_id  = 0;
-    sr->logfile  = 0;
+    sr->capture  = 0;
     sr->hw_init  = 0;
+    sr->rbuf     = 0;
+    sr->rbuf_pos = 0;
+    sr->rbuf_len = 0;
+    sr->rbuf_free = 0;
+    sr->sendq    = 0;
 
     sr->interface_subsystem = 0;
 
@@ -375,5 +394,7 @@ static void usage(char* argv0)
 {
     printf("Simple Router Client\n");
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
-    printf("           [-t topo id] \n");
+    printf("           [-t topo id] [-r rtable] [-l logfile] \n");
+    printf("           [-S snaplen] [-C MB per logfile] [-G s per logfile] \n");
+    printf("           [-F capture filter] \n");
 } /* -- usage -- */
@@ -38,6 +38,12 @@
 
 #define SR_NAMELEN 32
 
+/* -- receive buffer for commands from the VNS server, must hold several of
+      the largest commands so a single recv() can drain many packets at
+      once -- */
+#define SR_VNS_RBUF_SIZE (64*1024)
+#define SR_VNS_CMD_MAX 10000 /* longest command accepted from the server */
+
 #define CPU_HW_FILENAME "cpuhw"
 
 /* -- gcc specific vararg macro support ... but its so nice! -- */
@@ -75,6 +81,27 @@ struct sr_vns_if
 #endif /* _CPUMODE_ */
 };
 
+struct sr_vns_sendq; /* -- sr_vns.c -- */
+struct sr_capture;   /* -- sr_dumper.c -- */
+struct sr_instance;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rbuf
+ *
+ * Block the commands from the VNS server are read into.  Packets are lent
+ * to the worker threads straight out of it, each holding a reference, and
+ * the block goes back to its instance's free list once the last is done.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_rbuf
+{
+    int refs; /* the reader's, while it reads into it, and one per packet lent */
+    struct sr_instance* sr; /* whose free list it goes back to */
+    struct sr_rbuf* next; /* on the free list */
+    uint8_t data[SR_VNS_RBUF_SIZE];
+};
+
 /* ----------------------------------------------------------------------------
  * struct sr_instance
  *
@@ -92,9 +119,14 @@ struct sr_instance
     char rtable[32];/* filename for routing table          */
     unsigned short topo_id; /* topology id */
     struct sockaddr_in sr_addr; /* address to server */
-    FILE* logfile; /* file to log all received/sent packets to */
+    struct sr_capture* capture; /* logs received/sent packets to a file */
     volatile uint8_t  hw_init; /* bool : hardware has been initialized */
     pthread_mutex_t   send_lock; /* experimental */
+    struct sr_rbuf* rbuf; /* commands read from server */
+    unsigned int rbuf_pos; /* first byte of rbuf not handled yet */
+    unsigned int rbuf_len; /* bytes currently held in rbuf */
+    struct sr_rbuf* rbuf_free; /* blocks no packet refers to any more */
+    struct sr_vns_sendq* sendq; /* packets waiting to be written to server */
 
     void* interface_subsystem; /* subsystem to send/recv packets from */
 };
@@ -123,6 +155,11 @@ void sr_integ_input(struct sr_instance* sr,
                    const uint8_t * packet/* borrowed */,
                    unsigned int len,
                    const char* interface/* borrowed */);
+void sr_integ_input_ref(struct sr_instance* sr,
+                   uint8_t * packet/* lent, lies in ref */,
+                   unsigned int len,
+                   const char* interface/* borrowed */,
+                   struct sr_rbuf* ref);
 void sr_integ_add_interface(struct sr_instance*,
                             struct sr_vns_if* /* borrowed */);
 
@@ -141,6 +178,12 @@ int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
                              uint8_t* buf /* borrowed */ ,
                              unsigned int len,
                              const char* iface /* borrowed */);
+int sr_integ_low_level_outputv(struct sr_instance* sr /* borrowed */,
+                               uint8_t* hdr /* borrowed */,
+                               unsigned int hdr_len,
+                               const uint8_t* body /* borrowed */,
+                               unsigned int body_len,
+                               const char* iface /* borrowed */);
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
 
 
@@ -265,6 +265,58 @@ int sr_cpu_output(struct sr_instance* sr /* borrowed */,
     return -1;
 } /* -- sr_cpu_output -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_cpu_outputv(..)
+ * Scope: Global
+ *
+ * sr_cpu_output() for a packet in two pieces, written with one sendmsg()
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_cpu_outputv(struct sr_instance* sr /* borrowed */,
+                       uint8_t* hdr /* borrowed */ ,
+                       unsigned int hdr_len,
+                       const uint8_t* body /* borrowed */ ,
+                       unsigned int body_len,
+                       const char* iface /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(hdr);
+    assert(iface);
+
+#ifdef _CPUMODE_
+
+	int i, retVal;
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = hdr_len;
+	iov[1].iov_base = (void*)body;
+	iov[1].iov_len = body_len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = body_len ? 2 : 1;
+		
+	pthread_rwlock_rdlock(&subsystem->if_lock);
+	for(i = 0; i < subsystem->num_ifaces; i++){
+		if(!strcmp(iface, subsystem->ifaces[i].name)){
+			retVal = sendmsg(subsystem->ifaces[i].socket, &msg, 0);
+			pthread_rwlock_unlock(&subsystem->if_lock);
+			return retVal;
+		}
+	}
+
+	pthread_rwlock_unlock(&subsystem->if_lock);
+
+#endif /* _CPUMODE_ */
+
+    /* Return the length of the packet on success, -1 on failure */
+    return -1;
+} /* -- sr_cpu_outputv -- */
+
 
 /*-----------------------------------------------------------------------------
  * Method: copy_next_field(..)
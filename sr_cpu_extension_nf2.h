@@ -27,5 +27,11 @@ int sr_cpu_output(struct sr_instance* sr /* borrowed */,
                        uint8_t* buf /* borrowed */ ,
                        unsigned int len,
                        const char* iface /* borrowed */);
+int sr_cpu_outputv(struct sr_instance* sr /* borrowed */,
+                       uint8_t* hdr /* borrowed */ ,
+                       unsigned int hdr_len,
+                       const uint8_t* body /* borrowed */ ,
+                       unsigned int body_len,
+                       const char* iface /* borrowed */);
 
 #endif  /* --  SR_CPU_EXTENSIONS_H -- */
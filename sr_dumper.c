@@ -1,13 +1,828 @@
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <arpa/inet.h>
 
 #include "sr_dumper.h"
 
 #include "sr_base_internal.h"
 
+#include "lwtcp/lwip/sys.h"
+
+/* ----------------------------------------------------------------------------
+ * struct sr_filter
+ *
+ * Capture filter, a small subset of the tcpdump/BPF expression language:
+ *
+ *   expr      := and { ("or" | "||") and }
+ *   and       := not { ("and" | "&&") not }
+ *   not       := ("not" | "!") not | "(" expr ")" | primitive
+ *   primitive := "ip" | "arp" | "icmp" | "tcp" | "udp" | "ospf" | "proto" N
+ *              | ["src" | "dst"] ("host" A.B.C.D | "net" A.B.C.D/len | "port" N)
+ *
+ * compiled into a tree of nodes and checked against a packet's headers,
+ * which are decoded once per packet.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_FILTER_NODES  64
+#define SR_FILTER_TOKENS 128
+
+enum { F_AND, F_OR, F_NOT, F_ETHERTYPE, F_PROTO, F_HOST, F_NET, F_PORT };
+enum { F_ANY, F_SRC, F_DST };
+
+struct sr_filter_node
+{
+    int op;
+    int dir;         /* F_ANY, F_SRC or F_DST */
+    uint32_t val;    /* ethertype, protocol, address or port */
+    uint32_t mask;   /* F_NET */
+    int l, r;        /* operands of F_AND, F_OR and F_NOT */
+};
+
+struct sr_filter
+{
+    struct sr_filter_node node[SR_FILTER_NODES];
+    int cnt;
+    int root; /* -1 for no filter */
+};
+
+/* what the filter looks at, host byte order */
+struct sr_pkt_info
+{
+    uint16_t ethertype;
+    int has_addr;   /* IP or ARP */
+    uint32_t src, dst;
+    int has_proto;  /* IP */
+    uint8_t proto;
+    int has_ports;  /* TCP or UDP, first fragment */
+    uint16_t sport, dport;
+};
+
+/* a packet in up to two pieces */
+struct sr_pkt
+{
+    const uint8_t* hdr;
+    unsigned int hdr_len;
+    const uint8_t* body;
+    unsigned int body_len;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_capture
+ *
+ * Bounded multi-producer/single-consumer queue of captured packets, the
+ * same scheme as the VNS send queue (sr_vns.c).  A slot holds the pcap
+ * record header followed by the first snaplen bytes of the packet, so the
+ * writer hands runs of slots straight to writev().
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_capture_slot
+{
+    volatile unsigned int seq;
+    unsigned int len; /* record header + captured bytes */
+    uint8_t data[];
+};
+
+struct sr_capture
+{
+    uint8_t* slots;          /* SR_CAPTURE_DEPTH slots of stride bytes */
+    unsigned int stride;
+    volatile unsigned int head; /* next slot producers claim */
+    unsigned int tail;          /* next slot the writer writes */
+    sem_t ready;                /* posted once per published slot */
+    sem_t done;                 /* writer is finished, see sr_capture_close() */
+    volatile int closing;
+
+    struct sr_filter filter;
+    unsigned int snaplen;
+    unsigned long rotate_bytes;
+    unsigned int rotate_secs;
+
+    /* -- only used by the writer -- */
+    char fname[256];
+    int fd;
+    unsigned long file_bytes;
+    time_t file_opened;
+
+    volatile unsigned long captured;
+    volatile unsigned long filtered;
+    volatile unsigned long dropped;
+    volatile unsigned long writes;
+    volatile unsigned long files;
+};
+
+/* the capture flushed at exit */
+static struct sr_capture* sr_capture_open_one = 0;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_filter_parse_*(..)
+ * Scope:  local
+ *
+ * Recursive descent over the tokens of the filter expression, each returns
+ * the index of the node it built or -1 on a syntax error.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_filter_parser
+{
+    struct sr_filter* f;
+    char* tok[SR_FILTER_TOKENS];
+    int cnt;
+    int pos;
+};
+
+static int sr_filter_node_new(struct sr_filter* f, int op, int dir,
+                              uint32_t val, uint32_t mask, int l, int r)
+{
+    struct sr_filter_node* n;
+
+    if ( f->cnt >= SR_FILTER_NODES || (op <= F_NOT && (l < 0 || (op != F_NOT && r < 0))) )
+    { return -1; }
+
+    n = &f->node[f->cnt];
+    n->op = op;
+    n->dir = dir;
+    n->val = val;
+    n->mask = mask;
+    n->l = l;
+    n->r = r;
+
+    return f->cnt++;
+}
+
+static const char* sr_filter_peek(struct sr_filter_parser* p)
+{ return p->pos < p->cnt ? p->tok[p->pos] : ""; }
+
+static int sr_filter_accept(struct sr_filter_parser* p, const char* a,
+                            const char* b)
+{
+    const char* t = sr_filter_peek(p);
+
+    if ( !strcasecmp(t, a) || (b && !strcasecmp(t, b)) )
+    {
+        p->pos++;
+        return 1;
+    }
+    return 0;
+}
+
+static int sr_filter_number(const char* t, unsigned long max, uint32_t* val)
+{
+    char* end;
+    unsigned long v = strtoul(t, &end, 0);
+
+    if ( !*t || *end || v > max )
+    { return 0; }
+    *val = v;
+    return 1;
+}
+
+static int sr_filter_parse_expr(struct sr_filter_parser* p);
+
+static int sr_filter_parse_primitive(struct sr_filter_parser* p)
+{
+    static const struct { const char* name; int op; uint32_t val; } kw[] =
+    {
+        { "ip",   F_ETHERTYPE, 0x0800 },
+        { "arp",  F_ETHERTYPE, 0x0806 },
+        { "icmp", F_PROTO, 1 },
+        { "tcp",  F_PROTO, 6 },
+        { "udp",  F_PROTO, 17 },
+        { "ospf", F_PROTO, 89 },
+    };
+    int dir = F_ANY;
+    unsigned int i;
+    uint32_t val, len;
+    struct in_addr a;
+    char* slash;
+    char* t;
+
+    for ( i = 0; i < sizeof(kw) / sizeof(kw[0]); i++ )
+    {
+        if ( sr_filter_accept(p, kw[i].name, NULL) )
+        { return sr_filter_node_new(p->f, kw[i].op, F_ANY, kw[i].val, 0, -1, -1); }
+    }
+    if ( sr_filter_accept(p, "proto", NULL) )
+    {
+        if ( !sr_filter_number(sr_filter_peek(p), 255, &val) )
+        { return -1; }
+        p->pos++;
+        return sr_filter_node_new(p->f, F_PROTO, F_ANY, val, 0, -1, -1);
+    }
+
+    if ( sr_filter_accept(p, "src", NULL) )
+    { dir = F_SRC; }
+    else if ( sr_filter_accept(p, "dst", NULL) )
+    { dir = F_DST; }
+
+    if ( sr_filter_accept(p, "host", NULL) )
+    {
+        if ( !inet_aton(sr_filter_peek(p), &a) )
+        { return -1; }
+        p->pos++;
+        return sr_filter_node_new(p->f, F_HOST, dir, ntohl(a.s_addr), 0, -1, -1);
+    }
+    if ( sr_filter_accept(p, "net", NULL) )
+    {
+        if ( p->pos >= p->cnt )
+        { return -1; }
+        t = p->tok[p->pos];
+        if ( (slash = strchr(t, '/')) == NULL )
+        { return -1; }
+        *slash = 0;
+        if ( !inet_aton(t, &a) || !sr_filter_number(slash + 1, 32, &len) )
+        { return -1; }
+        p->pos++;
+        val = len ? 0xffffffff << (32 - len) : 0;
+        return sr_filter_node_new(p->f, F_NET, dir, ntohl(a.s_addr) & val, val, -1, -1);
+    }
+    if ( sr_filter_accept(p, "port", NULL) )
+    {
+        if ( !sr_filter_number(sr_filter_peek(p), 65535, &val) )
+        { return -1; }
+        p->pos++;
+        return sr_filter_node_new(p->f, F_PORT, dir, val, 0, -1, -1);
+    }
+
+    return -1;
+}
+
+static int sr_filter_parse_not(struct sr_filter_parser* p)
+{
+    int n;
+
+    if ( sr_filter_accept(p, "not", "!") )
+    { return sr_filter_node_new(p->f, F_NOT, F_ANY, 0, 0, sr_filter_parse_not(p), -1); }
+    if ( sr_filter_accept(p, "(", NULL) )
+    {
+        n = sr_filter_parse_expr(p);
+        return sr_filter_accept(p, ")", NULL) ? n : -1;
+    }
+    return sr_filter_parse_primitive(p);
+}
+
+static int sr_filter_parse_and(struct sr_filter_parser* p)
+{
+    int n = sr_filter_parse_not(p);
+
+    while ( n >= 0 && sr_filter_accept(p, "and", "&&") )
+    { n = sr_filter_node_new(p->f, F_AND, F_ANY, 0, 0, n, sr_filter_parse_not(p)); }
+    return n;
+}
+
+static int sr_filter_parse_expr(struct sr_filter_parser* p)
+{
+    int n = sr_filter_parse_and(p);
+
+    while ( n >= 0 && sr_filter_accept(p, "or", "||") )
+    { n = sr_filter_node_new(p->f, F_OR, F_ANY, 0, 0, n, sr_filter_parse_and(p)); }
+    return n;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_filter_compile(..)
+ * Scope:  local
+ *
+ * Compile expr into f, an empty expression matches everything.  Returns
+ * -1 if expr doesn't parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_filter_compile(struct sr_filter* f, const char* expr)
+{
+    struct sr_filter_parser p;
+    char* buf;
+    char* c;
+    int ret = 0;
+
+    f->cnt = 0;
+    f->root = -1;
+    if ( !expr )
+    { return 0; }
+
+    /* -- split into words, parentheses are words of their own -- */
+    if ( (buf = (char*)malloc(strlen(expr) * 3 + 1)) == NULL )
+    { return -1; }
+    for ( c = buf; *expr; expr++ )
+    {
+        if ( *expr == '(' || *expr == ')' )
+        {
+            *c++ = ' ';
+            *c++ = *expr;
+            *c++ = ' ';
+        }
+        else
+        { *c++ = *expr; }
+    }
+    *c = 0;
+
+    p.f = f;
+    p.cnt = p.pos = 0;
+    for ( c = strtok(buf, " \t"); c; c = strtok(NULL, " \t") )
+    {
+        if ( p.cnt == SR_FILTER_TOKENS )
+        { ret = -1; break; }
+        p.tok[p.cnt++] = c;
+    }
+
+    if ( ret == 0 && p.cnt > 0 )
+    {
+        f->root = sr_filter_parse_expr(&p);
+        if ( f->root < 0 || p.pos != p.cnt )
+        {
+            fprintf(stderr, "capture filter: syntax error at \"%s\"\n",
+                    p.pos < p.cnt ? p.tok[p.pos] : "end");
+            ret = -1;
+        }
+    }
+
+    free(buf);
+    return ret;
+} /* -- sr_filter_compile -- */
+
+/* n bytes at offset off of the packet, 0 if it is shorter */
+static int sr_pkt_get(const struct sr_pkt* pkt, unsigned int off,
+                      unsigned int n, uint8_t* out)
+{
+    unsigned int i;
+
+    if ( off + n > pkt->hdr_len + pkt->body_len )
+    { return 0; }
+    for ( i = 0; i < n; i++, off++ )
+    { out[i] = off < pkt->hdr_len ? pkt->hdr[off] : pkt->body[off - pkt->hdr_len]; }
+    return 1;
+}
+
+static uint32_t sr_get_be(const uint8_t* b, int n)
+{
+    uint32_t v = 0;
+
+    while ( n-- > 0 )
+    { v = (v << 8) | *b++; }
+    return v;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_filter_decode(..)
+ * Scope:  local
+ *
+ * Fill in the parts of the Ethernet, ARP, IP and TCP/UDP headers the filter
+ * can look at.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_filter_decode(const struct sr_pkt* pkt, struct sr_pkt_info* info)
+{
+    uint8_t b[20];
+    unsigned int ihl;
+
+    memset(info, 0, sizeof(*info));
+    if ( !sr_pkt_get(pkt, 12, 2, b) )
+    { return; }
+    info->ethertype = sr_get_be(b, 2);
+
+    if ( info->ethertype == 0x0806 )
+    {
+        if ( sr_pkt_get(pkt, 14 + 14, 4, b) && sr_pkt_get(pkt, 14 + 24, 4, b + 4) )
+        {
+            info->has_addr = 1;
+            info->src = sr_get_be(b, 4);
+            info->dst = sr_get_be(b + 4, 4);
+        }
+    }
+    else if ( info->ethertype == 0x0800 && sr_pkt_get(pkt, 14, 20, b) )
+    {
+        info->has_addr = info->has_proto = 1;
+        info->proto = b[9];
+        info->src = sr_get_be(b + 12, 4);
+        info->dst = sr_get_be(b + 16, 4);
+        ihl = (b[0] & 0x0f) * 4;
+        if ( (info->proto == 6 || info->proto == 17) &&
+             (sr_get_be(b + 6, 2) & 0x1fff) == 0 &&
+             sr_pkt_get(pkt, 14 + ihl, 4, b) )
+        {
+            info->has_ports = 1;
+            info->sport = sr_get_be(b, 2);
+            info->dport = sr_get_be(b + 2, 2);
+        }
+    }
+} /* -- sr_filter_decode -- */
+
+static int sr_filter_match_node(const struct sr_filter* f, int i,
+                                const struct sr_pkt_info* info)
+{
+    const struct sr_filter_node* n = &f->node[i];
+
+    switch ( n->op )
+    {
+        case F_AND:
+            return sr_filter_match_node(f, n->l, info) && sr_filter_match_node(f, n->r, info);
+        case F_OR:
+            return sr_filter_match_node(f, n->l, info) || sr_filter_match_node(f, n->r, info);
+        case F_NOT:
+            return !sr_filter_match_node(f, n->l, info);
+        case F_ETHERTYPE:
+            return info->ethertype == n->val;
+        case F_PROTO:
+            return info->has_proto && info->proto == n->val;
+        case F_HOST:
+            return info->has_addr &&
+                   ((n->dir != F_DST && info->src == n->val) ||
+                    (n->dir != F_SRC && info->dst == n->val));
+        case F_NET:
+            return info->has_addr &&
+                   ((n->dir != F_DST && (info->src & n->mask) == n->val) ||
+                    (n->dir != F_SRC && (info->dst & n->mask) == n->val));
+        case F_PORT:
+            return info->has_ports &&
+                   ((n->dir != F_DST && info->sport == n->val) ||
+                    (n->dir != F_SRC && info->dport == n->val));
+    }
+    return 0;
+}
+
+static int sr_filter_match(const struct sr_filter* f, const struct sr_pkt* pkt)
+{
+    struct sr_pkt_info info;
+
+    if ( f->root < 0 )
+    { return 1; }
+    sr_filter_decode(pkt, &info);
+    return sr_filter_match_node(f, f->root, &info);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_open_file(..)
+ * Scope:  local
+ *
+ * Open the next capture file and write its pcap header.  The first one is
+ * named as given, the ones after a rotation get a .1, .2, ... suffix.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_capture_open_file(struct sr_capture* c)
+{
+    struct pcap_file_header hdr;
+    char name[sizeof(c->fname) + 16];
+    int fd;
+
+    if ( c->fname[0] == '-' && c->fname[1] == '\0' )
+    { fd = STDOUT_FILENO; }
+    else
+    {
+        if ( c->files == 0 )
+        { snprintf(name, sizeof(name), "%s", c->fname); }
+        else
+        { snprintf(name, sizeof(name), "%s.%lu", c->fname, c->files); }
+        if ( (fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 )
+        {
+            fprintf(stderr, "sr_capture: can't open %s\n", name);
+            return -1;
+        }
+    }
+
+    hdr.magic = TCPDUMP_MAGIC;
+    hdr.version_major = PCAP_VERSION_MAJOR;
+    hdr.version_minor = PCAP_VERSION_MINOR;
+    hdr.thiszone = 0;
+    hdr.snaplen = c->snaplen;
+    hdr.sigfigs = 0;
+    hdr.linktype = LINKTYPE_ETHERNET;
+    if ( write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) )
+    {
+        fprintf(stderr, "sr_capture: can't write header\n");
+        if ( fd != STDOUT_FILENO )
+        { close(fd); }
+        return -1;
+    }
+
+    c->fd = fd;
+    c->file_bytes = sizeof(hdr);
+    c->file_opened = time(NULL);
+    c->files++;
+
+    return 0;
+} /* -- sr_capture_open_file -- */
+
+/* rotate before writing len more bytes, if the file is due */
+static void sr_capture_rotate(struct sr_capture* c, unsigned long len)
+{
+    if ( c->fd == -1 || c->fd == STDOUT_FILENO ||
+         c->file_bytes <= sizeof(struct pcap_file_header) )
+    { return; }
+    if ( !(c->rotate_bytes && c->file_bytes + len > c->rotate_bytes) &&
+         !(c->rotate_secs && time(NULL) - c->file_opened >= (time_t)c->rotate_secs) )
+    { return; }
+
+    close(c->fd);
+    c->fd = -1;
+    sr_capture_open_file(c);
+}
+
+static int sr_capture_writev_all(int fd, struct iovec* iov, int cnt)
+{
+    ssize_t ret;
+
+    while ( cnt > 0 )
+    {
+        if ( (ret = writev(fd, iov, cnt)) == -1 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            return -1;
+        }
+
+        while ( cnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if ( cnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+#define SR_CAPTURE_SLOT(c, pos) \
+    ((struct sr_capture_slot*)((c)->slots + ((pos) & (SR_CAPTURE_DEPTH - 1)) * (c)->stride))
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_thread(..)
+ * Scope:  local
+ *
+ * Writer thread, drains the capture queue in batches of up to
+ * SR_CAPTURE_BATCH packets per writev() until the slot at the tail is not
+ * published yet, and only then waits for a post (or stops, once closing).
+ * Producers post after publishing, so a slot published after that check
+ * always wakes it up.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_capture_thread(void* arg)
+{
+    struct sr_capture* c = (struct sr_capture*)arg;
+    struct iovec iov[SR_CAPTURE_BATCH];
+    struct sr_capture_slot* slot;
+    unsigned long bytes;
+    int i, cnt;
+
+    while(1)
+    {
+        /* -- collect every slot published so far (in order) -- */
+        bytes = 0;
+        for ( cnt = 0; cnt < SR_CAPTURE_BATCH; cnt++ )
+        {
+            slot = SR_CAPTURE_SLOT(c, c->tail + cnt);
+            if ( slot->seq != c->tail + cnt + 1 )
+            { break; }
+            iov[cnt].iov_base = slot->data;
+            iov[cnt].iov_len  = slot->len;
+            bytes += slot->len;
+        }
+
+        /* -- queue empty, every publish after the check above posts -- */
+        if ( cnt == 0 )
+        {
+            if ( c->closing )
+            { break; }
+            while ( sem_wait(&c->ready) == -1 && errno == EINTR );
+            continue;
+        }
+
+        __sync_synchronize();
+
+        sr_capture_rotate(c, bytes);
+        if ( c->fd == -1 || sr_capture_writev_all(c->fd, iov, cnt) == -1 )
+        { __sync_fetch_and_add(&c->dropped, cnt); }
+        else
+        {
+            __sync_fetch_and_add(&c->captured, cnt);
+            c->file_bytes += bytes;
+        }
+        c->writes++;
+
+        /* -- hand the slots back to the producers -- */
+        for ( i = 0; i < cnt; i++ )
+        {
+            slot = SR_CAPTURE_SLOT(c, c->tail + i);
+            slot->seq = c->tail + i + SR_CAPTURE_DEPTH;
+        }
+        c->tail += cnt;
+
+        /* -- take back the posts of what was written, so that a busy
+         * queue does not pile them up; an extra one only costs an empty
+         * pass -- */
+        for ( i = 0; i < cnt; i++ )
+        {
+            if ( sem_trywait(&c->ready) == -1 )
+            { break; }
+        }
+    }
+
+    if ( c->fd != -1 && c->fd != STDOUT_FILENO )
+    { close(c->fd); }
+    c->fd = -1;
+    sem_post(&c->done);
+} /* -- sr_capture_thread -- */
+
+static void sr_capture_atexit(void)
+{
+    struct sr_capture* c = sr_capture_open_one;
+
+    if ( c )
+    { sr_capture_close(c); }
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_capture* sr_capture_open(const char* fname,
+                                   const struct sr_capture_opts* opts)
+{
+    static int registered = 0;
+    struct sr_capture* c;
+    unsigned int i;
+
+    /* REQUIRES */
+    assert(fname);
+    assert(opts);
+
+    if ( (c = (struct sr_capture*)calloc(1, sizeof(struct sr_capture))) == 0 )
+    {
+        fprintf(stderr,"Error: out of memory (sr_capture_open)\n");
+        return NULL;
+    }
+
+    c->snaplen = opts->snaplen ? opts->snaplen : SR_PACKET_DUMP_SIZE;
+    if ( c->snaplen > SR_CAPTURE_SNAPLEN_MAX )
+    { c->snaplen = SR_CAPTURE_SNAPLEN_MAX; }
+    c->rotate_bytes = opts->rotate_bytes;
+    c->rotate_secs = opts->rotate_secs;
+    strncpy(c->fname, fname, sizeof(c->fname) - 1);
+    c->fd = -1;
+
+    if ( sr_filter_compile(&c->filter, opts->filter) )
+    {
+        free(c);
+        return NULL;
+    }
+
+    /* -- slots cache line aligned -- */
+    c->stride = (sizeof(struct sr_capture_slot) + sizeof(struct pcap_sf_pkthdr) +
+                 c->snaplen + 63) & ~63;
+    if ( (c->slots = (uint8_t*)malloc((size_t)c->stride * SR_CAPTURE_DEPTH)) == 0 )
+    {
+        fprintf(stderr,"Error: out of memory (sr_capture_open)\n");
+        free(c);
+        return NULL;
+    }
+    for ( i = 0; i < SR_CAPTURE_DEPTH; i++ )
+    { SR_CAPTURE_SLOT(c, i)->seq = i; }
+
+    if ( sr_capture_open_file(c) )
+    {
+        free(c->slots);
+        free(c);
+        return NULL;
+    }
+
+    sem_init(&c->ready, 0, 0);
+    sem_init(&c->done, 0, 0);
+    sys_thread_new(sr_capture_thread, c);
+
+    sr_capture_open_one = c;
+    if ( !registered )
+    {
+        registered = 1;
+        atexit(sr_capture_atexit);
+    }
+
+    return c;
+} /* -- sr_capture_open -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope:  Global
+ *
+ * The queue itself stays, a forwarding thread may still be logging into it.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_capture* c)
+{
+    if ( !c || !__sync_bool_compare_and_swap(&c->closing, 0, 1) )
+    { return; }
+
+    __sync_bool_compare_and_swap(&sr_capture_open_one, c, 0);
+    sem_post(&c->ready);
+    while ( sem_wait(&c->done) == -1 && errno == EINTR );
+} /* -- sr_capture_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_get_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_capture_get_stats(struct sr_capture* c, struct sr_capture_stats* st)
+{
+    memset(st, 0, sizeof(*st));
+    if ( !c )
+    { return; }
+
+    st->captured = c->captured;
+    st->filtered = c->filtered;
+    st->dropped = c->dropped;
+    st->writes = c->writes;
+    st->files = c->files;
+} /* -- sr_capture_get_stats -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope:  local
+ *
+ * Copy a matching packet into the queue for the writer.  Drops (and
+ * counts) it rather than wait when the writer is a whole queue behind.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_capture_packet(struct sr_capture* c, const struct sr_pkt* pkt)
+{
+    struct sr_capture_slot* slot;
+    struct pcap_sf_pkthdr* h;
+    struct timeval now;
+    unsigned int pos;
+    unsigned int len = pkt->hdr_len + pkt->body_len;
+    unsigned int caplen = min(len, c->snaplen);
+    int diff;
+
+    if ( c->closing )
+    { return; }
+    if ( !sr_filter_match(&c->filter, pkt) )
+    {
+        __sync_fetch_and_add(&c->filtered, 1);
+        return;
+    }
+
+    pos = c->head;
+    while(1)
+    {
+        slot = SR_CAPTURE_SLOT(c, pos);
+        diff = (int)(slot->seq - pos);
+        if ( diff == 0 )
+        {
+            if ( __sync_bool_compare_and_swap(&c->head, pos, pos + 1) )
+            { break; }
+        }
+        else if ( diff < 0 )
+        { /* -- writer is a whole queue behind -- */
+            __sync_fetch_and_add(&c->dropped, 1);
+            return;
+        }
+        pos = c->head;
+    }
+
+    gettimeofday(&now, 0);
+    h = (struct pcap_sf_pkthdr*)slot->data;
+    h->ts.tv_sec  = now.tv_sec;
+    h->ts.tv_usec = now.tv_usec;
+    h->caplen     = caplen;
+    h->len        = len;
+    if ( caplen <= pkt->hdr_len )
+    { memcpy(slot->data + sizeof(*h), pkt->hdr, caplen); }
+    else
+    {
+        memcpy(slot->data + sizeof(*h), pkt->hdr, pkt->hdr_len);
+        memcpy(slot->data + sizeof(*h) + pkt->hdr_len, pkt->body,
+               caplen - pkt->hdr_len);
+    }
+    slot->len = sizeof(*h) + caplen;
+
+    __sync_synchronize();
+    slot->seq = pos + 1;
+    sem_post(&c->ready);
+} /* -- sr_capture_packet -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -17,24 +832,45 @@
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
+    struct sr_pkt pkt;
 
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(!sr->capture || len <= 0)
     {return; }
 
-    size = min(SR_PACKET_DUMP_SIZE, len);
+    pkt.hdr = buf;
+    pkt.hdr_len = len;
+    pkt.body = NULL;
+    pkt.body_len = 0;
+    sr_capture_packet(sr->capture, &pkt);
+} /* -- sr_log_packet -- */
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < SR_PACKET_DUMP_SIZE) ? size : SR_PACKET_DUMP_SIZE;
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packetv()
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------------*/
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+void sr_log_packetv(struct sr_instance* sr, const uint8_t* hdr,
+                    unsigned int hdr_len, const uint8_t* body,
+                    unsigned int body_len)
+{
+    struct sr_pkt pkt;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->capture)
+    {return; }
+
+    pkt.hdr = hdr;
+    pkt.hdr_len = hdr_len;
+    pkt.body = body;
+    pkt.body_len = body_len;
+    sr_capture_packet(sr->capture, &pkt);
+} /* -- sr_log_packetv -- */
 
 static void
 sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
@@ -3,6 +3,8 @@
  * format as well as a set of operations for logging.
  */
 
+#ifndef SR_DUMPER_H
+#define SR_DUMPER_H
 
 #ifdef _LINUX_
 #include <stdint.h>
@@ -12,6 +14,7 @@
 #include <inttypes.h>
 #endif /* _DARWIN_ */
 
+#include <stdio.h>
 #include <sys/time.h>
 
 #define PCAP_VERSION_MAJOR 2
@@ -26,6 +29,10 @@
 #define min(a,b) ( (a) < (b) ? (a) : (b) )
 
 #define SR_PACKET_DUMP_SIZE 1514
+#define SR_CAPTURE_SNAPLEN_MAX 65535
+
+#define SR_CAPTURE_DEPTH 4096 /* packets waiting for the writer, a power of two */
+#define SR_CAPTURE_BATCH 256  /* max packets per writev() */
 
 /* file header */
 struct pcap_file_header {
@@ -65,9 +72,53 @@ struct pcap_sf_pkthdr {
     uint32_t len;            /* length this packet (off wire) */
 };
 
+/*
+ * Packet capture (-l).  Packets sent and received are copied into a queue
+ * by the forwarding threads and written out by a background thread, a
+ * batch per writev(), so logging never waits on the disk.  Only packets
+ * matching the filter are copied, and only the first snaplen bytes of them.
+ * When the queue is full the packet is left out of the capture and counted.
+ */
+struct sr_capture_opts {
+    unsigned int snaplen;       /* bytes kept of a packet, 0 for SR_PACKET_DUMP_SIZE */
+    unsigned long rotate_bytes; /* start the next file after this many, 0 for never */
+    unsigned int rotate_secs;   /* or once the file is this old, 0 for never */
+    const char* filter;         /* e.g. "icmp and host 10.0.1.1", NULL for all */
+};
+
+struct sr_capture_stats {
+    unsigned long captured; /* packets written */
+    unsigned long filtered; /* not matching the filter */
+    unsigned long dropped;  /* queue full or write error */
+    unsigned long writes;   /* writev() calls */
+    unsigned long files;    /* opened, 1 + rotations */
+};
+
+struct sr_capture; /* -- sr_dumper.c -- */
+
+/**
+ * Start capturing into fname ("-" for stdout).  Rotated files are fname.1,
+ * fname.2, ...  Returns NULL (after saying why) if the file can't be
+ * opened or the filter doesn't parse.
+ */
+struct sr_capture* sr_capture_open(const char* fname,
+                                   const struct sr_capture_opts* opts);
+
+/**
+ * Write out the packets queued so far and close the file.  Packets logged
+ * afterwards are ignored.
+ */
+void sr_capture_close(struct sr_capture* c);
+
+void sr_capture_get_stats(struct sr_capture* c, struct sr_capture_stats* st);
+
 /* Given sr instance, log packet to logfile */
 struct sr_instance; /* forward declare */
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len );
+/* sr_log_packet() for a packet in two pieces */
+void sr_log_packetv(struct sr_instance* sr, const uint8_t* hdr,
+                    unsigned int hdr_len, const uint8_t* body,
+                    unsigned int body_len);
 
 /**
  * Open a dump file and initialize the file.
@@ -83,3 +134,5 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+#endif /* SR_DUMPER_H */
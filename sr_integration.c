@@ -75,22 +75,7 @@ void sr_integ_init(struct sr_instance* sr)
 
 #endif // _CPUMODE_    
     
-    pthread_rwlock_init(&tree_lock, NULL);
-    pthread_mutex_init(&list_lock, NULL);
-    pthread_mutex_init(&queue_lock, NULL);
-    pthread_mutex_init(&rtable_lock, NULL);
-    pthread_mutex_init(&gw_lock, NULL);
-    pthread_mutex_init(&ping_lock, NULL);
-    pthread_rwlock_init(&subsystem->if_lock, NULL);
-	pthread_mutex_init(&subsystem->mode_lock, NULL);
-    
-    subsystem->arpQueue = NULL;
-    subsystem->arpList = NULL;
-    subsystem->arpTree = NULL;
-    subsystem->rtable = NULL;
-    subsystem->gwList = NULL;
-
-	pingListHead = NULL;
+    initRouterState(subsystem);
 
 	srand(time(NULL));
 
@@ -152,31 +137,36 @@ void sr_integ_hw_setup(struct sr_instance* sr)
 
     
     // start refresh threads
-	sys_thread_new(arpCacheRefresh, NULL);
-	sys_thread_new(arpQueueRefresh, NULL);
-	sys_thread_new(refreshPingList, NULL);
+	routerThreadNew(sr, arpCacheRefresh, NULL);
+	routerThreadNew(sr, arpQueueRefresh, NULL);
+	routerThreadNew(sr, refreshPingList, NULL);
 	    
 	// clear arp tree (this is mainly for hw's benefit)
 	arpReplaceTree(&subsystem->arpTree, NULL);
     
     // init pwospf
     initPWOSPF(sr);
-	sys_thread_new(pwospfTimeoutHelloThread, NULL);
+	routerThreadNew(sr, pwospfTimeoutHelloThread, NULL);
 
-    // Load routing table
-    fill_rtable(&(subsystem->rtable));
+    // Load routing table, as it was at the last shutdown if there is a snapshot
+    if(snapshot_load(SNAPSHOT_FILE) <= 0)
+	    fill_rtable(&(subsystem->rtable));
 
 	// start pwospf threads
 	struct pwospf_if* node = subsystem->pwospf.if_list;
 	while(node){
-		sys_thread_new(pwospfSendHelloThread, (void*)node);
+		routerThreadNew(sr, pwospfSendHelloThread, (void*)node);
 		node = node->next;
 	}
-	sys_thread_new(pwospfSendLSUThread, NULL);
+	routerThreadNew(sr, pwospfSendLSUThread, NULL);
+	routerThreadNew(sr, pwospfThrottleThread, NULL);
+	routerThreadNew(sr, pwospfEchoThread, NULL);
 
-	sys_thread_new(topologyRefresh, NULL);
+	routerThreadNew(sr, topologyRefresh, NULL);
 
-	sys_thread_new(linkStatusThread, NULL);
+#ifdef _CPUMODE_
+	routerThreadNew(sr, linkStatusThread, NULL);
+#endif // _CPUMODE_
 
 	// put own interfaces in the routing table
 	update_rtable();
@@ -221,6 +211,25 @@ void sr_integ_input(struct sr_instance* sr,
 
 } /* -- sr_integ_input -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_integ_input_ref(..)
+ * Scope:  Global
+ *
+ * Same as sr_integ_input() for a packet that lies in a receive block
+ * (struct sr_rbuf): the worker gets the packet itself along with a
+ * reference to the block, dropped once it is done, rather than a copy.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_integ_input_ref(struct sr_instance* sr,
+        uint8_t * packet/* lent, lies in ref */,
+        unsigned int len,
+        const char* interface/* borrowed */,
+        struct sr_rbuf* ref)
+{
+	addThreadQueueRef(sr, packet, len, interface, ref);
+} /* -- sr_integ_input_ref -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_add_interface(..)
  * Scope: global
@@ -262,6 +271,8 @@ void sr_integ_add_interface(struct sr_instance* sr,
 struct sr_instance* get_sr() {
     struct sr_instance* sr;
 
+    sr = boundRouter();
+    if(sr) return sr;
     sr = sr_get_global_instance( NULL );
     assert( sr );
     return sr;
@@ -271,7 +282,8 @@ struct sr_instance* get_sr() {
  * Method: sr_integ_low_level_output(..)
  * Scope: global
  *
- * Send a packet to VNS to be injected into the topology
+ * Send a packet to VNS to be injected into the topology, counting it when
+ * it went out
  *
  *---------------------------------------------------------------------------*/
 
@@ -280,13 +292,45 @@ int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
                              unsigned int len,
                              const char* iface /* borrowed */)
 {
+    int ret;
+
 #ifdef _CPUMODE_
-    return sr_cpu_output(sr, buf /*lent*/, len, iface);
+    ret = sr_cpu_output(sr, buf /*lent*/, len, iface);
 #else
-    return sr_vns_send_packet(sr, buf /*lent*/, len, iface);
+    ret = sr_vns_send_packet(sr, buf /*lent*/, len, iface);
 #endif /* _CPUMODE_ */
+    if(ret >= 0) pktstats_tx(&((struct sr_router*)sr_get_subsystem(sr))->stats, len);
+    return ret;
 } /* -- sr_vns_integ_output -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_low_level_outputv(..)
+ * Scope: global
+ *
+ * Same as sr_integ_low_level_output() for a packet whose headers (hdr) and
+ * payload (body) are in separate buffers, so a payload sent to several
+ * hosts is never copied into a full packet for each of them
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_integ_low_level_outputv(struct sr_instance* sr /* borrowed */,
+                               uint8_t* hdr /* borrowed */,
+                               unsigned int hdr_len,
+                               const uint8_t* body /* borrowed */,
+                               unsigned int body_len,
+                               const char* iface /* borrowed */)
+{
+    int ret;
+
+#ifdef _CPUMODE_
+    ret = sr_cpu_outputv(sr, hdr, hdr_len, body, body_len, iface);
+#else
+    ret = sr_vns_send_packetv(sr, hdr, hdr_len, body, body_len, iface);
+#endif /* _CPUMODE_ */
+    if(ret >= 0) pktstats_tx(&((struct sr_router*)sr_get_subsystem(sr))->stats, hdr_len + body_len);
+    return ret;
+} /* -- sr_integ_low_level_outputv -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_destroy(..)
  * Scope: global
@@ -301,24 +345,19 @@ void sr_integ_destroy(struct sr_instance* sr)
     
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 
+    /* for a warm restart */
+    snapshot_save(SNAPSHOT_FILE);
+
     /* free routing table */
-    rtableNode *node = subsystem->rtable;
-    while(node != NULL) {
-	rtableNode *next_node = node->next;
-	free(node);
-	node = next_node;
-    }
+    kill_rtable(&subsystem->rtable);
 
-    free(subsystem->ifaces);
-    free(subsystem);
-    
     destroyThreadPool();
     
-    pthread_rwlock_destroy(&tree_lock);
-    pthread_mutex_destroy(&list_lock);
-    pthread_mutex_destroy(&queue_lock);
-    pthread_mutex_destroy(&rtable_lock);
-    pthread_mutex_destroy(&ping_lock);
+    pthread_rwlock_destroy(&subsystem->tree_lock);
+    pthread_mutex_destroy(&subsystem->list_lock);
+    pthread_mutex_destroy(&subsystem->queue_lock);
+    pthread_mutex_destroy(&subsystem->rtable_lock);
+    pthread_mutex_destroy(&subsystem->ping_lock);
     
 #ifdef _CPUMODE_
 	int i;
@@ -329,6 +368,10 @@ void sr_integ_destroy(struct sr_instance* sr)
     pthread_mutex_destroy(&arpRegLock);
     pthread_mutex_destroy(&routeRegLock);
 #endif /* _CPUMODE_ */
+
+    // the locks and lists above live in the subsystem, so it goes last
+    free(subsystem->ifaces);
+    free(subsystem);
     
 } /* -- sr_integ_destroy -- */
 
@@ -348,7 +391,7 @@ uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */)
 //    fprintf(stderr, "!!! defined to return the correct source address        !!!\n");
 //    fprintf(stderr, "!!! given a destination                                 !!!\n ");
 //    fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-	printf("call to sr_integ_findsrcip\n");
+	dbgMsg("call to sr_integ_findsrcip");
     /* --
      * e.g.
      *
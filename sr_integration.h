@@ -14,6 +14,14 @@ int sr_integ_low_level_output( struct sr_instance* sr /* borrowed */,
                                unsigned int len,
                                const char* iface );
 
+/** same, with the headers and the payload in separate buffers */
+int sr_integ_low_level_outputv( struct sr_instance* sr /* borrowed */,
+                                uint8_t* hdr /* borrowed */,
+                                unsigned int hdr_len,
+                                const uint8_t* body /* borrowed */,
+                                unsigned int body_len,
+                                const char* iface );
+
 /** returns the ip of the interface this will be sent via */
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
 
@@ -22,6 +22,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <semaphore.h>
 
 #include "sr_vns.h"
 #include "sr_dumper.h"
@@ -30,19 +32,58 @@
 
 #include "vnscommand.h"
 
+#include "lwtcp/lwip/sys.h"
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_sendq
+ *
+ * Bounded multi-producer/single-consumer queue of packets waiting to be
+ * written to the server.  Worker threads claim a slot with a CAS on head,
+ * build the VNS header and frame in it and publish it by bumping the slot
+ * sequence.  A single writer thread hands runs of published slots to
+ * writev() and recycles them.  When every slot is taken the packet is
+ * dropped and counted rather than blocking the forwarding path.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_VNS_SENDQ_DEPTH 1024 /* must be a power of two */
+#define SR_VNS_SENDQ_SLOT  2048 /* c_packet_header + largest queued frame */
+#define SR_VNS_SENDQ_BATCH 64   /* max packets per writev() */
+
+struct sr_vns_send_slot
+{
+    volatile unsigned int seq;
+    unsigned int len; /* header + frame */
+    uint8_t data[SR_VNS_SENDQ_SLOT];
+};
+
+struct sr_vns_sendq
+{
+    struct sr_vns_send_slot slot[SR_VNS_SENDQ_DEPTH];
+    volatile unsigned int head; /* next slot producers claim */
+    unsigned int tail;          /* next slot the writer sends */
+    sem_t ready;                /* posted once per published slot */
+    struct sr_instance* sr;
+
+    volatile unsigned long sent;
+    volatile unsigned long dropped;
+    volatile unsigned long writes;
+};
+
 
 /*-----------------------------------------------------------------------------
  * Method: sr_vns_init_log(..)
  * Scope: Global
  *---------------------------------------------------------------------------*/
 
-void sr_vns_init_log(struct sr_instance* sr, char* logfile)
+void sr_vns_init_log(struct sr_instance* sr, char* logfile,
+                     const struct sr_capture_opts* opts)
 {
     if (!logfile)
     { return; }
 
-    sr->logfile = sr_dump_open(logfile, 0, SR_PACKET_DUMP_SIZE);
-    if(!sr->logfile)
+    sr->capture = sr_capture_open(logfile, opts);
+    if(!sr->capture)
     {
         fprintf(stderr,"Error opening up dump file %s\n",
                 logfile);
@@ -59,8 +100,8 @@ void sr_close_instance(struct sr_instance* sr)
 {
     close(sr->sockfd);
 
-    if(sr->logfile)
-    { sr_dump_close(sr->logfile); }
+    if(sr->capture)
+    { sr_capture_close(sr->capture); }
 
     sr->hw_init = 0;
 } /* -- sr_close_instance -- */
@@ -158,6 +199,10 @@ int sr_vns_connect_to_server(struct sr_instance* sr,unsigned short port,
         return -1;
     }
 
+    /* -- packets from here on go through the writer thread -- */
+    if ( sr_vns_start_sender(sr) )
+    { return -1; }
+
     return 0;
 } /* -- sr_connect_to_server -- */
 
@@ -243,138 +288,490 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
     return num_entries;
 } /* -- sr_handle_hwinfo -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_rbuf_get(..)
+ * Scope: local
+ *
+ * A receive block from the free list, or a new one if none is free, with
+ * the reader's reference.  Only the reader takes blocks off the list, so a
+ * block seen at its head cannot go away before the compare-and-swap.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_rbuf* sr_rbuf_get(struct sr_instance* sr)
+{
+    struct sr_rbuf* b;
+
+    do
+    {
+        b = __atomic_load_n(&sr->rbuf_free, __ATOMIC_ACQUIRE);
+    } while ( b && !__sync_bool_compare_and_swap(&sr->rbuf_free, b, b->next) );
+
+    if ( b == NULL && (b = (struct sr_rbuf*)malloc(sizeof(struct sr_rbuf))) == NULL )
+    { return NULL; }
+
+    __atomic_store_n(&b->refs, 1, __ATOMIC_RELAXED);
+    b->sr = sr;
+    b->next = NULL;
+    return b;
+} /* -- sr_rbuf_get -- */
+
+void sr_rbuf_hold(struct sr_rbuf* b)
+{
+    __sync_fetch_and_add(&b->refs, 1);
+} /* -- sr_rbuf_hold -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rbuf_release(..)
+ * Scope: global
+ *
+ * Drops a reference to b; the last one puts b back on its free list.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_rbuf_release(struct sr_rbuf* b)
+{
+    struct sr_instance* sr = b->sr;
+
+    if ( __sync_sub_and_fetch(&b->refs, 1) > 0 )
+    { return; }
+
+    do
+    {
+        b->next = __atomic_load_n(&sr->rbuf_free, __ATOMIC_RELAXED);
+    } while ( !__sync_bool_compare_and_swap(&sr->rbuf_free, b->next, b) );
+} /* -- sr_rbuf_release -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_vns_read_from_server(..)
  * Scope: global
  *
  * Houses main while loop for communicating with the virtual router server.
  *
+ * Each call drains whatever the socket has into sr->rbuf with a single
+ * recv() and then handles every complete command in place.  Packets are
+ * lent to the router straight out of the buffer, each holding a reference
+ * to it, so nothing is allocated or copied per command.  The next call
+ * reads in behind them, until the room left might not hold a whole
+ * command: then the unhandled bytes are moved to the front of the buffer,
+ * or to a fresh one while packets in it are still being handled.  So a
+ * block is only held for packets if it is (nearly) full of them.
+ *
  *---------------------------------------------------------------------------*/
 
 int sr_vns_read_from_server(struct sr_instance* sr /* borrowed */)
 {
     int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    uint8_t *buf = 0;
+    unsigned int pos;
+    int ret = 0;
 
     /* REQUIRES */
     assert(sr);
 
+    if ( sr->rbuf == NULL && (sr->rbuf = sr_rbuf_get(sr)) == NULL )
+    {
+        perror("malloc(..):sr_client.c::sr_vns_read_from_server");
+        return -1;
+    }
+
     /*---------------------------------------------------------------------------
-      Read a command from the server
+      Read as much as the server has sent
       -------------------------------------------------------------------------*/
 
-    bytes_read = 0;
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        errno = 0; /* -- hacky glibc workaround -- */
+        if((ret = recv(sr->sockfd, sr->rbuf->data + sr->rbuf_len,
+                        SR_VNS_RBUF_SIZE - sr->rbuf_len, 0)) == -1)
+        {
+            if ( errno == EINTR )
+            { continue; }
+
+            perror("recv(..):sr_client.c::sr_vns_read_from_server");
+            return -1;
+        }
+    } while ( errno == EINTR); /* be mindful of signals */
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+    if ( ret == 0 )
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
+        fprintf(stderr,"Error: vns server closed the connection\n");
+        close(sr->sockfd);
+        return -1;
+    }
+
+    sr->rbuf_len += ret;
+    pos = sr->rbuf_pos;
 
-                perror("recv(..):sr_client.c::sr_vns_read_from_server");
+    /*---------------------------------------------------------------------------
+      Handle every complete command in the buffer
+      -------------------------------------------------------------------------*/
+
+    while ( sr->rbuf_len - pos >= sizeof(c_base) )
+    {
+        buf = sr->rbuf->data + pos;
+        len = ntohl(((c_base*)buf)->mLen);
+
+        if ( len > SR_VNS_CMD_MAX || len < (int)sizeof(c_base) )
+        {
+            fprintf(stderr,"Error: command length to large %d\n",len);
+            close(sr->sockfd);
+            return -1;
+        }
+
+        /* -- rest of the command is still on its way -- */
+        if ( sr->rbuf_len - pos < (unsigned int)len )
+        { break; }
+
+        command = ntohl(((c_base*)buf)->mType);
+
+        switch (command)
+        {
+            /* -------------        VNSPACKET     -------------------- */
+
+            case VNSPACKET:
+                if ( len < (int)sizeof(c_packet_header) )
+                {
+                    Debug("runt packet command: %d\n", len);
+                    break;
+                }
+
+                /* -- log packet -- */
+                sr_log_packet(sr, buf + sizeof(c_packet_header),
+                        len - sizeof(c_packet_header));
+
+                /* -- pass to router, student's code should take over here -- */
+                sr_integ_input_ref(sr,
+                        (buf+sizeof(c_packet_header)), /* lent */
+                        len - sizeof(c_packet_header),
+                        (const char*)buf + sizeof(c_base), /* lent */
+                        sr->rbuf);
+
+                break;
+
+                /* -------------        VNSCLOSE      -------------------- */
+
+            case VNSCLOSE:
+                fprintf(stderr,"vns server closed session.\n");
+                fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
+                sr_close_instance(sr);
+                sr_integ_close(sr);
+                sr->rbuf_pos = sr->rbuf_len = 0;
+                return 0;
+                break;
+
+                /* -------------     VNSHWINFO     -------------------- */
+
+            case VNSHWINFO:
+                sr_handle_hwinfo(sr,(c_hwinfo*)buf);
+                break;
+
+            default:
+                Debug("unknown command: %d\n", command);
+                break;
+        }
+
+        pos += len;
+    }
+
+    /*---------------------------------------------------------------------------
+      Keep the partial command (if any) for the next call, at the front of
+      a buffer once there may be no room behind it for the rest
+      -------------------------------------------------------------------------*/
+
+    sr->rbuf_pos = pos;
+    /* -- only the reader adds references, so once it holds the only one
+          nobody else can take another -- */
+    if ( pos == sr->rbuf_len &&
+         __atomic_load_n(&sr->rbuf->refs, __ATOMIC_ACQUIRE) == 1 )
+    { sr->rbuf_pos = sr->rbuf_len = 0; }
+    else if ( SR_VNS_RBUF_SIZE - sr->rbuf_len < SR_VNS_CMD_MAX )
+    {
+        sr->rbuf_len -= pos;
+        sr->rbuf_pos = 0;
+        if ( __atomic_load_n(&sr->rbuf->refs, __ATOMIC_ACQUIRE) == 1 )
+        {
+            if ( sr->rbuf_len > 0 )
+            { memmove(sr->rbuf->data, sr->rbuf->data + pos, sr->rbuf_len); }
+        }
+        else
+        { /* -- packets in it are still being handled -- */
+            struct sr_rbuf* b = sr_rbuf_get(sr);
+            if ( b == NULL )
+            {
+                perror("malloc(..):sr_client.c::sr_vns_read_from_server");
                 return -1;
             }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
+            memcpy(b->data, sr->rbuf->data + pos, sr->rbuf_len);
+            sr_rbuf_release(sr->rbuf);
+            sr->rbuf = b;
+        }
     }
 
-    len = ntohl(len);
+    return 1;
+}/* -- sr_vns_read_from_server -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_writev_all(..)
+ * Scope: local
+ *
+ * writev() the whole iovec array, picking up after short writes.  iov is
+ * modified.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_writev_all(int fd, struct iovec* iov, int cnt)
+{
+    ssize_t ret;
 
-    if ( len > 10000 || len < 0 )
+    while ( cnt > 0 )
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
+        if ( (ret = writev(fd, iov, cnt)) == -1 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            return -1;
+        }
+
+        while ( cnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if ( cnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
     }
 
-    if((buf = (unsigned char*)malloc(len)) == 0)
+    return 0;
+} /* -- sr_vns_writev_all -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_thread(..)
+ * Scope: local
+ *
+ * Writer thread, drains the send queue in batches of up to
+ * SR_VNS_SENDQ_BATCH packets per writev() until the slot at the tail is
+ * not published yet, and only then waits for a post.  Producers post after
+ * publishing, so a slot published after that check always wakes it up.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_vns_send_thread(void* arg)
+{
+    struct sr_vns_sendq* q = (struct sr_vns_sendq*)arg;
+    struct iovec iov[SR_VNS_SENDQ_BATCH];
+    struct sr_vns_send_slot* slot;
+    int i, cnt;
+
+    while(1)
     {
-        fprintf(stderr,"Error: out of memory (sr_vns_read_from_server)\n");
-        return -1;
+        /* -- collect every slot published so far (in order) -- */
+        for ( cnt = 0; cnt < SR_VNS_SENDQ_BATCH; cnt++ )
+        {
+            slot = &q->slot[(q->tail + cnt) & (SR_VNS_SENDQ_DEPTH - 1)];
+            if ( slot->seq != q->tail + cnt + 1 )
+            { break; }
+            iov[cnt].iov_base = slot->data;
+            iov[cnt].iov_len  = slot->len;
+        }
+
+        /* -- queue empty, every publish after the check above posts -- */
+        if ( cnt == 0 )
+        {
+            while ( sem_wait(&q->ready) == -1 && errno == EINTR );
+            continue;
+        }
+
+        __sync_synchronize();
+
+        if ( pthread_mutex_lock(&(q->sr->send_lock)) )
+        { assert (0); }
+        if ( sr_vns_writev_all(q->sr->sockfd, iov, cnt) == -1 )
+        {
+            fprintf(stderr, "Error writing packet\n");
+            __sync_fetch_and_add(&q->dropped, cnt);
+        }
+        else
+        { __sync_fetch_and_add(&q->sent, cnt); }
+        if ( pthread_mutex_unlock(&(q->sr->send_lock)) )
+        { assert (0); }
+        q->writes++;
+
+        /* -- hand the slots back to the producers -- */
+        for ( i = 0; i < cnt; i++ )
+        {
+            slot = &q->slot[(q->tail + i) & (SR_VNS_SENDQ_DEPTH - 1)];
+            slot->seq = q->tail + i + SR_VNS_SENDQ_DEPTH;
+        }
+        q->tail += cnt;
+
+        /* -- take back the posts of what was sent, so that a busy queue
+         * does not pile them up; an extra one only costs an empty pass -- */
+        for ( i = 0; i < cnt; i++ )
+        {
+            if ( sem_trywait(&q->ready) == -1 )
+            { break; }
+        }
     }
+} /* -- sr_vns_send_thread -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_start_sender(..)
+ * Scope: Global
+ *
+ * Allocate the send queue and start its writer thread.  Must be called
+ * once the socket to the server is open.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_start_sender(struct sr_instance* sr)
+{
+    struct sr_vns_sendq* q;
+    unsigned int i;
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    /* REQUIRES */
+    assert(sr);
 
-    bytes_read = 0;
+    if ( sr->sendq )
+    { return 0; }
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    if ( (q = (struct sr_vns_sendq*)malloc(sizeof(struct sr_vns_sendq))) == 0 )
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        fprintf(stderr,"Error: out of memory (sr_vns_start_sender)\n");
+        return -1;
     }
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    for ( i = 0; i < SR_VNS_SENDQ_DEPTH; i++ )
+    { q->slot[i].seq = i; }
+    q->head = q->tail = 0;
+    q->sent = q->dropped = q->writes = 0;
+    q->sr = sr;
+    sem_init(&q->ready, 0, 0);
 
-    switch (command)
-    {
-        /* -------------        VNSPACKET     -------------------- */
+    sr->sendq = q;
+    sys_thread_new(sr_vns_send_thread, q);
 
-        case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
+    return 0;
+} /* -- sr_vns_start_sender -- */
 
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_stats(..)
+ * Scope: Global
+ *
+ * Counters of the send queue: packets written, packets dropped (queue full
+ * or write error) and writev() calls.
+ *
+ *---------------------------------------------------------------------------*/
 
-            /* -- pass to router, student's code should take over here -- */
-            sr_integ_input(sr,
-                    (buf+sizeof(c_packet_header)), /* lent */
-                    len - sizeof(c_packet_header),
-                    (const char*)buf + sizeof(c_base)); /* lent */
+void sr_vns_send_stats(struct sr_instance* sr, unsigned long* sent,
+                       unsigned long* dropped, unsigned long* writes)
+{
+    struct sr_vns_sendq* q = sr->sendq;
 
-            break;
+    *sent = q ? q->sent : 0;
+    *dropped = q ? q->dropped : 0;
+    *writes = q ? q->writes : 0;
+} /* -- sr_vns_send_stats -- */
 
-            /* -------------        VNSCLOSE      -------------------- */
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_direct(..)
+ * Scope: local
+ *
+ * Write a single packet to the server from the calling thread.  Used for
+ * frames too large for a send queue slot (and before the queue exists).
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_send_direct(struct sr_instance* sr, uint8_t* buf,
+                              unsigned int len, const char* iface)
+{
+    c_packet_header hdr;
+    struct iovec iov[2];
+    int ret;
+
+    memset(&hdr, 0, sizeof(c_packet_header));
+    hdr.mLen  = htonl(len + sizeof(c_packet_header));
+    hdr.mType = htonl(VNSPACKET);
+    strncpy(hdr.mInterfaceName,iface,16);
 
-        case VNSCLOSE:
-            fprintf(stderr,"vns server closed session.\n");
-            fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
-            sr_close_instance(sr);
-            sr_integ_close(sr);
-            if(buf)
-            { free(buf); }
-            return 0;
-            break;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len  = sizeof(c_packet_header);
+    iov[1].iov_base = buf;
+    iov[1].iov_len  = len;
 
-            /* -------------     VNSHWINFO     -------------------- */
+    if ( pthread_mutex_lock(&(sr->send_lock)) )
+    { assert (0); }
+    ret = sr_vns_writev_all(sr->sockfd, iov, 2);
+    if ( pthread_mutex_unlock(&(sr->send_lock)) )
+    { assert (0); }
+
+    if ( ret == -1 )
+    { fprintf(stderr, "Error writing packet\n"); }
 
-        case VNSHWINFO:
-            sr_handle_hwinfo(sr,(c_hwinfo*)buf);
-            break;
+    return ret;
+} /* -- sr_vns_send_direct -- */
 
-        default:
-            Debug("unknown command: %d\n", command);
-            break;
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_sendq_claim(..)
+ * Scope: local
+ *
+ * Claim the next free send queue slot for a producer.  Returns NULL (and
+ * counts a drop) if the writer is a whole queue behind.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_vns_send_slot* sr_vns_sendq_claim(struct sr_vns_sendq* q,
+                                                   unsigned int* ppos)
+{
+    struct sr_vns_send_slot* slot;
+    unsigned int pos = q->head;
+    int diff;
+
+    while(1)
+    {
+        slot = &q->slot[pos & (SR_VNS_SENDQ_DEPTH - 1)];
+        diff = (int)(slot->seq - pos);
+        if ( diff == 0 )
+        {
+            if ( __sync_bool_compare_and_swap(&q->head, pos, pos + 1) )
+            { break; }
+        }
+        else if ( diff < 0 )
+        { /* -- writer is a whole queue behind -- */
+            __sync_fetch_and_add(&q->dropped, 1);
+            return NULL;
+        }
+        pos = q->head;
     }
 
-    if(buf)
-    { free(buf); }
-    return 1;
-}/* -- sr_vns_read_from_server -- */
+    *ppos = pos;
+    return slot;
+} /* -- sr_vns_sendq_claim -- */
+
+/* VNS header of a claimed slot */
+static void sr_vns_sendq_fill(struct sr_vns_send_slot* slot, const char* iface,
+                              unsigned int total_len)
+{
+    c_packet_header *sr_pkt = (c_packet_header *)slot->data;
+
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface,16);
+    slot->len = total_len;
+} /* -- sr_vns_sendq_fill -- */
+
+/* hand a filled slot to the writer */
+static void sr_vns_sendq_publish(struct sr_vns_sendq* q,
+                                 struct sr_vns_send_slot* slot, unsigned int pos)
+{
+    __sync_synchronize();
+    slot->seq = pos + 1;
+    sem_post(&q->ready);
+} /* -- sr_vns_sendq_publish -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
@@ -383,6 +780,10 @@ int sr_vns_read_from_server(struct sr_instance* sr /* borrowed */)
  * Send a packet (ethernet header included!) of length 'len' to the server
  * to be injected onto the wire.
  *
+ * The packet is queued for the writer thread; buf may be reused as soon as
+ * this returns.  Returns -1 if the queue is full and the packet was
+ * dropped.
+ *
  * Note: buf is expected to be an IP packet!!
  *
  *---------------------------------------------------------------------------*/
@@ -392,8 +793,10 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
                        unsigned int len,
                        const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
+    struct sr_vns_sendq* q;
+    struct sr_vns_send_slot* slot;
     unsigned int total_len =  len + (sizeof(c_packet_header));
+    unsigned int pos;
 
     /* REQUIRES */
     assert(sr);
@@ -407,34 +810,69 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
+    /* -- log packet -- */
+    sr_log_packet(sr,buf,len);
+
+    q = sr->sendq;
+    if ( !q || total_len > SR_VNS_SENDQ_SLOT )
+    { return sr_vns_send_direct(sr, buf, len, iface); }
+
+    if ( (slot = sr_vns_sendq_claim(q, &pos)) == NULL )
+    { return -1; }
+
     /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(total_len);
+    sr_vns_sendq_fill(slot, iface, total_len);
+    memcpy(slot->data + sizeof(c_packet_header), buf, len);
+    sr_vns_sendq_publish(q, slot, pos);
 
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    return 0;
+} /* -- sr_send_packet -- */
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_packetv(..)
+ * Scope: Global
+ *
+ * Like sr_vns_send_packet() for a packet in two pieces, hdr and body, which
+ * go straight into the send queue slot.  Slow path (no queue, oversized
+ * frames) puts them together first.
+ *
+ *---------------------------------------------------------------------------*/
 
-    if ( pthread_mutex_lock(&(sr->send_lock)) )
-    { assert (0); }
-    if( write(sr->sockfd, sr_pkt, total_len) < (signed int)total_len )
+int sr_vns_send_packetv(struct sr_instance* sr /* borrowed */,
+                        uint8_t* hdr /* borrowed */,
+                        unsigned int hdr_len,
+                        const uint8_t* body /* borrowed */,
+                        unsigned int body_len,
+                        const char* iface /* borrowed */)
+{
+    struct sr_vns_sendq* q = sr->sendq;
+    struct sr_vns_send_slot* slot;
+    unsigned int total_len = hdr_len + body_len + sizeof(c_packet_header);
+    unsigned int pos;
+    uint8_t* buf;
+    int ret;
+
+    if ( !q || total_len > SR_VNS_SENDQ_SLOT || hdr_len < 14 )
     {
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        if ( pthread_mutex_unlock(&(sr->send_lock)) )
-        { assert (0); }
-        return -1;
+        buf = (uint8_t*)malloc(hdr_len + body_len);
+        memcpy(buf, hdr, hdr_len);
+        memcpy(buf + hdr_len, body, body_len);
+        ret = sr_vns_send_packet(sr, buf, hdr_len + body_len, iface);
+        free(buf);
+        return ret;
     }
-    if ( pthread_mutex_unlock(&(sr->send_lock)) )
-    { assert (0); }
 
-    free(sr_pkt);
+    /* -- log packet -- */
+    sr_log_packetv(sr, hdr, hdr_len, body, body_len);
+
+    if ( (slot = sr_vns_sendq_claim(q, &pos)) == NULL )
+    { return -1; }
+
+    sr_vns_sendq_fill(slot, iface, total_len);
+    memcpy(slot->data + sizeof(c_packet_header), hdr, hdr_len);
+    memcpy(slot->data + sizeof(c_packet_header) + hdr_len, body, body_len);
+    sr_vns_sendq_publish(q, slot, pos);
 
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_send_packetv -- */
 
@@ -28,16 +28,29 @@
 #endif /* _SOLARIS_ */
 
 struct sr_instance* sr; /* -- forward declare -- */
+struct sr_capture_opts;
+struct sr_rbuf;
 
 int  sr_vns_read_from_server(struct sr_instance* );
+void sr_rbuf_hold(struct sr_rbuf* );
+void sr_rbuf_release(struct sr_rbuf* );
 
 int  sr_vns_connected_to_server(struct sr_instance* );
 
-void sr_vns_init_log(struct sr_instance* sr, char* logfile);
+void sr_vns_init_log(struct sr_instance* sr, char* logfile,
+                     const struct sr_capture_opts* opts);
 
 int  sr_vns_connect_to_server(struct sr_instance* ,unsigned short , char* );
 
 int  sr_vns_send_packet(struct sr_instance* ,uint8_t* , unsigned int , const char*);
 
+int  sr_vns_send_packetv(struct sr_instance* ,uint8_t* , unsigned int ,
+                         const uint8_t* , unsigned int , const char*);
+
+int  sr_vns_start_sender(struct sr_instance* );
+
+void sr_vns_send_stats(struct sr_instance* , unsigned long* , unsigned long* ,
+                       unsigned long* );
+
 
 #endif  /* -- SR_VNS_H -- */
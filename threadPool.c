@@ -2,21 +2,14 @@
 #include <string.h>
 #include "lwtcp/lwip/sys.h"
 
-static int workCnt = 0;
-
 // initializes thread pool
 void initThreadPool(){
     int i = 0;
 	struct sr_instance* sr = get_sr();
-	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
-
-	subsystem->poolHead = subsystem->poolTail = NULL;
 
-    pthread_mutex_init(&pool_lock, NULL);
-	pthread_cond_init (&pool_cond, NULL);
-    
+	// the queue itself is set up by initRouterState(), frames may be waiting already
 	while(i < NUM_THREADS){    	
-    	sys_thread_new(startThread, NULL);
+    	routerThreadNew(sr, startThread, NULL);
     	i++;
     	//if (pthread_create(&workers[i], NULL, startThread, NULL) == 0){
     	//	i++;
@@ -39,30 +32,38 @@ void destroyThreadPool(){
 //		pthread_join(workers[i], NULL);
 //	}
 
-	pthread_mutex_lock(&pool_lock);
+	pthread_mutex_lock(&subsystem->pool_lock);
 	struct threadWorker* cur = subsystem->poolHead;
 	struct threadWorker* tmp;
 	while(cur){
-		if(cur->packet) free(cur->packet);
+		if(cur->ref) sr_rbuf_release(cur->ref);
+		else if(cur->packet) free(cur->packet);
 		tmp = cur;
 		cur = cur->next;
 		free(tmp);
 	}
-	pthread_cond_destroy(&pool_cond);
-	pthread_mutex_unlock(&pool_lock);
+	while((cur = subsystem->poolFree)){
+		subsystem->poolFree = cur->next;
+		free(cur);
+	}
+	pthread_cond_destroy(&subsystem->pool_cond);
+	pthread_mutex_unlock(&subsystem->pool_lock);
 
-    pthread_mutex_destroy(&pool_lock);
+    pthread_mutex_destroy(&subsystem->pool_lock);
     dbgMsg("Tread Pool destroyed");
 }
 
+static struct threadWorker* takeThreadQueueAfter(struct threadWorker** head, struct threadWorker** tail, struct threadWorker* done);
+
 // main thread function
 void startThread(void* dummy){
-	struct threadWorker *w;
+	struct threadWorker *w, *done = NULL;
 	struct sr_instance* sr = get_sr();
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	
 	while(1){
-		w = takeThreadQueue(&subsystem->poolHead, &subsystem->poolTail);
+		w = takeThreadQueueAfter(&subsystem->poolHead, &subsystem->poolTail, done);
+		done = NULL;
 		if(w){
 			//dbgMsg("Job taken off queue");
 			if(w->stop_work){
@@ -72,28 +73,35 @@ void startThread(void* dummy){
 			}
 			else{
 				processPacket(sr, w->packet, w->len, w->interface);				
-				if(w->packet) free(w->packet);
-				free(w);
+				if(w->ref) sr_rbuf_release(w->ref);
+				else if(w->packet) free(w->packet);
+				// handed back with the next take, under the lock it takes anyway
+				done = w;
 			}
 		}
 	}
 	return;
 }
 
-// adds a job to the queue (a packet to process)
-void addThreadQueue(struct sr_instance* sr, const uint8_t* packet, unsigned len, const char* interface){
+// queues packet (owned by the node, or lying in ref) for the workers
+static void queueJob(struct sr_instance* sr, uint8_t* packet, unsigned len, const char* interface, struct sr_rbuf* ref){
 	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+	struct threadWorker* node;
 	
-	struct threadWorker* node = (struct threadWorker*)malloc(sizeof(struct threadWorker));
-	
-	node->packet = (uint8_t*)malloc(len*sizeof(uint8_t));
-	memcpy(node->packet, packet, len);
+	pthread_mutex_lock(&subsystem->pool_lock);
+	// nodes are only allocated until there are enough to go round
+	if((node = subsystem->poolFree))
+		subsystem->poolFree = node->next;
+	else
+		node = (struct threadWorker*)malloc(sizeof(struct threadWorker));
+
+	node->packet = packet;
 	node->len = len;
+	node->ref = ref;
 	strcpy(node->interface, interface);
 	node->stop_work = 0;
 	node->prev = node->next = NULL;
 	
-	pthread_mutex_lock(&pool_lock);
 	struct threadWorker** head = &subsystem->poolHead;
 	struct threadWorker** tail = &subsystem->poolTail;
 	
@@ -106,23 +114,40 @@ void addThreadQueue(struct sr_instance* sr, const uint8_t* packet, unsigned len,
 		node->next = *head;
 		*head = node;
 	}
-	workCnt++;
-	pthread_cond_signal(&pool_cond);	
-	pthread_mutex_unlock(&pool_lock);
+	subsystem->pool_cnt++;
+	pthread_cond_signal(&subsystem->pool_cond);	
+	pthread_mutex_unlock(&subsystem->pool_lock);
 	//dbgMsg("Job put in queue");
 }
 
+// adds a job to the queue (a packet to process), packet is borrowed and copied
+void addThreadQueue(struct sr_instance* sr, const uint8_t* packet, unsigned len, const char* interface){
+	uint8_t* copy = (uint8_t*)malloc(len*sizeof(uint8_t));
+
+	memcpy(copy, packet, len);
+	queueJob(sr, copy, len, interface, NULL);
+}
+
+// adds a job to the queue without copying packet: it lies in ref, which is held until the packet is processed
+void addThreadQueueRef(struct sr_instance* sr, uint8_t* packet, unsigned len, const char* interface, struct sr_rbuf* ref){
+	sr_rbuf_hold(ref);
+	queueJob(sr, packet, len, interface, ref);
+}
+
 // adds a stop node to the queue (this node causes all spawned threads to exit)
 void addStopNode(struct threadWorker** head, struct threadWorker** tail){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	struct threadWorker* node = (struct threadWorker*)malloc(sizeof(struct threadWorker));
 
 	node->packet = NULL;
 	node->len = 0;
+	node->ref = NULL;
 	strcpy(node->interface, "");
 	node->stop_work = 1;
 	node->prev = node->next = NULL;
 	
-	pthread_mutex_lock(&pool_lock);
+	pthread_mutex_lock(&subsystem->pool_lock);
 	
 	if(*head == NULL){
 		*head = node;
@@ -133,26 +158,37 @@ void addStopNode(struct threadWorker** head, struct threadWorker** tail){
 		node->next = *head;
 		*head = node;
 	}	
-	workCnt++;		
-	pthread_cond_signal(&pool_cond);	
-	pthread_mutex_unlock(&pool_lock);
+	subsystem->pool_cnt++;		
+	pthread_cond_signal(&subsystem->pool_cond);	
+	pthread_mutex_unlock(&subsystem->pool_lock);
 }
 
 // takes next packet in the queue for processing, whoever calls this gets the ownership of the returned node
 struct threadWorker* takeThreadQueue(struct threadWorker** head, struct threadWorker** tail){
+	return takeThreadQueueAfter(head, tail, NULL);
+}
+
+// takeThreadQueue(), also keeping done (if not NULL), a node the caller is finished with, for reuse
+static struct threadWorker* takeThreadQueueAfter(struct threadWorker** head, struct threadWorker** tail, struct threadWorker* done){
+	struct sr_instance* sr = get_sr();
+	struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 	struct threadWorker *retVal;
 
-	pthread_mutex_lock(&pool_lock);
+	pthread_mutex_lock(&subsystem->pool_lock);
+	if(done){
+		done->next = subsystem->poolFree;
+		subsystem->poolFree = done;
+	}
 
-	if(workCnt == 0)
-		pthread_cond_wait(&pool_cond, &pool_lock);
+	if(subsystem->pool_cnt == 0)
+		pthread_cond_wait(&subsystem->pool_cond, &subsystem->pool_lock);
 
 	if(*tail == NULL){
 		retVal = NULL;
 	}
 	else{
-		workCnt--;
-//		printf("thread Cnt: %d\n", workCnt);
+		subsystem->pool_cnt--;
+//		printf("thread Cnt: %d\n", subsystem->pool_cnt);
 		retVal = *tail;
 		if((*tail)->prev){
 			(*tail)->prev->next = NULL;
@@ -163,7 +199,7 @@ struct threadWorker* takeThreadQueue(struct threadWorker** head, struct threadWo
 			*tail = NULL;
 		}
 	}
-	pthread_mutex_unlock(&pool_lock);
+	pthread_mutex_unlock(&subsystem->pool_lock);
 
 	return retVal;
 }
@@ -11,20 +11,19 @@
 struct threadWorker{
 	uint8_t* packet;
 	unsigned len;
+	struct sr_rbuf* ref; // packet lies in it, NULL if packet is our own copy
 	char interface[SR_NAMELEN];
 	int stop_work;
 	struct threadWorker* prev;
 	struct threadWorker* next;	
 };
 
-pthread_mutex_t pool_lock;
-pthread_cond_t pool_cond;
-
 void initThreadPool();
 void destroyThreadPool();
 void startThread(void* dummy);
 void addStopNode(struct threadWorker** head, struct threadWorker** tail);
 void addThreadQueue(struct sr_instance* sr, const uint8_t* packet, unsigned len, const char* interface);
+void addThreadQueueRef(struct sr_instance* sr, uint8_t* packet, unsigned len, const char* interface, struct sr_rbuf* ref);
 struct threadWorker* takeThreadQueue(struct threadWorker** head, struct threadWorker** tail);
 
 #endif // THREAD_POOL_H
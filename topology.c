@@ -1,6 +1,9 @@
 #include "topology.h"
 #include "pwospf.h"
 #include "router.h"
+#include <limits.h>
+#include <unistd.h>
+#include "lwtcp/lwip/sys.h"
 
 #ifndef max
 	#define max( a, b ) ( ((a) > (b)) ? (a) : (b) )
@@ -10,425 +13,299 @@
 	#define min( a, b ) ( ((a) < (b)) ? (a) : (b) )
 #endif
 
-int add_router(uint32_t router_id, uint16_t last_seq)
+/*
+ * ------------------------------- link state database ------------------
+ * see struct topo_db, every router has its own
+ * */
+
+#define TOPO_HASH_MIN_BITS 6
+
+// the database of the router this thread works for
+static struct topo_db *topo_db() {
+    return &((struct sr_router*)sr_get_subsystem(get_sr()))->topo;
+}
+
+static unsigned topo_hash_index(const struct topo_db *db, uint32_t router_id) {
+    return (router_id * 2654435761u) >> (32 - db->hash_bits);
+}
+
+static int cmp_ad(const void *a, const void *b) {
+    const lsu_ad *x = (const lsu_ad*)a, *y = (const lsu_ad*)b;
+    if(x->router_id != y->router_id)
+	return x->router_id < y->router_id ? -1 : 1;
+    if(x->subnet != y->subnet)
+	return x->subnet < y->subnet ? -1 : 1;
+    if(x->mask != y->mask)
+	return x->mask < y->mask ? -1 : 1;
+    return 0;
+}
+
+topo_router *new_lsa(uint32_t router_id, uint32_t max_ads)
 {
-    //acquire lock
-    pthread_mutex_lock(&topo_lock);
+    topo_router *lsa = malloc(sizeof(topo_router) + sizeof(lsu_ad)*max_ads);
+    memset(lsa, 0, sizeof(topo_router));
+    lsa->router_id = router_id;
+    lsa->max_ads = max_ads;
+    lsa->ads = (lsu_ad*)(lsa + 1);
+    return lsa;
+}
 
-    topo_router *rtr = topo_head;
-    topo_router *new_rtr;
-    if(rtr == NULL) {
-	new_rtr = malloc(sizeof(topo_router));
-	new_rtr->router_id = router_id;
-	new_rtr->last_seq = last_seq;
-	new_rtr->next = new_rtr->prev = NULL;
-	rtr = new_rtr;
-	num_routers++;
-    pthread_mutex_unlock(&topo_lock);
-	return 1;
+void lsa_add_ad(topo_router **lsa, uint32_t subnet, uint32_t mask, uint32_t router_id)
+{
+    topo_router *r = *lsa;
+    if(r->num_ads == r->max_ads) {
+	r->max_ads = r->max_ads ? 2*r->max_ads : 4;
+	r = realloc(r, sizeof(topo_router) + sizeof(lsu_ad)*r->max_ads);
+	r->ads = (lsu_ad*)(r + 1);
+	*lsa = r;
+    }
+    r->ads[r->num_ads].subnet = subnet;
+    r->ads[r->num_ads].mask = mask;
+    r->ads[r->num_ads].router_id = router_id;
+    r->num_ads++;
+}
+
+void free_lsa(topo_router *lsa)
+{
+    free(lsa);
+}
+
+topo_router *find_router(uint32_t router_id)
+{
+    struct topo_db *db = topo_db();
+    topo_router *rtr;
+    if(db->hash == NULL)
+	return NULL;
+    for(rtr = db->hash[topo_hash_index(db, router_id)]; rtr != NULL; rtr = rtr->hnext) {
+	if(rtr->router_id == router_id)
+	    return rtr;
     }
+    return NULL;
+}
 
-    if(rtr->router_id > router_id) {
-	new_rtr = malloc(sizeof(topo_router));
-	new_rtr->router_id = router_id;
-	new_rtr->last_seq = last_seq;
-	new_rtr->next = new_rtr->prev = NULL;
-	new_rtr->next = rtr;
-	rtr->prev = new_rtr;
-	rtr = new_rtr;
-	num_routers++;
-    pthread_mutex_unlock(&topo_lock);
-	return 1;
+static void resize_hash(struct topo_db *db, int bits) {
+    topo_router *rtr;
+    free(db->hash);
+    db->hash_bits = bits;
+    db->hash = calloc(1 << bits, sizeof(topo_router*));
+    for(rtr = db->head; rtr != NULL; rtr = rtr->next) {
+	unsigned h = topo_hash_index(db, rtr->router_id);
+	rtr->hnext = db->hash[h];
+	db->hash[h] = rtr;
     }
+}
 
-    while(rtr->next != NULL) {
-       	if(router_id < rtr->next->router_id) {
-	    break;
-	}
-	rtr = rtr->next;
+// puts lsa in the database, there must be no other entry for its router
+static void link_router(struct topo_db *db, topo_router *lsa) {
+    unsigned h;
+
+    lsa->prev = NULL;
+    lsa->next = db->head;
+    if(db->head != NULL)
+	db->head->prev = lsa;
+    db->head = lsa;
+    db->num_routers++;
+
+    if(db->hash == NULL || db->num_routers > (1 << db->hash_bits)) {
+	// rehashes lsa too
+	resize_hash(db, db->hash ? db->hash_bits + 1 : TOPO_HASH_MIN_BITS);
+	return;
     }
+    h = topo_hash_index(db, lsa->router_id);
+    lsa->hnext = db->hash[h];
+    db->hash[h] = lsa;
+}
 
-    if(rtr->router_id == router_id) {
+static void unlink_router(struct topo_db *db, topo_router *rtr) {
+    topo_router **pp = &db->hash[topo_hash_index(db, rtr->router_id)];
+    while(*pp != rtr)
+	pp = &(*pp)->hnext;
+    *pp = rtr->hnext;
+
+    if(rtr->prev != NULL)
+	rtr->prev->next = rtr->next;
+    else
+	db->head = rtr->next;
+    if(rtr->next != NULL)
+	rtr->next->prev = rtr->prev;
+    db->num_routers--;
+}
+
+int add_router(uint32_t router_id, uint16_t last_seq)
+{
+    struct topo_db *db = topo_db();
+    //acquire lock
+    pthread_mutex_lock(&db->lock);
+
+    topo_router *rtr = find_router(router_id);
+    if(rtr != NULL) {
 	// router exists
 	// XXX: should the sequence number be updated?
 	rtr->last_seq = last_seq;
-    pthread_mutex_unlock(&topo_lock);
+	pthread_mutex_unlock(&db->lock);
 	return 0;
     }
-    else {
-	// insert new router
-	new_rtr = malloc(sizeof(topo_router));
-	new_rtr->router_id = router_id;
-	new_rtr->last_seq = last_seq;
-	new_rtr->next = new_rtr->prev = NULL;
-	if(rtr->next != NULL) {
-	    rtr->next->prev = new_rtr;
-	}
-	new_rtr->next = rtr->next;
-	new_rtr->prev = rtr;
-	rtr->next = new_rtr;
-	num_routers++;
-    pthread_mutex_unlock(&topo_lock);
-	return 1;
-    }
+
+    rtr = new_lsa(router_id, 0);
+    rtr->last_seq = last_seq;
+    rtr->last_update_time = time(NULL);
+    link_router(db, rtr);
 
     //release lock
-    pthread_mutex_unlock(&topo_lock);
-    return -1;
+    pthread_mutex_unlock(&db->lock);
+    return 1;
 }
 
 int get_last_seq(uint32_t router_id)
 {
+    struct topo_db *db = topo_db();
     //acquire lock
-    pthread_mutex_lock(&topo_lock);
-
-    topo_router *rtr = topo_head;
-    int last_seq;
-    /*
-     * redundant stuff
-     * if(rtr == NULL) {
-    pthread_mutex_unlock(&topo_lock);
-   	return -1;
-    }*/
-    while(rtr != NULL) {
-	if(rtr->router_id == router_id){
-	    last_seq = rtr->last_seq;
-	    pthread_mutex_unlock(&topo_lock);
-	    return last_seq;
-	}
-	rtr = rtr->next;
-    }
+    pthread_mutex_lock(&db->lock);
+
+    topo_router *rtr = find_router(router_id);
+    int last_seq = rtr ? rtr->last_seq : -1;
 
     //release lock
-    pthread_mutex_unlock(&topo_lock);
-    return -1;
+    pthread_mutex_unlock(&db->lock);
+    return last_seq;
 }
 
 int rm_router(uint32_t router_id)
 {
+    struct topo_db *db = topo_db();
     //acquire lock
-    pthread_mutex_lock(&topo_lock);
-
-    topo_router *rtr = topo_head;
-
-    while(rtr != NULL) {
-	if(rtr->router_id == router_id) {
-	    // unlink the adj list from the topo db
-	    if(rtr->prev != NULL) {
-		rtr->prev->next = rtr->next;
-	    }
-	    else {
-		topo_head = rtr->next;
-	    }
-	    if(rtr->next != NULL) {
-		rtr->next->prev = rtr->prev;
-	    }
+    pthread_mutex_lock(&db->lock);
 
-	    // free the adj list
-	    // free the ads first
-	    lsu_ad *old_ad, *prev_ad;
-	    old_ad = rtr->ads;
-	    if(old_ad != NULL) {
-		while(old_ad->next != NULL) {
-		    old_ad = old_ad->next;
-		}
-		while(old_ad->prev != NULL) {
-		    prev_ad = old_ad->prev;
-		    free(old_ad);
-		    old_ad = prev_ad;
-		}
-	    }
-	    // free rtr
-	    free(rtr);
-        pthread_mutex_unlock(&topo_lock);
-	    return 1;
-	}
-	rtr = rtr->next;
+    topo_router *rtr = find_router(router_id);
+    if(rtr != NULL) {
+	unlink_router(db, rtr);
+	free_lsa(rtr);
     }
 
     //release lock
-    pthread_mutex_unlock(&topo_lock);
-    return 0;
+    pthread_mutex_unlock(&db->lock);
+    return rtr != NULL;
 }
 
 int purge_topo()
 {
+    struct topo_db *db = topo_db();
     //acquire lock
-    pthread_mutex_lock(&topo_lock);
+    pthread_mutex_lock(&db->lock);
     
     int ret = 0;
-    topo_router *rtr = topo_head;
+    time_t now = time(NULL);
+    topo_router *rtr = db->head;
 
     while(rtr != NULL) {
-		if( (time(NULL) > rtr->last_update_time) && (time(NULL) - rtr->last_update_time > LSU_TIMEOUT) ) {
-		    topo_router *nxt_rtr = rtr->next;
-		    // unlink the adj list from the topo db
-		    if(rtr->prev != NULL) {
-				rtr->prev->next = rtr->next;
-		    }
-		    else {
-				topo_head = rtr->next;
-		    }
-		    if(rtr->next != NULL) {
-				rtr->next->prev = rtr->prev;
-		    }
-
-		    // free the adj list
-		    // free the ads first
-		    lsu_ad *old_ad, *prev_ad;
-		    old_ad = rtr->ads;
-		    if(old_ad != NULL) {
-			// go to the end first 
-			while(old_ad->next != NULL) {
-			    old_ad = old_ad->next;
-			}
-			while(old_ad->prev != NULL) {
-			    prev_ad = old_ad->prev;
-			    free(old_ad);
-			    old_ad = prev_ad;
-			}
-			free(old_ad);
-		    }
-
-		    // free rtr
-		    free(rtr);
-			num_routers--;
+		topo_router *nxt_rtr = rtr->next;
+		if( (now > rtr->last_update_time) && (now - rtr->last_update_time > LSU_TIMEOUT) ) {
+		    unlink_router(db, rtr);
+		    free_lsa(rtr);
 		    ret = 1;
-		    rtr = nxt_rtr;
-		}
-		else {
-		    rtr = rtr->next;
 		}
+		rtr = nxt_rtr;
     }
 
     //release lock
-    pthread_mutex_unlock(&topo_lock);
+    pthread_mutex_unlock(&db->lock);
     return ret;
 }
 
 
 int flush_topo()
 {
+    struct topo_db *db = topo_db();
     //acquire lock
-    pthread_mutex_lock(&topo_lock);
+    pthread_mutex_lock(&db->lock);
     
-    int ret = 0;
-    topo_router *rtr = topo_head;
-
-    while(rtr != NULL) {
-	    topo_router *nxt_rtr = rtr->next;
-	    // unlink the adj list from the topo db
-	    if(rtr->prev != NULL) {
-			rtr->prev->next = rtr->next;
-	    }
-	    else {
-			topo_head = rtr->next;
-	    }
-	    if(rtr->next != NULL) {
-			rtr->next->prev = rtr->prev;
-	    }
+    int ret = db->head != NULL;
 
-	    // free the adj list
-	    // free the ads first
-	    lsu_ad *old_ad, *prev_ad;
-	    old_ad = rtr->ads;
-	    if(old_ad != NULL) {
-		// go to the end first 
-		while(old_ad->next != NULL) {
-		    old_ad = old_ad->next;
-		}
-		while(old_ad->prev != NULL) {
-		    prev_ad = old_ad->prev;
-		    free(old_ad);
-		    old_ad = prev_ad;
-		}
-		free(old_ad);
-	    }
-
-	    // free rtr
-	    free(rtr);
-		num_routers--;
-	    ret = 1;
-	    rtr = nxt_rtr;
-	}    
+    while(db->head != NULL) {
+	    topo_router *nxt_rtr = db->head->next;
+	    free_lsa(db->head);
+	    db->head = nxt_rtr;
+    }
+    db->num_routers = 0;
+    if(db->hash != NULL)
+	resize_hash(db, TOPO_HASH_MIN_BITS);
 
     //release lock
-    pthread_mutex_unlock(&topo_lock);
+    pthread_mutex_unlock(&db->lock);
     return ret;
 }
 
 int add_router_ad(uint32_t router_id, uint32_t subnet, uint32_t mask, uint32_t nbr_router_id)
 {
+    struct topo_db *db = topo_db();
     //acquire lock
-    pthread_mutex_lock(&topo_lock);
+    pthread_mutex_lock(&db->lock);
 
-    topo_router *rtr = topo_head;
+    topo_router *rtr = find_router(router_id);
+    uint32_t i;
 
-    while(rtr != NULL) {
-	rtr = rtr->next;
-	if(rtr->router_id == router_id) {
-	    lsu_ad *curr_ad = rtr->ads;
-	    lsu_ad *new_ad;
-	    if(curr_ad == NULL) {
-		new_ad = malloc(sizeof(lsu_ad));
-		new_ad->router_id = nbr_router_id;
-		new_ad->subnet = subnet;
-		new_ad->mask = mask;
-		new_ad->next = new_ad->prev = NULL;
-		curr_ad = new_ad;
- 	    pthread_mutex_unlock(&topo_lock);
-		return 1;
-	    }
-	    if(curr_ad->router_id > nbr_router_id) {
-		new_ad = malloc(sizeof(lsu_ad));
-		new_ad->router_id = nbr_router_id;
-		new_ad->subnet = subnet;
-		new_ad->mask = mask;
-		new_ad->next = new_ad->prev = NULL;
-
-		curr_ad->prev = new_ad;
-		new_ad->next = curr_ad;
-		rtr->ads = new_ad;
-	    }
+    if(rtr == NULL) {
+	pthread_mutex_unlock(&db->lock);
+	return -1;
+    }
 
-	    while(curr_ad->next != NULL) {
-		if(curr_ad->next->router_id > nbr_router_id)
-		    break;
-		curr_ad = curr_ad->next;
-	    }
-	    if(curr_ad->router_id == nbr_router_id) {
-		// router ad exists
-		if(curr_ad->subnet == subnet && curr_ad->mask == mask) {
-		    pthread_mutex_unlock(&topo_lock);
-		    return 0;
-		}
-		curr_ad->subnet = subnet;
-		curr_ad->mask = mask;
-	    pthread_mutex_unlock(&topo_lock);
-		return 1;
-	    }
-	    else {
-		new_ad = malloc(sizeof(lsu_ad));
-		new_ad->router_id = nbr_router_id;
-		new_ad->subnet = subnet;
-		new_ad->mask = mask;
-		new_ad->next = new_ad->prev = NULL;
-
-		if(curr_ad->next != NULL)
-		    curr_ad->next->prev = new_ad;
-		new_ad->next = curr_ad->next;
-		curr_ad->next = new_ad;
-		new_ad->prev = curr_ad;
-	    pthread_mutex_unlock(&topo_lock);
-		return 1;
-	    }
+    for(i = 0; i < rtr->num_ads; i++) {
+	if(rtr->ads[i].router_id == nbr_router_id)
+	    break;
+    }
+    if(i < rtr->num_ads) {
+	// router ad exists
+	if(rtr->ads[i].subnet == subnet && rtr->ads[i].mask == mask) {
+	    pthread_mutex_unlock(&db->lock);
+	    return 0;
 	}
+	rtr->ads[i].subnet = subnet;
+	rtr->ads[i].mask = mask;
     }
+    else {
+	// the record may move when it grows
+	unlink_router(db, rtr);
+	lsa_add_ad(&rtr, subnet, mask, nbr_router_id);
+	link_router(db, rtr);
+    }
+    qsort(rtr->ads, rtr->num_ads, sizeof(lsu_ad), cmp_ad);
+
     //release lock
-    pthread_mutex_unlock(&topo_lock);
-    return -1;
+    pthread_mutex_unlock(&db->lock);
+    return 1;
 }
 
 int update_lsu(topo_router *adj_list)
 {
-    int ret = 0;
-    topo_router *rtr = topo_head;
-    //acquire lock
-    pthread_mutex_lock(&topo_lock);
-    if(rtr == NULL) {
-		topo_head = adj_list;
-		num_routers++;
-		//release lock
-		pthread_mutex_unlock(&topo_lock);
-		return 1;
-    }
-    if(rtr->router_id > adj_list->router_id) {
-		adj_list->next = rtr;
-		rtr->prev = adj_list;
-		topo_head = adj_list;
-		num_routers++;
-		//release lock
-		pthread_mutex_unlock(&topo_lock);
-		return 1;
-    }
-
-    while(rtr->next != NULL) {
-	// loop invariant: rtr->router_id <= adj_list->router_id
-       	if(adj_list->router_id < rtr->next->router_id) {
-	    	break;
-		}
-		rtr = rtr->next;
-    }
+    struct topo_db *db = topo_db();
+    int ret = 1;
+    topo_router *rtr;
 
-    if(rtr->router_id == adj_list->router_id) {
-		// router exists
-		// compare the neighbor list with the existing neighbor list
-		lsu_ad *old_ad = rtr->ads;
-		lsu_ad *new_ad = adj_list->ads;
-		lsu_ad *prev_ad;
-		while(old_ad != NULL && new_ad != NULL) {
-		    if(old_ad->router_id != new_ad->router_id || old_ad->subnet != new_ad->subnet
-			    || old_ad->mask != new_ad->mask) {
-				break;
-		    }
-		    old_ad = old_ad->next;
-		    new_ad = new_ad->next;
-		}
-		if (old_ad == new_ad) { // == NULL
-		    // No change!
-		    // just update the last received sequence number
-		    rtr->last_seq = adj_list->last_seq;
-			rtr->last_update_time = adj_list->last_update_time;
-		    rtr = adj_list;
-		    ret = 0;
-		}
-		else {
-		    // adj list has changed
-		    adj_list->next = rtr->next;
-		    adj_list->prev = rtr->prev;
-		    if(rtr->prev != NULL) {
-				rtr->prev->next = adj_list;
-		    }
-		    else {
-				topo_head = adj_list;
-		    }
-		    if(rtr->next != NULL) {
-				rtr->next->prev = adj_list;
-		    }
-			ret = 1;
-		}
+    // sort once, then comparing with the old ads is a single pass
+    qsort(adj_list->ads, adj_list->num_ads, sizeof(lsu_ad), cmp_ad);
 
-		// free the old or new adj list
-		// depending on the situation
-		// free the ads first
-		old_ad = rtr->ads;
-		if(old_ad != NULL) {
-		    while(old_ad->next != NULL) {
-				old_ad = old_ad->next;
-		    }
-		    while(old_ad->prev != NULL) {
-				prev_ad = old_ad->prev;
-				free(old_ad);
-				old_ad = prev_ad;
-		    }
-		    free(old_ad);
-		}
-		// free rtr
-		free(rtr);
+    //acquire lock
+    pthread_mutex_lock(&db->lock);
+    rtr = find_router(adj_list->router_id);
+    if(rtr != NULL && rtr->num_ads == adj_list->num_ads
+	    && memcmp(rtr->ads, adj_list->ads, sizeof(lsu_ad)*rtr->num_ads) == 0) {
+	// No change!
+	// just update the last received sequence number
+	rtr->last_seq = adj_list->last_seq;
+	rtr->last_update_time = adj_list->last_update_time;
+	free_lsa(adj_list);
+	ret = 0;
     }
     else {
-		// insert new router
-		if(rtr->next != NULL) {
-		    rtr->next->prev = adj_list;
-		}
-		adj_list->next = rtr->next;
-		adj_list->prev = rtr;
-		rtr->next = adj_list;
-		num_routers++;
-		ret = 1;
+	// new router or its adj list has changed
+	if(rtr != NULL) {
+	    unlink_router(db, rtr);
+	    free_lsa(rtr);
+	}
+	link_router(db, adj_list);
     }
     //release lock
-    pthread_mutex_unlock(&topo_lock);
+    pthread_mutex_unlock(&db->lock);
 
     return ret;
 }
@@ -437,36 +314,828 @@ int update_lsu(topo_router *adj_list)
  * ------------------------------- helper functions to run dijkstra's algo ------------------
  * */
 
-static int get_index(topo_router **rtr_vec, int n, uint32_t router_id) {
-    int i;
-    for(i = 0; i < n; i++) {
-		if(rtr_vec[i]->router_id == router_id)
-		    return i;
+// one direction of a link, taken from an LSU ad
+struct spf_edge {
+    int to;
+    uint32_t subnet;
+    uint32_t mask;
+};
+
+/* the topology as adjacency lists, shared by the SPF runs of all interfaces
+ * routers are indexed in increasing order of router_id,
+ * the links of router i are edges[first[i]] .. edges[first[i+1]-1], sorted by neighbor
+ */
+struct spf_graph {
+    int n;
+    topo_router **rtr;
+    uint32_t *id; // router_id of each router, still valid once the routers are gone
+    int *first;
+    struct spf_edge *edges;
+};
+
+// binary min-heap of router indices, ordered by (distance, index)
+struct spf_heap {
+    int size;
+    int *heap;
+    int *pos; // position of each router in heap, -1 if it is not in it
+    const int *dist;
+};
+
+static int cmp_router_id(const void *a, const void *b) {
+    uint32_t ida = (*(topo_router* const*)a)->router_id;
+    uint32_t idb = (*(topo_router* const*)b)->router_id;
+    return (ida > idb) - (ida < idb);
+}
+
+static int cmp_edge(const void *a, const void *b) {
+    return ((const struct spf_edge*)a)->to - ((const struct spf_edge*)b)->to;
+}
+
+static int get_index(const struct spf_graph *g, uint32_t router_id) {
+    int lo = 0, hi = g->n - 1;
+    while(lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if(g->id[mid] == router_id)
+	    return mid;
+	if(g->id[mid] < router_id)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
     }
     return -1;
 }
 
-static int get_min(const int *dist_vec, const int *tight_vec, int n) {
-    int i, min_index = -1, min_dist = INT_MAX;
+static int has_edge(const struct spf_graph *g, int u, int z) {
+    int lo = g->first[u], hi = g->first[u+1] - 1;
+    while(lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if(g->edges[mid].to == z)
+	    return 1;
+	if(g->edges[mid].to < z)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return 0;
+}
+
+/*
+ * builds the graph from the first n routers of the topology
+ * a link is only used if both of its ends advertise it
+ * caller must hold topo.lock
+ */
+static void build_graph(struct spf_graph *g, topo_router *head, int n) {
+    int i, k, e = 0, num_ads = 0;
+    uint32_t a;
+    topo_router *cur_rtr;
+    char *keep;
+
+    g->rtr = malloc(sizeof(topo_router*)*(n+1));
+    for(i = 0, cur_rtr = head; i < n && cur_rtr != NULL; i++, cur_rtr = cur_rtr->next) {
+	g->rtr[i] = cur_rtr;
+	num_ads += cur_rtr->num_ads;
+    }
+    g->n = n = i;
+    qsort(g->rtr, n, sizeof(topo_router*), cmp_router_id);
+    g->id = malloc(sizeof(uint32_t)*(n+1));
+    for(i = 0; i < n; i++)
+	g->id[i] = g->rtr[i]->router_id;
+
+    g->first = malloc(sizeof(int)*(n+1));
+    g->edges = malloc(sizeof(struct spf_edge)*(num_ads+1));
     for(i = 0; i < n; i++) {
-	if(!tight_vec[i]) {
-	    min_index = i;
-	    min_dist = dist_vec[i];
-	    break;
+	g->first[i] = e;
+	for(a = 0; a < g->rtr[i]->num_ads; a++) {
+	    const lsu_ad *cur_ad = &g->rtr[i]->ads[a];
+	    int j = get_index(g, cur_ad->router_id);
+	    if(j < 0 || j == i)
+		continue;
+	    g->edges[e].to = j;
+	    g->edges[e].subnet = cur_ad->subnet;
+	    g->edges[e].mask = cur_ad->mask;
+	    e++;
+	}
+	qsort(&g->edges[g->first[i]], e - g->first[i], sizeof(struct spf_edge), cmp_edge);
+    }
+    g->first[n] = e;
+
+    // drop the one way links
+    keep = malloc(e+1);
+    for(i = 0; i < n; i++) {
+	for(k = g->first[i]; k < g->first[i+1]; k++)
+	    keep[k] = has_edge(g, g->edges[k].to, i);
+    }
+    for(i = 0, e = 0; i < n; i++) {
+	int end = g->first[i+1];
+	for(k = g->first[i], g->first[i] = e; k < end; k++) {
+	    if(keep[k])
+		g->edges[e++] = g->edges[k];
+	}
+    }
+    g->first[n] = e;
+    free(keep);
+}
+
+static void free_graph(struct spf_graph *g) {
+    free(g->rtr);
+    free(g->id);
+    free(g->first);
+    free(g->edges);
+}
+
+static int heap_less(const struct spf_heap *h, int a, int b) {
+    return h->dist[a] < h->dist[b] || (h->dist[a] == h->dist[b] && a < b);
+}
+
+static void heap_swap(struct spf_heap *h, int i, int j) {
+    int tmp = h->heap[i];
+    h->heap[i] = h->heap[j];
+    h->heap[j] = tmp;
+    h->pos[h->heap[i]] = i;
+    h->pos[h->heap[j]] = j;
+}
+
+// inserts u, or moves it up after its distance went down
+static void heap_update(struct spf_heap *h, int u) {
+    int i = h->pos[u];
+    if(i < 0) {
+	i = h->size++;
+	h->heap[i] = u;
+	h->pos[u] = i;
+    }
+    while(i > 0 && heap_less(h, h->heap[i], h->heap[(i-1)/2])) {
+	heap_swap(h, i, (i-1)/2);
+	i = (i-1)/2;
+    }
+}
+
+static int heap_pop(struct spf_heap *h) {
+    int u = h->heap[0], i = 0;
+    h->size--;
+    if(h->size > 0) {
+	h->heap[0] = h->heap[h->size];
+	h->pos[h->heap[0]] = 0;
+	while(1) {
+	    int c = 2*i + 1;
+	    if(c >= h->size)
+		break;
+	    if(c + 1 < h->size && heap_less(h, h->heap[c+1], h->heap[c]))
+		c++;
+	    if(!heap_less(h, h->heap[c], h->heap[i]))
+		break;
+	    heap_swap(h, i, c);
+	    i = c;
 	}
     }
-    for(; i < n; i++) {
-	if(dist_vec[i] < min_dist && !tight_vec[i]) {
-	    min_index = i;
-	    min_dist = dist_vec[i];
+    h->pos[u] = -1;
+    return u;
+}
+
+/*
+ * dijkstra's algo from router s over links of cost 1
+ * if if_mask is set, s only uses its links on the subnet if_ip/if_mask
+ * fills dist_vec (INT_MAX if unreachable), hop_vec, the index of the first router
+ * on the path, and par_vec, the router before the last one (both -1 if unreachable);
+ * ties are broken towards the lower router_id
+ */
+static void run_dijkstra(const struct spf_graph *g, int s, uint32_t if_ip, uint32_t if_mask,
+	int *dist_vec, int *hop_vec, int *par_vec, struct spf_heap *h) {
+    int i, k, u, z;
+
+    for(i = 0; i < g->n; i++) {
+	dist_vec[i] = INT_MAX;
+	hop_vec[i] = -1;
+	par_vec[i] = -1;
+	h->pos[i] = -1;
+    }
+    h->size = 0;
+    h->dist = dist_vec;
+
+    dist_vec[s] = 0;
+    hop_vec[s] = s;
+    heap_update(h, s);
+    while(h->size > 0) {
+	u = heap_pop(h);
+	for(k = g->first[u]; k < g->first[u+1]; k++) {
+	    const struct spf_edge *e = &g->edges[k];
+	    if(u == s && if_mask && (e->subnet & e->mask) != (if_ip & if_mask))
+		continue;
+	    z = e->to;
+	    if(dist_vec[u] + 1 < dist_vec[z]) {
+		dist_vec[z] = dist_vec[u] + 1;
+		hop_vec[z] = (u == s) ? z : hop_vec[u];
+		par_vec[z] = u;
+		heap_update(h, z);
+	    }
 	}
     }
-    return min_index;
 }
 
-static int successor(const int *adj_mat, int n, int u, int z)
+/*
+ * ------------------------------- incremental SPF ------------------
+ * the results of the last run are kept, and when the topology changes only the
+ * routers around the changed links are looked at again: the ones that lost their
+ * path to me get a new distance, the ones whose neighbors moved get a new parent,
+ * and the first hop is pushed down the subtrees whose path changed
+ */
+
+#define SPF_CHANGED 0x1 // links changed, or new router
+#define SPF_ORPHAN  0x2 // lost its path, needs a new distance
+#define SPF_PARENT  0x4 // needs a new parent
+
+// what the last run left behind, in topo_db.spf_prev under its lock
+struct spf_state {
+    int valid;
+    struct spf_graph graph; // without rtr, those routers may be gone by now
+    int nif;
+    uint32_t *if_ip;
+    uint32_t *if_mask;
+    int *dist_vec; // [ai*n+i], as in update_rtable()
+    int *hop_vec;
+    int *par_vec;
+    int *ad_first; // ads of router i are ads[ad_first[i]] .. ads[ad_first[i+1]-1]
+    lsu_ad *ads;
+    uint32_t *me; // my interfaces and neighbors, see get_my_links()
+    int me_len;
+    int mode;
+};
+
+static void free_spf_state(struct spf_state *st) {
+    if(!st->valid)
+	return;
+    free_graph(&st->graph);
+    free(st->if_ip);
+    free(st->if_mask);
+    free(st->dist_vec);
+    free(st->hop_vec);
+    free(st->par_vec);
+    free(st->ad_first);
+    free(st->ads);
+    free(st->me);
+    st->valid = 0;
+}
+
+void forget_spf()
+{
+    struct topo_db *db = topo_db();
+    pthread_mutex_lock(&db->lock);
+    free_spf_state(db->spf_prev);
+    pthread_mutex_unlock(&db->lock);
+}
+
+void init_topo(struct topo_db *db)
 {
-    return (adj_mat[u*n+z] < INT_MAX && u != z);
+    pthread_mutex_init(&db->lock, NULL);
+    db->head = NULL;
+    db->num_routers = 0;
+    db->hash = NULL;
+    db->hash_bits = 0;
+    db->spf_prev = calloc(1, sizeof(struct spf_state));
+    db->grace_until = 0;
+    db->grace_nbrs = 0;
+}
+
+// takes a copy of all the ads, in the order of the graph
+static void get_ads(const struct spf_graph *g, int **ad_first, lsu_ad **ads) {
+    int i, a = 0;
+
+    for(i = 0; i < g->n; i++)
+	a += g->rtr[i]->num_ads;
+    *ad_first = malloc(sizeof(int)*(g->n+1));
+    *ads = malloc(sizeof(lsu_ad)*(a+1));
+    for(i = 0, a = 0; i < g->n; i++) {
+	(*ad_first)[i] = a;
+	memcpy(&(*ads)[a], g->rtr[i]->ads, sizeof(lsu_ad)*g->rtr[i]->num_ads);
+	a += g->rtr[i]->num_ads;
+    }
+    (*ad_first)[g->n] = a;
+}
+
+/* everything about my own interfaces the routes depend on besides the topology:
+ * for each interface its address, whether it is enabled and the address of each neighbor
+ */
+static uint32_t *get_my_links(int *len) {
+    struct sr_instance* sr = get_sr();
+    struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    struct pwospf_if *pif;
+    struct pwospf_neighbor *nbr;
+    uint32_t *me;
+    int cnt = 0;
+
+    pthread_rwlock_rdlock(&subsystem->if_lock);
+    for(pif = subsystem->pwospf.if_list; pif != NULL; pif = pif->next) {
+	pthread_mutex_lock(&pif->neighbor_lock);
+	cnt += 3;
+	for(nbr = pif->neighbor_list; nbr != NULL; nbr = nbr->next)
+	    cnt += 2;
+	pthread_mutex_unlock(&pif->neighbor_lock);
+    }
+    me = malloc(sizeof(uint32_t)*(cnt+1));
+    cnt = 0;
+    for(pif = subsystem->pwospf.if_list; pif != NULL; pif = pif->next) {
+	int i;
+	me[cnt++] = pif->ip;
+	me[cnt++] = pif->netmask;
+	me[cnt] = 0;
+	for(i = 0; i < subsystem->num_ifaces; i++)
+	    if(subsystem->ifaces[i].ip == pif->ip)
+		me[cnt] = subsystem->ifaces[i].enabled;
+	cnt++;
+	pthread_mutex_lock(&pif->neighbor_lock);
+	for(nbr = pif->neighbor_list; nbr != NULL; nbr = nbr->next) {
+	    me[cnt++] = nbr->id;
+	    me[cnt++] = nbr->ip;
+	}
+	pthread_mutex_unlock(&pif->neighbor_lock);
+    }
+    pthread_rwlock_unlock(&subsystem->if_lock);
+
+    *len = cnt;
+    return me;
+}
+
+// if_mask is set when s may only use its links on the subnet if_ip/if_mask
+static int usable(const struct spf_edge *e, int u, int s, uint32_t if_ip, uint32_t if_mask) {
+    return u != s || !if_mask || (e->subnet & e->mask) == (if_ip & if_mask);
+}
+
+// whether s can use a link to v
+static int s_link(const struct spf_graph *g, int s, int v, uint32_t if_ip, uint32_t if_mask) {
+    int lo = g->first[s], hi = g->first[s+1];
+    while(lo < hi) { // first link to v or beyond
+	int mid = (lo + hi) / 2;
+	if(g->edges[mid].to < v)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    for(; lo < g->first[s+1] && g->edges[lo].to == v; lo++)
+	if(usable(&g->edges[lo], s, s, if_ip, if_mask))
+	    return 1;
+    return 0;
+}
+
+/*
+ * compares the neighbors router v (ov in the old graph, os is me there) can use now
+ * with the ones it could use before, and marks v and the neighbors that came or went
+ */
+static void diff_links(const struct spf_graph *g, int s, int v, const struct spf_graph *og, int os, int ov,
+	const int *o2n, uint32_t if_ip, uint32_t if_mask, char *mark) {
+    int k = g->first[v], ok = og->first[ov];
+    int last = -1, olast = -1;
+
+    while(1) {
+	int z = INT_MAX, oz = INT_MAX;
+	// next neighbor in each list, skipping the parallel links
+	while(k < g->first[v+1] && (g->edges[k].to == last || !usable(&g->edges[k], v, s, if_ip, if_mask)))
+	    k++;
+	if(k < g->first[v+1])
+	    z = g->edges[k].to;
+	while(ok < og->first[ov+1] && (og->edges[ok].to == olast || !usable(&og->edges[ok], ov, os, if_ip, if_mask)
+		|| o2n[og->edges[ok].to] < 0)) {
+	    if(o2n[og->edges[ok].to] < 0) // neighbor is gone
+		mark[v] |= SPF_CHANGED;
+	    ok++;
+	}
+	if(ok < og->first[ov+1])
+	    oz = o2n[og->edges[ok].to];
+	if(z == INT_MAX && oz == INT_MAX)
+	    break;
+
+	if(z != oz) {
+	    mark[v] |= SPF_CHANGED;
+	    mark[min(z, oz)] |= SPF_CHANGED;
+	}
+	if(z <= oz) {
+	    last = z;
+	    k++;
+	}
+	if(oz <= z) {
+	    olast = og->edges[ok].to;
+	    ok++;
+	}
+    }
+}
+
+// the lowest usable neighbor of v one hop closer to me, -1 if there is none
+static int find_parent(const struct spf_graph *g, int s, int v, uint32_t if_ip, uint32_t if_mask,
+	const int *dist_vec, const char *mark) {
+    int k, u;
+
+    if(v == s || dist_vec[v] == INT_MAX)
+	return -1;
+    for(k = g->first[v]; k < g->first[v+1]; k++) { // sorted by neighbor
+	u = g->edges[k].to;
+	if(dist_vec[u] != dist_vec[v] - 1 || (mark[u] & SPF_ORPHAN))
+	    continue;
+	if(u != s || s_link(g, s, v, if_ip, if_mask))
+	    return u;
+    }
+    return -1;
+}
+
+/*
+ * brings the results of the last run (odist, ohop, opar over the old graph og)
+ * up to date for the graph g, giving the same results as run_dijkstra()
+ * o2n and n2o map router indices between the graphs, -1 for removed/new routers
+ * mark holds the routers whose links changed, see diff_links()
+ * returns the number of routers whose distance or first hop changed,
+ * -1 if too much changed and run_dijkstra() should be used instead
+ */
+static int run_incremental(const struct spf_graph *g, int s, uint32_t if_ip, uint32_t if_mask,
+	const struct spf_graph *og, int os, const int *o2n, const int *n2o, char *mark,
+	const int *odist, const int *ohop, const int *opar,
+	int *dist_vec, int *hop_vec, int *par_vec, struct spf_heap *h) {
+    int n = g->n, i, k, u, v, z, num = 0, cnt = 0;
+    int *cdist, *chop, *list;
+
+    // my links on this interface
+    diff_links(g, s, s, og, os, os, o2n, if_ip, if_mask, mark);
+    for(i = 0; i < n; i++) {
+	if(n2o[i] < 0)
+	    mark[i] |= SPF_CHANGED;
+	if(mark[i] & SPF_CHANGED)
+	    cnt++;
+    }
+    if(cnt > n / 2)
+	return -1;
+
+    // start from the old results
+    cdist = malloc(sizeof(int)*(n+1));
+    chop = malloc(sizeof(int)*(n+1));
+    list = malloc(sizeof(int)*(n+1));
+    for(i = 0; i < n; i++) {
+	int oi = n2o[i];
+	if(oi < 0) {
+	    cdist[i] = INT_MAX;
+	    chop[i] = par_vec[i] = -1;
+	}
+	else {
+	    cdist[i] = odist[oi];
+	    chop[i] = (ohop[oi] < 0) ? -1 : o2n[ohop[oi]];
+	    par_vec[i] = (opar[oi] < 0) ? -1 : o2n[opar[oi]];
+	}
+	dist_vec[i] = cdist[i];
+	hop_vec[i] = chop[i];
+	h->pos[i] = -1;
+    }
+    h->size = 0;
+    h->dist = dist_vec;
+
+    // find the routers that lost their path, closest first, starting from the changed links
+    for(i = 0; i < n; i++) {
+	if((mark[i] & SPF_CHANGED) && i != s && dist_vec[i] != INT_MAX)
+	    heap_update(h, i);
+    }
+    while(h->size > 0) {
+	v = heap_pop(h);
+	if(find_parent(g, s, v, if_ip, if_mask, dist_vec, mark) >= 0)
+	    continue;
+	mark[v] |= SPF_ORPHAN;
+	list[num++] = v;
+	// routers that may have hung off v
+	for(k = g->first[v]; k < g->first[v+1]; k++) {
+	    z = g->edges[k].to;
+	    if(z != s && dist_vec[z] == dist_vec[v] + 1 && !(mark[z] & SPF_ORPHAN))
+		heap_update(h, z);
+	}
+    }
+
+    // those and the new routers start over from their neighbors
+    for(i = 0; i < num; i++)
+	dist_vec[list[i]] = INT_MAX;
+    for(i = 0; i < n; i++) {
+	if(n2o[i] < 0)
+	    list[num++] = i;
+    }
+    for(i = 0; i < num; i++) {
+	v = list[i];
+	for(k = g->first[v]; k < g->first[v+1]; k++) {
+	    u = g->edges[k].to;
+	    if(dist_vec[u] != INT_MAX && dist_vec[u] + 1 < dist_vec[v] && (u != s || s_link(g, s, v, if_ip, if_mask)))
+		dist_vec[v] = dist_vec[u] + 1;
+	}
+    }
+    for(i = 0; i < num; i++) {
+	mark[list[i]] &= ~SPF_ORPHAN;
+	if(dist_vec[list[i]] != INT_MAX)
+	    heap_update(h, list[i]);
+    }
+    // and the new links may make paths shorter
+    for(i = 0; i < n; i++) {
+	if((mark[i] & SPF_CHANGED) && dist_vec[i] != INT_MAX)
+	    heap_update(h, i);
+    }
+    while(h->size > 0) {
+	u = heap_pop(h);
+	for(k = g->first[u]; k < g->first[u+1]; k++) {
+	    const struct spf_edge *e = &g->edges[k];
+	    z = e->to;
+	    if(usable(e, u, s, if_ip, if_mask) && dist_vec[u] + 1 < dist_vec[z]) {
+		dist_vec[z] = dist_vec[u] + 1;
+		heap_update(h, z);
+	    }
+	}
+    }
+
+    // new parents around the routers that moved and the changed links
+    for(i = 0; i < n; i++) {
+	if(mark[i] & SPF_CHANGED)
+	    mark[i] |= SPF_PARENT;
+	if(dist_vec[i] != cdist[i]) {
+	    mark[i] |= SPF_PARENT;
+	    for(k = g->first[i]; k < g->first[i+1]; k++)
+		mark[g->edges[k].to] |= SPF_PARENT;
+	}
+    }
+    for(i = 0; i < n; i++) {
+	if(!(mark[i] & SPF_PARENT))
+	    continue;
+	par_vec[i] = find_parent(g, s, i, if_ip, if_mask, dist_vec, mark);
+	if(dist_vec[i] == INT_MAX)
+	    hop_vec[i] = -1;
+	else
+	    heap_update(h, i);
+    }
+
+    // and new first hops, down the subtrees whose first hop changed
+    while(h->size > 0) {
+	v = heap_pop(h);
+	if(v == s)
+	    u = s;
+	else if(par_vec[v] < 0)
+	    u = -1;
+	else
+	    u = (par_vec[v] == s) ? v : hop_vec[par_vec[v]];
+	if(u == hop_vec[v])
+	    continue;
+	hop_vec[v] = u;
+	for(k = g->first[v]; k < g->first[v+1]; k++) {
+	    z = g->edges[k].to;
+	    if(par_vec[z] == v)
+		heap_update(h, z);
+	}
+    }
+
+    for(i = 0, cnt = 0; i < n; i++) {
+	if(dist_vec[i] != cdist[i] || hop_vec[i] != chop[i] || n2o[i] < 0)
+	    cnt++;
+    }
+    free(cdist);
+    free(chop);
+    free(list);
+    return cnt;
+}
+
+/*
+ * ------------------------------- SPF compute pool ------------------
+ * the per-interface runs of update_rtable() only read the graph and the last run
+ * and each writes its own slice of the vectors, so they can go to other threads;
+ * the pool is shared by all the routers in the process and started on first use
+ * */
+
+#define SPF_MAX_WORKERS 4
+#define SPF_PARALLEL_MIN 128 // smaller topologies are done before a worker wakes up
+
+// one interface's run, see update_rtable()
+struct spf_job {
+    const struct spf_graph *g;
+    int s;
+    uint32_t if_ip;
+    uint32_t if_mask;
+    const struct spf_graph *og; // last run, NULL for a full run
+    int os;
+    const int *o2n, *n2o;
+    const char *links; // see diff_links()
+    const int *odist_vec, *ohop_vec, *opar_vec;
+    int *dist_vec, *hop_vec, *par_vec;
+    int changed; // paths changed
+    int full; // 1 if run_dijkstra() had to be used
+};
+
+// the jobs of one update_rtable(), on the pool's list until all are handed out
+struct spf_batch {
+    struct spf_job *jobs;
+    int cnt;
+    int next; // next job to hand out
+    int done;
+    struct spf_batch *next_batch;
+};
+
+static pthread_mutex_t spf_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spf_pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t spf_pool_done = PTHREAD_COND_INITIALIZER;
+static struct spf_batch *spf_batches;
+static int spf_workers = -1; // -1 until the pool is started
+
+static void run_spf_job(struct spf_job *j) {
+    int n = j->g->n;
+    struct spf_heap heap;
+
+    heap.heap = malloc(sizeof(int)*(n+1));
+    heap.pos = malloc(sizeof(int)*(n+1));
+    j->changed = -1;
+    j->full = 0;
+    if(j->og) {
+	char *mark = malloc(n+1);
+	memcpy(mark, j->links, n);
+	j->changed = run_incremental(j->g, j->s, j->if_ip, j->if_mask, j->og, j->os, j->o2n, j->n2o, mark,
+		j->odist_vec, j->ohop_vec, j->opar_vec, j->dist_vec, j->hop_vec, j->par_vec, &heap);
+	free(mark);
+    }
+    if(j->changed < 0) {
+	run_dijkstra(j->g, j->s, j->if_ip, j->if_mask, j->dist_vec, j->hop_vec, j->par_vec, &heap);
+	j->changed = n;
+	j->full = 1;
+    }
+    free(heap.heap);
+    free(heap.pos);
+}
+
+// hands out the next job of batch b, or of any batch if b is NULL; called with spf_pool_lock held
+static struct spf_job *take_spf_job(struct spf_batch *b, struct spf_batch **from) {
+    struct spf_batch **pb = &spf_batches;
+    struct spf_job *j;
+
+    while(*pb && b && *pb != b)
+	pb = &(*pb)->next_batch;
+    if(*pb == NULL)
+	return NULL;
+    *from = *pb;
+    j = &(*pb)->jobs[(*pb)->next++];
+    if((*pb)->next == (*pb)->cnt)
+	*pb = (*pb)->next_batch;
+    return j;
+}
+
+static void spfWorker(void *dummy) {
+    struct spf_batch *b;
+    struct spf_job *j;
+
+    pthread_mutex_lock(&spf_pool_lock);
+    while(1) {
+	j = take_spf_job(NULL, &b);
+	if(j == NULL) {
+	    pthread_cond_wait(&spf_pool_work, &spf_pool_lock);
+	    continue;
+	}
+	pthread_mutex_unlock(&spf_pool_lock);
+	run_spf_job(j);
+	pthread_mutex_lock(&spf_pool_lock);
+	if(++b->done == b->cnt)
+	    pthread_cond_broadcast(&spf_pool_done);
+    }
+}
+
+// runs the jobs, on the pool if they are worth it; the caller takes its share and returns when all are done
+static void run_spf_jobs(struct spf_job *jobs, int cnt) {
+    struct spf_batch batch, *b;
+    struct spf_job *j;
+    int i;
+
+    pthread_mutex_lock(&spf_pool_lock);
+    if(spf_workers < 0) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	spf_workers = (cpus > 1) ? min(cpus - 1, SPF_MAX_WORKERS) : 0;
+	for(i = 0; i < spf_workers; i++)
+	    sys_thread_new(spfWorker, NULL);
+    }
+    if(cnt < 2 || spf_workers == 0 || jobs[0].g->n < SPF_PARALLEL_MIN) {
+	pthread_mutex_unlock(&spf_pool_lock);
+	for(i = 0; i < cnt; i++)
+	    run_spf_job(&jobs[i]);
+	return;
+    }
+
+    batch.jobs = jobs;
+    batch.cnt = cnt;
+    batch.next = 0;
+    batch.done = 0;
+    batch.next_batch = spf_batches;
+    spf_batches = &batch;
+    pthread_cond_broadcast(&spf_pool_work);
+
+    while((j = take_spf_job(&batch, &b)) != NULL) {
+	pthread_mutex_unlock(&spf_pool_lock);
+	run_spf_job(j);
+	pthread_mutex_lock(&spf_pool_lock);
+	batch.done++;
+    }
+    while(batch.done < batch.cnt)
+	pthread_cond_wait(&spf_pool_done, &spf_pool_lock);
+    pthread_mutex_unlock(&spf_pool_lock);
+}
+
+// set by update_rtable() for cmp_dist, per thread as other routers may run their SPF at the same time
+static __thread const int *sort_dist;
+
+// orders router indices by increasing distance, then router_id
+static int cmp_dist(const void *a, const void *b) {
+    int i = *(const int*)a, j = *(const int*)b;
+    if(sort_dist[i] != sort_dist[j])
+	return sort_dist[i] < sort_dist[j] ? -1 : 1;
+    return i - j; // indices are in router_id order
+}
+
+// a set of subnets whose routes need another look
+struct spf_keys {
+    int size; // power of 2
+    int cnt;
+    uint32_t *ip;
+    uint32_t *mask;
+    char *used;
+};
+
+static void init_keys(struct spf_keys *k, int max_cnt) {
+    k->size = 16;
+    while(k->size < 2*max_cnt)
+	k->size *= 2;
+    k->cnt = 0;
+    k->ip = malloc(sizeof(uint32_t)*k->size);
+    k->mask = malloc(sizeof(uint32_t)*k->size);
+    k->used = calloc(k->size, 1);
+}
+
+static void free_keys(struct spf_keys *k) {
+    free(k->ip);
+    free(k->mask);
+    free(k->used);
+}
+
+// slot of the subnet, or of the empty slot where it would go
+static int find_key(const struct spf_keys *k, uint32_t ip, uint32_t mask) {
+    int i = ((ip & mask) * 2654435761u ^ mask) & (k->size - 1);
+    while(k->used[i] && (k->ip[i] != (ip & mask) || k->mask[i] != mask))
+	i = (i + 1) & (k->size - 1);
+    return i;
+}
+
+static void add_key(struct spf_keys *k, uint32_t ip, uint32_t mask) {
+    int i = find_key(k, ip, mask);
+    if(k->used[i])
+	return;
+    k->used[i] = 1;
+    k->ip[i] = ip & mask;
+    k->mask[i] = mask;
+    k->cnt++;
+}
+
+// no set means all subnets
+static int has_key(const struct spf_keys *k, uint32_t ip, uint32_t mask) {
+    return k == NULL || k->used[find_key(k, ip, mask)];
+}
+
+/*
+ * collects the subnets advertised, now or in the last run, by the routers that
+ * came, went, changed their ads or got a new distance or first hop on some interface;
+ * the routes to all other subnets come out the same as last time
+ */
+static void get_changed_subnets(struct spf_keys *keys, const struct spf_graph *g, const int *ad_first,
+	const lsu_ad *ads, const int *dist_vec, const int *hop_vec, int nif,
+	const int *o2n, const int *n2o, const struct spf_state *prev) {
+    const struct spf_graph *og = &prev->graph;
+    int n = g->n, on = og->n, i, oi, ai, a, cnt = 0;
+    char *moved = calloc(n+1, 1);
+
+    for(i = 0; i < n; i++) {
+	oi = n2o[i];
+	if(oi < 0 || ad_first[i+1] - ad_first[i] != prev->ad_first[oi+1] - prev->ad_first[oi]
+		|| memcmp(&ads[ad_first[i]], &prev->ads[prev->ad_first[oi]],
+		    sizeof(lsu_ad)*(ad_first[i+1] - ad_first[i])))
+	    moved[i] = 1;
+	for(ai = 0; ai < nif && !moved[i]; ai++) {
+	    int h = hop_vec[ai*n+i], oh = prev->hop_vec[ai*on+oi];
+	    if(dist_vec[ai*n+i] != prev->dist_vec[ai*on+oi] || (h < 0) != (oh < 0)
+		    || (h >= 0 && g->id[h] != og->id[oh]))
+		moved[i] = 1;
+	}
+	if(moved[i]) {
+	    cnt += ad_first[i+1] - ad_first[i];
+	    if(oi >= 0)
+		cnt += prev->ad_first[oi+1] - prev->ad_first[oi];
+	}
+    }
+    for(oi = 0; oi < on; oi++) {
+	if(o2n[oi] < 0)
+	    cnt += prev->ad_first[oi+1] - prev->ad_first[oi];
+    }
+
+    init_keys(keys, cnt);
+    for(i = 0; i < n; i++) {
+	if(!moved[i])
+	    continue;
+	for(a = ad_first[i]; a < ad_first[i+1]; a++)
+	    add_key(keys, ads[a].subnet, ads[a].mask);
+	if(n2o[i] >= 0)
+	    for(a = prev->ad_first[n2o[i]]; a < prev->ad_first[n2o[i]+1]; a++)
+		add_key(keys, prev->ads[a].subnet, prev->ads[a].mask);
+    }
+    for(oi = 0; oi < on; oi++) {
+	if(o2n[oi] < 0)
+	    for(a = prev->ad_first[oi]; a < prev->ad_first[oi+1]; a++)
+		add_key(keys, prev->ads[a].subnet, prev->ads[a].mask);
+    }
+    free(moved);
 }
 
 /*
@@ -476,30 +1145,13 @@ static int successor(const int *adj_mat, int n, int u, int z)
  */
 static void insert_shadow_node(rtableNode **head, uint32_t ip, uint32_t netmask, uint32_t* gateway, char** output_if, int out_cnt, int is_static, int entry_index)
 {
-	int i;
-	
-	if(out_cnt < 1) return;
-	
-    //check output_if size
-    for(i = 0; i < out_cnt; i++){
-	    if(strlen(output_if[i]) >= SR_NAMELEN) {
-			return;
-	    }
-	}
+	// entries without next hops only mark a subnet, see patch_rtable()
+	if(out_cnt < 1 && entry_index >= 0) return;
 
-	//create new node
-    rtableNode *node = (rtableNode*) malloc(sizeof(rtableNode));
-    node->ip = ip;
-    node->netmask = netmask;
-    node->out_cnt = out_cnt;
-    node->gateway = (uint32_t*)malloc(sizeof(uint32_t)*out_cnt);
-    node->output_if = (char**)malloc(sizeof(char*)*out_cnt);
+	//create new node, equal next hops share one group
+    rtableNode *node = alloc_rtable_node(ip, netmask, gateway, output_if, out_cnt, is_static);
+    if(node == NULL) return;
     node->entry_index = entry_index;
-    for(i = 0; i < out_cnt; i++) node->output_if[i] = (char*)malloc(sizeof(char)*SR_NAMELEN);
-    for(i = 0; i < out_cnt; i++) node->gateway[i] = gateway[i];
-    for(i = 0; i < out_cnt; i++) strcpy(node->output_if[i], output_if[i]);
-    node->is_static = is_static;
-    node->next = node->prev = NULL;
     
     //Check if the list is empty
     if(*head == NULL) {
@@ -523,9 +1175,9 @@ static void insert_shadow_node(rtableNode **head, uint32_t ip, uint32_t netmask,
 		}
 
 		//check for equality to prevent adding duplicate nodes (this is tricky, because we kinda need duplicates for fast reroute) 
-		if((cnode->ip & cnode->netmask) == (ip & netmask)) {
+		if(cnode->netmask == netmask && (cnode->ip & cnode->netmask) == (ip & netmask)) {
 			int tmp_flag = 1;
-			while((cnode->ip & cnode->netmask) == (ip & netmask)){			
+			while(cnode->netmask == netmask && (cnode->ip & cnode->netmask) == (ip & netmask)){			
 				if(cnode->next){	
 					cnode = cnode->next;
 				}
@@ -536,10 +1188,7 @@ static void insert_shadow_node(rtableNode **head, uint32_t ip, uint32_t netmask,
 			}
 			if(tmp_flag) cnode = cnode->prev;
 			if(cnode->entry_index >= entry_index){
-				for(i = 0; i < node->out_cnt; i++) free(node->output_if[i]);
-				free(node->output_if);
-				free(node->gateway);
-			    free(node);
+			    free_rtable_node(node);
 			    return;
 			}
 		}
@@ -556,18 +1205,205 @@ static void insert_shadow_node(rtableNode **head, uint32_t ip, uint32_t netmask,
     return;
 }
 
+/*
+ * adds the routes to the subnets of router t to the shadow table, only those in keys if given
+ * routers must be visited closest first, so the nearest advertiser of a subnet wins
+ */
+static void add_routes(struct sr_router *subsystem, const struct spf_graph *g, int t, int s, int nif,
+	const int *dist_vec, const int *hop_vec, const struct spf_keys *keys, rtableNode **shadow)
+{
+	int n = g->n, ai;
+	uint32_t a, num_ads = g->rtr[t]->num_ads;
+	const lsu_ad *ads = g->rtr[t]->ads;
+
+	if(t == s) {
+	    // I'm da ROUTER!
+	    // add all my subnets to the routing table
+	    struct pwospf_if *pif = subsystem->pwospf.if_list;
+	    while(pif != NULL) {
+			char if_name[SR_NAMELEN];
+			if(isEnabled(pif->ip) && has_key(keys, pif->ip, pif->netmask)){
+				strcpy(if_name, getIfName(pif->ip));
+				//insert_shadow_node
+				uint32_t null_gw = 0;
+			    char *tmp_if = (char*)malloc(sizeof(char)*SR_NAMELEN);
+			    strcpy(tmp_if, if_name);
+				insert_shadow_node(shadow, pif->ip, pif->netmask, &null_gw, &tmp_if, 1, 0, 0);
+				free(tmp_if);
+			}
+			pif = pif->next;
+	    }
+	    //printf("Built rtable for my neighbors\n");
+	    return;
+	}
+
+	// nothing to do if none of its subnets is wanted
+	for(a = 0; a < num_ads; a++)
+		if(has_key(keys, ads[a].subnet, ads[a].mask)) break;
+	if(a == num_ads) return;
+
+	// first router on the path over each interface, -1 if disconnected
+	// and its distance, cleared once a route over that interface is in
+	int *curr_index = (int*)malloc(sizeof(int)*nif);
+	int *t_dist = (int*)malloc(sizeof(int)*nif);
+    for(ai = 0; ai < nif; ai++){
+		curr_index[ai] = hop_vec[ai*n+t];
+		t_dist[ai] = dist_vec[ai*n+t];
+	}
+	
+	/* the backup (fast reroute) has to be a loop-free alternate (RFC 5286):
+	 * its neighbor N must not route back through me, d(N,t) < d(N,me) + d(me,t).
+	 * t_dist over an interface is 1 + N's distance to t around me, and N is
+	 * one hop away, so that is t_dist <= primary distance + 1
+	 */
+	int lfa_max = INT_MAX;
+	int fast_reroute_cnt = 0;
+	while(1){	// this will loop once for normal mode, twice for fast reroute
+		int min_dist = INT_MAX;
+		if(subsystem->mode & 0x1){ // if multipath
+			int entry_cnt = 0;
+			for(ai = 0; ai < nif; ai++){
+				if(curr_index[ai] < 0 || t_dist[ai] > lfa_max) continue;
+				if(t_dist[ai] < min_dist){
+					min_dist = t_dist[ai];
+					entry_cnt = 1;
+				}
+				else if(min_dist != INT_MAX  &&  t_dist[ai] == min_dist){
+					entry_cnt++;
+				}
+			}
+			if(entry_cnt > 0  &&  min_dist != INT_MAX){
+				uint32_t* m_gw = (uint32_t*)malloc(sizeof(uint32_t)*entry_cnt);
+				char** m_ifname = (char**)malloc(sizeof(char*)*entry_cnt);
+				int j;
+				for (j = 0; j < entry_cnt; j++) m_ifname[j] = (char*)malloc(sizeof(char)*SR_NAMELEN);
+		
+				int entry_index = 0;
+				for(ai = 0; ai < nif; ai++){
+					if(t_dist[ai] == min_dist){
+						if(curr_index[ai] < 0) continue;
+						int ret = findNeighbor(g->rtr[curr_index[ai]]->router_id, m_ifname[entry_index], &m_gw[entry_index]);
+						if(!ret) continue;
+						entry_index++;
+						t_dist[ai] = INT_MAX;
+					}		
+				}
+
+				for(a = 0; a < num_ads && entry_index > 0; a++) {
+				    //insert_shadow_node
+				    if(has_key(keys, ads[a].subnet, ads[a].mask))
+				    	insert_shadow_node(shadow, ads[a].subnet, ads[a].mask, m_gw, m_ifname, entry_index, 0, fast_reroute_cnt);
+				}
+
+				for (j = 0; j < entry_cnt; j++) free(m_ifname[j]);	
+				free(m_ifname);		
+				free(m_gw);
+			}
+		}
+		else{
+			int min_index = -1;
+			for(ai = 0; ai < nif; ai++){
+				if(curr_index[ai] < 0 || t_dist[ai] > lfa_max) continue;
+				if(t_dist[ai] < min_dist){
+					min_dist = t_dist[ai];
+					min_index = ai;
+				}
+			}
+			uint32_t m_gw;
+			char* m_ifname = (char*)malloc(sizeof(char)*SR_NAMELEN);
+			
+			if(min_index >= 0){
+				int ret = findNeighbor(g->rtr[curr_index[min_index]]->router_id, m_ifname, &m_gw);
+				if(ret){
+					t_dist[min_index] = INT_MAX;
+					for(a = 0; a < num_ads; a++) {
+					    //insert_shadow_node
+					    if(has_key(keys, ads[a].subnet, ads[a].mask))
+					    	insert_shadow_node(shadow, ads[a].subnet, ads[a].mask, &m_gw, &m_ifname, 1, 0, fast_reroute_cnt);
+					}				
+				}
+			}			
+			
+			free(m_ifname);		
+		} 
+		fast_reroute_cnt++;
+		if(min_dist == INT_MAX)
+			break;
+		lfa_max = min_dist + 1;
+		if(subsystem->mode & 0x2){	// if fast reroute
+			if(fast_reroute_cnt >= 2)
+				break;
+		}
+		else{
+			break;
+		}
+	}		
+	free(curr_index);
+	free(t_dist);
+}
+
+// a line of a debug dump, logged in as many messages as it takes
+struct log_line {
+	char buf[LOG_MSG_LEN];
+	int len;
+};
+
+static void line_end(struct log_line *l)
+{
+	if(l->len > 0) dbgMsg(l->buf);
+	l->len = 0;
+}
+
+static void line_add(struct log_line *l, const char *fmt, uint32_t v)
+{
+	int len = snprintf(l->buf + l->len, LOG_MSG_LEN - l->len, fmt, v);
+	if(l->len + len >= LOG_MSG_LEN) {
+		l->buf[l->len] = 0;
+		line_end(l);
+		len = snprintf(l->buf, LOG_MSG_LEN, fmt, v);
+	}
+	l->len += len;
+}
+
+/* the routes restored from a snapshot stay while the neighbors are not all
+ * back, an SPF before that would drop the routes through them
+ * caller must hold db->lock
+ */
+static int in_grace(struct topo_db *db, uint32_t router_id)
+{
+    topo_router *me;
+    int i, nbrs = 0;
+
+    if(db->grace_until == 0) return 0;
+    if((me = find_router(router_id)) != NULL) {
+	for(i = 0; i < me->num_ads; i++)
+	    if(me->ads[i].router_id != 0) nbrs++;
+    }
+    if(nbrs >= db->grace_nbrs || time(NULL) >= db->grace_until) {
+	db->grace_until = 0;
+	return 0;
+    }
+    return 1;
+}
+
 void update_rtable()
 {
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
+    struct topo_db *db = &subsystem->topo;
+    struct spf_state *prev = db->spf_prev;
 
 	// add myself to topology
 	addMeToTopology();
 
     //acquire lock
-    pthread_mutex_lock(&topo_lock);
+    pthread_mutex_lock(&db->lock);
+
+	if(in_grace(db, subsystem->pwospf.routerID)) {
+		pthread_mutex_unlock(&db->lock);
+		return;
+	}
 		
-    int n = num_routers;
 	int nif;
 	
 	pthread_mutex_lock(&subsystem->mode_lock);
@@ -579,385 +1415,222 @@ void update_rtable()
 	//	nif = 1;
 	
 	// if there is no topology, no point in doing anything
-	if(topo_head == NULL || n == 0) return;
-
-    //malloc matrix
-    //[i][j] = [i*n+j]
-    int *adj_mat = malloc(sizeof(int)*n*n*nif);
-    topo_router **rtr_vec = malloc(sizeof(topo_router*)*n*nif);
-    topo_router **rtr_vec_tot = malloc(sizeof(topo_router*)*n);
-    int *dist_vec = malloc(sizeof(int)*n*nif);
-    int *dist_vec_tot = malloc(sizeof(int)*n);
-    int *parent_vec = malloc(sizeof(int)*n*nif);
-    int *tight_vec = malloc(sizeof(int)*n*nif);
+	if(db->head == NULL || db->num_routers == 0 || nif == 0) {
+		pthread_mutex_unlock(&subsystem->mode_lock);
+		pthread_mutex_unlock(&db->lock);
+		return;
+	}
 
-    // fill rtr_vec, dist_vec, parent_vec, tight_vec, adj_mat
-    int i, j, ai;
-    topo_router *cur_rtr;
-    
-    int s;
-    
-    cur_rtr = topo_head;
-    for(i = 0; i < n; i++, cur_rtr = cur_rtr->next){
-		rtr_vec_tot[i] = cur_rtr;
-		dist_vec_tot[i] = INT_MAX;    
+	// one graph for all the interfaces
+	struct spf_graph graph;
+	build_graph(&graph, db->head, db->num_routers);
+    int n = graph.n;
+
+    int i, ai;
+    int s = get_index(&graph, subsystem->pwospf.routerID); // source router
+    if(s < 0) {
+		errorMsg("Failed to get index of myself...something's wrong!");
+		free_graph(&graph);
+		pthread_mutex_unlock(&subsystem->mode_lock);
+		pthread_mutex_unlock(&db->lock);
+		return;
     }
-    
-    for(ai = 0; ai < nif; ai++){
-	    cur_rtr = topo_head;
-
-	    for(i = 0; i < n; i++, cur_rtr = cur_rtr->next) {
-			rtr_vec[ai*n+i] = cur_rtr;
-			dist_vec[ai*n+i] = INT_MAX;
-			parent_vec[ai*n+i] = -1;
-			tight_vec[ai*n+i] = 0;
-			for(j = 0; j < n; j++) {
-				adj_mat[ai*n*n+i*n+j] = INT_MAX;
-			}
-	    }
-	    //printf("Initialized variables\n");
-
-	    // fill adj_mat
-	    for(i = 0, cur_rtr = topo_head; i < n && cur_rtr != NULL; i++, cur_rtr = cur_rtr->next) {
-			//printf("populating adj_mat: i = %d\n", i);
-			lsu_ad *cur_ad = cur_rtr->ads;
-			for(j = 0; j < n && cur_ad != NULL; j++) {
-			    //printf("populating adj_mat: j = %d\n", j);
-			    while(cur_ad != NULL && cur_ad->router_id < rtr_vec[ai*n+j]->router_id) {
-					cur_ad = cur_ad->next;
-			    }
-			    if(cur_ad == NULL)
-					break;
-				if(cur_rtr->router_id == subsystem->pwospf.routerID){
-					if((nif > 1) && (cur_ad->subnet & cur_ad->mask) != (subsystem->ifaces[ai].ip & subsystem->ifaces[ai].mask) ){
-						cur_ad = cur_ad->next;
-						continue;
-					} 
-				}
-			    if(cur_ad->router_id == rtr_vec[ai*n+j]->router_id) {
-					adj_mat[ai*n*n+i*n+j] = 1;
-					cur_ad = cur_ad->next;
-			    }
-			}
-	    }
 
-	    // print topology
-	    printf("**********************************************\n");
-		topo_router *p_router = topo_head;
+    // [ai][i] = [ai*n+i]
+    int *dist_vec = malloc(sizeof(int)*n*nif);
+    int *hop_vec = malloc(sizeof(int)*n*nif);
+    int *par_vec = malloc(sizeof(int)*n*nif);
+    int *dist_vec_tot = malloc(sizeof(int)*n);
+    int *order = malloc(sizeof(int)*n);
+    struct spf_job *jobs = malloc(sizeof(struct spf_job)*nif);
+
+    // print topology, only worth the time when it is shown
+	if(log_enabled(LOG_LVL_DBG)){
+		struct log_line line;
+		dbgMsg("**********************************************");
+		topo_router *p_router = db->head;
 		while(p_router){
-			printf("%x:: ", p_router->router_id);
-			lsu_ad *p_ad = p_router->ads;
-			while(p_ad){
-				printf("%x ", p_ad->router_id);
-				p_ad = p_ad->next;
-			}
-			printf("\n");
+			line.len = 0;
+			line_add(&line, "%x:: ", p_router->router_id);
+			for(i = 0; i < p_router->num_ads; i++)
+				line_add(&line, "%x ", p_router->ads[i].router_id);
+			line_end(&line);
 			p_router = p_router->next;
 		}
-	    printf("**********************************************\n");
+		dbgMsg("**********************************************");
+	}
 
-	    // print adj_mat
-	    printf("----------------------------------------------\n");
-	    printf("----------------------------------------------\n");
-	    for(i = 0, cur_rtr = topo_head; i < n; i++, cur_rtr = cur_rtr->next) {
-			printf("%x, ", cur_rtr->router_id);
-	    }
-	    printf("\n");
-	    printf("----------------------------------------------\n");
-	    printf("interface: %d\n", ai);
-	    for(i = 0; i < n; i++) {
-			for(j = 0; j < n; j++) {
-			    printf("%d\t", adj_mat[ai*n*n+i*n+j]);
-			}
-			printf("\n");
-	    }
-	    printf("----------------------------------------------\n");
-	    printf("----------------------------------------------\n");
-	    
-	    // make the matrix symmetric
-	    for(i = 0; i < n; i++) {
-			for(j = 0; j < n; j++) {
-			    if(i == j)
-				continue;
-			    adj_mat[ai*n*n+i*n+j] = adj_mat[ai*n*n+j*n+i] = max(adj_mat[ai*n*n+i*n+j], adj_mat[ai*n*n+j*n+i]);
-			}
-	    }
-	    //printf("Made the matrix symmetric\n");
-
-	    // run dijkstra's algo
-	    int z, u;
-	    s = get_index((topo_router**)(&rtr_vec[ai*n]), n, subsystem->pwospf.routerID); // source router
-	    if(s < 0 || s >= n) {
-			printf("Failed to get index of myself...something's wrong!\n");
-			return;
-	    }
-	    dist_vec[ai*n+s] = 0;
-	    parent_vec[ai*n+s] = s;
-	    for(i = 0; i < n; i++) {
-			u = get_min(&dist_vec[ai*n], &tight_vec[ai*n], n);
-			if(u < 0) {
-			    printf("get_min returned negative value...something's wrong - breaking out\n");
-			    break;
-			}
-			tight_vec[ai*n+u] = 1;
-			if(dist_vec[ai*n+u] == INT_MAX) continue;
-			for(z = 0; z < n; z++) {
-			    if(successor(&adj_mat[ai*n*n], n, u, z) && !tight_vec[ai*n+z] 
-							    && adj_mat[ai*n*n+u*n+z] < INT_MAX 
-							    && dist_vec[ai*n+u]+adj_mat[ai*n*n+u*n+z] < dist_vec[ai*n+z]) {
-					dist_vec[ai*n+z] = dist_vec[ai*n+u] + adj_mat[ai*n*n+u*n+z];
-					parent_vec[ai*n+z] = u;
-			    }
+    uint32_t *if_ip = malloc(sizeof(uint32_t)*nif);
+    uint32_t *if_mask = malloc(sizeof(uint32_t)*nif);
+    for(ai = 0; ai < nif; ai++){
+		if_ip[ai] = subsystem->ifaces[ai].ip;
+		if_mask[ai] = (nif > 1) ? subsystem->ifaces[ai].mask : 0;
+	}
+
+	// pick up from the last run if it was over the same interfaces
+	int os = -1, full = 1, changed = 0;
+	int *o2n = NULL, *n2o = NULL; // router indices between the last graph and this one
+	if(prev->valid && prev->nif == nif && !memcmp(prev->if_ip, if_ip, sizeof(uint32_t)*nif)
+		&& !memcmp(prev->if_mask, if_mask, sizeof(uint32_t)*nif))
+		os = get_index(&prev->graph, subsystem->pwospf.routerID);
+
+    // run dijkstra's algo once per interface, using only my links on that interface;
+    // the runs are independent, see run_spf_jobs()
+	char *links = NULL;
+	for(ai = 0; ai < nif; ai++){
+		jobs[ai].g = &graph;
+		jobs[ai].s = s;
+		jobs[ai].if_ip = if_ip[ai];
+		jobs[ai].if_mask = if_mask[ai];
+		jobs[ai].og = NULL;
+		jobs[ai].dist_vec = &dist_vec[ai*n];
+		jobs[ai].hop_vec = &hop_vec[ai*n];
+		jobs[ai].par_vec = &par_vec[ai*n];
+	}
+	if(os >= 0){
+		struct spf_graph *og = &prev->graph;
+		o2n = malloc(sizeof(int)*(og->n+1));
+		n2o = malloc(sizeof(int)*(n+1));
+		links = malloc(n+1);
+		int oi;
+
+		// routers are sorted by router_id in both graphs
+		for(i = 0, oi = 0; i < n || oi < og->n; ){
+			if(oi == og->n || (i < n && graph.id[i] < og->id[oi]))
+				n2o[i++] = -1;
+			else if(i == n || og->id[oi] < graph.id[i])
+				o2n[oi++] = -1;
+			else {
+				n2o[i] = oi;
+				o2n[oi++] = i++;
 			}
-	    }
-	    //printf("Ran Dijkstra's algo\n");
-	    
-	    // calculate total minimum distances (over all interfaces)
-	    for(i = 0; i < n; i++){
-			//int loc_i = get_index((topo_router**)&rtr_vec[ai*n], n, rtr_vec_tot[i]->router_id); // source router
-		    if(dist_vec[ai*n+i] < dist_vec_tot[i]) dist_vec_tot[i] = dist_vec[ai*n+i];
 		}
-	    
-	    // Sort vectors by distance - increasing order
-	    // simple bubble sort
-	    for (i = 0; i < n - 1; i++) {
-		for (j = 0; j < n-1 - i; j++)
-		    if ( (dist_vec[ai*n+j+1] < dist_vec[ai*n+j]) || ( (dist_vec[ai*n+j+1] == dist_vec[ai*n+j]) && (rtr_vec[ai*n+j+1]->router_id < rtr_vec[ai*n+j]->router_id)) ) {  /* compare the two neighbors */
-				int tmp_int;
-				topo_router *tmp_rtr;
-				// swap dist_vec neighbors
-				tmp_int = dist_vec[ai*n+j];
-				dist_vec[ai*n+j] = dist_vec[ai*n+j+1];
-				dist_vec[ai*n+j+1] = tmp_int;
-				// swap rtr_vec neighbors
-				tmp_rtr = rtr_vec[ai*n+j];
-				rtr_vec[ai*n+j] = rtr_vec[ai*n+j+1];
-				rtr_vec[ai*n+j+1] = tmp_rtr;
-				// swap parent_vec neighbors
-				tmp_int = parent_vec[ai*n+j];
-				parent_vec[ai*n+j] = parent_vec[ai*n+j+1];
-				parent_vec[ai*n+j+1] = tmp_int;
-				int k = 0;
-				for(k = 0; k < n; k++) {
-					if(parent_vec[ai*n+k] == j)
-						parent_vec[ai*n+k] = j+1;
-					else if(parent_vec[ai*n+k] == j+1)
-						parent_vec[ai*n+k] = j;
-				}
-		    }
-	    }
-	}    
+		memset(links, 0, n);
+		for(i = 0; i < n; i++){
+			if(n2o[i] >= 0)
+				diff_links(&graph, s, i, og, os, n2o[i], o2n, 0, 0, links);
+		}
 
-	printf("^^^^^^^^^^ dist_vec ^^^^^^^^^^\n");
-	for(ai = 0; ai < nif; ai++){
-		for(i = 0; i < n; i++) printf("%d\t", dist_vec[ai*n+i]);
-	    printf("\n");
+		for(ai = 0; ai < nif; ai++){
+			jobs[ai].og = og;
+			jobs[ai].os = os;
+			jobs[ai].o2n = o2n;
+			jobs[ai].n2o = n2o;
+			jobs[ai].links = links;
+			jobs[ai].odist_vec = &prev->dist_vec[ai*og->n];
+			jobs[ai].ohop_vec = &prev->hop_vec[ai*og->n];
+			jobs[ai].opar_vec = &prev->par_vec[ai*og->n];
+		}
 	}
-	printf("^^^^^^^^^^ dist_vec_tot ^^^^^^^^^^\n");
-	for(i = 0; i < n; i++) printf("%d\t", dist_vec_tot[i]);
-    printf("\n");
-	printf("^^^^^^^^^^ rtr_vec ^^^^^^^^^^\n");
+	run_spf_jobs(jobs, nif);
+	full = 0;
 	for(ai = 0; ai < nif; ai++){
-		for(i = 0; i < n; i++) printf("%x\t", rtr_vec[ai*n+i]->router_id);
-	    printf("\n");
+		changed += jobs[ai].changed;
+		full |= jobs[ai].full;
 	}
-	printf("^^^^^^^^^^ rtr_vec_tot ^^^^^^^^^^\n");
-	for(i = 0; i < n; i++) printf("%x\t", rtr_vec_tot[i]->router_id);
-    printf("\n");
-
-	// sort total distances
-    // simple bubble sort
-    for (i = 0; i < n - 1; i++) {
-		for (j = 0; j < n-1 - i; j++)
-		    if ( (dist_vec_tot[j+1] < dist_vec_tot[j]) || ( (dist_vec_tot[j+1] == dist_vec_tot[j]) && (rtr_vec_tot[j+1]->router_id < rtr_vec_tot[j]->router_id)) ) {  /* compare the two neighbors */
-				int tmp_int;
-				topo_router *tmp_rtr;
-				// swap dist_vec neighbors
-				tmp_int = dist_vec_tot[j];
-				dist_vec_tot[j] = dist_vec_tot[j+1];
-				dist_vec_tot[j+1] = tmp_int;
-				// swap rtr_vec neighbors
-				tmp_rtr = rtr_vec_tot[j];
-				rtr_vec_tot[j] = rtr_vec_tot[j+1];
-				rtr_vec_tot[j+1] = tmp_rtr;
-		    }
-    }
-        
-    s = get_index((topo_router**)rtr_vec_tot, n, subsystem->pwospf.routerID); // source router
-    // For each router, reconstruct path
-    rtableNode *shadow = NULL;
-    for(i = 0; i < n; i++) {
-		//printf("Reconstructing path for router %u\n", i);
-		if(rtr_vec_tot[i]->router_id == subsystem->pwospf.routerID) {
-		    // I'm da ROUTER!
-		    // add all my subnets to the routing table
-		    struct pwospf_if *pif = subsystem->pwospf.if_list;
-		    while(pif != NULL) {
-				char if_name[SR_NAMELEN];
-				if(isEnabled(pif->ip)){
-					strcpy(if_name, getIfName(pif->ip));
-					//insert_shadow_node
-					uint32_t null_gw = 0;
-				    char *tmp_if = (char*)malloc(sizeof(char)*SR_NAMELEN);
-				    strcpy(tmp_if, if_name);
-					insert_shadow_node(&shadow, pif->ip, pif->netmask, &null_gw, &tmp_if, 1, 0, 0);
-					free(tmp_if);
-				}
-				pif = pif->next;
-		    }
-		    //printf("Built rtable for my neighbors\n");
- 		    continue;
+	free(links);
+	free(jobs);
+	logMsg(LOG_LVL_INFO, "SPF: %s run, %d paths changed", full ? "full" : "incremental", changed);
+
+	// the routes only change for the subnets of routers whose path or ads changed,
+	// unless the mode or my own links changed
+	int *ad_first, me_len;
+	lsu_ad *ads;
+	uint32_t *me = get_my_links(&me_len);
+	int mode = subsystem->mode;
+	struct spf_keys keys;
+	get_ads(&graph, &ad_first, &ads);
+	int all = os < 0 || prev->mode != mode
+		|| prev->me_len != me_len || memcmp(prev->me, me, sizeof(uint32_t)*me_len);
+	if(!all)
+		get_changed_subnets(&keys, &graph, ad_first, ads, dist_vec, hop_vec, nif, o2n, n2o, prev);
+
+	if(all || keys.cnt > 0){
+	    // calculate total minimum distances (over all interfaces)
+	    for(i = 0; i < n; i++){
+			dist_vec_tot[i] = INT_MAX;
+			for(ai = 0; ai < nif; ai++)
+				if(dist_vec[ai*n+i] < dist_vec_tot[i]) dist_vec_tot[i] = dist_vec[ai*n+i];
+			order[i] = i;
 		}
 
-	    int *curr_index = (int*)malloc(sizeof(int)*nif);
-	    int cont_flag = 0;
-	    for(ai = 0; ai < nif; ai++){
-			int loc_i = get_index((topo_router**)&rtr_vec[ai*n], n, rtr_vec_tot[i]->router_id); // target router
-	    	if(rtr_vec[ai*n+loc_i]->router_id == subsystem->pwospf.routerID){
-	    		cont_flag = 1;
-	    		curr_index[ai] = -1;
-	    		break;	
-	    	}
-			curr_index[ai] = loc_i;
-			int hack_index = -1;
-			while(parent_vec[ai*n+curr_index[ai]] != s){
-			    if(hack_index == curr_index[ai]) break;
-			    hack_index = curr_index[ai];
-			    curr_index[ai] = parent_vec[ai*n+curr_index[ai]];
-			    if(curr_index[ai] < 0 || curr_index[ai] >= n) {
-					//disconnected node
-					break;
-			    }
+		if(log_enabled(LOG_LVL_DBG)){
+			struct log_line line;
+			dbgMsg("^^^^^^^^^^ dist_vec ^^^^^^^^^^");
+			for(ai = 0; ai < nif; ai++){
+				line.len = 0;
+				for(i = 0; i < n; i++) line_add(&line, "%d\t", dist_vec[ai*n+i]);
+				line_end(&line);
 			}
-			if(parent_vec[ai*n+curr_index[ai]] < 0 || parent_vec[ai*n+curr_index[ai]] >= n) {
-			    //disconnected node
-			    curr_index[ai] = -1;
-			}
- 
+			dbgMsg("^^^^^^^^^^ dist_vec_tot ^^^^^^^^^^");
+			line.len = 0;
+			for(i = 0; i < n; i++) line_add(&line, "%d\t", dist_vec_tot[i]);
+			line_end(&line);
 		}
-		if(cont_flag) continue;
-		
-		int fast_reroute_cnt = 0;
-		while(1){	// this will loop once for normal mode, twice for fast reroute
-			int min_dist = INT_MAX;
-			if(subsystem->mode & 0x1){ // if multipath
-				int entry_cnt = 0;
-				for(ai = 0; ai < nif; ai++){
-					if(curr_index[ai] < 0) continue;
-					int loc_i = get_index((topo_router**)&rtr_vec[ai*n], n, rtr_vec_tot[i]->router_id); // target rtr
-					if(dist_vec[ai*n+loc_i] < min_dist){
-						min_dist = dist_vec[ai*n+loc_i];
-						entry_cnt = 1;
-					}
-					else if(min_dist != INT_MAX  &&  dist_vec[ai*n+loc_i] == min_dist){
-						entry_cnt++;
-					}
-				}
-				if(entry_cnt > 0  &&  min_dist != INT_MAX){
-					uint32_t* m_gw = (uint32_t*)malloc(sizeof(uint32_t)*entry_cnt);
-					char** m_ifname = (char**)malloc(sizeof(char*)*entry_cnt);
-					int j;
-					for (j = 0; j < entry_cnt; j++) m_ifname[j] = (char*)malloc(sizeof(char)*SR_NAMELEN);
-			
-					int entry_index = 0;
-					for(ai = 0; ai < nif; ai++){
-						int loc_i = get_index((topo_router**)&rtr_vec[ai*n], n, rtr_vec_tot[i]->router_id); // target router
-						if(dist_vec[ai*n+loc_i] == min_dist){
-							if(curr_index[ai] < 0) continue;
-							int ret = findNeighbor(rtr_vec[ai*n+curr_index[ai]]->router_id, m_ifname[entry_index], &m_gw[entry_index]);
-							if(!ret) continue;
-							entry_index++;
-							dist_vec[ai*n+loc_i] = INT_MAX;
-						}		
-					}
-
-					lsu_ad *nbr = rtr_vec_tot[i]->ads;
-					while(nbr != NULL && entry_index > 0) {
-					    //insert_shadow_node
-					    insert_shadow_node(&shadow, nbr->subnet, nbr->mask, m_gw, m_ifname, entry_index, 0, fast_reroute_cnt);
-					    nbr = nbr->next;
-					}
 
-					for (j = 0; j < entry_cnt; j++) free(m_ifname[j]);	
-					free(m_ifname);		
-					free(m_gw);
-				}
-			}
-			else{
-				int min_index = -1;
-				for(ai = 0; ai < nif; ai++){
-					if(curr_index[ai] < 0) continue;
-					int loc_i = get_index((topo_router**)&rtr_vec[ai*n], n, rtr_vec_tot[i]->router_id); // source router
-					if(dist_vec[ai*n+loc_i] < min_dist){
-						min_dist = dist_vec[ai*n+loc_i];
-						min_index = ai;
-					}
-				}
-				uint32_t m_gw;
-				char* m_ifname = (char*)malloc(sizeof(char)*SR_NAMELEN);
-				
-				if(min_index >= 0){
-					int ret = findNeighbor(rtr_vec[min_index*n+curr_index[min_index]]->router_id, m_ifname, &m_gw);
-					if(ret){
-						int loc_i = get_index((topo_router**)&rtr_vec[min_index*n], n, rtr_vec_tot[i]->router_id); // source router
-						dist_vec[min_index*n+loc_i] = INT_MAX;
-						lsu_ad *nbr = rtr_vec[min_index*n+loc_i]->ads;
-						while(nbr != NULL) {
-						    //insert_shadow_node
-						    insert_shadow_node(&shadow, nbr->subnet, nbr->mask, &m_gw, &m_ifname, 1, 0, fast_reroute_cnt);
-						    nbr = nbr->next;
-						}				
-					}
-				}			
-				
-				free(m_ifname);		
-			} 
-			fast_reroute_cnt++;
-			if(subsystem->mode & 0x2){	// if fast reroute
-				if(fast_reroute_cnt >= 2)
-					break;
-			}
-			else{
-				break;
-			}
-		}		
+		// visit routers closest first, so the nearest advertiser of a subnet wins
+		sort_dist = dist_vec_tot;
+		qsort(order, n, sizeof(int), cmp_dist);
 
-		free(curr_index);
-    }
+	    // For each router, reconstruct path
+	    rtableNode *shadow = NULL;
+		if(!all){
+			// the subnets whose routes are all in the shadow table, see patch_rtable()
+			for(i = 0; i < keys.size; i++)
+				if(keys.used[i]) insert_shadow_node(&shadow, keys.ip[i], keys.mask[i], NULL, NULL, 0, 0, -1);
+		}
+	    for(i = 0; i < n; i++)
+			add_routes(subsystem, &graph, order[i], s, nif, dist_vec, hop_vec, all ? NULL : &keys, &shadow);
 
-	pthread_mutex_unlock(&subsystem->mode_lock);
+		pthread_mutex_unlock(&subsystem->mode_lock);
 
-    //printf("Calling rebuild_rtable\n");
-    rebuild_rtable(&(subsystem->rtable), shadow);
+	    // only the routes that changed go into the table
+	    int routes_changed = patch_rtable(&(subsystem->rtable), shadow, all);
+	    logMsg(LOG_LVL_INFO, "SPF: %d routes changed", routes_changed);
+	}
+	else {
+		pthread_mutex_unlock(&subsystem->mode_lock);
+	}
+	if(!all)
+		free_keys(&keys);
+
+	// keep this run for the next one
+	free_spf_state(prev);
+	free(graph.rtr);
+	graph.rtr = NULL;
+	prev->graph = graph;
+	prev->nif = nif;
+	prev->if_ip = if_ip;
+	prev->if_mask = if_mask;
+	prev->dist_vec = dist_vec;
+	prev->hop_vec = hop_vec;
+	prev->par_vec = par_vec;
+	prev->ad_first = ad_first;
+	prev->ads = ads;
+	prev->me = me;
+	prev->me_len = me_len;
+	prev->mode = mode;
+	prev->valid = 1;
 
     // release all allocated memory
-    free(adj_mat);
-    free(rtr_vec);
-    free(rtr_vec_tot);
-    free(dist_vec);
+    free(o2n);
+    free(n2o);
     free(dist_vec_tot);
-    free(parent_vec);
-    free(tight_vec);
-
+    free(order);
     //release lock
-    pthread_mutex_unlock(&topo_lock);
+    pthread_mutex_unlock(&db->lock);
 }
 
-
 void addMeToTopology(){
-	int i, advCnt = 0;
+	int i;
     struct sr_instance* sr = get_sr();
     struct sr_router* subsystem = (struct sr_router*)sr_get_subsystem(sr);
 
 	// create topology data structures					
-	topo_router *head = (topo_router*)malloc(sizeof(topo_router));
-	head->router_id = subsystem->pwospf.routerID;
+	topo_router *head = new_lsa(subsystem->pwospf.routerID, subsystem->num_ifaces);
 	head->area_id = subsystem->pwospf.areaID;
 	head->last_seq = 0;
 	head->last_update_time = (time_t)INT_MAX;
-	head->next = NULL;
-	head->prev = NULL;
-	head->ads = NULL;
 	
 	pthread_rwlock_rdlock(&subsystem->if_lock);
 	for(i = 0; i < subsystem->num_ifaces; i++){
@@ -968,107 +1641,18 @@ void addMeToTopology(){
 		
 		pthread_mutex_lock(&pif->neighbor_lock);
 		struct pwospf_neighbor *nbr = pif->neighbor_list;
-		while(nbr == NULL){ // no neighbors
-			lsu_ad *node = (lsu_ad*)malloc(sizeof(lsu_ad));
-			node->subnet = pif->ip & pif->netmask;
-			node->mask = pif->netmask;
-			node->router_id = 0;
-			node->next = NULL;
-			node->prev = NULL;
-				
-			advCnt++;
-						
-			if(head->ads == NULL){
-				head->ads = node;
-				break;
-			}
-			
-			// insert node into sorted list
-			lsu_ad *tmp = head->ads;
-			while(tmp){
-				if(node->router_id < tmp->router_id) break;
-				tmp = tmp->next;
-			}
-			if(tmp==NULL){ // find last list element and insert after it
-				tmp = head->ads;
-				while(tmp){
-					if(tmp->next){
-						tmp = tmp->next;
-					}
-					else{
-						break;
-					}
-				}
-				tmp->next = node;
-				node->prev = tmp;
-			}
-			else if(tmp->prev == NULL){ // insert before first element
-				node->next = tmp;
-				tmp->prev = node;
-				head->ads = node;
-			}
-			else{
-				node->next = tmp;
-				node->prev = tmp->prev;
-				tmp->prev->next = node;
-				tmp->prev = node;
-			}
-			break;
+		if(nbr == NULL){ // no neighbors
+			lsa_add_ad(&head, pif->ip & pif->netmask, pif->netmask, 0);
 		}
 		while(nbr){
-			lsu_ad *node = (lsu_ad*)malloc(sizeof(lsu_ad));
-			node->subnet = nbr->ip & nbr->nm;
-			node->mask = nbr->nm;
-			node->router_id = nbr->id;
-			node->next = NULL;
-			node->prev = NULL;
-				
-			advCnt++;
+			lsa_add_ad(&head, nbr->ip & nbr->nm, nbr->nm, nbr->id);
 			nbr = nbr->next;
-			
-			if(head->ads == NULL){
-				head->ads = node;
-				continue;
-			}
-			
-			// insert node into sorted list
-			lsu_ad *tmp = head->ads;
-			while(tmp){
-				if(node->router_id < tmp->router_id) break;
-				tmp = tmp->next;
-			}
-			if(tmp==NULL){ // find last list element and insert after it
-				tmp = head->ads;
-				while(tmp){
-					if(tmp->next){
-						tmp = tmp->next;
-					}
-					else{
-						break;
-					}
-				}
-				tmp->next = node;
-				node->prev = tmp;
-			}
-			else if(tmp->prev == NULL){ // insert before first element
-				node->next = tmp;
-				tmp->prev = node;
-				head->ads = node;
-			}
-			else{
-				node->next = tmp;
-				node->prev = tmp->prev;
-				tmp->prev->next = node;
-				tmp->prev = node;
-			}
 		}
 		pthread_mutex_unlock(&pif->neighbor_lock);
 				
 	}
 	pthread_rwlock_unlock(&subsystem->if_lock);
 
-	head->num_ads = advCnt;
-			
 	// add me to topology pretending I sent myself an LSU packet
 	update_lsu(head);
 	
@@ -14,27 +14,55 @@ typedef struct nbr {
     uint32_t subnet;
     uint32_t mask;
     uint32_t router_id;
-
-    struct nbr *next;
-    struct nbr *prev;
 } lsu_ad;
 
+/* one router's LSA
+ * the record and its ads are a single allocation, see new_lsa()
+ * once in the database the ads are sorted by router_id, subnet, mask
+ */
 typedef struct topology_router {
     uint32_t router_id;
     uint32_t area_id;
     uint16_t last_seq;
     time_t last_update_time;
     uint32_t num_ads;
+    uint32_t max_ads; // room for this many ads
 
-    lsu_ad *ads;
+    lsu_ad *ads; // right behind the record
 
-    struct topology_router *next;
+    struct topology_router *next; // all routers, in no particular order
     struct topology_router *prev;
+    struct topology_router *hnext; // next in the same hash bucket
 } topo_router;
 
-pthread_mutex_t topo_lock;
-topo_router *topo_head;
-int num_routers;
+struct spf_state; /* -- topology.c -- */
+
+/* a router's link state database, struct sr_router.topo
+ * every router is on the head list, in no particular order,
+ * and in a hash table on router_id, chained through hnext
+ * both are only touched with lock held
+ */
+struct topo_db {
+    pthread_mutex_t lock;
+    topo_router *head;
+    int num_routers;
+    topo_router **hash;
+    int hash_bits;
+    struct spf_state *spf_prev; // what update_rtable() kept from its last run
+    time_t grace_until; // routes restored from a snapshot are kept until then, see snapshot_load()
+    int grace_nbrs; // or until we have this many adjacencies again
+};
+
+// a new LSA with room for max_ads ads and none in it
+topo_router *new_lsa(uint32_t router_id, uint32_t max_ads);
+// appends an ad, moving the LSA to a bigger allocation if it is full
+void lsa_add_ad(topo_router **lsa, uint32_t subnet, uint32_t mask, uint32_t router_id);
+void free_lsa(topo_router *lsa);
+/* looks router_id up in the database
+ * caller must hold topo.lock
+ * returns NULL if router_id doesn't exist in the topology
+ */
+topo_router *find_router(uint32_t router_id);
 
 /*
  * returns:
@@ -66,8 +94,7 @@ int purge_topo();
  */
 int add_router_ad(uint32_t router_id, uint32_t subnet, uint32_t mask, uint32_t nbr_router_id);
 
-/* takes an adjacency list of nodes
- ** note: the nodes in the list must be sorted in increasing order of router_id
+/* takes an LSA made with new_lsa(), in any order, and keeps or frees it
  * returns:
  ** 1 if the topology needed an update
  ** 0 otherwise
@@ -78,9 +105,16 @@ int update_lsu(topo_router *adj_list);
  * updates the routing table
  */
 void update_rtable();
+/* drops what is kept from the last run of update_rtable(), so the next one
+ * recomputes all paths and dynamic routes
+ */
+void forget_spf();
 
 // adds this router to topology
 void addMeToTopology();
 
 int flush_topo();
+
+// sets up an empty database
+void init_topo(struct topo_db *db);
 #endif
@@ -0,0 +1,822 @@
+/*-----------------------------------------------------------------------------
+ * File: vns_loopback.c
+ *
+ * Stand-in for the VNS server so forwarding performance can be measured on
+ * a single machine.  Listens for one router, hands it a fixed three
+ * interface topology (VNSHWINFO), feeds it traffic on eth0 (VNSPACKET) and
+ * sinks whatever the router forwards, answering its ARP requests along the
+ * way.  When done it closes the session (VNSCLOSE) and reports throughput
+ * and per-packet latency percentiles.
+ *
+ * Topology handed to the router:
+ *
+ *   eth0  10.0.1.1/24  ingress, traffic comes from 10.0.1.100
+ *   eth1  10.0.2.1/24  egress, synthetic traffic goes to 10.0.2.100
+ *   eth2  10.0.3.1/24  unused
+ *
+ * The router's rtable must send 10.0.2.0/24 out of eth1 (e.g.
+ * "10.0.2.0  0.0.0.0  255.255.255.0  eth1").  Packets replayed from a pcap
+ * file keep their addresses, so the rtable has to cover those instead.
+ *
+ * Each injected packet gets its IP id set to its sequence number, which is
+ * how forwarded packets are matched back to their send time, so at most
+ * 65536 packets may be in flight.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vnscommand.h"
+#include "sr_dumper.h"
+
+#define LB_DEFAULT_PORT  12345
+#define LB_DEFAULT_COUNT 100000
+#define LB_DEFAULT_LEN   64
+#define LB_MAX_LEN       1514
+#define LB_NUM_IFACES    3
+#define LB_NUM_IDS       65536
+
+#define LB_ETH_HDR  14
+#define LB_IP_HDR   20
+#define LB_UDP_HDR  8
+#define LB_ARP_LEN  42
+
+#define LB_ETHERTYPE_IP  0x0800
+#define LB_ETHERTYPE_ARP 0x0806
+#define LB_PROTO_UDP     17
+#define LB_PROTO_OSPF    89
+
+/* -- one of the router's interfaces and the host sitting behind it -- */
+struct lb_iface
+{
+    char     name[16];
+    uint32_t ip;      /* router side, host byte order */
+    uint32_t mask;
+    uint8_t  mac[6];
+    uint32_t host_ip; /* our side */
+    uint8_t  host_mac[6];
+};
+
+struct lb_frame
+{
+    uint8_t* data;
+    unsigned int len;
+};
+
+struct lb_state
+{
+    int fd;
+    pthread_mutex_t send_lock;
+
+    struct lb_iface ifaces[LB_NUM_IFACES];
+
+    struct lb_frame* frames; /* packets to inject, in order */
+    unsigned int num_frames;
+    unsigned long count;     /* packets to send in total */
+    unsigned long rate;      /* packets per second, 0 = as fast as possible */
+
+    uint64_t sent_ns[LB_NUM_IDS];
+    uint8_t  sent_ttl[LB_NUM_IDS];
+    volatile unsigned long sent;
+    volatile int send_done;
+    uint64_t start_ns;
+    uint64_t end_send_ns;
+
+    uint64_t* latency;       /* ns, one per packet received */
+    unsigned long received;
+    uint64_t rx_bytes;
+    unsigned long bad;       /* forwarded, but TTL/checksum/MAC wrong */
+    unsigned long arp_replies;
+    unsigned long other;     /* router's own traffic (OSPF, ICMP, ...) */
+    uint64_t last_rx_ns;
+};
+
+static struct lb_state lb;
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_now_ns()
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static uint64_t lb_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- lb_now_ns -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_cksum(..)
+ * Scope: local
+ *
+ * Internet checksum of len bytes (len must be even).
+ *---------------------------------------------------------------------------*/
+
+static uint16_t lb_cksum(const uint8_t* data, unsigned int len)
+{
+    uint32_t sum = 0;
+    unsigned int i;
+
+    for ( i = 0; i + 1 < len; i += 2 )
+    { sum += (data[i] << 8) | data[i+1]; }
+    while ( sum >> 16 )
+    { sum = (sum & 0xffff) + (sum >> 16); }
+
+    return htons(~sum & 0xffff);
+} /* -- lb_cksum -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_write_all(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int lb_write_all(int fd, const void* buf, unsigned int len)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+    ssize_t ret;
+
+    while ( len > 0 )
+    {
+        if ( (ret = write(fd, p, len)) == -1 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+} /* -- lb_write_all -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_read_all(..)
+ * Scope: local
+ *
+ * Returns 0 on success, -1 on error or when the router hung up.
+ *---------------------------------------------------------------------------*/
+
+static int lb_read_all(int fd, void* buf, unsigned int len)
+{
+    uint8_t* p = (uint8_t*)buf;
+    ssize_t ret;
+
+    while ( len > 0 )
+    {
+        if ( (ret = read(fd, p, len)) <= 0 )
+        {
+            if ( ret == -1 && errno == EINTR )
+            { continue; }
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+} /* -- lb_read_all -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_send_packet(..)
+ * Scope: local
+ *
+ * Hand a frame to the router as if it arrived on iface.
+ *---------------------------------------------------------------------------*/
+
+static int lb_send_packet(const char* iface, const uint8_t* frame,
+                          unsigned int len)
+{
+    uint8_t buf[sizeof(c_packet_header) + LB_MAX_LEN];
+    c_packet_header* hdr = (c_packet_header*)buf;
+    int ret;
+
+    assert(len <= LB_MAX_LEN);
+
+    hdr->mLen  = htonl(sizeof(c_packet_header) + len);
+    hdr->mType = htonl(VNSPACKET);
+    strncpy(hdr->mInterfaceName, iface, 16);
+    memcpy(buf + sizeof(c_packet_header), frame, len);
+
+    pthread_mutex_lock(&lb.send_lock);
+    ret = lb_write_all(lb.fd, buf, sizeof(c_packet_header) + len);
+    pthread_mutex_unlock(&lb.send_lock);
+
+    return ret;
+} /* -- lb_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_send_hwinfo(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int lb_send_hwinfo(void)
+{
+    c_hwinfo hw;
+    uint32_t v;
+    int i, n = 0;
+
+    memset(&hw, 0, sizeof(c_hwinfo));
+
+    for ( i = 0; i < LB_NUM_IFACES; i++ )
+    {
+        struct lb_iface* ifc = &lb.ifaces[i];
+
+        hw.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strncpy(hw.mHWInfo[n++].value, ifc->name, 32);
+
+        v = htonl(100);
+        hw.mHWInfo[n].mKey = htonl(HWSPEED);
+        memcpy(hw.mHWInfo[n++].value, &v, 4);
+
+        v = htonl(ifc->ip & ifc->mask);
+        hw.mHWInfo[n].mKey = htonl(HWSUBNET);
+        memcpy(hw.mHWInfo[n++].value, &v, 4);
+
+        v = htonl(ifc->mask);
+        hw.mHWInfo[n].mKey = htonl(HWMASK);
+        memcpy(hw.mHWInfo[n++].value, &v, 4);
+
+        v = htonl(ifc->ip);
+        hw.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw.mHWInfo[n++].value, &v, 4);
+
+        hw.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw.mHWInfo[n++].value, ifc->mac, 6);
+    }
+
+    v = 2*sizeof(uint32_t) + n*sizeof(c_hw_entry);
+    hw.mLen  = htonl(v);
+    hw.mType = htonl(VNSHWINFO);
+
+    return lb_write_all(lb.fd, &hw, v);
+} /* -- lb_send_hwinfo -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_send_close(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void lb_send_close(const char* reason)
+{
+    c_close cmd;
+
+    memset(&cmd, 0, sizeof(c_close));
+    cmd.mLen  = htonl(sizeof(c_close));
+    cmd.mType = htonl(VNSCLOSE);
+    strncpy(cmd.mErrorMessage, reason, sizeof(cmd.mErrorMessage) - 1);
+
+    pthread_mutex_lock(&lb.send_lock);
+    lb_write_all(lb.fd, &cmd, sizeof(c_close));
+    pthread_mutex_unlock(&lb.send_lock);
+} /* -- lb_send_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_build_synthetic(..)
+ * Scope: local
+ *
+ * One UDP packet from the host behind eth0 to the host behind eth1.
+ *---------------------------------------------------------------------------*/
+
+static void lb_build_synthetic(unsigned int len)
+{
+    struct lb_iface* in  = &lb.ifaces[0];
+    struct lb_iface* out = &lb.ifaces[1];
+    uint8_t* p;
+    uint32_t v;
+    uint16_t s;
+
+    lb.frames = (struct lb_frame*)malloc(sizeof(struct lb_frame));
+    p = (uint8_t*)calloc(1, len);
+    assert(lb.frames && p);
+    lb.frames[0].data = p;
+    lb.frames[0].len  = len;
+    lb.num_frames = 1;
+
+    /* ethernet */
+    memcpy(p, in->mac, 6);
+    memcpy(p + 6, in->host_mac, 6);
+    s = htons(LB_ETHERTYPE_IP);
+    memcpy(p + 12, &s, 2);
+
+    /* ip */
+    p += LB_ETH_HDR;
+    p[0] = 0x45;
+    s = htons(len - LB_ETH_HDR);
+    memcpy(p + 2, &s, 2);
+    p[8] = 64;
+    p[9] = LB_PROTO_UDP;
+    v = htonl(in->host_ip);
+    memcpy(p + 12, &v, 4);
+    v = htonl(out->host_ip);
+    memcpy(p + 16, &v, 4);
+
+    /* udp, to the discard port */
+    p += LB_IP_HDR;
+    s = htons(9);
+    memcpy(p, &s, 2);
+    memcpy(p + 2, &s, 2);
+    s = htons(len - LB_ETH_HDR - LB_IP_HDR);
+    memcpy(p + 4, &s, 2);
+} /* -- lb_build_synthetic -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_load_pcap(..)
+ * Scope: local
+ *
+ * Load every IPv4 frame from a pcap file.  Frames are re-addressed to the
+ * router's eth0 MAC; IP addresses are left alone.
+ *---------------------------------------------------------------------------*/
+
+static int lb_load_pcap(const char* fname)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    unsigned int cap = 0;
+    uint8_t* data;
+    FILE* fp;
+
+    if ( (fp = fopen(fname, "rb")) == 0 )
+    {
+        perror("fopen(..):vns_loopback.c::lb_load_pcap");
+        return -1;
+    }
+
+    if ( fread(&fh, sizeof(fh), 1, fp) != 1 || fh.magic != TCPDUMP_MAGIC ||
+         fh.linktype != LINKTYPE_ETHERNET )
+    {
+        fprintf(stderr, "Error: %s is not an ethernet pcap file\n", fname);
+        fclose(fp);
+        return -1;
+    }
+
+    lb.frames = 0;
+    lb.num_frames = 0;
+
+    while ( fread(&ph, sizeof(ph), 1, fp) == 1 )
+    {
+        if ( (data = (uint8_t*)malloc(ph.caplen)) == 0 ||
+             fread(data, ph.caplen, 1, fp) != 1 )
+        { free(data); break; }
+
+        /* -- only complete IPv4 frames can be matched on the way out -- */
+        if ( ph.caplen != ph.len || ph.caplen > LB_MAX_LEN ||
+             ph.caplen < LB_ETH_HDR + LB_IP_HDR ||
+             data[12] != (LB_ETHERTYPE_IP >> 8) ||
+             data[13] != (LB_ETHERTYPE_IP & 0xff) )
+        { free(data); continue; }
+
+        memcpy(data, lb.ifaces[0].mac, 6);
+
+        if ( lb.num_frames == cap )
+        {
+            cap = cap ? 2*cap : 1024;
+            lb.frames = (struct lb_frame*)realloc(lb.frames,
+                    cap*sizeof(struct lb_frame));
+            assert(lb.frames);
+        }
+        lb.frames[lb.num_frames].data = data;
+        lb.frames[lb.num_frames].len  = ph.caplen;
+        lb.num_frames++;
+    }
+
+    fclose(fp);
+
+    if ( lb.num_frames == 0 )
+    {
+        fprintf(stderr, "Error: no usable IPv4 frames in %s\n", fname);
+        return -1;
+    }
+    return 0;
+} /* -- lb_load_pcap -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_sender(..)
+ * Scope: local
+ *
+ * Inject lb.count packets on eth0, paced to lb.rate.
+ *---------------------------------------------------------------------------*/
+
+static void* lb_sender(void* arg)
+{
+    struct lb_frame* f;
+    unsigned long i;
+    uint64_t due, now;
+    uint16_t id, sum;
+    uint8_t* ip;
+
+    lb.start_ns = lb_now_ns();
+
+    for ( i = 0; i < lb.count; i++ )
+    {
+        if ( lb.rate )
+        {
+            due = lb.start_ns + (uint64_t)i * 1000000000ULL / lb.rate;
+            while ( (now = lb_now_ns()) < due )
+            {
+                if ( due - now > 100000 )
+                { usleep((due - now) / 1000 - 50); }
+            }
+        }
+
+        f = &lb.frames[i % lb.num_frames];
+        ip = f->data + LB_ETH_HDR;
+
+        /* -- tag with the sequence number and fix up the checksum -- */
+        id = i & (LB_NUM_IDS - 1);
+        ip[4] = id >> 8;
+        ip[5] = id & 0xff;
+        ip[10] = ip[11] = 0;
+        sum = lb_cksum(ip, (ip[0] & 0xf) * 4);
+        memcpy(ip + 10, &sum, 2);
+
+        lb.sent_ttl[id] = ip[8];
+        lb.sent_ns[id] = lb_now_ns();
+
+        if ( lb_send_packet(lb.ifaces[0].name, f->data, f->len) )
+        {
+            fprintf(stderr, "Error: lost connection to the router\n");
+            break;
+        }
+        lb.sent++;
+    }
+
+    lb.end_send_ns = lb_now_ns();
+    lb.send_done = 1;
+    return 0;
+} /* -- lb_sender -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_find_iface(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static struct lb_iface* lb_find_iface(const char* name)
+{
+    int i;
+
+    for ( i = 0; i < LB_NUM_IFACES; i++ )
+    {
+        if ( strncmp(lb.ifaces[i].name, name, 16) == 0 )
+        { return &lb.ifaces[i]; }
+    }
+    return 0;
+} /* -- lb_find_iface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_handle_arp(..)
+ * Scope: local
+ *
+ * Answer every ARP request from the router; the host behind the interface
+ * owns the asked-for address.
+ *---------------------------------------------------------------------------*/
+
+static void lb_handle_arp(struct lb_iface* ifc, const uint8_t* req,
+                          unsigned int len)
+{
+    uint8_t rep[LB_ARP_LEN];
+
+    /* -- request (opcode 1) only -- */
+    if ( len < LB_ARP_LEN || req[20] != 0 || req[21] != 1 )
+    { return; }
+
+    memcpy(rep, req + 6, 6);          /* to the router */
+    memcpy(rep + 6, ifc->host_mac, 6);
+    memcpy(rep + 12, req + 12, 8);    /* ethertype, htype, ptype, sizes */
+    rep[20] = 0;
+    rep[21] = 2;
+    memcpy(rep + 22, ifc->host_mac, 6);
+    memcpy(rep + 28, req + 38, 4);    /* sender ip: the one asked for */
+    memcpy(rep + 32, req + 22, 10);   /* target: the router */
+
+    if ( lb_send_packet(ifc->name, rep, LB_ARP_LEN) == 0 )
+    { lb.arp_replies++; }
+} /* -- lb_handle_arp -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_handle_packet(..)
+ * Scope: local
+ *
+ * A frame the router sent out of one of its interfaces.
+ *---------------------------------------------------------------------------*/
+
+static void lb_handle_packet(const char* iface, const uint8_t* frame,
+                             unsigned int len, uint64_t now)
+{
+    struct lb_iface* ifc = lb_find_iface(iface);
+    const uint8_t* ip = frame + LB_ETH_HDR;
+    uint32_t src;
+    uint16_t id;
+    int hl;
+
+    if ( !ifc || len < LB_ETH_HDR )
+    { lb.other++; return; }
+
+    if ( frame[12] == (LB_ETHERTYPE_ARP >> 8) &&
+         frame[13] == (LB_ETHERTYPE_ARP & 0xff) )
+    { lb_handle_arp(ifc, frame, len); return; }
+
+    if ( frame[12] != (LB_ETHERTYPE_IP >> 8) ||
+         frame[13] != (LB_ETHERTYPE_IP & 0xff) ||
+         len < LB_ETH_HDR + LB_IP_HDR )
+    { lb.other++; return; }
+
+    /* -- skip what the router originates itself -- */
+    memcpy(&src, ip + 12, 4);
+    src = ntohl(src);
+    if ( ip[9] == LB_PROTO_OSPF || src == lb.ifaces[0].ip ||
+         src == lb.ifaces[1].ip || src == lb.ifaces[2].ip )
+    { lb.other++; return; }
+
+    hl = (ip[0] & 0xf) * 4;
+    id = (ip[4] << 8) | ip[5];
+
+    if ( hl < LB_IP_HDR || len < (unsigned int)(LB_ETH_HDR + hl) ||
+         lb_cksum(ip, hl) != 0 || ip[8] + 1 != lb.sent_ttl[id] ||
+         memcmp(frame, ifc->host_mac, 6) != 0 ||
+         memcmp(frame + 6, ifc->mac, 6) != 0 )
+    { lb.bad++; return; }
+
+    lb.latency[lb.received++] = now - lb.sent_ns[id];
+    lb.rx_bytes += len;
+    lb.last_rx_ns = now;
+} /* -- lb_handle_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_receive(..)
+ * Scope: local
+ *
+ * Sink commands from the router until every packet came back or the router
+ * has been quiet for idle_ms after the last packet was sent.
+ *---------------------------------------------------------------------------*/
+
+static void lb_receive(unsigned int idle_ms)
+{
+    uint8_t buf[10000];
+    c_packet_header* hdr = (c_packet_header*)buf;
+    struct timeval tv;
+    uint32_t len;
+    uint64_t now;
+    fd_set rset;
+
+    while ( lb.received < lb.count )
+    {
+        FD_ZERO(&rset);
+        FD_SET(lb.fd, &rset);
+        tv.tv_sec  = 0;
+        tv.tv_usec = 100000;
+
+        if ( select(lb.fd + 1, &rset, 0, 0, &tv) <= 0 )
+        {
+            now = lb_now_ns();
+            if ( lb.send_done && now - (lb.last_rx_ns > lb.end_send_ns ?
+                        lb.last_rx_ns : lb.end_send_ns)
+                    > (uint64_t)idle_ms * 1000000ULL )
+            { break; }
+            continue;
+        }
+
+        if ( lb_read_all(lb.fd, buf, sizeof(c_base)) )
+        {
+            fprintf(stderr, "router closed the connection\n");
+            break;
+        }
+        len = ntohl(hdr->mLen);
+        if ( len < sizeof(c_base) || len > sizeof(buf) ||
+             lb_read_all(lb.fd, buf + sizeof(c_base), len - sizeof(c_base)) )
+        {
+            fprintf(stderr, "Error: bad command from router (%u bytes)\n", len);
+            break;
+        }
+
+        if ( ntohl(hdr->mType) == VNSPACKET && len >= sizeof(c_packet_header) )
+        {
+            char iface[17];
+            memcpy(iface, hdr->mInterfaceName, 16);
+            iface[16] = 0;
+            lb_handle_packet(iface, buf + sizeof(c_packet_header),
+                    len - sizeof(c_packet_header), lb_now_ns());
+        }
+    }
+} /* -- lb_receive -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_report(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int lb_cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void lb_report(void)
+{
+    double secs, rx_secs;
+
+    secs = (lb.end_send_ns - lb.start_ns) / 1e9;
+    rx_secs = ((lb.last_rx_ns ? lb.last_rx_ns : lb.end_send_ns)
+               - lb.start_ns) / 1e9;
+
+    printf("sent:        %lu packets in %.3f s (%.0f pps)\n",
+            lb.sent, secs, secs > 0 ? lb.sent / secs : 0);
+    printf("forwarded:   %lu packets (%.0f pps, %.1f Mbps), %lu lost, %lu bad\n",
+            lb.received, rx_secs > 0 ? lb.received / rx_secs : 0,
+            rx_secs > 0 ? lb.rx_bytes * 8 / rx_secs / 1e6 : 0,
+            lb.sent - lb.received - lb.bad, lb.bad);
+    printf("router sent: %lu other packets, %lu ARP requests answered\n",
+            lb.other, lb.arp_replies);
+
+    if ( lb.received == 0 )
+    { return; }
+
+    qsort(lb.latency, lb.received, sizeof(uint64_t), lb_cmp_u64);
+    printf("latency us:  min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+            lb.latency[0] / 1e3,
+            lb.latency[lb.received * 50 / 100] / 1e3,
+            lb.latency[lb.received * 90 / 100] / 1e3,
+            lb.latency[lb.received * 99 / 100] / 1e3,
+            lb.latency[lb.received * 999 / 1000] / 1e3,
+            lb.latency[lb.received - 1] / 1e3);
+} /* -- lb_report -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lb_init_ifaces(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void lb_init_ifaces(void)
+{
+    int i;
+
+    for ( i = 0; i < LB_NUM_IFACES; i++ )
+    {
+        struct lb_iface* ifc = &lb.ifaces[i];
+        uint8_t mac[6] = { 0, 0, 0, 0, i + 1, 1 };
+
+        snprintf(ifc->name, 16, "eth%d", i);
+        ifc->ip      = 0x0a000001 | ((i + 1) << 8);  /* 10.0.i+1.1 */
+        ifc->mask    = 0xffffff00;
+        ifc->host_ip = 0x0a000064 | ((i + 1) << 8);  /* 10.0.i+1.100 */
+        memcpy(ifc->mac, mac, 6);
+        mac[5] = 100;
+        memcpy(ifc->host_mac, mac, 6);
+    }
+} /* -- lb_init_ifaces -- */
+
+static void usage(char* argv0)
+{
+    printf("Simple Router Loopback VNS Server\n");
+    printf("Format: %s [-h] [-p port] [-n count] [-r pps] [-l len] [-f pcap] [-w ms] [-d s]\n",
+            argv0);
+    printf("  -p  port to listen on (default %d)\n", LB_DEFAULT_PORT);
+    printf("  -n  packets to send (default %d)\n", LB_DEFAULT_COUNT);
+    printf("  -r  packets per second, 0 for as fast as possible (default 0)\n");
+    printf("  -l  synthetic frame length in bytes (default %d)\n", LB_DEFAULT_LEN);
+    printf("  -f  replay IPv4 frames from this pcap file instead\n");
+    printf("  -w  ms to wait after the last packet before giving up (default 2000)\n");
+    printf("  -d  seconds to wait after HWINFO for the router to settle (default 2)\n");
+} /* -- usage -- */
+
+int main(int argc, char** argv)
+{
+    struct sockaddr_in addr;
+    unsigned short port = LB_DEFAULT_PORT;
+    unsigned int len = LB_DEFAULT_LEN;
+    unsigned int idle_ms = 2000, settle = 2;
+    char* pcap = 0;
+    c_open open_cmd;
+    pthread_t sender;
+    int c, lfd, on = 1;
+
+    memset(&lb, 0, sizeof(lb));
+    lb.count = LB_DEFAULT_COUNT;
+
+    while ((c = getopt(argc, argv, "hp:n:r:l:f:w:d:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'p':
+                port = atoi((char *) optarg);
+                break;
+            case 'n':
+                lb.count = strtoul(optarg, 0, 10);
+                break;
+            case 'r':
+                lb.rate = strtoul(optarg, 0, 10);
+                break;
+            case 'l':
+                len = atoi((char *) optarg);
+                break;
+            case 'f':
+                pcap = optarg;
+                break;
+            case 'w':
+                idle_ms = atoi((char *) optarg);
+                break;
+            case 'd':
+                settle = atoi((char *) optarg);
+                break;
+        } /* switch */
+    } /* -- while -- */
+
+    if ( len < LB_ETH_HDR + LB_IP_HDR + LB_UDP_HDR || len > LB_MAX_LEN )
+    {
+        fprintf(stderr, "Error: frame length must be between %d and %d\n",
+                LB_ETH_HDR + LB_IP_HDR + LB_UDP_HDR, LB_MAX_LEN);
+        return 1;
+    }
+
+    lb_init_ifaces();
+    pthread_mutex_init(&lb.send_lock, 0);
+
+    if ( pcap )
+    {
+        if ( lb_load_pcap(pcap) )
+        { return 1; }
+    }
+    else
+    { lb_build_synthetic(len); }
+
+    if ( (lb.latency = (uint64_t*)malloc(lb.count * sizeof(uint64_t))) == 0 )
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    /* -- wait for the router -- */
+    if ( (lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
+    {
+        perror("socket(..):vns_loopback.c::main");
+        return 1;
+    }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ( bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+         listen(lfd, 1) < 0 )
+    {
+        perror("bind(..):vns_loopback.c::main");
+        return 1;
+    }
+
+    printf("waiting for router on localhost:%u ...\n", port);
+    if ( (lb.fd = accept(lfd, 0, 0)) < 0 )
+    {
+        perror("accept(..):vns_loopback.c::main");
+        return 1;
+    }
+    close(lfd);
+
+    if ( lb_read_all(lb.fd, &open_cmd, sizeof(c_open)) ||
+         ntohl(open_cmd.mType) != VNSOPEN )
+    {
+        fprintf(stderr, "Error: expected VNSOPEN from the router\n");
+        return 1;
+    }
+    open_cmd.mVirtualHostID[IDSIZE-1] = 0;
+    printf("router '%s' connected, sending hardware info\n",
+            open_cmd.mVirtualHostID);
+
+    if ( lb_send_hwinfo() )
+    {
+        perror("write(..):vns_loopback.c::main");
+        return 1;
+    }
+
+    /* -- let the router finish its setup (threads, rtable, hellos) -- */
+    sleep(settle);
+
+    printf("sending %lu packets (%u distinct) at %s\n", lb.count, lb.num_frames,
+            lb.rate ? "fixed rate" : "full speed");
+    pthread_create(&sender, 0, lb_sender, 0);
+    lb_receive(idle_ms);
+    pthread_join(sender, 0);
+
+    lb_send_close("loopback benchmark finished");
+    close(lb.fd);
+
+    lb_report();
+    return 0;
+}